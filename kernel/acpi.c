@@ -0,0 +1,276 @@
+#include "acpi.h"
+
+#include "console.h"
+#include "mem/multiboot2.h"
+#include "mem/paging.h"
+#include "lib/string.h"
+
+#include <stdint.h>
+
+struct acpi_rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+    uint32_t length;
+    uint64_t xsdt_addr;
+    uint8_t ext_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_madt {
+    struct acpi_sdt_header header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed));
+
+#define MADT_LAPIC 0u
+#define MADT_IOAPIC 1u
+#define MADT_ISO 2u
+#define MADT_LAPIC_OVERRIDE 5u
+
+static acpi_madt_info_t g_madt;
+
+static void print_u32(uint32_t n) {
+    char buf[11];
+    int i = 0;
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+    while (i > 0) {
+        console_putc(buf[--i]);
+    }
+}
+
+static uint8_t checksum(const void* p, uint32_t len) {
+    const uint8_t* b = (const uint8_t*)p;
+    uint8_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        sum = (uint8_t)(sum + b[i]);
+    }
+    return sum;
+}
+
+static uint32_t rd32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const struct acpi_rsdp* rsdp_check(const void* p) {
+    const struct acpi_rsdp* r = (const struct acpi_rsdp*)p;
+
+    if (memcmp(r->signature, "RSD PTR ", 8) != 0) return 0;
+    if (checksum(r, 20) != 0) return 0;
+    return r;
+}
+
+static const struct acpi_rsdp* rsdp_from_multiboot(uint32_t mb_magic, uint32_t mb_info_addr) {
+    const struct mb2_info_header* info;
+    const struct mb2_tag* tag;
+    const struct mb2_tag* end_tag;
+    const struct acpi_rsdp* found = 0;
+
+    if (mb_magic != MULTIBOOT2_BOOTLOADER_MAGIC || mb_info_addr == 0u) {
+        return 0;
+    }
+
+    info = (const struct mb2_info_header*)(uintptr_t)mb_info_addr;
+    tag = (const struct mb2_tag*)((uintptr_t)info + 8u);
+    end_tag = (const struct mb2_tag*)((uintptr_t)info + info->total_size - 8u);
+
+    while ((uintptr_t)tag < (uintptr_t)end_tag && tag->type != MULTIBOOT2_TAG_TYPE_END) {
+        if (tag->type == MULTIBOOT2_TAG_TYPE_ACPI_NEW || tag->type == MULTIBOOT2_TAG_TYPE_ACPI_OLD) {
+            const struct mb2_tag_acpi* acpi = (const struct mb2_tag_acpi*)tag;
+            const struct acpi_rsdp* r = rsdp_check(acpi->rsdp);
+            /* Prefer the ACPI 2.0 copy when both tags are present. */
+            if (r && (!found || tag->type == MULTIBOOT2_TAG_TYPE_ACPI_NEW)) {
+                found = r;
+            }
+        }
+        tag = (const struct mb2_tag*)((uintptr_t)tag + ((tag->size + 7u) & ~7u));
+    }
+    return found;
+}
+
+static const struct acpi_rsdp* rsdp_scan(uint32_t start, uint32_t len) {
+    uint32_t addr;
+
+    for (addr = start; addr + 20u <= start + len; addr += 16u) {
+        const struct acpi_rsdp* r = rsdp_check((const void*)(uintptr_t)addr);
+        if (r) return r;
+    }
+    return 0;
+}
+
+static const struct acpi_rsdp* rsdp_from_bios(void) {
+    const volatile uint16_t* bda_ebda = (const volatile uint16_t*)(uintptr_t)0x40Eu;
+    uint32_t ebda;
+    const struct acpi_rsdp* r = 0;
+
+    /* Hide the low constant address from -Warray-bounds. */
+    __asm__("" : "+r"(bda_ebda));
+    ebda = (uint32_t)*bda_ebda << 4;
+
+    if (ebda >= 0x80000u && ebda < 0xA0000u) {
+        r = rsdp_scan(ebda, 1024u);
+    }
+    if (!r) {
+        r = rsdp_scan(0xE0000u, 0x20000u);
+    }
+    return r;
+}
+
+/* Tables live in ACPI reclaim/NVS memory that may be outside the identity map. */
+static const struct acpi_sdt_header* map_table(uint32_t phys) {
+    const struct acpi_sdt_header* h;
+
+    if (phys == 0u) return 0;
+    if (map_identity(phys, sizeof(struct acpi_sdt_header), PAGE_WRITE) != 0) return 0;
+    h = (const struct acpi_sdt_header*)(uintptr_t)phys;
+    if (h->length < sizeof(struct acpi_sdt_header)) return 0;
+    if (map_identity(phys, h->length, PAGE_WRITE) != 0) return 0;
+    if (checksum(h, h->length) != 0) return 0;
+    return h;
+}
+
+static const struct acpi_sdt_header* find_table(const struct acpi_rsdp* rsdp, const char* sig) {
+    const struct acpi_sdt_header* root;
+    uint32_t entry_size = 4u;
+    uint32_t count;
+    uint32_t i;
+
+    if (rsdp->revision >= 2u && rsdp->xsdt_addr != 0u && rsdp->xsdt_addr <= 0xFFFFFFFFull) {
+        root = map_table((uint32_t)rsdp->xsdt_addr);
+        entry_size = 8u;
+    } else {
+        root = 0;
+    }
+    if (!root) {
+        root = map_table(rsdp->rsdt_addr);
+        entry_size = 4u;
+    }
+    if (!root) return 0;
+
+    count = (root->length - (uint32_t)sizeof(*root)) / entry_size;
+    for (i = 0; i < count; i++) {
+        const uint8_t* ent = (const uint8_t*)root + sizeof(*root) + i * entry_size;
+        const struct acpi_sdt_header* h;
+
+        /* XSDT entries above 4 GiB are unreachable without PAE. */
+        if (entry_size == 8u && rd32(ent + 4) != 0u) continue;
+        h = map_table(rd32(ent));
+        if (h && memcmp(h->signature, sig, 4) == 0) return h;
+    }
+    return 0;
+}
+
+static void parse_madt(const struct acpi_madt* madt) {
+    const uint8_t* p = (const uint8_t*)madt + sizeof(*madt);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+
+    g_madt.lapic_addr = madt->lapic_addr;
+    g_madt.flags = madt->flags;
+
+    while (p + 2 <= end && p[1] >= 2u && p + p[1] <= end) {
+        switch (p[0]) {
+        case MADT_LAPIC:
+            /* flags bit 0: enabled, bit 1: online capable */
+            if ((rd32(p + 4) & 0x3u) != 0u && g_madt.cpu_count < ACPI_MAX_CPUS) {
+                g_madt.cpu_apic_ids[g_madt.cpu_count++] = p[3];
+            }
+            break;
+        case MADT_IOAPIC:
+            if (g_madt.ioapic_count < ACPI_MAX_IOAPICS) {
+                acpi_ioapic_t* io = &g_madt.ioapics[g_madt.ioapic_count++];
+                io->id = p[2];
+                io->addr = rd32(p + 4);
+                io->gsi_base = rd32(p + 8);
+            }
+            break;
+        case MADT_ISO:
+            if (p[2] == 0u && g_madt.override_count < ACPI_MAX_OVERRIDES) {
+                acpi_irq_override_t* o = &g_madt.overrides[g_madt.override_count++];
+                o->source = p[3];
+                o->gsi = rd32(p + 4);
+                o->flags = (uint16_t)(p[8] | (p[9] << 8));
+            }
+            break;
+        case MADT_LAPIC_OVERRIDE:
+            if (rd32(p + 8) == 0u) {
+                g_madt.lapic_addr = rd32(p + 4);
+            }
+            break;
+        default:
+            break;
+        }
+        p += p[1];
+    }
+}
+
+int acpi_init(uint32_t mb_magic, uint32_t mb_info_addr) {
+    const struct acpi_rsdp* rsdp;
+    const struct acpi_sdt_header* madt;
+
+    memset(&g_madt, 0, sizeof(g_madt));
+
+    rsdp = rsdp_from_multiboot(mb_magic, mb_info_addr);
+    if (!rsdp) rsdp = rsdp_from_bios();
+    if (!rsdp) {
+        console_print("ACPI: no RSDP found\n");
+        return -1;
+    }
+
+    madt = find_table(rsdp, "APIC");
+    if (!madt) {
+        console_print("ACPI: no MADT\n");
+        return -1;
+    }
+
+    parse_madt((const struct acpi_madt*)madt);
+    g_madt.present = 1;
+
+    console_print("ACPI: MADT cpus=");
+    print_u32(g_madt.cpu_count);
+    console_print(" ioapics=");
+    print_u32(g_madt.ioapic_count);
+    console_print(" overrides=");
+    print_u32(g_madt.override_count);
+    console_putc('\n');
+    return 0;
+}
+
+const acpi_madt_info_t* acpi_madt(void) {
+    return g_madt.present ? &g_madt : 0;
+}
+
+uint32_t acpi_isa_irq_to_gsi(uint8_t irq, uint16_t* flags) {
+    uint32_t i;
+
+    for (i = 0; i < g_madt.override_count; i++) {
+        if (g_madt.overrides[i].source == irq) {
+            if (flags) *flags = g_madt.overrides[i].flags;
+            return g_madt.overrides[i].gsi;
+        }
+    }
+    if (flags) *flags = 0;
+    return irq;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+#define ACPI_MAX_CPUS 16
+#define ACPI_MAX_IOAPICS 4
+#define ACPI_MAX_OVERRIDES 16
+
+/* MPS INTI flags from interrupt source overrides. */
+#define ACPI_INTI_POLARITY_MASK 0x3u
+#define ACPI_INTI_POLARITY_LOW 0x3u
+#define ACPI_INTI_TRIGGER_MASK 0xCu
+#define ACPI_INTI_TRIGGER_LEVEL 0xCu
+
+typedef struct acpi_ioapic {
+    uint8_t id;
+    uint32_t addr;
+    uint32_t gsi_base;
+} acpi_ioapic_t;
+
+typedef struct acpi_irq_override {
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} acpi_irq_override_t;
+
+typedef struct acpi_madt_info {
+    int present;
+    uint32_t lapic_addr;
+    uint32_t flags;
+    uint32_t cpu_count;
+    uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+    uint32_t ioapic_count;
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+    uint32_t override_count;
+    acpi_irq_override_t overrides[ACPI_MAX_OVERRIDES];
+} acpi_madt_info_t;
+
+/* Locates the RSDP (multiboot2 tag, then BIOS areas) and parses the MADT. */
+int acpi_init(uint32_t mb_magic, uint32_t mb_info_addr);
+const acpi_madt_info_t* acpi_madt(void);
+/* Maps an ISA IRQ to its GSI; flags get the override's INTI bits (0 = bus default). */
+uint32_t acpi_isa_irq_to_gsi(uint8_t irq, uint16_t* flags);
@@ -0,0 +1,202 @@
+#include "apic.h"
+
+#include "acpi.h"
+#include "console.h"
+#include "mem/paging.h"
+
+#include <stdint.h>
+
+#define LAPIC_ID 0x020u
+#define LAPIC_TPR 0x080u
+#define LAPIC_EOI 0x0B0u
+#define LAPIC_SVR 0x0F0u
+#define LAPIC_ISR 0x100u
+#define LAPIC_LVT_LINT0 0x350u
+#define LAPIC_LVT_LINT1 0x360u
+
+#define LAPIC_SVR_ENABLE 0x100u
+#define LAPIC_LVT_MASKED 0x10000u
+#define LAPIC_LVT_NMI 0x400u
+
+#define IOAPIC_REGSEL 0x00u
+#define IOAPIC_WIN 0x10u
+#define IOAPIC_REG_VER 0x01u
+#define IOAPIC_REDTBL(n) (0x10u + 2u * (n))
+
+#define IOAPIC_RED_MASKED 0x10000u
+#define IOAPIC_RED_LEVEL 0x8000u
+#define IOAPIC_RED_ACTIVE_LOW 0x2000u
+
+#define MSR_APIC_BASE 0x1Bu
+#define MSR_APIC_BASE_ENABLE 0x800u
+
+typedef struct ioapic {
+    volatile uint32_t* base;
+    uint32_t gsi_base;
+    uint32_t gsi_count;
+} ioapic_t;
+
+static volatile uint32_t* g_lapic;
+static ioapic_t g_ioapics[ACPI_MAX_IOAPICS];
+static uint32_t g_ioapic_count;
+static uint32_t g_bsp_id;
+
+static void print_u32(uint32_t n) {
+    char buf[11];
+    int i = 0;
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+    while (i > 0) {
+        console_putc(buf[--i]);
+    }
+}
+
+static uint32_t lapic_read(uint32_t reg) {
+    return g_lapic[reg / 4u];
+}
+
+static void lapic_write(uint32_t reg, uint32_t v) {
+    g_lapic[reg / 4u] = v;
+}
+
+static uint32_t ioapic_read(const ioapic_t* io, uint32_t reg) {
+    io->base[IOAPIC_REGSEL / 4u] = reg;
+    return io->base[IOAPIC_WIN / 4u];
+}
+
+static void ioapic_write(const ioapic_t* io, uint32_t reg, uint32_t v) {
+    io->base[IOAPIC_REGSEL / 4u] = reg;
+    io->base[IOAPIC_WIN / 4u] = v;
+}
+
+static int cpu_has_apic(void) {
+    uint32_t a = 1;
+    uint32_t b;
+    uint32_t c = 0;
+    uint32_t d;
+
+    __asm__ volatile("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+    return (d & (1u << 9)) != 0u;
+}
+
+static void lapic_enable_msr(uint32_t base) {
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(MSR_APIC_BASE));
+    lo = (base & 0xFFFFF000u) | (lo & 0xFFFu) | MSR_APIC_BASE_ENABLE;
+    __asm__ volatile("wrmsr" : : "a"(lo), "d"(hi), "c"(MSR_APIC_BASE));
+}
+
+static ioapic_t* ioapic_for_gsi(uint32_t gsi, uint32_t* pin) {
+    uint32_t i;
+
+    for (i = 0; i < g_ioapic_count; i++) {
+        ioapic_t* io = &g_ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->gsi_count) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return 0;
+}
+
+int apic_init(void) {
+    const acpi_madt_info_t* madt = acpi_madt();
+    uint32_t i;
+
+    if (!madt || madt->ioapic_count == 0u || madt->lapic_addr == 0u) return -1;
+    if (!cpu_has_apic()) return -1;
+
+    if (map_mmio(madt->lapic_addr, 4096u) != 0) {
+        console_print("APIC: cannot map LAPIC\n");
+        return -1;
+    }
+
+    g_ioapic_count = 0;
+    for (i = 0; i < madt->ioapic_count; i++) {
+        ioapic_t* io = &g_ioapics[g_ioapic_count];
+        uint32_t pin;
+
+        if (map_mmio(madt->ioapics[i].addr, 4096u) != 0) continue;
+        io->base = (volatile uint32_t*)(uintptr_t)madt->ioapics[i].addr;
+        io->gsi_base = madt->ioapics[i].gsi_base;
+        io->gsi_count = ((ioapic_read(io, IOAPIC_REG_VER) >> 16) & 0xFFu) + 1u;
+        for (pin = 0; pin < io->gsi_count; pin++) {
+            ioapic_write(io, IOAPIC_REDTBL(pin), IOAPIC_RED_MASKED);
+            ioapic_write(io, IOAPIC_REDTBL(pin) + 1u, 0);
+        }
+        g_ioapic_count++;
+    }
+    if (g_ioapic_count == 0u) return -1;
+
+    lapic_enable_msr(madt->lapic_addr);
+    g_lapic = (volatile uint32_t*)(uintptr_t)madt->lapic_addr;
+    g_bsp_id = lapic_read(LAPIC_ID) >> 24;
+
+    /* The 8259 stays masked; drop its virtual-wire path and keep NMIs on LINT1. */
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_EOI, 0);
+
+    console_print("APIC: lapic id=");
+    print_u32(g_bsp_id);
+    console_print(" ioapic pins=");
+    print_u32(g_ioapics[0].gsi_count);
+    console_putc('\n');
+    return 0;
+}
+
+/*
+ * IRQ -> GSI via MADT overrides, delivered fixed to the boot CPU. Without
+ * an override ("conforms to the bus") ISA lines are edge/active-high and
+ * PCI INTx lines level/active-low, as they may be shared.
+ */
+int apic_route_irq(uint8_t irq, uint8_t vector, int pci) {
+    uint16_t flags = 0;
+    uint32_t gsi = acpi_isa_irq_to_gsi(irq, &flags);
+    uint32_t pin;
+    uint32_t low = vector;
+    uint16_t polarity = flags & ACPI_INTI_POLARITY_MASK;
+    uint16_t trigger = flags & ACPI_INTI_TRIGGER_MASK;
+    ioapic_t* io = ioapic_for_gsi(gsi, &pin);
+
+    if (!io) return -1;
+    if (polarity == ACPI_INTI_POLARITY_LOW || (polarity == 0 && pci)) low |= IOAPIC_RED_ACTIVE_LOW;
+    if (trigger == ACPI_INTI_TRIGGER_LEVEL || (trigger == 0 && pci)) low |= IOAPIC_RED_LEVEL;
+
+    ioapic_write(io, IOAPIC_REDTBL(pin) + 1u, g_bsp_id << 24);
+    ioapic_write(io, IOAPIC_REDTBL(pin), low);
+    return 0;
+}
+
+void apic_mask_irq(uint8_t irq) {
+    uint32_t gsi = acpi_isa_irq_to_gsi(irq, 0);
+    uint32_t pin;
+    ioapic_t* io = ioapic_for_gsi(gsi, &pin);
+
+    if (!io) return;
+    ioapic_write(io, IOAPIC_REDTBL(pin), ioapic_read(io, IOAPIC_REDTBL(pin)) | IOAPIC_RED_MASKED);
+}
+
+/* Single MMIO store, no port I/O on the interrupt path. */
+void apic_eoi(void) {
+    g_lapic[LAPIC_EOI / 4u] = 0;
+}
+
+int apic_vector_in_service(uint8_t vector) {
+    uint32_t reg = LAPIC_ISR + 0x10u * (vector / 32u);
+    return (lapic_read(reg) & (1u << (vector % 32u))) != 0u;
+}
+
+uint32_t apic_lapic_id(void) {
+    return g_bsp_id;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+#define APIC_SPURIOUS_VECTOR 0xFFu
+
+/* LAPIC + IOAPIC backend; returns -1 when the MADT or the CPU lacks an APIC. */
+int apic_init(void);
+/* pci: the line is a PCI INTx line (level/active-low unless the MADT says otherwise). */
+int apic_route_irq(uint8_t irq, uint8_t vector, int pci);
+void apic_mask_irq(uint8_t irq);
+void apic_eoi(void);
+int apic_vector_in_service(uint8_t vector);
+uint32_t apic_lapic_id(void);
@@ -0,0 +1,113 @@
+#include "../block/bcache.h"
+#include "../console.h"
+
+static void print_u32(unsigned int n) {
+    char buf[11];
+    int i = 0;
+
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+
+    while (i > 0) {
+        i--;
+        console_putc(buf[i]);
+    }
+}
+
+static int streq(const char* a, const char* b) {
+    while (*a && *b && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == 0 && *b == 0;
+}
+
+static void print_ratio(uint32_t part, uint32_t whole) {
+    uint32_t permille;
+
+    if (whole == 0) {
+        console_print("-");
+        return;
+    }
+    /* Avoid overflow once the counters get large. */
+    while (part > 0x003FFFFFu) {
+        part >>= 1;
+        whole >>= 1;
+    }
+    permille = (part * 1000u) / whole;
+    print_u32(permille / 10u);
+    console_putc('.');
+    print_u32(permille % 10u);
+    console_putc('%');
+}
+
+static void print_stats(void) {
+    bcache_stats_t st;
+
+    bcache_get_stats(&st);
+    console_print("bcache: ");
+    print_u32(st.in_use);
+    console_putc('/');
+    print_u32(st.entries);
+    console_print(" sectors used, ");
+    print_u32(st.dirty);
+    console_print(" dirty\n");
+
+    console_print("  lookups=");
+    print_u32(st.lookups);
+    console_print(" hits=");
+    print_u32(st.hits);
+    console_print(" misses=");
+    print_u32(st.misses);
+    console_print(" hit ratio=");
+    print_ratio(st.hits, st.lookups);
+    console_putc('\n');
+
+    console_print("  evictions=");
+    print_u32(st.evictions);
+    console_print(" writebacks=");
+    print_u32(st.writebacks);
+    console_print(" flushes=");
+    print_u32(st.flushes);
+    console_print(" bypass=");
+    print_u32(st.bypass);
+    console_putc('\n');
+}
+
+int app_bcache_main(int argc, char** argv) {
+    if (argc >= 2 && streq(argv[1], "sync")) {
+        if (bcache_sync(0) != 0) {
+            console_print("bcache: sync failed\n");
+            return -1;
+        }
+    } else if (argc >= 2 && streq(argv[1], "drop")) {
+        if (bcache_invalidate(0) != 0) {
+            console_print("bcache: writeback failed, dirty sectors kept\n");
+            return -1;
+        }
+    } else if (argc >= 2) {
+        console_print("usage: bcache [sync|drop]\n");
+        return -1;
+    }
+
+    print_stats();
+    return 0;
+}
+
+int app_sync_main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+
+    if (bcache_sync(0) != 0) {
+        console_print("sync: writeback failed\n");
+        return -1;
+    }
+    return 0;
+}
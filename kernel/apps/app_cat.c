@@ -1,10 +1,18 @@
 #include "../console.h"
 #include "../fs/vfs.h"
 
+/* The data is printed where it lies; no copy into a local buffer. */
+static int put_page(const void* data, size_t len, void* user) {
+    const char* p = (const char*)data;
+    size_t i;
+
+    (void)user;
+    for (i = 0; i < len; i++) console_putc(p[i]);
+    return 0;
+}
+
 int app_cat_main(int argc, char** argv) {
     int fd;
-    char buf[64];
-    int n;
 
     if (argc < 2) {
         console_print("usage: cat <path>\n");
@@ -17,9 +25,7 @@ int app_cat_main(int argc, char** argv) {
         return 1;
     }
 
-    while ((n = vfs_read(fd, buf, sizeof(buf))) > 0) {
-        int i;
-        for (i = 0; i < n; i++) console_putc(buf[i]);
+    while (vfs_read_pages(fd, 65536u, put_page, 0) > 0) {
     }
     vfs_close(fd);
     console_putc('\n');
@@ -1,6 +1,14 @@
+#include "../block/bcache.h"
+#include "../block/bio.h"
 #include "../block/blockdev.h"
 #include "../console.h"
+#include "../heap.h"
+#include "../input/input.h"
+#include "../lib/div64.h"
 #include "../lib/string.h"
+#include "../pit.h"
+#include "../sched/thread.h"
+#include "../sched/timer.h"
 
 static void print_u32(unsigned int n) {
     char buf[11];
@@ -60,6 +68,9 @@ static void usage(void) {
     console_print("disk\n");
     console_print("disk info <name>\n");
     console_print("disk read <name> <lba> <count>\n");
+    console_print("disk stats <name> [reset]\n");
+    console_print("disk iostat [count]\n");
+    console_print("disk mixbench <name> [ms]\n");
 }
 
 static void print_dev_line(const blockdev_t* dev) {
@@ -75,6 +86,32 @@ static void print_dev_line(const blockdev_t* dev) {
     console_putc('\n');
 }
 
+static void print_u32_width(unsigned int n, unsigned int width) {
+    unsigned int digits = 1;
+    unsigned int v = n;
+
+    while (v >= 10u) {
+        v /= 10u;
+        digits++;
+    }
+    while (digits < width) {
+        console_putc(' ');
+        digits++;
+    }
+    print_u32(n);
+}
+
+static void print_padded(const char* s, unsigned int width) {
+    unsigned int len = 0;
+
+    console_print(s);
+    while (s[len]) len++;
+    while (len < width) {
+        console_putc(' ');
+        len++;
+    }
+}
+
 static void print_hex_byte(unsigned char b) {
     static const char* hexdig = "0123456789ABCDEF";
     console_putc(hexdig[(b >> 4) & 0x0F]);
@@ -99,6 +136,7 @@ static int cmd_list(void) {
 
 static int cmd_info(const char* name) {
     const blockdev_t* dev = block_find(name);
+    block_queue_stats_t qs;
 
     if (!dev) {
         console_print("disk not found\n");
@@ -106,15 +144,34 @@ static int cmd_info(const char* name) {
     }
 
     print_dev_line(dev);
+    if (block_queue_stats(dev, &qs) == 0 && qs.workers > 0) {
+        console_print("queue: workers ");
+        print_u32(qs.workers);
+        console_print(" submitted ");
+        print_u32(qs.submitted);
+        console_print(" dispatched ");
+        print_u32(qs.dispatched);
+        console_print(" merged ");
+        print_u32(qs.merged);
+        console_print(" bounced ");
+        print_u32(qs.bounced);
+        console_print(" max_queued ");
+        print_u32(qs.max_queued);
+        console_putc('\n');
+    }
     return 0;
 }
 
+/* One request for the whole range; the block layer splits it at the driver's max_sectors. */
+#define DISK_READ_MAX_SECTORS 256u
+
 static int cmd_read(const char* name, const char* lba_s, const char* count_s) {
     const blockdev_t* dev = block_find(name);
     unsigned int lba;
     unsigned int count;
-    unsigned char buf[512];
+    unsigned char* buf;
     unsigned int max_print = 256;
+    unsigned int sum = 0;
     unsigned int i;
 
     if (!dev) {
@@ -125,16 +182,23 @@ static int cmd_read(const char* name, const char* lba_s, const char* count_s) {
         console_print("invalid lba/count\n");
         return 1;
     }
-    if (count == 0 || count > 1) {
-        console_print("count must be 1 for now\n");
+    if (count == 0 || count > DISK_READ_MAX_SECTORS) {
+        console_print("count must be 1..256\n");
         return 1;
     }
-    if (dev->sector_size > sizeof(buf)) {
-        console_print("sector size unsupported\n");
+    if (lba >= dev->sector_count || count > dev->sector_count - lba) {
+        console_print("range beyond end of disk\n");
         return 1;
     }
 
-    if (dev->read((blockdev_t*)dev, lba, count, buf) != 0) {
+    buf = (unsigned char*)kmalloc(count * dev->sector_size);
+    if (!buf) {
+        console_print("out of memory\n");
+        return 1;
+    }
+
+    if (bcache_read(dev, lba, count, buf) != 0) {
+        kfree(buf);
         console_print("read failed\n");
         return 1;
     }
@@ -150,6 +214,320 @@ static int cmd_read(const char* name, const char* lba_s, const char* count_s) {
         if ((i % 16u) == 15u) console_putc('\n');
     }
 
+    if (count > 1) {
+        for (i = 0; i < count * dev->sector_size; i++) {
+            sum = (sum << 1 | sum >> 31) ^ buf[i];
+        }
+        console_print("read ");
+        print_u32(count);
+        console_print(" sectors, checksum ");
+        for (i = 0; i < 4u; i++) print_hex_byte((unsigned char)(sum >> (24u - i * 8u)));
+        console_putc('\n');
+    }
+
+    kfree(buf);
+    return 0;
+}
+
+static void print_bucket_bound(unsigned int b) {
+    unsigned int us = 1u << b;
+
+    if (us >= 1000000u) {
+        print_u32(us / 1000000u);
+        console_print("s");
+    } else if (us >= 1000u) {
+        print_u32(us / 1000u);
+        console_print("ms");
+    } else {
+        print_u32(us);
+        console_print("us");
+    }
+}
+
+static void print_hist(const char* what, const uint32_t* hist) {
+    unsigned int b;
+    uint32_t max = 0;
+
+    for (b = 0; b < BLOCK_HIST_BUCKETS; b++) {
+        if (hist[b] > max) max = hist[b];
+    }
+    console_print(what);
+    if (max == 0) {
+        console_print(" -\n");
+        return;
+    }
+    console_putc('\n');
+
+    for (b = 0; b < BLOCK_HIST_BUCKETS; b++) {
+        unsigned int bar;
+        unsigned int i;
+
+        if (hist[b] == 0) continue;
+        console_print("  ");
+        if (b == 0) console_print("0");
+        else print_bucket_bound(b);
+        console_print(b == BLOCK_HIST_BUCKETS - 1u ? "+" : "..");
+        if (b != BLOCK_HIST_BUCKETS - 1u) print_bucket_bound(b + 1u);
+        console_print(" ");
+        print_u32(hist[b]);
+        console_print(" ");
+        bar = (unsigned int)div_u64((uint64_t)hist[b] * 40u, max, 0);
+        if (bar == 0) bar = 1;
+        for (i = 0; i < bar; i++) console_putc('#');
+        console_putc('\n');
+    }
+}
+
+static uint32_t hist_total(const uint32_t* hist) {
+    uint32_t total = 0;
+    unsigned int b;
+
+    for (b = 0; b < BLOCK_HIST_BUCKETS; b++) total += hist[b];
+    return total;
+}
+
+static unsigned int avg_us(uint64_t total, uint32_t n) {
+    return n ? (unsigned int)div_u64(total, n, 0) : 0u;
+}
+
+static int cmd_stats(const char* name, const char* arg) {
+    const blockdev_t* dev = block_find(name);
+    block_io_stats_t st;
+
+    if (!dev) {
+        console_print("disk not found\n");
+        return 1;
+    }
+    if (arg && streq(arg, "reset")) {
+        block_io_stats_reset(dev);
+        return 0;
+    }
+    if (block_io_stats(dev, &st) != 0) return 1;
+
+    print_dev_line(dev);
+    console_print("read  ");
+    print_u32(st.ops[BIO_READ]);
+    console_print(" ops ");
+    print_u32(st.sectors[BIO_READ]);
+    console_print(" sectors\nwrite ");
+    print_u32(st.ops[BIO_WRITE]);
+    console_print(" ops ");
+    print_u32(st.sectors[BIO_WRITE]);
+    console_print(" sectors\nflush ");
+    print_u32(st.flushes);
+    console_print("  errors ");
+    print_u32(st.errors);
+    console_print("  in flight ");
+    print_u32(st.in_flight);
+    console_putc('\n');
+
+    console_print("avg queue ");
+    print_u32(avg_us(st.queue_us, hist_total(st.queue_hist)));
+    console_print("us  avg service ");
+    print_u32(avg_us(st.service_us, st.service_calls));
+    console_print("us\n");
+    print_hist("queue time:", st.queue_hist);
+    print_hist("service time:", st.service_hist);
+    return 0;
+}
+
+/* One line per device and second until a key is pressed or count runs out. */
+static int cmd_iostat(const char* count_s) {
+    static block_io_stats_t prev[BLOCKDEV_MAX];
+    block_io_stats_t cur;
+    unsigned int count = 0;
+    unsigned int round;
+    size_t n = block_count();
+    size_t i;
+    key_event_t ev;
+
+    if (count_s && parse_u32(count_s, &count) != 0) {
+        console_print("invalid count\n");
+        return 1;
+    }
+    if (n == 0) {
+        console_print("no block devices\n");
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) block_io_stats(block_get(i), &prev[i]);
+    /* Drop keys typed before the start so they do not stop the first round. */
+    while (input_poll_event(&ev)) continue;
+    console_print("dev     r/s    w/s  rKiB/s  wKiB/s  inflt  svc_us  q_us  (key stops)\n");
+
+    for (round = 0; count == 0 || round < count; round++) {
+        unsigned int t;
+
+        for (t = 0; t < 20u; t++) {
+            thread_sleep_ms(50);
+            if (input_poll_event(&ev)) return 0;
+        }
+
+        for (i = 0; i < n; i++) {
+            const blockdev_t* dev = block_get(i);
+            uint32_t calls;
+            uint32_t queued;
+
+            block_io_stats(dev, &cur);
+            queued = hist_total(cur.queue_hist) - hist_total(prev[i].queue_hist);
+            calls = cur.service_calls - prev[i].service_calls;
+
+            print_padded(dev->name, 6);
+            print_u32_width(cur.ops[BIO_READ] - prev[i].ops[BIO_READ], 7);
+            print_u32_width(cur.ops[BIO_WRITE] - prev[i].ops[BIO_WRITE], 7);
+            print_u32_width((cur.sectors[BIO_READ] - prev[i].sectors[BIO_READ]) * dev->sector_size / 1024u, 8);
+            print_u32_width((cur.sectors[BIO_WRITE] - prev[i].sectors[BIO_WRITE]) * dev->sector_size / 1024u, 8);
+            print_u32_width(cur.in_flight, 7);
+            print_u32_width(avg_us(cur.service_us - prev[i].service_us, calls), 8);
+            print_u32_width(avg_us(cur.queue_us - prev[i].queue_us, queued), 6);
+            console_putc('\n');
+            prev[i] = cur;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Mixed load: a CPU-bound thread next to a sequential reader. Each phase
+ * runs alone first; the mixed phase shows how much of both survives when
+ * the reader sleeps on the completion IRQ instead of spinning.
+ */
+#define MIXBENCH_CHUNK 64u
+#define MIXBENCH_SPIN 20000u
+
+static volatile int g_mix_stop;
+static volatile int g_mix_worker_done;
+static volatile unsigned int g_mix_rounds;
+
+static void mix_cpu_worker(void* arg) {
+    volatile unsigned int x = 1;
+    unsigned int i;
+
+    (void)arg;
+    while (!g_mix_stop) {
+        for (i = 0; i < MIXBENCH_SPIN; i++) x = x * 1664525u + 1013904223u;
+        g_mix_rounds++;
+        thread_yield();
+    }
+    g_mix_worker_done = 1;
+}
+
+static int mix_start_cpu(void) {
+    g_mix_stop = 0;
+    g_mix_worker_done = 0;
+    g_mix_rounds = 0;
+    return thread_create("mix-cpu", mix_cpu_worker, 0);
+}
+
+static void mix_stop_cpu(void) {
+    g_mix_stop = 1;
+    while (!g_mix_worker_done) thread_yield();
+}
+
+/* Sequential reads for `ticks`; returns KiB read or -1. */
+static int mix_read(const blockdev_t* dev, unsigned char* buf, uint32_t ticks) {
+    uint32_t start = pit_get_ticks();
+    unsigned int lba = 0;
+    unsigned int kib = 0;
+
+    while (pit_get_ticks() - start < ticks) {
+        if (lba + MIXBENCH_CHUNK > dev->sector_count) lba = 0;
+        if (block_read(dev, lba, MIXBENCH_CHUNK, buf) != 0) return -1;
+        lba += MIXBENCH_CHUNK;
+        kib += (MIXBENCH_CHUNK * dev->sector_size) / 1024u;
+    }
+    return (int)kib;
+}
+
+static void print_rate(unsigned int kib, uint32_t ticks) {
+    print_u32((unsigned int)div_u64((uint64_t)kib * pit_get_hz(), ticks, 0));
+    console_print(" KiB/s");
+}
+
+static void print_percent(unsigned int part, unsigned int whole) {
+    if (whole == 0) {
+        console_print("-");
+        return;
+    }
+    print_u32((unsigned int)div_u64((uint64_t)part * 100u, whole, 0));
+    console_putc('%');
+}
+
+static int cmd_mixbench(const char* name, const char* ms_s) {
+    const blockdev_t* dev = block_find(name);
+    unsigned int ms = 2000;
+    uint32_t ticks;
+    unsigned char* buf;
+    uint32_t start;
+    unsigned int cpu_solo;
+    unsigned int cpu_mixed;
+    int disk_solo;
+    int disk_mixed;
+
+    if (!dev) {
+        console_print("disk not found\n");
+        return 1;
+    }
+    if (ms_s && (parse_u32(ms_s, &ms) != 0 || ms < 100u || ms > 60000u)) {
+        console_print("ms must be 100..60000\n");
+        return 1;
+    }
+    if (dev->sector_count < MIXBENCH_CHUNK) {
+        console_print("disk too small\n");
+        return 1;
+    }
+    ticks = (ms * pit_get_hz()) / 1000u;
+    if (ticks == 0) ticks = 1;
+
+    buf = (unsigned char*)kmalloc(MIXBENCH_CHUNK * dev->sector_size);
+    if (!buf) {
+        console_print("out of memory\n");
+        return 1;
+    }
+
+    /* CPU alone: the shell thread only sleeps. */
+    if (mix_start_cpu() < 0) {
+        kfree(buf);
+        console_print("cannot start worker\n");
+        return 1;
+    }
+    start = pit_get_ticks();
+    while (pit_get_ticks() - start < ticks) thread_sleep_ms(10);
+    mix_stop_cpu();
+    cpu_solo = g_mix_rounds;
+
+    disk_solo = mix_read(dev, buf, ticks);
+
+    if (mix_start_cpu() < 0) {
+        kfree(buf);
+        console_print("cannot start worker\n");
+        return 1;
+    }
+    disk_mixed = mix_read(dev, buf, ticks);
+    mix_stop_cpu();
+    cpu_mixed = g_mix_rounds;
+    kfree(buf);
+
+    if (disk_solo < 0 || disk_mixed < 0) {
+        console_print("read failed\n");
+        return 1;
+    }
+
+    console_print("cpu  alone ");
+    print_u32(cpu_solo);
+    console_print(" rounds, mixed ");
+    print_u32(cpu_mixed);
+    console_print(" (");
+    print_percent(cpu_mixed, cpu_solo);
+    console_print(")\n");
+
+    console_print("disk alone ");
+    print_rate((unsigned int)disk_solo, ticks);
+    console_print(", mixed ");
+    print_rate((unsigned int)disk_mixed, ticks);
+    console_print(" (");
+    print_percent((unsigned int)disk_mixed, (unsigned int)disk_solo);
+    console_print(")\n");
     return 0;
 }
 
@@ -174,6 +552,26 @@ int app_disk_main(int argc, char** argv) {
         return cmd_read(argv[2], argv[3], argv[4]);
     }
 
+    if (streq(argv[1], "stats")) {
+        if (argc < 3) {
+            usage();
+            return 1;
+        }
+        return cmd_stats(argv[2], argc >= 4 ? argv[3] : 0);
+    }
+
+    if (streq(argv[1], "iostat")) {
+        return cmd_iostat(argc >= 3 ? argv[2] : 0);
+    }
+
+    if (streq(argv[1], "mixbench")) {
+        if (argc < 3) {
+            usage();
+            return 1;
+        }
+        return cmd_mixbench(argv[2], argc >= 4 ? argv[3] : 0);
+    }
+
     usage();
     return 1;
 }
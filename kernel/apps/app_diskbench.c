@@ -0,0 +1,348 @@
+#include "../block/bcache.h"
+#include "../block/bio.h"
+#include "../block/blockdev.h"
+#include "../console.h"
+#include "../heap.h"
+#include "../lib/div64.h"
+#include "../lib/string.h"
+#include "../sched/sync.h"
+#include "../tsc.h"
+
+#include <stdint.h>
+
+#define BENCH_MAX_QD 32u
+#define BENCH_MAX_BYTES 65536u /* smallest per-command limit of the drivers (AHCI) */
+#define BENCH_MAX_SAMPLES 8192u
+
+/*
+ * Closed-loop load generator on top of blockdev_submit: qd requests stay
+ * in flight, each completion immediately resubmits until the time is up.
+ * Latency is submit to end_io, so it includes queueing in the bio layer.
+ */
+typedef struct bench_slot {
+    bio_t bio;
+    uint8_t* buf;
+    volatile uint64_t end_tsc;
+    volatile int finished;
+    int busy;
+} bench_slot_t;
+
+typedef struct bench_result {
+    uint32_t ops;
+    uint32_t errors;
+    uint32_t elapsed_us;
+    uint32_t p50_us;
+    uint32_t p99_us;
+} bench_result_t;
+
+static semaphore_t g_bench_done;
+static int g_bench_initialized;
+static bench_slot_t g_slots[BENCH_MAX_QD];
+static uint32_t* g_samples;
+static uint32_t g_sample_count;
+static uint32_t g_seen;
+static uint32_t g_rand = 0x2545F491u;
+
+static void print_u32(unsigned int n) {
+    char buf[11];
+    int i = 0;
+
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+
+    while (i > 0) {
+        i--;
+        console_putc(buf[i]);
+    }
+}
+
+static int streq(const char* a, const char* b) {
+    while (*a && *b && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == 0 && *b == 0;
+}
+
+static int parse_u32(const char* s, unsigned int* out) {
+    unsigned int value = 0;
+
+    if (!s || !*s) return -1;
+    while (*s) {
+        if (*s < '0' || *s > '9') return -1;
+        value = value * 10u + (unsigned int)(*s - '0');
+        s++;
+    }
+
+    *out = value;
+    return 0;
+}
+
+static uint32_t next_rand(void) {
+    g_rand = g_rand * 1664525u + 1013904223u;
+    return g_rand;
+}
+
+/* Reservoir sampling keeps the percentiles fair for long runs. */
+static void add_sample(uint32_t us) {
+    uint32_t j;
+
+    g_seen++;
+    if (g_sample_count < BENCH_MAX_SAMPLES) {
+        g_samples[g_sample_count++] = us;
+        return;
+    }
+    j = next_rand() % g_seen;
+    if (j < BENCH_MAX_SAMPLES) g_samples[j] = us;
+}
+
+static void sort_samples(uint32_t* v, uint32_t n) {
+    uint32_t gap;
+    uint32_t i;
+
+    for (gap = n / 2u; gap > 0; gap /= 2u) {
+        for (i = gap; i < n; i++) {
+            uint32_t x = v[i];
+            uint32_t j = i;
+            while (j >= gap && v[j - gap] > x) {
+                v[j] = v[j - gap];
+                j -= gap;
+            }
+            v[j] = x;
+        }
+    }
+}
+
+static void bench_end_io(bio_t* bio) {
+    bench_slot_t* slot = (bench_slot_t*)bio->private_data;
+
+    slot->end_tsc = tsc_read();
+    slot->finished = 1;
+    sem_post(&g_bench_done);
+}
+
+static int submit_slot(const blockdev_t* dev, bench_slot_t* slot, int write, unsigned int lba, unsigned int count) {
+    bio_init(&slot->bio, dev, write ? BIO_WRITE : BIO_READ, lba, count, slot->buf);
+    slot->bio.end_io = bench_end_io;
+    slot->bio.private_data = slot;
+    slot->finished = 0;
+    slot->busy = 1;
+    if (blockdev_submit(&slot->bio) != 0) {
+        slot->busy = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static int run_pattern(const blockdev_t* dev, int random, int write, unsigned int count, unsigned int qd,
+                       unsigned int ms, bench_result_t* res) {
+    unsigned int span = dev->sector_count / count;
+    unsigned int seq_next = 0;
+    uint64_t start = tsc_read();
+    uint64_t limit = (uint64_t)ms * tsc_khz();
+    unsigned int in_flight = 0;
+    int stop = 0;
+    unsigned int i;
+
+    memset(res, 0, sizeof(*res));
+    g_sample_count = 0;
+    g_seen = 0;
+
+    for (;;) {
+        /* Refill every idle slot while the run is still going. */
+        for (i = 0; i < qd && !stop; i++) {
+            unsigned int lba;
+
+            if (g_slots[i].busy) continue;
+            if (random) {
+                lba = (next_rand() % span) * count;
+            } else {
+                if (seq_next >= span) seq_next = 0;
+                lba = seq_next++ * count;
+            }
+            if (submit_slot(dev, &g_slots[i], write, lba, count) != 0) {
+                res->errors++;
+                stop = 1;
+                break;
+            }
+            in_flight++;
+        }
+        if (in_flight == 0) break;
+
+        sem_wait(&g_bench_done);
+        for (i = 0; i < qd; i++) {
+            bench_slot_t* slot = &g_slots[i];
+
+            if (!slot->busy || !slot->finished) continue;
+            slot->busy = 0;
+            in_flight--;
+            if (slot->bio.status != 0) {
+                res->errors++;
+                stop = 1;
+                continue;
+            }
+            res->ops++;
+            add_sample(tsc_cycles_to_us(slot->end_tsc - slot->bio.submit_tsc));
+        }
+        if (tsc_read() - start >= limit) stop = 1;
+    }
+
+    /* Written data counts once it is durable. */
+    if (write && blockdev_flush(dev) != 0) res->errors++;
+    res->elapsed_us = tsc_cycles_to_us(tsc_read() - start);
+
+    if (g_sample_count > 0) {
+        sort_samples(g_samples, g_sample_count);
+        res->p50_us = g_samples[(g_sample_count - 1u) / 2u];
+        res->p99_us = g_samples[(uint32_t)div_u64((uint64_t)(g_sample_count - 1u) * 99u, 100u, 0)];
+    }
+    return res->errors ? -1 : 0;
+}
+
+static void print_result(const char* name, unsigned int bytes, unsigned int qd, const bench_result_t* res) {
+    uint64_t total = (uint64_t)res->ops * bytes;
+    uint32_t us = res->elapsed_us ? res->elapsed_us : 1u;
+    uint32_t mb10 = (uint32_t)div_u64(total * 10u, us, 0); /* bytes/us = MB/s */
+
+    console_print(name);
+    console_print(" bs=");
+    print_u32(bytes);
+    console_print(" qd=");
+    print_u32(qd);
+    console_print(": ");
+    print_u32(mb10 / 10u);
+    console_putc('.');
+    print_u32(mb10 % 10u);
+    console_print(" MB/s ");
+    print_u32((uint32_t)div_u64((uint64_t)res->ops * 1000000u, us, 0));
+    console_print(" IOPS p50=");
+    print_u32(res->p50_us);
+    console_print("us p99=");
+    print_u32(res->p99_us);
+    console_print("us ops=");
+    print_u32(res->ops);
+    if (res->errors) {
+        console_print(" errors=");
+        print_u32(res->errors);
+    }
+    console_putc('\n');
+}
+
+static void usage(void) {
+    console_print("diskbench <name> [read|write|all] [bs_bytes] [qd] [ms]\n");
+    console_print("  defaults: read 4096 1 2000; write/all overwrite the disk\n");
+}
+
+int app_diskbench_main(int argc, char** argv) {
+    static const char* names[4] = { "seqread", "randread", "seqwrite", "randwrite" };
+    const blockdev_t* dev;
+    unsigned int bytes = 4096;
+    unsigned int qd = 1;
+    unsigned int ms = 2000;
+    int do_read = 1;
+    int do_write = 0;
+    unsigned int count;
+    unsigned int i;
+    bench_result_t res;
+    int rc = 0;
+
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    dev = block_find(argv[1]);
+    if (!dev) {
+        console_print("disk not found\n");
+        return 1;
+    }
+
+    if (argc >= 3) {
+        if (streq(argv[2], "write")) {
+            do_read = 0;
+            do_write = 1;
+        } else if (streq(argv[2], "all")) {
+            do_write = 1;
+        } else if (!streq(argv[2], "read")) {
+            usage();
+            return 1;
+        }
+    }
+    if ((argc >= 4 && parse_u32(argv[3], &bytes) != 0) || (argc >= 5 && parse_u32(argv[4], &qd) != 0) ||
+        (argc >= 6 && parse_u32(argv[5], &ms) != 0)) {
+        usage();
+        return 1;
+    }
+    if (bytes == 0 || bytes % dev->sector_size != 0 || bytes > BENCH_MAX_BYTES) {
+        console_print("bs must be a multiple of the sector size, max 65536\n");
+        return 1;
+    }
+    if (qd == 0 || qd > BENCH_MAX_QD || ms < 100u || ms > 600000u) {
+        console_print("qd must be 1..32, ms 100..600000\n");
+        return 1;
+    }
+    count = bytes / dev->sector_size;
+    if (dev->sector_count / count == 0) {
+        console_print("disk too small\n");
+        return 1;
+    }
+    if (do_write && !dev->write) {
+        console_print("device is read-only\n");
+        return 1;
+    }
+    if (tsc_khz() == 0) {
+        console_print("TSC not calibrated\n");
+        return 1;
+    }
+
+    if (!g_bench_initialized) {
+        sem_init(&g_bench_done, "diskbench", 0);
+        g_bench_initialized = 1;
+    }
+    g_samples = (uint32_t*)kmalloc(BENCH_MAX_SAMPLES * sizeof(uint32_t));
+    if (!g_samples) {
+        console_print("out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < qd; i++) {
+        g_slots[i].buf = (uint8_t*)kmalloc(bytes);
+        g_slots[i].busy = 0;
+        if (!g_slots[i].buf) {
+            console_print("out of memory\n");
+            while (i > 0) kfree(g_slots[--i].buf);
+            kfree(g_samples);
+            return 1;
+        }
+        memset(g_slots[i].buf, (int)(0xA5u ^ i), bytes);
+    }
+
+    /* Requests go around the buffer cache; start from a clean state. */
+    bcache_invalidate(dev);
+
+    for (i = 0; i < 4u && rc == 0; i++) {
+        int write = i >= 2u;
+
+        if ((write && !do_write) || (!write && !do_read)) continue;
+        rc = run_pattern(dev, (int)(i & 1u), write, count, qd, ms, &res);
+        print_result(names[i], bytes, qd, &res);
+    }
+
+    /* Cached copies of overwritten sectors are stale now. */
+    if (do_write) bcache_invalidate(dev);
+
+    for (i = 0; i < qd; i++) kfree(g_slots[i].buf);
+    kfree(g_samples);
+    g_samples = 0;
+
+    if (rc != 0) {
+        console_print("diskbench: I/O error, run aborted\n");
+        return 1;
+    }
+    return 0;
+}
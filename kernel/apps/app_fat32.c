@@ -1,10 +1,17 @@
 #include "../block/blockdev.h"
 #include "../console.h"
 #include "../fs/fat32.h"
+#include "../fs/fat32_vfs.h"
+#include "../heap.h"
+#include "../lib/div64.h"
 #include "../lib/string.h"
+#include "../tsc.h"
+
+#define FAT32_APP_CHUNK 65536u
 
 static const blockdev_t* g_selected;
-static int g_mounted;
+/* Resident volume of g_selected, owned by its VFS mount. */
+static fat32_fs_t* g_fs;
 
 static void print_u32(unsigned int n) {
     char buf[11];
@@ -34,6 +41,41 @@ static int streq(const char* a, const char* b) {
     return *a == 0 && *b == 0;
 }
 
+static int parse_u32(const char* s, unsigned int* out) {
+    unsigned int value = 0;
+
+    if (!s || !*s) return -1;
+    while (*s) {
+        if (*s < '0' || *s > '9') return -1;
+        value = value * 10u + (unsigned int)(*s - '0');
+        s++;
+    }
+
+    *out = value;
+    return 0;
+}
+
+static void print_failure(const char* what) {
+    console_print(what);
+    console_print(" failed\nreason: ");
+    console_print(fat32_last_error());
+    console_putc('\n');
+}
+
+static void print_rate(unsigned int bytes, uint64_t cycles) {
+    uint32_t us = tsc_cycles_to_us(cycles);
+    uint32_t kbs;
+
+    if (us == 0) us = 1;
+    kbs = (uint32_t)div_u64((uint64_t)bytes * 15625u, us, 0) / 16u; /* * 10^6 / 1024 */
+    print_u32(bytes);
+    console_print(" B in ");
+    print_u32(us / 1000u);
+    console_print(" ms (");
+    print_u32(kbs);
+    console_print(" KiB/s)");
+}
+
 static void print_capacity(unsigned int sector_size, unsigned int sector_count) {
     unsigned int whole_mib;
     unsigned int frac;
@@ -56,13 +98,21 @@ static void print_capacity(unsigned int sector_size, unsigned int sector_count)
 static void usage(void) {
     console_print("fat32 select <disk>\n");
     console_print("fat32 format [disk] --yes\n");
-    console_print("fat32 mount\n");
+    console_print("fat32 mount [path]   (default /mnt/<disk>)\n");
+    console_print("fat32 umount\n");
     console_print("fat32 info\n");
-    console_print("fat32 ls\n");
+    console_print("fat32 check\n");
+    console_print("fat32 ls [DIR]\n");
+    console_print("fat32 mkdir <DIR>\n");
+    console_print("fat32 populate <DIR> <count> [long]\n");
     console_print("fat32 write <NAME.EXT> <text>\n");
     console_print("fat32 edit <NAME.EXT> <text>\n");
     console_print("fat32 cat <NAME.EXT>\n");
-    console_print("fat32 rm <NAME.EXT>\n");
+    console_print("fat32 fill <NAME.EXT> <bytes> [chunk]\n");
+    console_print("fat32 sum <NAME.EXT> [chunk|pages]\n");
+    console_print("fat32 map <NAME.EXT>\n");
+    console_print("fat32 rm <NAME.EXT|DIR>\n");
+    console_print("  names may be paths with long names, e.g. Logs/BootLog.txt (any case)\n");
     console_print("fat32 log\n");
 }
 
@@ -78,19 +128,63 @@ static int build_selected_dev(fat32_device_t* dev) {
     return 0;
 }
 
-static int ensure_mounted(fat32_fs_t* fs) {
-    fat32_device_t dev;
+/* Another device name for the selected drive (hd0/dma0) that is mounted already. */
+static const blockdev_t* mounted_alias(void) {
+    size_t i;
 
-    if (build_selected_dev(&dev) != 0) return -1;
-    if (fat32_mount(fs, &dev) != 0) {
-        g_mounted = 0;
-        console_print("mount failed\n");
-        console_print("reason: ");
-        console_print(fat32_last_error());
+    for (i = 0; i < block_count(); i++) {
+        const blockdev_t* d = block_get(i);
+        if (d != g_selected && block_disk(d) == block_disk(g_selected) && fat32_vfs_fs(d)) return d;
+    }
+    return 0;
+}
+
+static int mount_selected(const char* mountpoint, int quiet) {
+    const blockdev_t* alias;
+
+    if (!g_selected) {
+        console_print("no device selected\n");
+        return -1;
+    }
+    g_fs = fat32_vfs_fs(g_selected);
+    if (g_fs) return 0;
+
+    alias = mounted_alias();
+    if (alias) {
+        if (!quiet) {
+            console_print("drive already mounted as ");
+            console_print(alias->name);
+            console_print(" on ");
+            console_print(fat32_vfs_mountpoint(alias));
+            console_putc('\n');
+        }
+        return -1;
+    }
+    if (fat32_vfs_mount(g_selected, mountpoint) != 0) {
+        if (!quiet) print_failure("mount");
+        return -1;
+    }
+    g_fs = fat32_vfs_fs(g_selected);
+    if (!quiet) {
+        console_print("mounted on ");
+        console_print(fat32_vfs_mountpoint(g_selected));
         console_putc('\n');
+    }
+    return 0;
+}
+
+/* Commands work on the VFS mount of the selected device, mounting it on first use. */
+static int ensure_mounted(void) {
+    return mount_selected(0, 0);
+}
+
+static int unmount_selected(void) {
+    if (!g_selected || !fat32_vfs_fs(g_selected)) return 0;
+    if (fat32_vfs_unmount(g_selected) != 0) {
+        console_print("volume busy (open files)\n");
         return -1;
     }
-    g_mounted = 1;
+    g_fs = 0;
     return 0;
 }
 
@@ -103,7 +197,7 @@ static int cmd_select(const char* name) {
     }
 
     g_selected = found;
-    g_mounted = 0;
+    g_fs = fat32_vfs_fs(found);
     console_print("selected: ");
     console_print(g_selected->name);
     console_putc('\n');
@@ -111,6 +205,7 @@ static int cmd_select(const char* name) {
 }
 
 static int cmd_format(int argc, char** argv) {
+    const blockdev_t* alias;
     const char* disk_name = 0;
     int has_yes = 0;
     int i;
@@ -143,6 +238,17 @@ static int cmd_format(int argc, char** argv) {
         return 1;
     }
 
+    /* The alias mount would write its cached FAT and FSInfo over the new volume. */
+    alias = mounted_alias();
+    if (alias) {
+        console_print("drive mounted as ");
+        console_print(alias->name);
+        console_print(" on ");
+        console_print(fat32_vfs_mountpoint(alias));
+        console_print(", unmount it first\n");
+        return 1;
+    }
+    if (unmount_selected() != 0) return 1;
     if (build_selected_dev(&dev) != 0) return 1;
     if (dev.sector_size != 512) {
         console_print("unsupported sector size\n");
@@ -157,7 +263,6 @@ static int cmd_format(int argc, char** argv) {
         return 1;
     }
 
-    g_mounted = 0;
     console_print("fat32 formatted on ");
     console_print(g_selected->name);
     console_putc('\n');
@@ -165,16 +270,13 @@ static int cmd_format(int argc, char** argv) {
 }
 
 static int cmd_info(void) {
-    fat32_device_t dev;
-    fat32_fs_t fs;
+    fat32_cache_stats_t stats;
 
     if (!g_selected) {
         console_print("no device selected\n");
         return 1;
     }
 
-    if (build_selected_dev(&dev) != 0) return 1;
-
     console_print("selected device: ");
     console_print(g_selected->name);
     console_putc('\n');
@@ -189,35 +291,336 @@ static int cmd_info(void) {
     print_capacity(g_selected->sector_size, g_selected->sector_count);
     console_putc('\n');
 
-    if (fat32_mount(&fs, &dev) != 0) {
-        g_mounted = 0;
+    if (mount_selected(0, 1) != 0) {
         console_print("formatted: no\n");
         console_print("mounted: no\n");
         return 0;
     }
 
-    g_mounted = 1;
     console_print("formatted: yes\n");
-    console_print("mounted: yes\n");
-    console_print("bytes/sector: ");
-    print_u32(dev.sector_size);
+    console_print("mounted: ");
+    console_print(fat32_vfs_mountpoint(g_selected));
+    console_print("\nbytes/sector: ");
+    print_u32(g_selected->sector_size);
     console_print("\nsectors/cluster: ");
-    print_u32(fs.sectors_per_cluster);
+    print_u32(g_fs->sectors_per_cluster);
     console_print("\nreserved sectors: ");
-    print_u32(fs.reserved_sectors);
+    print_u32(g_fs->reserved_sectors);
     console_print("\nfat count: ");
-    print_u32(fs.fat_count);
+    print_u32(g_fs->fat_count);
     console_print("\nfat sectors: ");
-    print_u32(fs.sectors_per_fat);
+    print_u32(g_fs->sectors_per_fat);
     console_print("\nroot cluster: ");
-    print_u32(fs.root_cluster);
+    print_u32(g_fs->root_cluster);
+    console_print("\nclusters: ");
+    print_u32(g_fs->total_clusters);
+    console_print("\nstate: ");
+    console_print(g_fs->was_dirty ? "dirty (not cleanly unmounted, run fat32 check)" : "clean");
+    console_print("\nfree clusters: ");
+    print_u32(g_fs->free_count);
+    if (!g_fs->used_bitmap) console_print(" (FSInfo, FAT not scanned yet)");
+    console_print("\nnext free: ");
+    print_u32(g_fs->next_free);
+    fat32_get_cache_stats(g_fs, &stats);
+    console_print("\nfat cache: ");
+    print_u32(stats.fat_hits);
+    console_print(" hits, ");
+    print_u32(stats.fat_misses);
+    console_print(" misses\ndentry cache: ");
+    print_u32(stats.dentry_hits);
+    console_print(" hits, ");
+    print_u32(stats.dentry_misses);
+    console_print(" misses\nread-ahead: ");
+    print_u32(stats.ra_requests);
+    console_print(" requests, ");
+    print_u32(stats.ra_hits);
+    console_print(" hits\nwrite-behind: ");
+    print_u32(stats.wb_appends);
+    console_print(" appends, ");
+    print_u32(stats.wb_flushes);
+    console_print(" flushes\nwrite barriers: ");
+    print_u32(stats.barriers);
     console_putc('\n');
     return 0;
 }
 
-int app_fat32_main(int argc, char** argv) {
-    fat32_fs_t fs;
+static void print_count(const char* label, unsigned int n) {
+    console_print(label);
+    print_u32(n);
+    console_putc('\n');
+}
+
+static int cmd_check(void) {
+    fat32_check_t r;
+    uint64_t start;
+    unsigned int errors;
+
+    if (ensure_mounted() != 0) return 1;
+    start = tsc_read();
+    if (fat32_check(g_fs, &r) != 0) {
+        print_failure("check");
+        return 1;
+    }
+    print_count("files: ", r.files);
+    print_count("directories: ", r.dirs);
+    print_count("used clusters: ", r.used_clusters);
+    print_count("free clusters: ", r.free_clusters);
+    print_count("bad clusters: ", r.bad_clusters);
+    print_count("bad links: ", r.bad_links);
+    print_count("cross-linked clusters: ", r.cross_links);
+    print_count("lost chains: ", r.lost_chains);
+    print_count("lost clusters: ", r.lost_clusters);
+    print_count("size mismatches: ", r.size_mismatches);
+    print_count("directory errors: ", r.dir_errors);
+    if (r.fsinfo_fixed) console_print("FSInfo free count corrected\n");
+
+    errors = r.bad_links + r.cross_links + r.lost_clusters + r.size_mismatches + r.dir_errors;
+    console_print(errors ? "errors found" : "clean");
+    console_print(" (");
+    print_u32(tsc_cycles_to_us(tsc_read() - start) / 1000u);
+    console_print(" ms)\n");
+    return errors ? 1 : 0;
+}
 
+static int print_dirent(const fat32_dirent_t* ent, void* user) {
+    (*(unsigned int*)user)++;
+    console_print(ent->name);
+    if (ent->is_dir) {
+        console_print(" <DIR>\n");
+        return 0;
+    }
+    console_print(" (");
+    print_u32(ent->size);
+    console_print(" B)\n");
+    return 0;
+}
+
+static int cmd_ls(const char* path) {
+    unsigned int count = 0;
+
+    if (ensure_mounted() != 0) return 1;
+    if (fat32_list_dir(g_fs, path, print_dirent, &count) != 0) {
+        print_failure("ls");
+        return 1;
+    }
+    if (count == 0) console_print("directory empty\n");
+    return 0;
+}
+
+/*
+ * Creates count empty files F0000000.DAT.. in dir, then looks each one up
+ * again. With long names the files are "Data File 0000000.bin" and the
+ * second pass opens them as "DATA FILE 0000000.BIN".
+ */
+static int cmd_populate(const char* dir, unsigned int count, int long_names) {
+    const char* names[2];
+    unsigned int digit0 = long_names ? 10u : 1u;
+    char path[64];
+    size_t dlen = strlen(dir);
+    size_t nlen;
+    fat32_file_t f;
+    uint64_t start;
+    unsigned int i;
+    int pass;
+
+    names[0] = long_names ? "Data File 0000000.bin" : "F0000000.DAT";
+    names[1] = long_names ? "DATA FILE 0000000.BIN" : "F0000000.DAT";
+    nlen = strlen(names[0]);
+    if (dlen + nlen + 2u > sizeof(path)) {
+        console_print("path too long\n");
+        return 1;
+    }
+    if (ensure_mounted() != 0) return 1;
+
+    memcpy(path, dir, dlen);
+    path[dlen] = '/';
+    for (pass = 0; pass < 2; pass++) {
+        memcpy(path + dlen + 1u, names[pass], nlen + 1u);
+        start = tsc_read();
+        for (i = 0; i < count; i++) {
+            unsigned int v = i;
+            int d;
+
+            for (d = 6; d >= 0; d--) {
+                path[dlen + 1u + digit0 + (unsigned int)d] = (char)('0' + v % 10u);
+                v /= 10u;
+            }
+            if ((pass == 0 ? fat32_create(g_fs, path, &f) : fat32_open(g_fs, path, &f)) != 0 || fat32_close(&f) != 0) {
+                print_failure(pass == 0 ? "create" : "open");
+                return 1;
+            }
+        }
+        console_print(pass == 0 ? "created " : "opened ");
+        print_u32(count);
+        console_print(" files in ");
+        print_u32(tsc_cycles_to_us(tsc_read() - start) / 1000u);
+        console_print(" ms\n");
+    }
+    return 0;
+}
+
+/* Streams the file to the console one sector-sized chunk at a time. */
+static int cmd_cat(const char* name) {
+    fat32_file_t f;
+    char buf[513];
+    unsigned int off = 0;
+    int n;
+
+    if (ensure_mounted() != 0) return 1;
+    if (fat32_open(g_fs, name, &f) != 0) {
+        print_failure("read");
+        return 1;
+    }
+    while ((n = fat32_file_read(&f, off, buf, sizeof(buf) - 1u)) > 0) {
+        int i;
+        for (i = 0; i < n; i++) console_putc(buf[i]);
+        off += (unsigned int)n;
+    }
+    fat32_close(&f);
+    if (n < 0) {
+        print_failure("read");
+        return 1;
+    }
+    console_putc('\n');
+    return 0;
+}
+
+/* chunk is the size of each write call; small ones show write-behind at work. */
+static int cmd_fill(const char* name, unsigned int bytes, unsigned int chunk) {
+    fat32_file_t f;
+    unsigned char* buf;
+    unsigned int off = 0;
+    uint64_t start;
+    unsigned int i;
+    int rc = 0;
+
+    if (ensure_mounted() != 0) return 1;
+    buf = (unsigned char*)kmalloc(FAT32_APP_CHUNK);
+    if (!buf) {
+        console_print("out of memory\n");
+        return 1;
+    }
+    if (fat32_create(g_fs, name, &f) != 0) {
+        kfree(buf);
+        print_failure("create");
+        return 1;
+    }
+
+    start = tsc_read();
+    while (off < bytes && rc == 0) {
+        unsigned int n = bytes - off > chunk ? chunk : bytes - off;
+        for (i = 0; i < n; i++) buf[i] = (unsigned char)('A' + (off + i) % 26u);
+        if (fat32_file_write(&f, off, buf, n) != (int)n) rc = -1;
+        off += n;
+    }
+    if (fat32_close(&f) != 0) rc = -1;
+    kfree(buf);
+
+    if (rc != 0) {
+        print_failure("write");
+        return 1;
+    }
+    console_print("wrote ");
+    print_rate(bytes, tsc_read() - start);
+    console_putc('\n');
+    return 0;
+}
+
+static int sum_page(const void* data, size_t len, void* user) {
+    const unsigned char* p = (const unsigned char*)data;
+    unsigned int* sum = (unsigned int*)user;
+    size_t i;
+
+    for (i = 0; i < len; i++) *sum = *sum * 31u + p[i];
+    return 0;
+}
+
+/* chunk 0 reads with fat32_file_read_pages, straight from the read-ahead buffers. */
+static int cmd_sum(const char* name, unsigned int chunk) {
+    fat32_file_t f;
+    unsigned char* buf;
+    unsigned int off = 0;
+    unsigned int sum = 0;
+    uint64_t start;
+    int n;
+
+    if (ensure_mounted() != 0) return 1;
+    buf = (unsigned char*)kmalloc(FAT32_APP_CHUNK);
+    if (!buf) {
+        console_print("out of memory\n");
+        return 1;
+    }
+    if (fat32_open(g_fs, name, &f) != 0) {
+        kfree(buf);
+        print_failure("open");
+        return 1;
+    }
+
+    start = tsc_read();
+    if (chunk == 0) {
+        n = fat32_file_read_pages(&f, 0, f.size, sum_page, &sum);
+        if (n > 0) off = (unsigned int)n;
+    } else {
+        while ((n = fat32_file_read(&f, off, buf, chunk)) > 0) {
+            sum_page(buf, (size_t)n, &sum);
+            off += (unsigned int)n;
+        }
+    }
+    fat32_close(&f);
+    kfree(buf);
+
+    if (n < 0) {
+        print_failure("read");
+        return 1;
+    }
+    console_print("read ");
+    print_rate(off, tsc_read() - start);
+    console_print(" sum=");
+    print_u32(sum);
+    console_putc('\n');
+    return 0;
+}
+
+static int cmd_map(const char* name) {
+    fat32_file_t f;
+    fat32_extent_t ext[FAT32_FILE_EXTENTS];
+    size_t count = 0;
+    size_t i;
+
+    if (ensure_mounted() != 0) return 1;
+    if (fat32_open(g_fs, name, &f) != 0) {
+        print_failure("open");
+        return 1;
+    }
+    if (fat32_file_extents(&f, ext, FAT32_FILE_EXTENTS, &count) != 0) {
+        fat32_close(&f);
+        print_failure("map");
+        return 1;
+    }
+
+    console_print("size ");
+    print_u32(f.size);
+    console_print(" B, ");
+    print_u32(f.chain_len);
+    console_print(" clusters, ");
+    print_u32((unsigned int)count);
+    console_print(" extents");
+    if (f.mapped < f.chain_len) console_print(" (table full)");
+    console_putc('\n');
+    for (i = 0; i < count; i++) {
+        console_print("  ");
+        print_u32(ext[i].file_cluster);
+        console_print(": cluster ");
+        print_u32(ext[i].disk_cluster);
+        console_print(" x");
+        print_u32(ext[i].count);
+        console_putc('\n');
+    }
+    fat32_close(&f);
+    return 0;
+}
+
+int app_fat32_main(int argc, char** argv) {
     if (argc < 2) {
         usage();
         return 1;
@@ -236,41 +639,49 @@ int app_fat32_main(int argc, char** argv) {
     }
 
     if (streq(argv[1], "mount")) {
-        if (ensure_mounted(&fs) != 0) return 1;
-        console_print("mount ok\n");
-        return 0;
+        if (g_selected && fat32_vfs_fs(g_selected)) {
+            console_print("already mounted on ");
+            console_print(fat32_vfs_mountpoint(g_selected));
+            console_putc('\n');
+            return 0;
+        }
+        return mount_selected(argc >= 3 ? argv[2] : 0, 0) != 0;
     }
 
     if (streq(argv[1], "info")) {
         return cmd_info();
     }
 
+    if (streq(argv[1], "check")) {
+        return cmd_check();
+    }
+
     if (streq(argv[1], "ls")) {
-        fat32_dirent_t entries[16];
-        size_t i;
-        size_t count = 0;
+        return cmd_ls(argc >= 3 ? argv[2] : "/");
+    }
 
-        if (ensure_mounted(&fs) != 0) return 1;
-        if (fat32_list_root(&fs, entries, 16, &count) != 0) {
-            console_print("ls failed\n");
-            console_print("reason: ");
-            console_print(fat32_last_error());
-            console_putc('\n');
+    if (streq(argv[1], "mkdir")) {
+        if (argc < 3) {
+            console_print("usage: fat32 mkdir <DIR>\n");
             return 1;
         }
 
-        if (count == 0) {
-            console_print("root empty\n");
-            return 0;
+        if (ensure_mounted() != 0) return 1;
+        if (fat32_mkdir(g_fs, argv[2]) != 0) {
+            print_failure("mkdir");
+            return 1;
         }
+        return 0;
+    }
 
-        for (i = 0; i < count; i++) {
-            console_print(entries[i].name83);
-            console_print(" (");
-            print_u32(entries[i].size);
-            console_print(" B)\n");
+    if (streq(argv[1], "populate")) {
+        unsigned int count;
+
+        if (argc < 4 || parse_u32(argv[3], &count) != 0 || (argc >= 5 && !streq(argv[4], "long"))) {
+            console_print("usage: fat32 populate <DIR> <count> [long]\n");
+            return 1;
         }
-        return 0;
+        return cmd_populate(argv[2], count, argc >= 5);
     }
 
     if (streq(argv[1], "write") || streq(argv[1], "edit")) {
@@ -279,9 +690,9 @@ int app_fat32_main(int argc, char** argv) {
             return 1;
         }
 
-        if (ensure_mounted(&fs) != 0) return 1;
-        if (fat32_write_file(&fs, argv[2], argv[3], strlen(argv[3])) != 0) {
-            console_print("write failed (name must be 8.3, data <= 512 bytes)\n");
+        if (ensure_mounted() != 0) return 1;
+        if (fat32_write_file(g_fs, argv[2], argv[3], strlen(argv[3])) != 0) {
+            console_print("write failed\n");
             console_print("reason: ");
             console_print(fat32_last_error());
             console_putc('\n');
@@ -296,8 +707,8 @@ int app_fat32_main(int argc, char** argv) {
             return 1;
         }
 
-        if (ensure_mounted(&fs) != 0) return 1;
-        if (fat32_delete_file(&fs, argv[2]) != 0) {
+        if (ensure_mounted() != 0) return 1;
+        if (fat32_delete_file(g_fs, argv[2]) != 0) {
             console_print("delete failed\n");
             console_print("reason: ");
             console_print(fat32_last_error());
@@ -307,26 +718,41 @@ int app_fat32_main(int argc, char** argv) {
         return 0;
     }
 
-    if (streq(argv[1], "cat")) {
-        char buf[513];
-        size_t out_len;
-
+    if (streq(argv[1], "cat") || streq(argv[1], "map")) {
         if (argc < 3) {
-            console_print("usage: fat32 cat <NAME.EXT>\n");
+            console_print("usage: fat32 cat|map <NAME.EXT>\n");
             return 1;
         }
+        if (streq(argv[1], "cat")) return cmd_cat(argv[2]);
+        return cmd_map(argv[2]);
+    }
 
-        if (ensure_mounted(&fs) != 0) return 1;
-        if (fat32_read_file(&fs, argv[2], buf, sizeof(buf), &out_len) != 0) {
-            console_print("read failed\n");
-            console_print("reason: ");
-            console_print(fat32_last_error());
-            console_putc('\n');
+    if (streq(argv[1], "sum")) {
+        unsigned int chunk = FAT32_APP_CHUNK;
+
+        if (argc >= 4 && streq(argv[3], "pages")) chunk = 0;
+        else if (argc < 3 || (argc >= 4 && parse_u32(argv[3], &chunk) != 0) || chunk == 0 || chunk > FAT32_APP_CHUNK) {
+            console_print("usage: fat32 sum <NAME.EXT> [chunk 1..65536|pages]\n");
             return 1;
         }
-        (void)out_len;
-        console_print(buf);
-        console_putc('\n');
+        return cmd_sum(argv[2], chunk);
+    }
+
+    if (streq(argv[1], "fill")) {
+        unsigned int bytes;
+        unsigned int chunk = FAT32_APP_CHUNK;
+
+        if (argc < 4 || parse_u32(argv[3], &bytes) != 0 || (argc >= 5 && parse_u32(argv[4], &chunk) != 0) ||
+            chunk == 0 || chunk > FAT32_APP_CHUNK) {
+            console_print("usage: fat32 fill <NAME.EXT> <bytes> [chunk 1..65536]\n");
+            return 1;
+        }
+        return cmd_fill(argv[2], bytes, chunk);
+    }
+
+    if (streq(argv[1], "umount")) {
+        if (unmount_selected() != 0) return 1;
+        console_print("unmounted\n");
         return 0;
     }
 
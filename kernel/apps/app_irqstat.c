@@ -0,0 +1,153 @@
+#include "../console.h"
+#include "../input/input.h"
+#include "../irqstat.h"
+#include "../isr.h"
+#include "../lib/div64.h"
+#include "../sched/softirq.h"
+#include "../serial.h"
+#include "../tsc.h"
+
+#include <stdint.h>
+
+static const char* g_softirq_names[SOFTIRQ_PRIO_COUNT] = {
+    "hi", "timer", "input", "block", "low",
+};
+
+static void print_u32(unsigned int n) {
+    char buf[11];
+    int i = 0;
+
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+
+    while (i > 0) {
+        i--;
+        console_putc(buf[i]);
+    }
+}
+
+static void print_hex(uint32_t v, int digits) {
+    static const char* hexdig = "0123456789ABCDEF";
+    int shift;
+
+    console_print("0x");
+    for (shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+        console_putc(hexdig[(v >> shift) & 0x0Fu]);
+    }
+}
+
+static int streq(const char* a, const char* b) {
+    while (*a && *b && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == 0 && *b == 0;
+}
+
+static void print_cycles(uint32_t cycles) {
+    print_u32(cycles);
+    console_print(" (");
+    print_u32(tsc_cycles_to_us(cycles));
+    console_print("us)");
+}
+
+static void show_vectors(void) {
+    uint32_t irq;
+
+    console_print("controller: ");
+    console_print(irq_controller_name());
+    console_print(", tsc: ");
+    print_u32(tsc_khz() / 1000u);
+    console_print(" MHz\n");
+    console_print("irq vec count min avg max [cycles]\n");
+    for (irq = 0; irq < IRQSTAT_VECTORS; irq++) {
+        irq_vector_stats_t st;
+        uint32_t avg;
+
+        irqstat_get(irq, &st);
+        if (st.count == 0) continue;
+        avg = (uint32_t)div_u64(st.total_cycles, st.count, 0);
+
+        print_u32(irq);
+        console_putc(' ');
+        print_hex(0x20u + irq, 2);
+        console_putc(' ');
+        print_u32(st.count);
+        console_putc(' ');
+        print_u32(st.min_cycles);
+        console_putc(' ');
+        print_u32(avg);
+        console_putc(' ');
+        print_cycles(st.max_cycles);
+        console_putc('\n');
+    }
+}
+
+static void show_irqsoff(void) {
+    irqsoff_entry_t top[IRQSOFF_TOP];
+    int n = irqsoff_get_top(top, IRQSOFF_TOP);
+    int i;
+
+    console_print("longest irqs-off sections (heap/pmm locks):\n");
+    if (n == 0) {
+        console_print("  none recorded\n");
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        console_print("  ");
+        print_hex(top[i].caller, 8);
+        console_putc(' ');
+        print_cycles(top[i].cycles);
+        console_putc('\n');
+    }
+}
+
+static void show_softirq(void) {
+    softirq_stats_t st;
+    int i;
+
+    softirq_get_stats(&st);
+    console_print("softirq raised executed:\n");
+    for (i = 0; i < SOFTIRQ_PRIO_COUNT; i++) {
+        console_print("  ");
+        console_print(g_softirq_names[i]);
+        console_putc(' ');
+        print_u32(st.raised[i]);
+        console_putc(' ');
+        print_u32(st.executed[i]);
+        console_putc('\n');
+    }
+    console_print("  deferred passes: ");
+    print_u32(st.deferred_passes);
+    console_putc('\n');
+    console_print("dropped: input ");
+    print_u32(input_dropped_events());
+    console_print(" serial rx ");
+    print_u32(serial_rx_dropped());
+    console_putc('\n');
+}
+
+int app_irqstat_main(int argc, char** argv) {
+    if (argc == 1) {
+        show_vectors();
+        show_irqsoff();
+        show_softirq();
+        return 0;
+    }
+
+    if (streq(argv[1], "reset")) {
+        irqstat_reset();
+        console_print("irqstat: counters cleared\n");
+        return 0;
+    }
+
+    console_print("usage: irqstat [reset]\n");
+    return 1;
+}
@@ -0,0 +1,236 @@
+#include "../console.h"
+#include "../sched/sync.h"
+#include "../sched/thread.h"
+
+#include <stdint.h>
+
+#define LOCKS_TEST_ROUNDS 40u
+#define LOCKS_TEST_WORKERS 3u
+#define LOCKS_TEST_ITEMS 16u
+
+static mutex_t g_test_mutex;
+static semaphore_t g_test_done;
+static condvar_t g_test_cond;
+static rwlock_t g_test_rw;
+static unsigned int g_shared;
+static unsigned int g_queue_len;
+static unsigned int g_consumed;
+static unsigned int g_readers_inside;
+static unsigned int g_rw_violations;
+static volatile int g_test_finished;
+static int g_test_initialized;
+
+static void print_u32(unsigned int n) {
+    char buf[11];
+    int i = 0;
+
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+
+    while (i > 0) {
+        i--;
+        console_putc(buf[i]);
+    }
+}
+
+static int streq(const char* a, const char* b) {
+    while (*a && *b && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == 0 && *b == 0;
+}
+
+static void mutex_worker(void* arg) {
+    unsigned int i;
+    (void)arg;
+
+    for (i = 0; i < LOCKS_TEST_ROUNDS; i++) {
+        unsigned int v;
+        mutex_lock(&g_test_mutex);
+        v = g_shared;
+        thread_yield();
+        g_shared = v + 1u;
+        mutex_unlock(&g_test_mutex);
+    }
+    sem_post(&g_test_done);
+}
+
+static void producer(void* arg) {
+    unsigned int i;
+    (void)arg;
+
+    for (i = 0; i < LOCKS_TEST_ITEMS; i++) {
+        mutex_lock(&g_test_mutex);
+        g_queue_len++;
+        cond_signal(&g_test_cond);
+        mutex_unlock(&g_test_mutex);
+        thread_yield();
+    }
+    sem_post(&g_test_done);
+}
+
+static void consumer(void* arg) {
+    (void)arg;
+
+    mutex_lock(&g_test_mutex);
+    while (g_consumed < LOCKS_TEST_ITEMS) {
+        while (g_queue_len == 0) {
+            cond_wait(&g_test_cond, &g_test_mutex);
+        }
+        g_queue_len--;
+        g_consumed++;
+    }
+    mutex_unlock(&g_test_mutex);
+    sem_post(&g_test_done);
+}
+
+static void reader(void* arg) {
+    unsigned int i;
+    (void)arg;
+
+    for (i = 0; i < LOCKS_TEST_ROUNDS / 4u; i++) {
+        rwlock_read_lock(&g_test_rw);
+        g_readers_inside++;
+        thread_yield();
+        g_readers_inside--;
+        rwlock_read_unlock(&g_test_rw);
+    }
+    sem_post(&g_test_done);
+}
+
+static void writer(void* arg) {
+    unsigned int i;
+    (void)arg;
+
+    for (i = 0; i < LOCKS_TEST_ROUNDS / 4u; i++) {
+        rwlock_write_lock(&g_test_rw);
+        if (g_readers_inside != 0) g_rw_violations++;
+        thread_yield();
+        if (g_readers_inside != 0) g_rw_violations++;
+        rwlock_write_unlock(&g_test_rw);
+        thread_yield();
+    }
+    sem_post(&g_test_done);
+}
+
+static void report(const char* what, int pass) {
+    console_print(pass ? "[ok] " : "[fail] ");
+    console_print(what);
+    console_putc('\n');
+}
+
+static void checker(void* arg) {
+    unsigned int i;
+    int failures = 0;
+    (void)arg;
+
+    for (i = 0; i < LOCKS_TEST_WORKERS; i++) {
+        thread_create("lk-mutex", mutex_worker, 0);
+    }
+    for (i = 0; i < LOCKS_TEST_WORKERS; i++) {
+        sem_wait(&g_test_done);
+    }
+    report("mutex handoff keeps counter exact", g_shared == LOCKS_TEST_ROUNDS * LOCKS_TEST_WORKERS);
+    if (g_shared != LOCKS_TEST_ROUNDS * LOCKS_TEST_WORKERS) failures++;
+
+    thread_create("lk-cons", consumer, 0);
+    thread_create("lk-prod", producer, 0);
+    sem_wait(&g_test_done);
+    sem_wait(&g_test_done);
+    report("condvar producer/consumer", g_consumed == LOCKS_TEST_ITEMS && g_queue_len == 0);
+    if (g_consumed != LOCKS_TEST_ITEMS || g_queue_len != 0) failures++;
+
+    thread_create("lk-rd", reader, 0);
+    thread_create("lk-rd", reader, 0);
+    thread_create("lk-wr", writer, 0);
+    for (i = 0; i < 3u; i++) {
+        sem_wait(&g_test_done);
+    }
+    report("rwlock excludes readers from writer", g_rw_violations == 0);
+    if (g_rw_violations != 0) failures++;
+
+    console_print(failures == 0 ? "locks test: PASS\n" : "locks test: FAIL\n");
+    g_test_finished = 1;
+}
+
+static int cmd_test(void) {
+    unsigned int spins = 0;
+
+    if (!g_test_initialized) {
+        mutex_init(&g_test_mutex, "test.mutex");
+        sem_init(&g_test_done, "test.done", 0);
+        cond_init(&g_test_cond);
+        rwlock_init(&g_test_rw, "test.rw");
+        g_test_initialized = 1;
+    }
+
+    g_shared = 0;
+    g_queue_len = 0;
+    g_consumed = 0;
+    g_readers_inside = 0;
+    g_rw_violations = 0;
+    g_test_finished = 0;
+
+    if (thread_create("lk-check", checker, 0) < 0) {
+        console_print("locks test: cannot create threads\n");
+        return 1;
+    }
+
+    /* Drive the cooperative scheduler until the checker reports back. */
+    while (!g_test_finished && spins < 1000000u) {
+        thread_yield();
+        spins++;
+    }
+    if (!g_test_finished) {
+        console_print("locks test: timeout\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int cmd_list(void) {
+    const lock_stats_t* st = sync_stats_head();
+
+    if (!st) {
+        console_print("no sleeping locks registered\n");
+        return 0;
+    }
+
+    console_print("name kind acquired contended wait_ticks max_wait\n");
+    for (; st; st = st->next) {
+        console_print(st->name);
+        console_putc(' ');
+        console_print(sync_kind_name(st->kind));
+        console_putc(' ');
+        print_u32(st->acquisitions);
+        console_putc(' ');
+        print_u32(st->contentions);
+        console_putc(' ');
+        print_u32(st->wait_ticks);
+        console_putc(' ');
+        print_u32(st->max_wait_ticks);
+        console_putc('\n');
+    }
+    return 0;
+}
+
+int app_locks_main(int argc, char** argv) {
+    if (argc == 1) {
+        return cmd_list();
+    }
+
+    if (streq(argv[1], "test")) {
+        return cmd_test();
+    }
+
+    console_print("usage: locks [test]\n");
+    return 1;
+}
@@ -0,0 +1,125 @@
+#include "../block/blockdev.h"
+#include "../console.h"
+#include "../drivers/memdisk.h"
+#include "../mem/pmm.h"
+
+static void print_u32(unsigned int n) {
+    char buf[11];
+    int i = 0;
+
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+
+    while (i > 0) {
+        i--;
+        console_putc(buf[i]);
+    }
+}
+
+static int streq(const char* a, const char* b) {
+    while (*a && *b && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == 0 && *b == 0;
+}
+
+static int parse_u32(const char* s, unsigned int* out) {
+    unsigned int value = 0;
+
+    if (!s || !*s) return -1;
+    while (*s) {
+        if (*s < '0' || *s > '9') return -1;
+        value = value * 10u + (unsigned int)(*s - '0');
+        s++;
+    }
+
+    *out = value;
+    return 0;
+}
+
+static void usage(void) {
+    console_print("memdisk\n");
+    console_print("memdisk create <MiB>\n");
+    console_print("memdisk latency <name> <us>\n");
+}
+
+static int cmd_list(void) {
+    size_t i;
+    int found = 0;
+
+    for (i = 0; i < block_count(); i++) {
+        const blockdev_t* dev = block_get(i);
+        uint32_t latency;
+
+        if (memdisk_get_latency(dev, &latency) != 0) continue;
+        found = 1;
+        console_print(dev->name);
+        console_print("  ");
+        print_u32(dev->sector_count / 2048u);
+        console_print(" MiB  latency ");
+        print_u32(latency);
+        console_print("us\n");
+    }
+    if (!found) console_print("no memdisks\n");
+    return 0;
+}
+
+static int cmd_create(const char* mib_s) {
+    unsigned int mib;
+    pmm_stats_t st;
+    const blockdev_t* dev;
+
+    if (parse_u32(mib_s, &mib) != 0 || mib == 0) {
+        console_print("invalid size\n");
+        return 1;
+    }
+
+    /* Keep at least half of the free memory for the rest of the kernel. */
+    pmm_get_stats(&st);
+    if (mib > (st.free_frames / 2u) / (1048576u / PMM_FRAME_SIZE)) {
+        console_print("not enough free memory\n");
+        return 1;
+    }
+
+    dev = memdisk_create(mib * 2048u);
+    if (!dev) {
+        console_print("memdisk create failed (no contiguous memory or slots)\n");
+        return 1;
+    }
+    console_print("created ");
+    console_print(dev->name);
+    console_putc('\n');
+    return 0;
+}
+
+static int cmd_latency(const char* name, const char* us_s) {
+    unsigned int us;
+
+    if (parse_u32(us_s, &us) != 0 || us > 1000000u) {
+        console_print("latency must be 0..1000000 us\n");
+        return 1;
+    }
+    if (memdisk_set_latency(block_find(name), us) != 0) {
+        console_print("not a memdisk\n");
+        return 1;
+    }
+    return 0;
+}
+
+int app_memdisk_main(int argc, char** argv) {
+    if (argc == 1) return cmd_list();
+
+    if (streq(argv[1], "create") && argc >= 3) return cmd_create(argv[2]);
+    if (streq(argv[1], "latency") && argc >= 4) return cmd_latency(argv[2], argv[3]);
+
+    usage();
+    return 1;
+}
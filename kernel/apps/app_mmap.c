@@ -0,0 +1,94 @@
+#include "../console.h"
+#include "../fs/vfs.h"
+
+static void print_u32(unsigned int n) {
+    char buf[11];
+    int i = 0;
+
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+
+    while (i > 0) {
+        i--;
+        console_putc(buf[i]);
+    }
+}
+
+static void print_hex(unsigned int n) {
+    static const char* hex = "0123456789ABCDEF";
+    int shift;
+
+    console_print("0x");
+    for (shift = 28; shift >= 0; shift -= 4) console_putc(hex[(n >> (unsigned int)shift) & 0xFu]);
+}
+
+static int parse_u32(const char* s, unsigned int* out) {
+    unsigned int value = 0;
+
+    if (!s || !*s) return -1;
+    while (*s) {
+        if (*s < '0' || *s > '9') return -1;
+        value = value * 10u + (unsigned int)(*s - '0');
+        s++;
+    }
+
+    *out = value;
+    return 0;
+}
+
+/* Maps a file, checksums it through the mapping and reports how many pages had to be read in. */
+int app_mmap_main(int argc, char** argv) {
+    unsigned int offset = 0;
+    unsigned int len = 0;
+    unsigned int faults;
+    unsigned int sum = 0;
+    vfs_stat_t st;
+    const unsigned char* p;
+    unsigned int i;
+    int fd;
+
+    if (argc < 2 || (argc >= 3 && parse_u32(argv[2], &offset) != 0) || (argc >= 4 && parse_u32(argv[3], &len) != 0)) {
+        console_print("usage: mmap <path> [offset] [len]\n");
+        return 1;
+    }
+    if (vfs_stat(argv[1], &st) != 0 || st.is_dir || offset >= st.size) {
+        console_print("mmap: no such file or offset past the end\n");
+        return 1;
+    }
+    if (len == 0 || len > st.size - offset) len = (unsigned int)(st.size - offset);
+
+    fd = vfs_open(argv[1], VFS_O_RDONLY);
+    if (fd < 0) {
+        console_print("mmap: open failed\n");
+        return 1;
+    }
+    p = (const unsigned char*)vfs_mmap(fd, offset, len);
+    vfs_close(fd);
+    if (!p) {
+        console_print("mmap: mapping failed\n");
+        return 1;
+    }
+
+    faults = vfs_mmap_faults();
+    for (i = 0; i < len; i++) sum = sum * 31u + p[i];
+    faults = vfs_mmap_faults() - faults;
+
+    console_print("mapped ");
+    print_u32(len);
+    console_print(" B at ");
+    print_hex((unsigned int)(uintptr_t)p);
+    console_print(" sum=");
+    print_u32(sum);
+    console_print(" pages read in: ");
+    print_u32(faults);
+    console_putc('\n');
+    vfs_munmap((void*)p);
+    return 0;
+}
@@ -13,9 +13,16 @@ int app_fs_main(int argc, char** argv);
 int app_fat32_main(int argc, char** argv);
 int app_ls_main(int argc, char** argv);
 int app_cat_main(int argc, char** argv);
+int app_mmap_main(int argc, char** argv);
 int app_pwd_main(int argc, char** argv);
 int app_cd_main(int argc, char** argv);
 int app_disk_main(int argc, char** argv);
+int app_locks_main(int argc, char** argv);
+int app_irqstat_main(int argc, char** argv);
+int app_bcache_main(int argc, char** argv);
+int app_sync_main(int argc, char** argv);
+int app_diskbench_main(int argc, char** argv);
+int app_memdisk_main(int argc, char** argv);
 
 static const struct app_entry g_apps[] = {
     {"help", "List all kernel apps", 0},
@@ -28,13 +35,20 @@ static const struct app_entry g_apps[] = {
     {"yield", "yield - switch to next runnable thread", app_yield_main},
     {"ps", "ps - dump scheduler thread table", app_ps_main},
     {"preempt", "preempt on|off - timer scheduling toggle", app_preempt_main},
+    {"locks", "locks [test] - sleeping lock contention stats / self test", app_locks_main},
+    {"irqstat", "irqstat [reset] - per-IRQ handler cost and irqs-off sections", app_irqstat_main},
     {"fs", "fs <cmd> - legacy RAMFS ops (ls/touch/write/append/cat/cp/mv/rm)", app_fs_main},
     {"fat32", "fat32 <cmd> - FAT32 on selected blockdev (select/format/mount/info/ls/...)", app_fat32_main},
     {"ls", "ls [path] - list directory", app_ls_main},
     {"cat", "cat <path> - print file", app_cat_main},
+    {"mmap", "mmap <path> [offset] [len] - map a file, checksum it through the mapping", app_mmap_main},
     {"pwd", "pwd - print current directory", app_pwd_main},
     {"cd", "cd [path] - change directory", app_cd_main},
-    {"disk", "disk [info/read] - list block devices", app_disk_main},
+    {"disk", "disk [info/read/stats/iostat/mixbench] - block devices and I/O stats", app_disk_main},
+    {"memdisk", "memdisk [create <MiB>/latency <dev> <us>] - RAM-backed block devices", app_memdisk_main},
+    {"diskbench", "diskbench <dev> [read/write/all] [bs] [qd] [ms] - MB/s, IOPS, p50/p99", app_diskbench_main},
+    {"bcache", "bcache [sync/drop] - block cache hit ratio and writeback", app_bcache_main},
+    {"sync", "sync - write back dirty cached sectors", app_sync_main},
 };
 
 const struct app_entry* apps_get_table(size_t* out_count) {
@@ -0,0 +1,692 @@
+#include "bcache.h"
+
+#include "bio.h"
+#include "../console.h"
+#include "../heap.h"
+#include "../lib/string.h"
+#include "../sched/sync.h"
+#include "../sched/thread.h"
+#include "../sched/timer.h"
+
+#define BCACHE_SECTOR 512u
+#define BCACHE_HASH 64u
+/* Larger transfers bypass the cache (sequential file data would only flush it). */
+#define BCACHE_BYPASS_SECTORS 8u
+#define BCACHE_WRITE_RUN 128u
+
+typedef struct bcache_buf {
+    const void* disk; /* key: block_disk(dev), shared by hd0 and dma0 */
+    const blockdev_t* dev; /* the device writeback goes through */
+    unsigned int lba;
+    int valid;
+    int dirty;
+    int busy; /* I/O on data in flight with g_lock dropped; others wait on g_idle */
+    struct bcache_buf* hnext;
+    struct bcache_buf* prev;
+    struct bcache_buf* next;
+    uint8_t* data;
+} bcache_buf_t;
+
+/*
+ * Transfers that go around the cache while g_lock is dropped. A read keeps
+ * overlapping entries from being evicted until it has overlaid them; a
+ * write holds off fills and cached writes of its sectors until it lands.
+ */
+typedef struct bcache_range {
+    const void* disk;
+    unsigned int lba;
+    unsigned int count;
+    int write;
+} bcache_range_t;
+
+#define BCACHE_RANGES 16u
+
+static bcache_buf_t* g_bufs;
+static uint8_t* g_data;
+static bcache_buf_t* g_hash[BCACHE_HASH];
+static bcache_buf_t* g_lru_head; /* most recently used */
+static bcache_buf_t* g_lru_tail;
+static bcache_range_t g_ranges[BCACHE_RANGES];
+/* Held for lookups and inserts only, never across block I/O. */
+static mutex_t g_lock;
+static condvar_t g_idle; /* an entry stopped being busy or a range ended */
+/* One writeback pass at a time; it owns the static run buffer. */
+static mutex_t g_sync_lock;
+static bcache_stats_t g_stats;
+/* Devices written since their last cache flush. */
+static uint8_t g_unflushed[BLOCKDEV_MAX];
+static int g_ready;
+
+static unsigned int hash_of(const void* disk, unsigned int lba) {
+    return ((unsigned int)(uintptr_t)disk / 16u + lba * 2654435761u) % BCACHE_HASH;
+}
+
+static void lru_unlink(bcache_buf_t* b) {
+    if (b->prev) b->prev->next = b->next;
+    else g_lru_head = b->next;
+    if (b->next) b->next->prev = b->prev;
+    else g_lru_tail = b->prev;
+    b->prev = 0;
+    b->next = 0;
+}
+
+static void lru_push_front(bcache_buf_t* b) {
+    b->prev = 0;
+    b->next = g_lru_head;
+    if (g_lru_head) g_lru_head->prev = b;
+    g_lru_head = b;
+    if (!g_lru_tail) g_lru_tail = b;
+}
+
+static void hash_remove(bcache_buf_t* b) {
+    bcache_buf_t** link = &g_hash[hash_of(b->disk, b->lba)];
+
+    while (*link && *link != b) link = &(*link)->hnext;
+    if (*link) *link = b->hnext;
+    b->hnext = 0;
+}
+
+static bcache_buf_t* lookup(const blockdev_t* dev, unsigned int lba) {
+    const void* disk = block_disk(dev);
+    bcache_buf_t* b = g_hash[hash_of(disk, lba)];
+
+    while (b && !(b->valid && b->disk == disk && b->lba == lba)) b = b->hnext;
+    return b;
+}
+
+static void touch(bcache_buf_t* b) {
+    if (g_lru_head == b) return;
+    lru_unlink(b);
+    lru_push_front(b);
+}
+
+static void mark_unflushed(const blockdev_t* dev) {
+    int idx = block_index(dev);
+    if (idx >= 0) g_unflushed[idx] = 1;
+}
+
+static void unbusy(bcache_buf_t* b) {
+    b->busy = 0;
+    cond_broadcast(&g_idle);
+}
+
+/* writes_only: ignore uncached reads. */
+static int range_overlap(const blockdev_t* dev, unsigned int lba, unsigned int count, int writes_only) {
+    const void* disk = block_disk(dev);
+    uint32_t i;
+
+    for (i = 0; i < BCACHE_RANGES; i++) {
+        const bcache_range_t* r = &g_ranges[i];
+        if (r->disk != disk || (writes_only && !r->write)) continue;
+        if (lba < r->lba + r->count && r->lba < lba + count) return 1;
+    }
+    return 0;
+}
+
+/* 0 when the table is full; the caller waits on g_idle. */
+static bcache_range_t* range_add(const blockdev_t* dev, unsigned int lba, unsigned int count, int write) {
+    uint32_t i;
+
+    for (i = 0; i < BCACHE_RANGES; i++) {
+        bcache_range_t* r = &g_ranges[i];
+        if (r->disk) continue;
+        r->disk = block_disk(dev);
+        r->lba = lba;
+        r->count = count;
+        r->write = write;
+        return r;
+    }
+    return 0;
+}
+
+static void range_del(bcache_range_t* r) {
+    r->disk = 0;
+    cond_broadcast(&g_idle);
+}
+
+/* Writes one dirty entry back; g_lock is dropped meanwhile and the entry is busy. */
+static int writeback_one(bcache_buf_t* b) {
+    int rc;
+
+    if (!b->dirty) return 0;
+    b->busy = 1;
+    mutex_unlock(&g_lock);
+    rc = block_write(b->dev, b->lba, 1, b->data);
+    mutex_lock(&g_lock);
+    unbusy(b);
+    if (rc != 0) return -1;
+    mark_unflushed(b->dev);
+    b->dirty = 0;
+    g_stats.dirty--;
+    g_stats.writebacks++;
+    return 0;
+}
+
+/* Drops a clean, idle buffer; free buffers are reused first. */
+static void release(bcache_buf_t* b) {
+    hash_remove(b);
+    if (b->valid) g_stats.in_use--;
+    b->valid = 0;
+    lru_unlink(b);
+    b->next = 0;
+    b->prev = g_lru_tail;
+    if (g_lru_tail) g_lru_tail->next = b;
+    g_lru_tail = b;
+    if (!g_lru_head) g_lru_head = b;
+}
+
+/*
+ * Claims the least recently used idle entry for (dev, lba). A dirty victim
+ * is written back first with the lock dropped: then 0 is returned with
+ * *again set and the caller has to look the sector up again. 0 without
+ * *again means nothing can be claimed and the caller goes around the cache.
+ */
+static bcache_buf_t* grab(const blockdev_t* dev, unsigned int lba, int* again) {
+    bcache_buf_t* b = g_lru_tail;
+
+    *again = 0;
+    while (b && (b->busy || (b->valid && range_overlap(b->dev, b->lba, 1, 0)))) b = b->prev;
+    if (!b) return 0;
+    if (b->valid) {
+        if (b->dirty) {
+            *again = writeback_one(b) == 0;
+            return 0;
+        }
+        hash_remove(b);
+        g_stats.evictions++;
+    } else {
+        g_stats.in_use++;
+    }
+
+    b->disk = block_disk(dev);
+    b->dev = dev;
+    b->lba = lba;
+    b->valid = 1;
+    b->dirty = 0;
+    b->hnext = g_hash[hash_of(b->disk, lba)];
+    g_hash[hash_of(b->disk, lba)] = b;
+    touch(b);
+    return b;
+}
+
+/*
+ * Uncached read with the lock dropped, then every cached copy is laid
+ * over the result: a cached sector is never older than the disk, and the
+ * registered range keeps those copies from being evicted meanwhile.
+ */
+static int read_around(const blockdev_t* dev, unsigned int lba, unsigned int count, uint8_t* out) {
+    bcache_range_t* r;
+    unsigned int i;
+    int rc;
+
+    while ((r = range_add(dev, lba, count, 0)) == 0) cond_wait(&g_idle, &g_lock);
+    mutex_unlock(&g_lock);
+    rc = block_read(dev, lba, count, out);
+    mutex_lock(&g_lock);
+    for (i = 0; rc == 0 && i < count; i++) {
+        bcache_buf_t* b = lookup(dev, lba + i);
+        /* A busy clean entry is still being filled from the disk. */
+        if (b && (!b->busy || b->dirty)) memcpy(out + i * BCACHE_SECTOR, b->data, BCACHE_SECTOR);
+    }
+    range_del(r);
+    return rc;
+}
+
+/*
+ * Uncached write with the lock dropped. Cached copies take the new data and
+ * turn clean up front; the range keeps new copies from appearing until the
+ * write has landed. On failure they are dirty again, so writeback retries.
+ */
+static int write_through(const blockdev_t* dev, unsigned int lba, unsigned int count, const uint8_t* in) {
+    bcache_range_t* r = 0;
+    unsigned int i;
+    int rc;
+
+    while (!r) {
+        int busy = range_overlap(dev, lba, count, 1);
+
+        for (i = 0; !busy && i < count; i++) {
+            bcache_buf_t* b = lookup(dev, lba + i);
+            if (b && b->busy) busy = 1;
+        }
+        if (!busy) r = range_add(dev, lba, count, 1);
+        if (!r) cond_wait(&g_idle, &g_lock);
+    }
+
+    for (i = 0; i < count; i++) {
+        bcache_buf_t* b = lookup(dev, lba + i);
+        if (!b) continue;
+        memcpy(b->data, in + i * BCACHE_SECTOR, BCACHE_SECTOR);
+        if (b->dirty) {
+            b->dirty = 0;
+            g_stats.dirty--;
+        }
+    }
+
+    mutex_unlock(&g_lock);
+    rc = block_write(dev, lba, count, in);
+    mutex_lock(&g_lock);
+    mark_unflushed(dev);
+    for (i = 0; rc != 0 && i < count; i++) {
+        bcache_buf_t* b = lookup(dev, lba + i);
+        if (b && !b->dirty) {
+            b->dirty = 1;
+            g_stats.dirty++;
+        }
+    }
+    range_del(r);
+    return rc;
+}
+
+/*
+ * Dirty sectors of dev in LBA order, written as merged runs. Called with
+ * g_sync_lock and g_lock held; g_lock is dropped around every request.
+ */
+static int sync_locked(const blockdev_t* dev) {
+    static bcache_buf_t* list[BCACHE_ENTRIES];
+    static uint8_t run[BCACHE_WRITE_RUN * BCACHE_SECTOR];
+    uint32_t n = 0;
+    uint32_t i;
+    uint32_t j;
+    int rc = 0;
+
+    /* A writeback already in flight has to land before this sync can count it. */
+    for (;;) {
+        int busy = 0;
+
+        n = 0;
+        for (i = 0; i < BCACHE_ENTRIES && !busy; i++) {
+            bcache_buf_t* b = &g_bufs[i];
+            if (!b->valid || !b->dirty || (dev && b->disk != block_disk(dev))) continue;
+            if (b->busy) {
+                busy = 1;
+                continue;
+            }
+            j = n++;
+            while (j > 0 && ((uintptr_t)list[j - 1]->disk > (uintptr_t)b->disk ||
+                             (list[j - 1]->disk == b->disk && list[j - 1]->lba > b->lba))) {
+                list[j] = list[j - 1];
+                j--;
+            }
+            list[j] = b;
+        }
+        if (!busy) break;
+        cond_wait(&g_idle, &g_lock);
+    }
+    for (i = 0; i < n; i++) list[i]->busy = 1;
+
+    for (i = 0; i < n; i = j) {
+        uint32_t k;
+        int wrc;
+
+        j = i + 1u;
+        while (j < n && j - i < BCACHE_WRITE_RUN && list[j]->disk == list[i]->disk && list[j]->lba == list[j - 1]->lba + 1u) {
+            j++;
+        }
+        for (k = i; k < j; k++) {
+            memcpy(run + (k - i) * BCACHE_SECTOR, list[k]->data, BCACHE_SECTOR);
+        }
+        mutex_unlock(&g_lock);
+        wrc = block_write(list[i]->dev, list[i]->lba, j - i, run);
+        mutex_lock(&g_lock);
+        if (wrc == 0) mark_unflushed(list[i]->dev);
+        else rc = -1;
+        for (k = i; k < j; k++) {
+            if (wrc == 0) {
+                list[k]->dirty = 0;
+                g_stats.dirty--;
+                g_stats.writebacks++;
+            }
+            list[k]->busy = 0;
+        }
+        cond_broadcast(&g_idle);
+    }
+
+    /* Drain the device write caches so synced data survives power loss. */
+    for (i = 0; i < BLOCKDEV_MAX; i++) {
+        const blockdev_t* bd = block_get(i);
+        int frc;
+
+        if (!g_unflushed[i] || !bd || (dev && block_disk(bd) != block_disk(dev))) continue;
+        /* Writes landing during the flush mark the device again. */
+        g_unflushed[i] = 0;
+        mutex_unlock(&g_lock);
+        frc = blockdev_flush(bd);
+        mutex_lock(&g_lock);
+        if (frc != 0) {
+            g_unflushed[i] = 1;
+            rc = -1;
+            continue;
+        }
+        g_stats.flushes++;
+    }
+    return rc;
+}
+
+static int has_unflushed(void) {
+    uint32_t i;
+
+    for (i = 0; i < BLOCKDEV_MAX; i++) {
+        if (g_unflushed[i]) return 1;
+    }
+    return 0;
+}
+
+static void flusher_thread(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        thread_sleep_ms(BCACHE_FLUSH_MS);
+        if (g_stats.dirty == 0 && !has_unflushed()) continue;
+        mutex_lock(&g_sync_lock);
+        mutex_lock(&g_lock);
+        if (sync_locked(0) != 0) {
+            console_print("bcache: background writeback failed\n");
+        }
+        mutex_unlock(&g_lock);
+        mutex_unlock(&g_sync_lock);
+    }
+}
+
+void bcache_init(void) {
+    uint32_t i;
+
+    g_bufs = (bcache_buf_t*)kmalloc(sizeof(bcache_buf_t) * BCACHE_ENTRIES);
+    g_data = (uint8_t*)kmalloc(BCACHE_SECTOR * BCACHE_ENTRIES);
+    if (!g_bufs || !g_data) {
+        console_print("bcache: out of memory, running uncached\n");
+        return;
+    }
+
+    memset(g_bufs, 0, sizeof(bcache_buf_t) * BCACHE_ENTRIES);
+    memset(g_hash, 0, sizeof(g_hash));
+    memset(g_ranges, 0, sizeof(g_ranges));
+    memset(&g_stats, 0, sizeof(g_stats));
+    memset(g_unflushed, 0, sizeof(g_unflushed));
+    g_lru_head = 0;
+    g_lru_tail = 0;
+    for (i = 0; i < BCACHE_ENTRIES; i++) {
+        g_bufs[i].data = g_data + i * BCACHE_SECTOR;
+        lru_push_front(&g_bufs[i]);
+    }
+    g_stats.entries = BCACHE_ENTRIES;
+    mutex_init(&g_lock, "bcache");
+    mutex_init(&g_sync_lock, "bcache.sync");
+    cond_init(&g_idle);
+
+    if (thread_create("bflush", flusher_thread, 0) < 0) {
+        console_print("bcache: no flush thread, use sync\n");
+    }
+    g_ready = 1;
+}
+
+static int cacheable(const blockdev_t* dev) {
+    return g_ready && dev && dev->sector_size == BCACHE_SECTOR;
+}
+
+int bcache_read(const blockdev_t* dev, unsigned int lba, unsigned int count, void* buf) {
+    uint8_t* out = (uint8_t*)buf;
+    unsigned int i;
+    int rc = 0;
+
+    if (!dev || !buf || count == 0) return -1;
+    if (!cacheable(dev)) return block_read(dev, lba, count, buf);
+
+    mutex_lock(&g_lock);
+
+    if (count > BCACHE_BYPASS_SECTORS) {
+        /* Straight from the device, then overlay the cached copies. */
+        g_stats.bypass++;
+        rc = read_around(dev, lba, count, out);
+        mutex_unlock(&g_lock);
+        return rc;
+    }
+
+    i = 0;
+    while (i < count) {
+        bcache_buf_t* run[BCACHE_BYPASS_SECTORS];
+        bcache_buf_t* b = lookup(dev, lba + i);
+        unsigned int n = 0;
+        unsigned int k;
+        int again;
+
+        if ((b && b->busy) || (!b && range_overlap(dev, lba + i, 1, 1))) {
+            cond_wait(&g_idle, &g_lock);
+            continue;
+        }
+        if (b) {
+            g_stats.lookups++;
+            g_stats.hits++;
+            touch(b);
+            memcpy(out + i * BCACHE_SECTOR, b->data, BCACHE_SECTOR);
+            i++;
+            continue;
+        }
+
+        /* Claim entries for the run of missing sectors, fill them with one request. */
+        while (i + n < count && !lookup(dev, lba + i + n) && !range_overlap(dev, lba + i + n, 1, 1)) {
+            b = grab(dev, lba + i + n, &again);
+            if (b) {
+                b->busy = 1;
+                run[n++] = b;
+            } else if (!again) {
+                break;
+            }
+        }
+        if (n == 0) {
+            /* The lock was dropped and the sector turned up, or every entry is busy. */
+            if (lookup(dev, lba + i) || range_overlap(dev, lba + i, 1, 1)) continue;
+            g_stats.lookups++;
+            g_stats.misses++;
+            if (read_around(dev, lba + i, 1, out + i * BCACHE_SECTOR) != 0) {
+                rc = -1;
+                break;
+            }
+            i++;
+            continue;
+        }
+
+        g_stats.lookups += n;
+        g_stats.misses += n;
+        mutex_unlock(&g_lock);
+        rc = block_read(dev, lba + i, n, out + i * BCACHE_SECTOR);
+        mutex_lock(&g_lock);
+        for (k = 0; k < n; k++) {
+            if (rc == 0) memcpy(run[k]->data, out + (i + k) * BCACHE_SECTOR, BCACHE_SECTOR);
+            run[k]->busy = 0;
+            if (rc != 0) release(run[k]);
+        }
+        cond_broadcast(&g_idle);
+        if (rc != 0) break;
+        i += n;
+    }
+
+    mutex_unlock(&g_lock);
+    return rc;
+}
+
+int bcache_read_bytes(const blockdev_t* dev, unsigned int lba, unsigned int offset, unsigned int len, void* buf) {
+    uint8_t sec[BCACHE_SECTOR];
+    bcache_buf_t* b;
+    int again;
+    int rc;
+
+    if (!dev || !buf || len == 0 || offset >= BCACHE_SECTOR || len > BCACHE_SECTOR - offset) return -1;
+    if (!cacheable(dev)) {
+        if (block_read(dev, lba, 1, sec) != 0) return -1;
+        memcpy(buf, sec + offset, len);
+        return 0;
+    }
+
+    mutex_lock(&g_lock);
+    for (;;) {
+        b = lookup(dev, lba);
+        if ((b && b->busy) || (!b && range_overlap(dev, lba, 1, 1))) {
+            cond_wait(&g_idle, &g_lock);
+            continue;
+        }
+        if (b) {
+            g_stats.lookups++;
+            g_stats.hits++;
+            touch(b);
+            memcpy(buf, b->data + offset, len);
+            mutex_unlock(&g_lock);
+            return 0;
+        }
+        b = grab(dev, lba, &again);
+        if (b || !again) break;
+    }
+
+    g_stats.lookups++;
+    g_stats.misses++;
+    if (!b) {
+        rc = read_around(dev, lba, 1, sec);
+        if (rc == 0) memcpy(buf, sec + offset, len);
+        mutex_unlock(&g_lock);
+        return rc;
+    }
+
+    /* The device reads into the entry itself. */
+    b->busy = 1;
+    mutex_unlock(&g_lock);
+    rc = block_read(dev, lba, 1, b->data);
+    mutex_lock(&g_lock);
+    unbusy(b);
+    if (rc == 0) memcpy(buf, b->data + offset, len);
+    else release(b);
+    mutex_unlock(&g_lock);
+    return rc;
+}
+
+int bcache_write(const blockdev_t* dev, unsigned int lba, unsigned int count, const void* buf) {
+    const uint8_t* in = (const uint8_t*)buf;
+    unsigned int i;
+    int rc = 0;
+
+    if (!dev || !buf || count == 0) return -1;
+    if (!cacheable(dev)) {
+        rc = block_write(dev, lba, count, buf);
+        if (rc == 0 && g_ready) mark_unflushed(dev);
+        return rc;
+    }
+    if (lba >= dev->sector_count || count > dev->sector_count - lba) return -1;
+
+    mutex_lock(&g_lock);
+
+    if (count > BCACHE_BYPASS_SECTORS) {
+        g_stats.bypass++;
+        rc = write_through(dev, lba, count, in);
+        mutex_unlock(&g_lock);
+        return rc;
+    }
+
+    i = 0;
+    while (i < count) {
+        bcache_buf_t* b = lookup(dev, lba + i);
+        int again = 0;
+
+        if ((b && b->busy) || range_overlap(dev, lba + i, 1, 1)) {
+            cond_wait(&g_idle, &g_lock);
+            continue;
+        }
+        if (b) touch(b);
+        else b = grab(dev, lba + i, &again);
+
+        if (!b) {
+            if (again) continue;
+            rc = write_through(dev, lba + i, 1, in + i * BCACHE_SECTOR);
+            if (rc != 0) break;
+            i++;
+            continue;
+        }
+        memcpy(b->data, in + i * BCACHE_SECTOR, BCACHE_SECTOR);
+        if (!b->dirty) {
+            b->dirty = 1;
+            g_stats.dirty++;
+        }
+        i++;
+    }
+
+    mutex_unlock(&g_lock);
+    return rc;
+}
+
+int bcache_writeback(const blockdev_t* dev, unsigned int lba, unsigned int count) {
+    unsigned int i = 0;
+    int rc = 0;
+
+    if (!dev || !cacheable(dev)) return 0;
+    mutex_lock(&g_lock);
+    while (i < count) {
+        bcache_buf_t* b = lookup(dev, lba + i);
+
+        if (b && b->busy) {
+            cond_wait(&g_idle, &g_lock);
+            continue;
+        }
+        if (b && writeback_one(b) != 0) rc = -1;
+        i++;
+    }
+    mutex_unlock(&g_lock);
+    return rc;
+}
+
+int bcache_sync(const blockdev_t* dev) {
+    int rc;
+
+    if (!g_ready) return 0;
+    mutex_lock(&g_sync_lock);
+    mutex_lock(&g_lock);
+    rc = sync_locked(dev);
+    mutex_unlock(&g_lock);
+    mutex_unlock(&g_sync_lock);
+    return rc;
+}
+
+int bcache_invalidate(const blockdev_t* dev) {
+    uint32_t i;
+    int rc;
+
+    if (!g_ready) return 0;
+    mutex_lock(&g_sync_lock);
+    mutex_lock(&g_lock);
+    rc = sync_locked(dev);
+    i = 0;
+    while (i < BCACHE_ENTRIES) {
+        bcache_buf_t* b = &g_bufs[i];
+        int match = b->valid && (!dev || b->disk == block_disk(dev));
+
+        if (match && b->busy) {
+            cond_wait(&g_idle, &g_lock);
+            continue;
+        }
+        if (match && !b->dirty) release(b);
+        i++;
+    }
+    mutex_unlock(&g_lock);
+    mutex_unlock(&g_sync_lock);
+    return rc;
+}
+
+int bcache_overlay(const blockdev_t* dev, unsigned int lba, unsigned int count, void* buf) {
+    uint8_t* out = (uint8_t*)buf;
+    unsigned int i;
+    int n = 0;
+
+    if (!dev || !buf || !cacheable(dev)) return 0;
+    mutex_lock(&g_lock);
+    for (i = 0; i < count; i++) {
+        bcache_buf_t* b = lookup(dev, lba + i);
+        /* Entries still being filled hold nothing newer than the disk. */
+        if (!b || (b->busy && !b->dirty)) continue;
+        memcpy(out + i * BCACHE_SECTOR, b->data, BCACHE_SECTOR);
+        n++;
+    }
+    mutex_unlock(&g_lock);
+    return n;
+}
+
+void bcache_get_stats(bcache_stats_t* out) {
+    if (!out) return;
+    *out = g_stats;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "blockdev.h"
+
+#include "../lib/types.h"
+
+#define BCACHE_ENTRIES 256u
+#define BCACHE_FLUSH_MS 5000u
+
+typedef struct bcache_stats {
+    uint32_t entries;
+    uint32_t in_use;
+    uint32_t dirty;
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;
+    uint32_t flushes;
+    uint32_t bypass;
+} bcache_stats_t;
+
+/*
+ * Write-back sector cache keyed by (drive, LBA) between filesystems and the
+ * bio layer; devices naming the same drive (block_disk) share entries.
+ * Until bcache_init runs every call passes straight through.
+ */
+void bcache_init(void);
+int bcache_read(const blockdev_t* dev, unsigned int lba, unsigned int count, void* buf);
+int bcache_write(const blockdev_t* dev, unsigned int lba, unsigned int count, const void* buf);
+/*
+ * Copies len bytes at offset within sector lba straight out of the cache
+ * entry, which is filled on a miss; for reads smaller than a sector
+ * without a bounce buffer on the caller's side.
+ */
+int bcache_read_bytes(const blockdev_t* dev, unsigned int lba, unsigned int offset, unsigned int len, void* buf);
+/*
+ * Writes back the dirty sectors of a range, without a device flush. Before
+ * an async read around the cache, so that no newer copy can be evicted
+ * while it is in flight.
+ */
+int bcache_writeback(const blockdev_t* dev, unsigned int lba, unsigned int count);
+/* Writes back dirty sectors of dev (0 = all devices), then flushes the device caches. */
+int bcache_sync(const blockdev_t* dev);
+/* Writes back, then forgets every cached sector of dev (0 = all devices). */
+int bcache_invalidate(const blockdev_t* dev);
+/*
+ * Copies every cached sector of the range over buf and returns how many
+ * there were. For data read around the cache with async bios: a cached
+ * copy is never older than the disk, so this brings the result up to date.
+ */
+int bcache_overlay(const blockdev_t* dev, unsigned int lba, unsigned int count, void* buf);
+void bcache_get_stats(bcache_stats_t* out);
@@ -0,0 +1,427 @@
+#include "bio.h"
+
+#include "../heap.h"
+#include "../isr.h"
+#include "../lib/string.h"
+#include "../sched/softirq.h"
+#include "../sched/sync.h"
+#include "../tsc.h"
+
+#define BIO_MAX_WORKERS 4u
+#define BIO_MERGE_MAX_SECTORS 128u
+
+/*
+ * Per-device request queue: bios sorted by LBA, served C-LOOK style by
+ * worker threads that call the synchronous driver entry points. Adjacent
+ * requests of the same direction are merged into one driver call; requests
+ * larger than the driver's max_sectors are split into several.
+ */
+typedef struct blk_queue {
+    const blockdev_t* dev;
+    bio_t* head;
+    unsigned int pos;
+    semaphore_t pending;
+    int ready;
+    block_queue_stats_t stats;
+} blk_queue_t;
+
+static blk_queue_t g_queues[BLOCKDEV_MAX];
+static block_io_stats_t g_io_stats[BLOCKDEV_MAX];
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+static unsigned int hist_bucket(uint32_t us) {
+    unsigned int b = 0;
+
+    while (us >= 2u && b < BLOCK_HIST_BUCKETS - 1u) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static block_io_stats_t* io_stats_for(const blockdev_t* dev) {
+    int idx = block_index(dev);
+    return idx < 0 ? 0 : &g_io_stats[idx];
+}
+
+static void account_start(const blockdev_t* dev) {
+    block_io_stats_t* st = io_stats_for(dev);
+    uint32_t flags = irq_save_disable();
+
+    if (st) st->in_flight++;
+    irq_restore(flags);
+}
+
+static void account_done(const blockdev_t* dev, bio_op_t op, unsigned int count, int status) {
+    block_io_stats_t* st = io_stats_for(dev);
+    uint32_t flags;
+
+    if (!st) return;
+    flags = irq_save_disable();
+    st->in_flight--;
+    if (status != 0) {
+        st->errors++;
+    } else if (op == BIO_FLUSH) {
+        st->flushes++;
+    } else {
+        st->ops[op]++;
+        st->sectors[op] += count;
+    }
+    irq_restore(flags);
+}
+
+static void account_queue(const bio_t* bio, uint64_t now) {
+    block_io_stats_t* st = io_stats_for(bio->dev);
+    uint32_t us = tsc_cycles_to_us(now - bio->submit_tsc);
+    uint32_t flags;
+
+    if (!st) return;
+    flags = irq_save_disable();
+    st->queue_us += us;
+    st->queue_hist[hist_bucket(us)]++;
+    irq_restore(flags);
+}
+
+static unsigned int merge_limit(const blockdev_t* dev) {
+    if (dev->max_sectors && dev->max_sectors < BIO_MERGE_MAX_SECTORS) return dev->max_sectors;
+    return BIO_MERGE_MAX_SECTORS;
+}
+
+/* The one path into the driver entry points; times every call. */
+static int driver_call(const blockdev_t* dev, bio_op_t op, unsigned int lba, unsigned int count, void* buf) {
+    block_io_stats_t* st = io_stats_for(dev);
+    uint64_t start = tsc_read();
+    uint8_t* p = (uint8_t*)buf;
+    uint32_t flags;
+    uint32_t us;
+    int rc = 0;
+
+    if (op == BIO_FLUSH) {
+        rc = dev->flush ? dev->flush((blockdev_t*)dev) : 0;
+    } else if (op == BIO_WRITE && !dev->write) {
+        rc = -1;
+    } else {
+        /* Drivers reject oversized requests; split at their limit. */
+        while (rc == 0 && count > 0) {
+            unsigned int n = (dev->max_sectors && count > dev->max_sectors) ? dev->max_sectors : count;
+
+            if (op == BIO_WRITE) {
+                rc = dev->write((blockdev_t*)dev, lba, n, p);
+            } else {
+                rc = dev->read((blockdev_t*)dev, lba, n, p);
+            }
+            lba += n;
+            count -= n;
+            p += n * dev->sector_size;
+        }
+    }
+
+    if (st) {
+        us = tsc_cycles_to_us(tsc_read() - start);
+        flags = irq_save_disable();
+        st->service_us += us;
+        st->service_calls++;
+        st->service_hist[hist_bucket(us)]++;
+        irq_restore(flags);
+    }
+    return rc;
+}
+
+static void complete(bio_t* bio, int status) {
+    bio_end_fn end_io = bio->end_io;
+    uint32_t flags;
+
+    account_done(bio->dev, bio->op, bio->count, status);
+    flags = irq_save_disable();
+
+    bio->status = status;
+    bio->done = 1;
+    thread_wake_all(&bio->wq);
+    irq_restore(flags);
+
+    if (end_io) end_io(bio);
+}
+
+/* Called with IRQs off. Removes the next request plus everything back-mergeable. */
+static bio_t* elevator_pick(blk_queue_t* q) {
+    bio_t** link = &q->head;
+    bio_t* rq;
+    bio_t* tail;
+    unsigned int total;
+
+    if (!q->head) return 0;
+
+    /* Flushes sit at the head and are served before the sweep continues. */
+    if (q->head->op != BIO_FLUSH) {
+        while (*link && (*link)->lba < q->pos) {
+            link = &(*link)->next;
+        }
+        if (!*link) link = &q->head;
+    }
+
+    rq = *link;
+    *link = rq->next;
+    rq->next = 0;
+    q->stats.queued--;
+
+    tail = rq;
+    total = rq->count;
+    while (*link && (*link)->op == rq->op && (*link)->lba == tail->lba + tail->count &&
+           total + (*link)->count <= merge_limit(q->dev)) {
+        bio_t* m = *link;
+        *link = m->next;
+        m->next = 0;
+        tail->next = m;
+        tail = m;
+        total += m->count;
+        q->stats.queued--;
+        q->stats.merged++;
+    }
+
+    if (rq->op != BIO_FLUSH) q->pos = tail->lba + tail->count;
+    return rq;
+}
+
+static void dispatch(blk_queue_t* q, bio_t* rq) {
+    const blockdev_t* dev = q->dev;
+    unsigned int ss = dev->sector_size;
+    unsigned int total = 0;
+    int contiguous = 1;
+    uint8_t* bounce = 0;
+    uint8_t* p;
+    bio_t* b;
+    bio_t* next;
+    int rc;
+
+    uint64_t now = tsc_read();
+
+    for (b = rq; b; b = b->next) {
+        account_queue(b, now);
+        if (b->next && (uint8_t*)b->buf + b->count * ss != (uint8_t*)b->next->buf) contiguous = 0;
+        total += b->count;
+    }
+
+    if (!rq->next || contiguous) {
+        rc = driver_call(dev, rq->op, rq->lba, total, rq->buf);
+        q->stats.dispatched++;
+    } else if ((bounce = (uint8_t*)kmalloc(total * ss)) != 0) {
+        /* Scattered buffers: one device command through a bounce buffer. */
+        if (rq->op == BIO_WRITE) {
+            for (b = rq, p = bounce; b; p += b->count * ss, b = b->next) memcpy(p, b->buf, b->count * ss);
+        }
+        rc = driver_call(dev, rq->op, rq->lba, total, bounce);
+        if (rc == 0 && rq->op == BIO_READ) {
+            for (b = rq, p = bounce; b; p += b->count * ss, b = b->next) memcpy(b->buf, p, b->count * ss);
+        }
+        kfree(bounce);
+        q->stats.dispatched++;
+        q->stats.bounced++;
+    } else {
+        for (b = rq; b; b = next) {
+            next = b->next;
+            complete(b, driver_call(dev, b->op, b->lba, b->count, b->buf));
+            q->stats.dispatched++;
+        }
+        return;
+    }
+
+    for (b = rq; b; b = next) {
+        next = b->next;
+        complete(b, rc);
+    }
+}
+
+static void queue_worker(void* arg) {
+    blk_queue_t* q = (blk_queue_t*)arg;
+
+    for (;;) {
+        bio_t* rq;
+        uint32_t flags;
+
+        sem_wait(&q->pending);
+        flags = irq_save_disable();
+        rq = elevator_pick(q);
+        irq_restore(flags);
+
+        /* Merged bios leave surplus semaphore counts behind; those wake-ups find nothing. */
+        if (rq) dispatch(q, rq);
+    }
+}
+
+/* Lazily starts the workers on first use; a failed start is not retried. */
+static blk_queue_t* queue_for(const blockdev_t* dev) {
+    int idx = block_index(dev);
+    blk_queue_t* q;
+    unsigned int depth;
+    unsigned int i;
+    uint32_t flags;
+
+    if (idx < 0) return 0;
+    q = &g_queues[idx];
+
+    flags = irq_save_disable();
+    if (q->ready == 0) {
+        q->dev = dev;
+        q->head = 0;
+        q->pos = 0;
+        sem_init(&q->pending, "blk.queue", 0);
+
+        depth = dev->queue_depth ? dev->queue_depth : 1u;
+        if (depth > BIO_MAX_WORKERS) depth = BIO_MAX_WORKERS;
+        for (i = 0; i < depth; i++) {
+            if (thread_create("kblockd", queue_worker, q) < 0) break;
+            q->stats.workers++;
+        }
+        q->ready = q->stats.workers ? 1 : -1;
+    }
+    irq_restore(flags);
+
+    return q->ready > 0 ? q : 0;
+}
+
+void bio_init(bio_t* bio, const blockdev_t* dev, bio_op_t op, unsigned int lba, unsigned int count, void* buf) {
+    memset(bio, 0, sizeof(*bio));
+    bio->dev = dev;
+    bio->op = op;
+    bio->lba = lba;
+    bio->count = count;
+    bio->buf = buf;
+    wait_queue_init(&bio->wq);
+}
+
+int blockdev_submit(bio_t* bio) {
+    blk_queue_t* q;
+    bio_t** link;
+    uint32_t flags;
+
+    if (!bio || !bio->dev) return -1;
+    if (bio->op != BIO_FLUSH) {
+        if (!bio->buf || bio->count == 0) return -1;
+        if (bio->lba >= bio->dev->sector_count || bio->count > bio->dev->sector_count - bio->lba) return -1;
+    }
+
+    q = queue_for(bio->dev);
+    if (!q) return -1;
+
+    bio->done = 0;
+    bio->status = 0;
+    bio->next = 0;
+    bio->submit_tsc = tsc_read();
+    account_start(bio->dev);
+
+    flags = irq_save_disable();
+    link = &q->head;
+    while (bio->op != BIO_FLUSH && *link && (*link)->lba <= bio->lba) {
+        link = &(*link)->next;
+    }
+    bio->next = *link;
+    *link = bio;
+    q->stats.submitted++;
+    q->stats.queued++;
+    if (q->stats.queued > q->stats.max_queued) q->stats.max_queued = q->stats.queued;
+    irq_restore(flags);
+
+    sem_post(&q->pending);
+    return 0;
+}
+
+int bio_wait(bio_t* bio) {
+    uint32_t flags = irq_save_disable();
+
+    while (!bio->done) {
+        thread_block(&bio->wq);
+    }
+    irq_restore(flags);
+    return bio->status;
+}
+
+static int can_queue(void) {
+    uint32_t flags;
+
+    if (!sched_is_running() || irq_in_hardirq() || softirq_in_progress()) return 0;
+    __asm__ volatile("pushf; pop %0" : "=r"(flags));
+    return (flags & 0x200u) != 0u;
+}
+
+/* Unqueued request: no queue time, but it counts like any other. */
+static int direct_call(const blockdev_t* dev, bio_op_t op, unsigned int lba, unsigned int count, void* buf) {
+    int rc;
+
+    account_start(dev);
+    rc = driver_call(dev, op, lba, count, buf);
+    account_done(dev, op, count, rc);
+    return rc;
+}
+
+static int block_sync(const blockdev_t* dev, bio_op_t op, unsigned int lba, unsigned int count, void* buf) {
+    bio_t bio;
+
+    if (!dev || (op != BIO_FLUSH && (!buf || count == 0))) return -1;
+    if (can_queue()) {
+        bio_init(&bio, dev, op, lba, count, buf);
+        if (blockdev_submit(&bio) == 0) return bio_wait(&bio);
+    }
+    return direct_call(dev, op, lba, count, buf);
+}
+
+int block_can_queue(void) {
+    return can_queue();
+}
+
+int block_read(const blockdev_t* dev, unsigned int lba, unsigned int count, void* buf) {
+    return block_sync(dev, BIO_READ, lba, count, buf);
+}
+
+int block_write(const blockdev_t* dev, unsigned int lba, unsigned int count, const void* buf) {
+    return block_sync(dev, BIO_WRITE, lba, count, (void*)buf);
+}
+
+int blockdev_flush(const blockdev_t* dev) {
+    if (!dev) return -1;
+    if (!dev->flush) return 0;
+    return block_sync(dev, BIO_FLUSH, 0, 0, 0);
+}
+
+int block_queue_stats(const blockdev_t* dev, block_queue_stats_t* out) {
+    int idx = block_index(dev);
+    uint32_t flags;
+
+    if (idx < 0 || !out) return -1;
+    flags = irq_save_disable();
+    *out = g_queues[idx].stats;
+    irq_restore(flags);
+    return 0;
+}
+
+int block_io_stats(const blockdev_t* dev, block_io_stats_t* out) {
+    int idx = block_index(dev);
+    uint32_t flags;
+
+    if (idx < 0 || !out) return -1;
+    flags = irq_save_disable();
+    *out = g_io_stats[idx];
+    irq_restore(flags);
+    return 0;
+}
+
+void block_io_stats_reset(const blockdev_t* dev) {
+    int idx = block_index(dev);
+    uint32_t in_flight;
+    uint32_t flags;
+
+    if (idx < 0) return;
+    flags = irq_save_disable();
+    in_flight = g_io_stats[idx].in_flight;
+    memset(&g_io_stats[idx], 0, sizeof(g_io_stats[idx]));
+    g_io_stats[idx].in_flight = in_flight;
+    irq_restore(flags);
+}
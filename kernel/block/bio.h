@@ -0,0 +1,82 @@
+#pragma once
+
+#include "blockdev.h"
+#include "../sched/thread.h"
+
+#include <stdint.h>
+
+typedef enum {
+    BIO_READ = 0,
+    BIO_WRITE = 1,
+    BIO_FLUSH = 2, /* no data; covers every write completed before submission */
+} bio_op_t;
+
+struct bio;
+typedef void (*bio_end_fn)(struct bio* bio);
+
+/*
+ * One block request. The submitter owns the memory until completion; end_io
+ * (if set) runs in the queue worker thread and is the last access to the bio.
+ */
+typedef struct bio {
+    const blockdev_t* dev;
+    bio_op_t op;
+    unsigned int lba;
+    unsigned int count;
+    void* buf;
+    int status;
+    volatile int done;
+    bio_end_fn end_io;
+    void* private_data;
+    struct bio* next;
+    wait_queue_t wq;
+    uint64_t submit_tsc;
+} bio_t;
+
+typedef struct block_queue_stats {
+    uint32_t submitted;
+    uint32_t dispatched;
+    uint32_t merged;
+    uint32_t bounced;
+    uint32_t queued;
+    uint32_t max_queued;
+    uint32_t workers;
+} block_queue_stats_t;
+
+void bio_init(bio_t* bio, const blockdev_t* dev, bio_op_t op, unsigned int lba, unsigned int count, void* buf);
+int blockdev_submit(bio_t* bio);
+int bio_wait(bio_t* bio);
+/* Nonzero when blockdev_submit can be used: a scheduler runs and interrupts are on. */
+int block_can_queue(void);
+
+/* Synchronous shim: queued when a scheduler context exists, direct driver call otherwise. */
+int block_read(const blockdev_t* dev, unsigned int lba, unsigned int count, void* buf);
+int block_write(const blockdev_t* dev, unsigned int lba, unsigned int count, const void* buf);
+/* Makes completed writes durable; 0 for devices without a write cache. */
+int blockdev_flush(const blockdev_t* dev);
+
+int block_queue_stats(const blockdev_t* dev, block_queue_stats_t* out);
+
+/* log2 microsecond buckets: bucket 0 is < 2 us, the last one collects the rest. */
+#define BLOCK_HIST_BUCKETS 20
+
+/*
+ * Per-device I/O accounting, kept for every request whether it went
+ * through the queue or straight to the driver. Queue time is submit to
+ * dispatch; service time is one driver call (merged requests share it).
+ */
+typedef struct block_io_stats {
+    uint32_t ops[2];      /* completed requests, indexed by BIO_READ/BIO_WRITE */
+    uint32_t sectors[2];
+    uint32_t flushes;
+    uint32_t errors;
+    uint32_t in_flight;
+    uint64_t queue_us;    /* totals for averages */
+    uint64_t service_us;
+    uint32_t service_calls;
+    uint32_t queue_hist[BLOCK_HIST_BUCKETS];
+    uint32_t service_hist[BLOCK_HIST_BUCKETS];
+} block_io_stats_t;
+
+int block_io_stats(const blockdev_t* dev, block_io_stats_t* out);
+void block_io_stats_reset(const blockdev_t* dev);
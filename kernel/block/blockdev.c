@@ -2,8 +2,6 @@
 
 #include "../lib/string.h"
 
-#define BLOCKDEV_MAX 8
-
 static blockdev_t g_blockdevs[BLOCKDEV_MAX];
 static size_t g_blockdev_count;
 
@@ -42,9 +40,20 @@ const blockdev_t* block_find(const char* name) {
     return 0;
 }
 
+int block_index(const blockdev_t* dev) {
+    if (dev < &g_blockdevs[0] || dev >= &g_blockdevs[g_blockdev_count]) return -1;
+    return (int)(dev - &g_blockdevs[0]);
+}
+
+const void* block_disk(const blockdev_t* dev) {
+    if (!dev) return 0;
+    return dev->disk ? dev->disk : (const void*)dev;
+}
+
 const char* block_type_name(blockdev_type_t type) {
     if (type == BLOCKDEV_TYPE_ATA) return "ATA";
     if (type == BLOCKDEV_TYPE_VIRTIO) return "VIRTIO";
     if (type == BLOCKDEV_TYPE_MEMDISK) return "MEMDISK";
+    if (type == BLOCKDEV_TYPE_SATA) return "SATA";
     return "UNKNOWN";
 }
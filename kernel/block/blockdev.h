@@ -2,16 +2,20 @@
 
 #include "../lib/types.h"
 
+#define BLOCKDEV_MAX 8
+
 typedef enum {
     BLOCKDEV_TYPE_ATA = 0,
     BLOCKDEV_TYPE_VIRTIO = 1,
     BLOCKDEV_TYPE_MEMDISK = 2,
+    BLOCKDEV_TYPE_SATA = 3,
 } blockdev_type_t;
 
 struct blockdev;
 
 typedef int (*blockdev_read_fn)(struct blockdev* dev, unsigned int lba, unsigned int count, void* buf);
 typedef int (*blockdev_write_fn)(struct blockdev* dev, unsigned int lba, unsigned int count, const void* buf);
+typedef int (*blockdev_flush_fn)(struct blockdev* dev);
 
 typedef struct blockdev {
     char name[8];
@@ -20,7 +24,11 @@ typedef struct blockdev {
     unsigned int sector_count;
     blockdev_read_fn read;
     blockdev_write_fn write;
+    blockdev_flush_fn flush; /* drains the volatile write cache, 0 = write-through */
     void* ctx;
+    unsigned int queue_depth; /* commands the driver can have in flight, 0 = 1 */
+    unsigned int max_sectors; /* largest count one read/write call accepts, 0 = no limit */
+    const void* disk; /* drive behind the device when several devices name it, 0 = its own */
 } blockdev_t;
 
 void block_init(void);
@@ -28,4 +36,7 @@ int block_register(const blockdev_t* dev);
 size_t block_count(void);
 const blockdev_t* block_get(size_t index);
 const blockdev_t* block_find(const char* name);
+int block_index(const blockdev_t* dev);
+/* Equal for devices that reach the same drive, e.g. hd0 and dma0. */
+const void* block_disk(const blockdev_t* dev);
 const char* block_type_name(blockdev_type_t type);
@@ -0,0 +1,555 @@
+#include "ahci.h"
+
+#include "pci.h"
+#include "../block/blockdev.h"
+#include "../console.h"
+#include "../lib/string.h"
+#include "../mem/paging.h"
+#include "../mem/pmm.h"
+#include "../ports.h"
+#include "../sched/sync.h"
+#include "../sched/thread.h"
+
+#include <stdint.h>
+
+#define AHCI_MAX_PORTS 32u
+#define AHCI_MAX_DEVS 4u
+#define AHCI_PRDS 24u
+#define AHCI_MAX_SECTORS 128u
+#define AHCI_SPIN_LIMIT 5000000u
+
+/* HBA registers */
+#define HBA_CAP 0x00u
+#define HBA_GHC 0x04u
+#define HBA_PI 0x0Cu
+
+#define HBA_CAP_SNCQ (1u << 30)
+#define HBA_CAP_SSS (1u << 27)
+#define HBA_GHC_AE (1u << 31)
+
+/* Port registers, relative to 0x100 + port * 0x80 */
+#define PX_CLB 0x00u
+#define PX_CLBU 0x04u
+#define PX_FB 0x08u
+#define PX_FBU 0x0Cu
+#define PX_IS 0x10u
+#define PX_IE 0x14u
+#define PX_CMD 0x18u
+#define PX_TFD 0x20u
+#define PX_SIG 0x24u
+#define PX_SSTS 0x28u
+#define PX_SCTL 0x2Cu
+#define PX_SERR 0x30u
+#define PX_SACT 0x34u
+#define PX_CI 0x38u
+
+#define PX_CMD_ST (1u << 0)
+#define PX_CMD_SUD (1u << 1)
+#define PX_CMD_FRE (1u << 4)
+#define PX_CMD_FR (1u << 14)
+#define PX_CMD_CR (1u << 15)
+
+#define PX_IS_TFES (1u << 30)
+#define PX_TFD_ERR 0x01u
+#define PX_TFD_DRQ 0x08u
+#define PX_TFD_BSY 0x80u
+
+#define SATA_SIG_ATA 0x00000101u
+#define FIS_TYPE_REG_H2D 0x27u
+
+#define ATA_CMD_IDENTIFY 0xECu
+#define ATA_CMD_READ_DMA_EXT 0x25u
+#define ATA_CMD_WRITE_DMA_EXT 0x35u
+#define ATA_CMD_READ_FPDMA 0x60u
+#define ATA_CMD_WRITE_FPDMA 0x61u
+#define ATA_CMD_FLUSH_EXT 0xEAu
+
+typedef struct {
+    uint16_t flags; /* CFL in dwords, bit 6: write */
+    uint16_t prdtl;
+    volatile uint32_t prdbc;
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} ahci_cmd_header_t;
+
+typedef struct {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc; /* byte count - 1 */
+} ahci_prd_t;
+
+typedef struct {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    ahci_prd_t prdt[AHCI_PRDS];
+} ahci_cmd_table_t;
+
+typedef struct {
+    volatile uint8_t* regs;
+    ahci_cmd_header_t* cmd_list;
+    ahci_cmd_table_t* tables[32];
+    uint32_t slots;
+    uint32_t free_mask;
+    uint32_t issued;
+    uint32_t failed;
+    int ncq;
+    uint32_t queue_depth;
+    semaphore_t slot_sem;
+    mutex_t drain_lock;
+} ahci_port_t;
+
+static ahci_port_t g_ports[AHCI_MAX_DEVS];
+static uint32_t g_port_count;
+
+static void print_u32(unsigned int n) {
+    char buf[11];
+    int i = 0;
+
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+
+    while (i > 0) {
+        i--;
+        console_putc(buf[i]);
+    }
+}
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+static uint32_t rd(volatile uint8_t* base, uint32_t off) {
+    return *(volatile uint32_t*)(base + off);
+}
+
+static void wr(volatile uint8_t* base, uint32_t off, uint32_t v) {
+    *(volatile uint32_t*)(base + off) = v;
+}
+
+static int wait_clear(volatile uint8_t* base, uint32_t off, uint32_t mask) {
+    uint32_t spins = 0;
+
+    while (rd(base, off) & mask) {
+        if (++spins > AHCI_SPIN_LIMIT) return -1;
+    }
+    return 0;
+}
+
+static void port_stop(ahci_port_t* p) {
+    wr(p->regs, PX_CMD, rd(p->regs, PX_CMD) & ~PX_CMD_ST);
+    wait_clear(p->regs, PX_CMD, PX_CMD_CR);
+    wr(p->regs, PX_CMD, rd(p->regs, PX_CMD) & ~PX_CMD_FRE);
+    wait_clear(p->regs, PX_CMD, PX_CMD_FR);
+}
+
+static int port_start(ahci_port_t* p) {
+    wr(p->regs, PX_SERR, 0xFFFFFFFFu);
+    wr(p->regs, PX_IS, 0xFFFFFFFFu);
+    wr(p->regs, PX_CMD, rd(p->regs, PX_CMD) | PX_CMD_FRE);
+    if (wait_clear(p->regs, PX_TFD, PX_TFD_BSY | PX_TFD_DRQ) != 0) return -1;
+    wr(p->regs, PX_CMD, rd(p->regs, PX_CMD) | PX_CMD_ST);
+    return 0;
+}
+
+/* COMRESET: hold DET=1 for at least 1 ms, then wait for the link to come back. */
+static void port_comreset(ahci_port_t* p) {
+    uint32_t sctl = rd(p->regs, PX_SCTL) & ~0x0Fu;
+    uint32_t i;
+
+    wr(p->regs, PX_SCTL, sctl | 1u);
+    for (i = 0; i < 2000u; i++) io_wait();
+    wr(p->regs, PX_SCTL, sctl);
+    for (i = 0; i < AHCI_SPIN_LIMIT && (rd(p->regs, PX_SSTS) & 0x0Fu) != 3u; i++) {
+    }
+}
+
+/*
+ * Every issued command is lost: stop the engine so PxCI/PxSACT clear and the
+ * HBA lets go of all command tables, then restart it (IRQs off).
+ */
+static void port_reset(ahci_port_t* p, int comreset) {
+    p->failed |= p->issued;
+    p->issued = 0;
+    port_stop(p);
+    if (comreset) port_comreset(p);
+    port_start(p);
+}
+
+/* Task file error: restart the engine. */
+static void port_recover(ahci_port_t* p) {
+    if ((rd(p->regs, PX_IS) & PX_IS_TFES) == 0 && (rd(p->regs, PX_TFD) & PX_TFD_ERR) == 0) return;
+    port_reset(p, 0);
+}
+
+static int port_setup(ahci_port_t* p, volatile uint8_t* regs, uint32_t slots, uint32_t cap) {
+    uint32_t list_frame = pmm_alloc_frame();
+    uint32_t i;
+
+    if (list_frame == 0u) return -1;
+
+    p->regs = regs;
+    p->slots = slots;
+    p->free_mask = (slots >= 32u) ? 0xFFFFFFFFu : ((1u << slots) - 1u);
+
+    /* One frame: 1 KiB command list + 256 B received-FIS area. */
+    memset((void*)(uintptr_t)list_frame, 0, PMM_FRAME_SIZE);
+    p->cmd_list = (ahci_cmd_header_t*)(uintptr_t)list_frame;
+
+    /* Command tables are 512 B each (128 B header + 24 PRDs), eight per frame. */
+    for (i = 0; i < slots; i += 8u) {
+        uint32_t frame = pmm_alloc_frame();
+        uint32_t j;
+
+        if (frame == 0u) return -1;
+        memset((void*)(uintptr_t)frame, 0, PMM_FRAME_SIZE);
+        for (j = 0; j < 8u && i + j < slots; j++) {
+            p->tables[i + j] = (ahci_cmd_table_t*)(uintptr_t)(frame + j * sizeof(ahci_cmd_table_t));
+            p->cmd_list[i + j].ctba = frame + j * (uint32_t)sizeof(ahci_cmd_table_t);
+            p->cmd_list[i + j].ctbau = 0;
+        }
+    }
+
+    port_stop(p);
+    wr(regs, PX_CLB, list_frame);
+    wr(regs, PX_CLBU, 0);
+    wr(regs, PX_FB, list_frame + 1024u);
+    wr(regs, PX_FBU, 0);
+    wr(regs, PX_IE, 0);
+    if (cap & HBA_CAP_SSS) {
+        wr(regs, PX_CMD, rd(regs, PX_CMD) | PX_CMD_SUD);
+    }
+    return port_start(p);
+}
+
+static int build_prdt(ahci_cmd_table_t* t, const void* buf, uint32_t bytes) {
+    uintptr_t va = (uintptr_t)buf;
+    uint32_t n = 0;
+
+    if (va & 1u) return -1;
+
+    while (bytes > 0) {
+        uint32_t phys = translate((uint32_t)va);
+        uint32_t chunk = PMM_FRAME_SIZE - (uint32_t)(va & (PMM_FRAME_SIZE - 1u));
+
+        if (phys == 0u) return -1;
+        if (chunk > bytes) chunk = bytes;
+
+        if (n > 0 && t->prdt[n - 1].dba + (t->prdt[n - 1].dbc + 1u) == phys) {
+            t->prdt[n - 1].dbc += chunk;
+        } else {
+            if (n >= AHCI_PRDS) return -1;
+            t->prdt[n].dba = phys;
+            t->prdt[n].dbau = 0;
+            t->prdt[n].reserved = 0;
+            t->prdt[n].dbc = chunk - 1u;
+            n++;
+        }
+        va += chunk;
+        bytes -= chunk;
+    }
+    return (int)n;
+}
+
+/* Claim a free slot; the caller already holds a slot_sem unit. */
+static int slot_take(ahci_port_t* p) {
+    uint32_t flags;
+    int slot = -1;
+    uint32_t i;
+
+    flags = irq_save_disable();
+    for (i = 0; i < p->slots; i++) {
+        if (p->free_mask & (1u << i)) {
+            p->free_mask &= ~(1u << i);
+            slot = (int)i;
+            break;
+        }
+    }
+    irq_restore(flags);
+    return slot;
+}
+
+static void slot_put(ahci_port_t* p, int slot) {
+    uint32_t flags = irq_save_disable();
+    p->free_mask |= 1u << (uint32_t)slot;
+    irq_restore(flags);
+}
+
+/*
+ * Issue one command in the given slot and wait for it. Several threads can be
+ * inside at once; with NCQ each occupies a tag until SActive clears. The slot
+ * is still owned by the caller afterwards.
+ */
+static int ahci_issue(ahci_port_t* p, int slot, uint8_t cmd, uint64_t lba, uint32_t count, const void* buf, uint32_t bytes, int is_write) {
+    uint32_t bit;
+    ahci_cmd_header_t* hdr;
+    ahci_cmd_table_t* t;
+    uint8_t* fis;
+    int prds = 0;
+    int queued = (cmd == ATA_CMD_READ_FPDMA || cmd == ATA_CMD_WRITE_FPDMA);
+    uint32_t flags;
+    uint32_t spins = 0;
+    int rc = -1;
+
+    if (slot < 0) return -1;
+    bit = 1u << (uint32_t)slot;
+    hdr = &p->cmd_list[slot];
+    t = p->tables[slot];
+
+    memset(t->cfis, 0, sizeof(t->cfis));
+    if (bytes > 0) {
+        prds = build_prdt(t, buf, bytes);
+        if (prds < 0) return -1;
+    }
+
+    fis = t->cfis;
+    fis[0] = FIS_TYPE_REG_H2D;
+    fis[1] = 0x80; /* command, not control */
+    fis[2] = cmd;
+    fis[4] = (uint8_t)lba;
+    fis[5] = (uint8_t)(lba >> 8);
+    fis[6] = (uint8_t)(lba >> 16);
+    fis[7] = 0x40; /* LBA mode */
+    fis[8] = (uint8_t)(lba >> 24);
+    fis[9] = (uint8_t)(lba >> 32);
+    fis[10] = (uint8_t)(lba >> 40);
+    if (queued) {
+        /* FPDMA: sector count in FEATURES, tag in COUNT[7:3] */
+        fis[3] = (uint8_t)count;
+        fis[11] = (uint8_t)(count >> 8);
+        fis[12] = (uint8_t)((uint32_t)slot << 3);
+    } else {
+        fis[12] = (uint8_t)count;
+        fis[13] = (uint8_t)(count >> 8);
+    }
+
+    hdr->flags = (uint16_t)(5u | (is_write ? 0x40u : 0u));
+    hdr->prdtl = (uint16_t)prds;
+    hdr->prdbc = 0;
+
+    flags = irq_save_disable();
+    p->issued |= bit;
+    if (queued) wr(p->regs, PX_SACT, bit);
+    wr(p->regs, PX_CI, bit);
+    irq_restore(flags);
+
+    for (;;) {
+        uint32_t busy;
+
+        flags = irq_save_disable();
+        port_recover(p);
+        if (p->failed & bit) {
+            p->failed &= ~bit;
+            irq_restore(flags);
+            break;
+        }
+        busy = rd(p->regs, PX_CI) | (queued ? rd(p->regs, PX_SACT) : 0u);
+        if ((busy & bit) == 0) {
+            rc = 0;
+            irq_restore(flags);
+            break;
+        }
+        irq_restore(flags);
+
+        if (++spins > AHCI_SPIN_LIMIT) {
+            /* The HBA may still own the table: take the port down before reuse. */
+            flags = irq_save_disable();
+            port_reset(p, 1);
+            p->failed &= ~bit;
+            irq_restore(flags);
+            console_print("AHCI: command timeout, port reset\n");
+            break;
+        }
+        thread_yield();
+    }
+
+    flags = irq_save_disable();
+    p->issued &= ~bit;
+    irq_restore(flags);
+    return rc;
+}
+
+static int ahci_exec(ahci_port_t* p, uint8_t cmd, uint64_t lba, uint32_t count, const void* buf, uint32_t bytes, int is_write) {
+    int slot;
+    int rc;
+
+    sem_wait(&p->slot_sem);
+    slot = slot_take(p);
+    rc = ahci_issue(p, slot, cmd, lba, count, buf, bytes, is_write);
+    if (slot >= 0) slot_put(p, slot);
+    sem_post(&p->slot_sem);
+    return rc;
+}
+
+static int ahci_read(struct blockdev* dev, unsigned int lba, unsigned int count, void* buf) {
+    ahci_port_t* p;
+
+    if (!dev || !buf || count == 0) return -1;
+    if (lba + count > dev->sector_count || count > AHCI_MAX_SECTORS) return -1;
+    p = (ahci_port_t*)dev->ctx;
+    return ahci_exec(p, p->ncq ? ATA_CMD_READ_FPDMA : ATA_CMD_READ_DMA_EXT, lba, count, buf, count * 512u, 0);
+}
+
+static int ahci_write(struct blockdev* dev, unsigned int lba, unsigned int count, const void* buf) {
+    ahci_port_t* p;
+
+    if (!dev || !buf || count == 0) return -1;
+    if (lba + count > dev->sector_count || count > AHCI_MAX_SECTORS) return -1;
+    p = (ahci_port_t*)dev->ctx;
+    return ahci_exec(p, p->ncq ? ATA_CMD_WRITE_FPDMA : ATA_CMD_WRITE_DMA_EXT, lba, count, buf, count * 512u, 1);
+}
+
+/*
+ * FLUSH CACHE EXT is not queued and must not be issued while NCQ tags are
+ * outstanding: take every slot_sem unit first so the port is idle. drain_lock
+ * keeps two flushers from each holding part of the units.
+ */
+static int ahci_flush(struct blockdev* dev) {
+    ahci_port_t* p;
+    uint32_t i;
+    int slot;
+    int rc;
+
+    if (!dev || !dev->ctx) return -1;
+    p = (ahci_port_t*)dev->ctx;
+
+    mutex_lock(&p->drain_lock);
+    for (i = 0; i < p->queue_depth; i++) sem_wait(&p->slot_sem);
+    mutex_unlock(&p->drain_lock);
+
+    slot = slot_take(p);
+    rc = ahci_issue(p, slot, ATA_CMD_FLUSH_EXT, 0, 0, 0, 0, 0);
+    if (slot >= 0) slot_put(p, slot);
+
+    for (i = 0; i < p->queue_depth; i++) sem_post(&p->slot_sem);
+    return rc;
+}
+
+static void probe_port(volatile uint8_t* regs, uint32_t slots, uint32_t cap) {
+    ahci_port_t* p;
+    uint16_t* id;
+    uint32_t id_frame;
+    uint32_t sectors;
+    uint32_t depth;
+    blockdev_t dev;
+
+    if ((rd(regs, PX_SSTS) & 0x0Fu) != 3u) return;
+    if (rd(regs, PX_SIG) != SATA_SIG_ATA) return;
+    if (g_port_count >= AHCI_MAX_DEVS) return;
+
+    p = &g_ports[g_port_count];
+    memset(p, 0, sizeof(*p));
+    if (port_setup(p, regs, slots, cap) != 0) {
+        console_print("AHCI: port start failed\n");
+        return;
+    }
+    sem_init(&p->slot_sem, "ahci.slots", 1);
+    mutex_init(&p->drain_lock, "ahci.drain");
+
+    id_frame = pmm_alloc_frame();
+    if (id_frame == 0u) return;
+    id = (uint16_t*)(uintptr_t)id_frame;
+    if (ahci_exec(p, ATA_CMD_IDENTIFY, 0, 0, id, 512u, 0) != 0) {
+        pmm_free_frame(id_frame);
+        console_print("AHCI: identify failed\n");
+        return;
+    }
+
+    /* Words 100..103: LBA48 capacity; the blockdev layer is 32-bit for now. */
+    sectors = (uint32_t)id[100] | ((uint32_t)id[101] << 16);
+    if (id[102] != 0 || id[103] != 0) sectors = 0xFFFFFFFFu;
+    if (sectors == 0) sectors = (uint32_t)id[60] | ((uint32_t)id[61] << 16);
+
+    p->queue_depth = 1;
+    if ((cap & HBA_CAP_SNCQ) && (id[76] & 0x0100u)) {
+        p->ncq = 1;
+        p->queue_depth = (uint32_t)(id[75] & 0x1Fu) + 1u;
+        if (p->queue_depth > slots) p->queue_depth = slots;
+    }
+    pmm_free_frame(id_frame);
+    depth = p->queue_depth;
+
+    /* Counting semaphore bounds outstanding commands to the usable queue depth. */
+    while (depth > 1u) {
+        sem_post(&p->slot_sem);
+        depth--;
+    }
+
+    memset(&dev, 0, sizeof(dev));
+    memcpy(dev.name, "sd", 2);
+    dev.name[2] = (char)('0' + (int)g_port_count);
+    dev.name[3] = 0;
+    dev.type = BLOCKDEV_TYPE_SATA;
+    dev.sector_size = 512;
+    dev.sector_count = sectors;
+    dev.read = ahci_read;
+    dev.write = ahci_write;
+    dev.flush = ahci_flush;
+    dev.ctx = p;
+    dev.queue_depth = p->queue_depth;
+    dev.max_sectors = AHCI_MAX_SECTORS;
+
+    if (block_register(&dev) != 0) {
+        console_print("BLOCK: registry full, AHCI device skipped\n");
+        return;
+    }
+    g_port_count++;
+
+    console_print("BLOCK: found ");
+    console_print(dev.name);
+    console_print(" SATA/AHCI ");
+    print_u32(dev.sector_count);
+    console_print(" sectors, queue depth ");
+    print_u32(p->queue_depth);
+    console_print(p->ncq ? " (NCQ)\n" : "\n");
+}
+
+void ahci_discover(void) {
+    uint32_t nth = 0;
+    const pci_device_t* pdev;
+
+    while ((pdev = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, nth++)) != 0) {
+        uint32_t abar;
+        volatile uint8_t* hba;
+        uint32_t cap;
+        uint32_t pi;
+        uint32_t slots;
+        uint32_t port;
+
+        if (pdev->prog_if != 0x01u) continue;
+
+        abar = pci_bar(pdev, 5) & 0xFFFFFFF0u;
+        if (abar == 0u || map_mmio(abar, 0x1100u) != 0) {
+            console_print("AHCI: cannot map ABAR\n");
+            continue;
+        }
+        pci_enable(pdev, PCI_CMD_MEMORY | PCI_CMD_BUS_MASTER);
+
+        hba = (volatile uint8_t*)(uintptr_t)abar;
+        wr(hba, HBA_GHC, rd(hba, HBA_GHC) | HBA_GHC_AE);
+        cap = rd(hba, HBA_CAP);
+        pi = rd(hba, HBA_PI);
+        slots = ((cap >> 8) & 0x1Fu) + 1u;
+
+        for (port = 0; port < AHCI_MAX_PORTS; port++) {
+            if (pi & (1u << port)) {
+                probe_port(hba + 0x100u + port * 0x80u, slots, cap);
+            }
+        }
+    }
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+/* AHCI SATA HBA (PCI class 01/06/01); registers sdN blockdevs with NCQ when supported. */
+void ahci_discover(void);
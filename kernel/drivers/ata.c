@@ -0,0 +1,294 @@
+#include "ata.h"
+
+#include "../console.h"
+#include "../isr.h"
+#include "../pit.h"
+#include "../ports.h"
+#include "../sched/softirq.h"
+#include "../sched/sync.h"
+#include "../sched/thread.h"
+#include "../sched/timer.h"
+
+#include <stdint.h>
+
+typedef struct ata_channel {
+    unsigned short io;
+    int irq;                   /* legacy IRQ line, -1 = poll only */
+    mutex_t lock;
+    wait_queue_t wq;
+    volatile int pending;      /* INTRQ seen since the last arm */
+    volatile int timed_out;
+    volatile unsigned char status;
+    ktimer_t timer;
+    uint32_t irqs;
+    unsigned char drives[2];   /* identity of master and slave, see ata_disk_id */
+} ata_channel_t;
+
+static ata_channel_t g_channels[ATA_MAX_CHANNELS];
+static unsigned int g_channel_count;
+static int g_irq_installed[2];
+static const char* g_channel_names[ATA_MAX_CHANNELS] = { "ide0", "ide1", "ide2", "ide3" };
+
+static unsigned short inw16(unsigned short port) {
+    unsigned short ret;
+    __asm__ volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+/* Reading the status register acknowledges INTRQ on the drive. */
+static void channel_irq(ata_channel_t* ch) {
+    ch->status = inb(ch->io + 7);
+    ch->pending = 1;
+    ch->irqs++;
+    thread_wake_all(&ch->wq);
+}
+
+static ata_channel_t* channel_by_irq(int irq) {
+    unsigned int i;
+
+    for (i = 0; i < g_channel_count; i++) {
+        if (g_channels[i].irq == irq) return &g_channels[i];
+    }
+    return 0;
+}
+
+static void ata_irq_primary(void) {
+    ata_channel_t* ch = channel_by_irq(ATA_IRQ_PRIMARY);
+    if (ch) channel_irq(ch);
+}
+
+static void ata_irq_secondary(void) {
+    ata_channel_t* ch = channel_by_irq(ATA_IRQ_SECONDARY);
+    if (ch) channel_irq(ch);
+}
+
+void ata_init(void) {
+    g_channel_count = 0;
+    g_irq_installed[0] = irq_install_handler(ATA_IRQ_PRIMARY, ata_irq_primary) == 0;
+    g_irq_installed[1] = irq_install_handler(ATA_IRQ_SECONDARY, ata_irq_secondary) == 0;
+}
+
+int ata_attach(ata_ctx_t* ctx) {
+    ata_channel_t* ch;
+    unsigned int i;
+
+    for (i = 0; i < g_channel_count; i++) {
+        if (g_channels[i].io == ctx->io) {
+            ctx->chan = &g_channels[i];
+            return 0;
+        }
+    }
+    if (g_channel_count >= ATA_MAX_CHANNELS) return -1;
+
+    ch = &g_channels[g_channel_count];
+    ch->io = ctx->io;
+    ch->irq = -1;
+    /* PCI native-mode channels have no legacy line and keep polling. */
+    if (ctx->io == ATA_PRIMARY_IO && g_irq_installed[0]) ch->irq = ATA_IRQ_PRIMARY;
+    if (ctx->io == ATA_SECONDARY_IO && g_irq_installed[1]) ch->irq = ATA_IRQ_SECONDARY;
+    mutex_init(&ch->lock, g_channel_names[g_channel_count]);
+    wait_queue_init(&ch->wq);
+    g_channel_count++;
+
+    ctx->chan = ch;
+    return 0;
+}
+
+const void* ata_disk_id(const ata_ctx_t* ctx) {
+    return ctx->chan ? (const void*)&ctx->chan->drives[ctx->slave ? 1 : 0] : 0;
+}
+
+void ata_lock(const ata_ctx_t* ctx) {
+    if (ctx->chan) mutex_lock(&ctx->chan->lock);
+}
+
+void ata_unlock(const ata_ctx_t* ctx) {
+    if (ctx->chan) mutex_unlock(&ctx->chan->lock);
+}
+
+void ata_irq_arm(const ata_ctx_t* ctx) {
+    if (ctx->chan) ctx->chan->pending = 0;
+}
+
+static void irq_timeout(void* arg) {
+    ata_channel_t* ch = (ata_channel_t*)arg;
+
+    ch->timed_out = 1;
+    thread_wake_all(&ch->wq);
+}
+
+int ata_wait_irq(const ata_ctx_t* ctx) {
+    ata_channel_t* ch = ctx->chan;
+    uint32_t flags;
+    int rc = 0;
+
+    if (!ch || ch->irq < 0 || !sched_is_running() || irq_in_hardirq() || softirq_in_progress()) return 0;
+
+    flags = irq_save_disable();
+    if (!(flags & 0x200u)) {
+        irq_restore(flags);
+        return 0;
+    }
+    if (!ch->pending) {
+        ch->timed_out = 0;
+        timer_add(&ch->timer, (ATA_IRQ_TIMEOUT_MS * pit_get_hz()) / 1000u + 1u, irq_timeout, ch);
+        while (!ch->pending && !ch->timed_out) {
+            thread_block(&ch->wq);
+        }
+        timer_cancel(&ch->timer);
+        if (!ch->pending) {
+            /* Device finished but the line never fired: stop trusting it. */
+            if (!(inb(ch->io + 7) & ATA_SR_BSY)) {
+                ch->irq = -1;
+                console_print("ATA: completion IRQ missing, channel falls back to polling\n");
+            } else {
+                rc = -1;
+            }
+        }
+    }
+    irq_restore(flags);
+    return rc;
+}
+
+void ata_io_delay(const ata_ctx_t* ctx) {
+    inb(ctx->ctrl);
+    inb(ctx->ctrl);
+    inb(ctx->ctrl);
+    inb(ctx->ctrl);
+}
+
+int ata_poll_ready(const ata_ctx_t* ctx) {
+    unsigned int timeout = 1000000;
+
+    ata_io_delay(ctx);
+    while (timeout--) {
+        unsigned char status = inb(ctx->io + 7);
+        if (!(status & ATA_SR_BSY)) {
+            if (status & ATA_SR_ERR) return -1;
+            if (status & ATA_SR_DRQ) return 0;
+            if (status & ATA_SR_DRDY) return 0;
+        }
+    }
+    return -1;
+}
+
+/* Wait for BSY to drop without expecting DRQ (DMA completion, flush). */
+int ata_wait_idle(const ata_ctx_t* ctx) {
+    unsigned int timeout = 1000000;
+
+    ata_io_delay(ctx);
+    while (timeout--) {
+        unsigned char status = inb(ctx->io + 7);
+        if (!(status & ATA_SR_BSY)) {
+            return (status & (ATA_SR_ERR | ATA_SR_DF)) ? -1 : 0;
+        }
+    }
+    return -1;
+}
+
+int ata_identify(const ata_ctx_t* ctx, unsigned short identify[256]) {
+    unsigned char status;
+    unsigned int i;
+
+    outb(ctx->io + 6, (unsigned char)((ctx->slave ? ATA_SEL_SLAVE : ATA_SEL_MASTER) | 0x40));
+    ata_io_delay(ctx);
+
+    outb(ctx->io + 2, 0);
+    outb(ctx->io + 3, 0);
+    outb(ctx->io + 4, 0);
+    outb(ctx->io + 5, 0);
+    outb(ctx->io + 7, ATA_CMD_IDENTIFY);
+
+    status = inb(ctx->io + 7);
+    if (status == 0) return -1;
+
+    while ((status & ATA_SR_BSY) != 0) {
+        status = inb(ctx->io + 7);
+    }
+
+    if (inb(ctx->io + 4) != 0 || inb(ctx->io + 5) != 0) {
+        return -1;
+    }
+
+    while ((status & ATA_SR_DRQ) == 0) {
+        if (status & ATA_SR_ERR) return -1;
+        status = inb(ctx->io + 7);
+    }
+
+    for (i = 0; i < 256; i++) {
+        identify[i] = inw16(ctx->io);
+    }
+    return 0;
+}
+
+void ata_setup_lba28(const ata_ctx_t* ctx, unsigned int lba, unsigned int count) {
+    outb(ctx->ctrl, 0x00);
+    outb(ctx->io + 6, (unsigned char)((ctx->slave ? ATA_SEL_SLAVE : ATA_SEL_MASTER) | 0x40 | ((lba >> 24) & 0x0Fu)));
+    outb(ctx->io + 2, (unsigned char)count);
+    outb(ctx->io + 3, (unsigned char)(lba & 0xFFu));
+    outb(ctx->io + 4, (unsigned char)((lba >> 8) & 0xFFu));
+    outb(ctx->io + 5, (unsigned char)((lba >> 16) & 0xFFu));
+}
+
+void ata_setup_lba48(const ata_ctx_t* ctx, unsigned int lba, unsigned int count) {
+    outb(ctx->ctrl, 0x00);
+    outb(ctx->io + 6, (unsigned char)((ctx->slave ? ATA_SEL_SLAVE : ATA_SEL_MASTER) | 0x40));
+    /* Each register is a two-deep FIFO: high order byte first. */
+    outb(ctx->io + 2, (unsigned char)((count >> 8) & 0xFFu));
+    outb(ctx->io + 3, (unsigned char)((lba >> 24) & 0xFFu));
+    outb(ctx->io + 4, 0);
+    outb(ctx->io + 5, 0);
+    outb(ctx->io + 2, (unsigned char)(count & 0xFFu));
+    outb(ctx->io + 3, (unsigned char)(lba & 0xFFu));
+    outb(ctx->io + 4, (unsigned char)((lba >> 8) & 0xFFu));
+    outb(ctx->io + 5, (unsigned char)((lba >> 16) & 0xFFu));
+}
+
+unsigned int ata_identify_sectors(ata_ctx_t* ctx, const unsigned short identify[256]) {
+    unsigned int lba28 = ((unsigned int)identify[61] << 16) | identify[60];
+
+    ctx->lba48 = 0;
+    if (identify[83] & ATA_ID_CMD_LBA48) {
+        unsigned int lo = ((unsigned int)identify[101] << 16) | identify[100];
+        unsigned int hi = ((unsigned int)identify[103] << 16) | identify[102];
+
+        if (lo != 0 || hi != 0) {
+            ctx->lba48 = 1;
+            return hi ? 0xFFFFFFFFu : lo;
+        }
+    }
+    return lba28;
+}
+
+void ata_set_multiple(ata_ctx_t* ctx, const unsigned short identify[256]) {
+    unsigned int max = identify[47] & 0xFFu;
+
+    ctx->multiple = 0;
+    if (max < 2) return;
+
+    outb(ctx->io + 6, (unsigned char)((ctx->slave ? ATA_SEL_SLAVE : ATA_SEL_MASTER) | 0x40));
+    ata_io_delay(ctx);
+    outb(ctx->io + 2, (unsigned char)max);
+    outb(ctx->io + 7, ATA_CMD_SET_MULTIPLE);
+    if (ata_wait_idle(ctx) == 0) ctx->multiple = (unsigned short)max;
+}
+
+int ata_flush(const ata_ctx_t* ctx) {
+    if (ata_wait_idle(ctx) != 0) return -1;
+    outb(ctx->io + 6, (unsigned char)((ctx->slave ? ATA_SEL_SLAVE : ATA_SEL_MASTER) | 0x40));
+    ata_io_delay(ctx);
+    ata_irq_arm(ctx);
+    outb(ctx->io + 7, ctx->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+    if (ata_wait_irq(ctx) != 0) return -1;
+    return ata_wait_idle(ctx);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+/* Shared taskfile helpers for the PIO and bus-master DMA ATA drivers. */
+
+#define ATA_SR_BSY 0x80
+#define ATA_SR_DRDY 0x40
+#define ATA_SR_DF 0x20
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_ERR 0x01
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_READ_PIO_EXT 0x24
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_READ_MULTIPLE 0xC4
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_SET_MULTIPLE 0xC6
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CMD_CACHE_FLUSH_EXT 0xEA
+#define ATA_CMD_IDENTIFY 0xEC
+
+#define ATA_PRIMARY_IO 0x1F0
+#define ATA_SECONDARY_IO 0x170
+#define ATA_PRIMARY_CTRL 0x3F6
+#define ATA_SECONDARY_CTRL 0x376
+
+#define ATA_SEL_MASTER 0xA0
+#define ATA_SEL_SLAVE 0xB0
+
+/* IDENTIFY word 49 bit 8: DMA supported */
+#define ATA_ID_CAP_DMA 0x0100u
+/* IDENTIFY word 83 bit 10: 48-bit address feature set */
+#define ATA_ID_CMD_LBA48 0x0400u
+
+/* Highest sector reachable with a 28-bit command, plus one. */
+#define ATA_LBA28_LIMIT 0x10000000u
+
+#define ATA_IRQ_PRIMARY 14
+#define ATA_IRQ_SECONDARY 15
+#define ATA_IRQ_TIMEOUT_MS 5000u
+#define ATA_MAX_CHANNELS 4
+
+struct ata_channel;
+
+typedef struct {
+    unsigned short io;
+    unsigned short ctrl;
+    unsigned char slave;
+    unsigned char lba48;    /* device accepts the EXT commands */
+    unsigned short multiple; /* sectors per DRQ block for READ/WRITE MULTIPLE, 0 = off */
+    struct ata_channel* chan; /* set by ata_attach */
+} ata_ctx_t;
+
+/* Installs the IRQ14/15 handlers; call before the first ata_attach. */
+void ata_init(void);
+/* Binds ctx to the shared state (lock, completion IRQ) of its I/O port range. */
+int ata_attach(ata_ctx_t* ctx);
+/* Same pointer for the PIO and DMA device of one drive; 0 before ata_attach. */
+const void* ata_disk_id(const ata_ctx_t* ctx);
+/* Serialises master and slave, PIO and bus-master DMA on one channel. */
+void ata_lock(const ata_ctx_t* ctx);
+void ata_unlock(const ata_ctx_t* ctx);
+/*
+ * Completion interrupts: ata_irq_arm before the device can raise INTRQ,
+ * then ata_wait_irq sleeps until it did. Where sleeping is impossible (no
+ * IRQ line, boot, IRQs off) it returns at once and the caller's status
+ * poll does the waiting. -1 only on timeout with the drive still busy.
+ */
+void ata_irq_arm(const ata_ctx_t* ctx);
+int ata_wait_irq(const ata_ctx_t* ctx);
+
+void ata_io_delay(const ata_ctx_t* ctx);
+int ata_poll_ready(const ata_ctx_t* ctx);
+int ata_wait_idle(const ata_ctx_t* ctx);
+int ata_identify(const ata_ctx_t* ctx, unsigned short identify[256]);
+void ata_setup_lba28(const ata_ctx_t* ctx, unsigned int lba, unsigned int count);
+/* count 0 means 65536 sectors; RōninOS LBAs are 32-bit, the upper 16 bits stay zero. */
+void ata_setup_lba48(const ata_ctx_t* ctx, unsigned int lba, unsigned int count);
+/* Sector count from IDENTIFY; fills ctx->lba48. Capped at 2^32-1 sectors. */
+unsigned int ata_identify_sectors(ata_ctx_t* ctx, const unsigned short identify[256]);
+/* SET MULTIPLE MODE with the largest block the device reports; fills ctx->multiple. */
+void ata_set_multiple(ata_ctx_t* ctx, const unsigned short identify[256]);
+/* Caller holds the channel lock. */
+int ata_flush(const ata_ctx_t* ctx);
@@ -0,0 +1,266 @@
+#include "ata_dma.h"
+
+#include "ata.h"
+#include "pci.h"
+#include "../block/blockdev.h"
+#include "../console.h"
+#include "../lib/string.h"
+#include "../mem/paging.h"
+#include "../mem/pmm.h"
+#include "../pit.h"
+#include "../ports.h"
+#include "../sched/thread.h"
+
+#include <stdint.h>
+
+#define BM_CMD 0x00u
+#define BM_STATUS 0x02u
+#define BM_PRDT 0x04u
+
+#define BM_CMD_START 0x01u
+#define BM_CMD_READ 0x08u /* bus master writes to memory */
+
+#define BM_SR_ACTIVE 0x01u
+#define BM_SR_ERR 0x02u
+#define BM_SR_IRQ 0x04u
+
+#define PRD_EOT 0x8000u
+#define ATA_DMA_MAX_PRDS (PMM_FRAME_SIZE / sizeof(ata_prd_t))
+#define ATA_DMA_MAX_SECTORS 255u
+#define ATA_DMA_TIMEOUT_MS 2000u
+
+typedef struct {
+    uint32_t phys;
+    uint16_t bytes; /* 0 means 64 KiB */
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+typedef struct {
+    ata_ctx_t ata;
+    unsigned short bm;
+    ata_prd_t* prdt;
+} ata_dma_ctx_t;
+
+static ata_dma_ctx_t g_dma_ctx[4];
+
+static void print_u32(unsigned int n) {
+    char buf[11];
+    int i = 0;
+
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+
+    while (i > 0) {
+        i--;
+        console_putc(buf[i]);
+    }
+}
+
+/* One PRD per physically contiguous run; a run never crosses a 64 KiB boundary. */
+static int build_prdt(ata_dma_ctx_t* ctx, const void* buf, uint32_t bytes) {
+    uintptr_t va = (uintptr_t)buf;
+    uint32_t n = 0;
+    uint32_t run_len = 0;
+
+    if (va & 1u) return -1;
+
+    while (bytes > 0) {
+        uint32_t phys = translate((uint32_t)va);
+        uint32_t chunk = PMM_FRAME_SIZE - (uint32_t)(va & (PMM_FRAME_SIZE - 1u));
+
+        if (phys == 0u) return -1;
+        if (chunk > bytes) chunk = bytes;
+
+        if (n > 0 && ctx->prdt[n - 1].phys + run_len == phys &&
+            (ctx->prdt[n - 1].phys >> 16) == ((phys + chunk - 1u) >> 16)) {
+            run_len += chunk;
+        } else {
+            if (n >= ATA_DMA_MAX_PRDS) return -1;
+            if (n > 0) ctx->prdt[n - 1].bytes = (uint16_t)run_len;
+            ctx->prdt[n].phys = phys;
+            ctx->prdt[n].flags = 0;
+            run_len = chunk;
+            n++;
+        }
+
+        va += chunk;
+        bytes -= chunk;
+    }
+
+    ctx->prdt[n - 1].bytes = (uint16_t)run_len;
+    ctx->prdt[n - 1].flags = PRD_EOT;
+    return 0;
+}
+
+static int ata_dma_transfer(ata_dma_ctx_t* ctx, unsigned int lba, unsigned int count, const void* buf, int is_write) {
+    unsigned char dir = is_write ? 0u : BM_CMD_READ;
+    uint32_t start;
+    uint32_t limit;
+    unsigned char bm_status;
+    unsigned char ata_status;
+    int rc = 0;
+
+    ata_lock(&ctx->ata);
+
+    if (build_prdt(ctx, buf, count * 512u) != 0 || ata_wait_idle(&ctx->ata) != 0) {
+        ata_unlock(&ctx->ata);
+        return -1;
+    }
+
+    outb((unsigned short)(ctx->bm + BM_CMD), 0);
+    outl((unsigned short)(ctx->bm + BM_PRDT), (uint32_t)(uintptr_t)ctx->prdt);
+    outb((unsigned short)(ctx->bm + BM_STATUS), (unsigned char)(inb((unsigned short)(ctx->bm + BM_STATUS)) | BM_SR_ERR | BM_SR_IRQ));
+    outb((unsigned short)(ctx->bm + BM_CMD), dir);
+
+    ata_irq_arm(&ctx->ata);
+    if (ctx->ata.lba48 && lba + count > ATA_LBA28_LIMIT) {
+        ata_setup_lba48(&ctx->ata, lba, count);
+        outb(ctx->ata.io + 7, is_write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+    } else {
+        ata_setup_lba28(&ctx->ata, lba, count);
+        outb(ctx->ata.io + 7, is_write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    }
+    outb((unsigned short)(ctx->bm + BM_CMD), (unsigned char)(dir | BM_CMD_START));
+
+    /* The controller moves the data; the thread sleeps until INTRQ, or yields where it cannot. */
+    if (ata_wait_irq(&ctx->ata) != 0) rc = -1;
+    start = pit_get_ticks();
+    limit = (ATA_DMA_TIMEOUT_MS * pit_get_hz()) / 1000u + 1u;
+    for (;;) {
+        bm_status = inb((unsigned short)(ctx->bm + BM_STATUS));
+        if (rc != 0) break;
+        if ((bm_status & (BM_SR_IRQ | BM_SR_ERR)) || !(bm_status & BM_SR_ACTIVE)) break;
+        if (pit_get_ticks() - start > limit) {
+            rc = -1;
+            break;
+        }
+        thread_yield();
+    }
+
+    outb((unsigned short)(ctx->bm + BM_CMD), 0);
+    ata_status = inb(ctx->ata.io + 7);
+    outb((unsigned short)(ctx->bm + BM_STATUS), BM_SR_ERR | BM_SR_IRQ);
+
+    if ((bm_status & BM_SR_ERR) || (ata_status & (ATA_SR_ERR | ATA_SR_DF))) rc = -1;
+    if (rc == 0 && (ata_status & ATA_SR_BSY) && ata_wait_idle(&ctx->ata) != 0) rc = -1;
+
+    ata_unlock(&ctx->ata);
+    return rc;
+}
+
+static int ata_dma_read(struct blockdev* dev, unsigned int lba, unsigned int count, void* buf) {
+    if (!dev || !buf || count == 0) return -1;
+    if (lba + count > dev->sector_count || count > ATA_DMA_MAX_SECTORS) return -1;
+    return ata_dma_transfer((ata_dma_ctx_t*)dev->ctx, lba, count, buf, 0);
+}
+
+static int ata_dma_write(struct blockdev* dev, unsigned int lba, unsigned int count, const void* buf) {
+    if (!dev || !buf || count == 0) return -1;
+    if (lba + count > dev->sector_count || count > ATA_DMA_MAX_SECTORS) return -1;
+    return ata_dma_transfer((ata_dma_ctx_t*)dev->ctx, lba, count, buf, 1);
+}
+
+static int ata_dma_flush(struct blockdev* dev) {
+    ata_dma_ctx_t* ctx;
+    int rc;
+
+    if (!dev || !dev->ctx) return -1;
+    ctx = (ata_dma_ctx_t*)dev->ctx;
+    ata_lock(&ctx->ata);
+    rc = ata_flush(&ctx->ata);
+    ata_unlock(&ctx->ata);
+    return rc;
+}
+
+static void detect_one(unsigned int index, unsigned short io, unsigned short ctrl, unsigned short bm) {
+    ata_dma_ctx_t* ctx = &g_dma_ctx[index];
+    unsigned short identify[256];
+    unsigned int sectors;
+    uint32_t frame;
+    blockdev_t dev;
+
+    ctx->ata.io = io;
+    ctx->ata.ctrl = ctrl;
+    ctx->ata.slave = (unsigned char)(index & 1u);
+    ctx->bm = bm;
+    ctx->ata.chan = 0;
+
+    if (ata_identify(&ctx->ata, identify) != 0) return;
+    sectors = ata_identify_sectors(&ctx->ata, identify);
+    if (sectors == 0 || !(identify[49] & ATA_ID_CAP_DMA)) return;
+    if (ata_attach(&ctx->ata) != 0) return;
+
+    /* PRDT: dword aligned and must not cross 64 KiB, a whole frame satisfies both. */
+    frame = pmm_alloc_frame();
+    if (frame == 0u) {
+        console_print("ATA-DMA: no frame for PRDT\n");
+        return;
+    }
+    ctx->prdt = (ata_prd_t*)(uintptr_t)frame;
+    memset(ctx->prdt, 0, PMM_FRAME_SIZE);
+
+    memset(&dev, 0, sizeof(dev));
+    memcpy(dev.name, "dma", 3);
+    dev.name[3] = (char)('0' + (int)index);
+    dev.name[4] = 0;
+    dev.type = BLOCKDEV_TYPE_ATA;
+    dev.sector_size = 512;
+    dev.sector_count = sectors;
+    dev.read = ata_dma_read;
+    dev.write = ata_dma_write;
+    dev.flush = ata_dma_flush;
+    dev.max_sectors = ATA_DMA_MAX_SECTORS;
+    dev.disk = ata_disk_id(&ctx->ata);
+    dev.ctx = ctx;
+
+    if (block_register(&dev) != 0) {
+        pmm_free_frame(frame);
+        console_print("BLOCK: registry full, ATA-DMA device skipped\n");
+        return;
+    }
+
+    console_print("BLOCK: found ");
+    console_print(dev.name);
+    console_print(" ATA bus-master DMA ");
+    print_u32(dev.sector_count);
+    console_print(" sectors\n");
+}
+
+void ata_dma_discover(void) {
+    const pci_device_t* ide = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, 0);
+    unsigned short bm;
+    unsigned short io[2] = { ATA_PRIMARY_IO, ATA_SECONDARY_IO };
+    unsigned short ctrl[2] = { ATA_PRIMARY_CTRL, ATA_SECONDARY_CTRL };
+    unsigned int ch;
+
+    if (!ide) return;
+    if (!(ide->prog_if & 0x80u)) {
+        console_print("ATA-DMA: IDE controller without bus mastering\n");
+        return;
+    }
+
+    bm = (unsigned short)(pci_bar(ide, 4) & 0xFFFCu);
+    if (bm == 0) return;
+
+    /* prog_if bit 0/2: channel in PCI native mode, ports come from BAR0..3. */
+    for (ch = 0; ch < 2u; ch++) {
+        if (ide->prog_if & (1u << (ch * 2u))) {
+            io[ch] = (unsigned short)(pci_bar(ide, ch * 2u) & 0xFFFCu);
+            ctrl[ch] = (unsigned short)((pci_bar(ide, ch * 2u + 1u) & 0xFFFCu) + 2u);
+        }
+    }
+
+    pci_enable(ide, PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+
+    for (ch = 0; ch < 2u; ch++) {
+        detect_one(ch * 2u, io[ch], ctrl[ch], (unsigned short)(bm + ch * 8u));
+        detect_one(ch * 2u + 1u, io[ch], ctrl[ch], (unsigned short)(bm + ch * 8u));
+    }
+}
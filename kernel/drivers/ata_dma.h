@@ -0,0 +1,4 @@
+#pragma once
+
+/* PIIX-style bus-master IDE; registers dmaN blockdevs next to the PIO hdN ones. */
+void ata_dma_discover(void);
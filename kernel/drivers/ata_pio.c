@@ -1,34 +1,11 @@
 #include "ata_pio.h"
 
+#include "ata.h"
 #include "../block/blockdev.h"
 #include "../console.h"
 #include "../lib/string.h"
 #include "../ports.h"
 
-#define ATA_SR_BSY 0x80
-#define ATA_SR_DRDY 0x40
-#define ATA_SR_DRQ 0x08
-#define ATA_SR_ERR 0x01
-
-#define ATA_CMD_READ_PIO 0x20
-#define ATA_CMD_WRITE_PIO 0x30
-#define ATA_CMD_CACHE_FLUSH 0xE7
-#define ATA_CMD_IDENTIFY 0xEC
-
-#define ATA_PRIMARY_IO 0x1F0
-#define ATA_SECONDARY_IO 0x170
-#define ATA_PRIMARY_CTRL 0x3F6
-#define ATA_SECONDARY_CTRL 0x376
-
-#define ATA_SEL_MASTER 0xA0
-#define ATA_SEL_SLAVE 0xB0
-
-typedef struct {
-    unsigned short io;
-    unsigned short ctrl;
-    unsigned char slave;
-} ata_ctx_t;
-
 static ata_ctx_t g_ata_ctx[4];
 static blockdev_t g_ata_devs[4];
 
@@ -63,144 +40,116 @@ static void print_size_gib(unsigned int sectors) {
     console_putc((char)('0' + (frac % 10u)));
 }
 
-static unsigned short inw16(unsigned short port) {
-    unsigned short ret;
-    __asm__ volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
+/* Sectors per command; LBA28 encodes 256 as a zero count. */
+#define ATA_PIO_MAX_SECTORS 256u
 
-static void io_delay_400ns(unsigned short ctrl) {
-    inb(ctrl);
-    inb(ctrl);
-    inb(ctrl);
-    inb(ctrl);
+static void insw_rep(unsigned short port, void* buf, unsigned int words) {
+    __asm__ volatile ("cld; rep insw" : "+D"(buf), "+c"(words) : "d"(port) : "memory");
 }
 
-static int ata_poll_ready(unsigned short io, unsigned short ctrl) {
-    unsigned int timeout = 1000000;
-
-    io_delay_400ns(ctrl);
-    while (timeout--) {
-        unsigned char status = inb(io + 7);
-        if (!(status & ATA_SR_BSY)) {
-            if (status & ATA_SR_ERR) return -1;
-            if (status & ATA_SR_DRQ) return 0;
-            if (status & ATA_SR_DRDY) return 0;
-        }
-    }
-    return -1;
+static void outsw_rep(unsigned short port, const void* buf, unsigned int words) {
+    __asm__ volatile ("cld; rep outsw" : "+S"(buf), "+c"(words) : "d"(port) : "memory");
 }
 
-static int ata_identify(ata_ctx_t* ctx, unsigned int* out_sectors) {
-    unsigned short identify[256];
-    unsigned char status;
-    unsigned int i;
-
-    outb(ctx->io + 6, (unsigned char)((ctx->slave ? ATA_SEL_SLAVE : ATA_SEL_MASTER) | 0x40));
-    io_delay_400ns(ctx->ctrl);
-
-    outb(ctx->io + 2, 0);
-    outb(ctx->io + 3, 0);
-    outb(ctx->io + 4, 0);
-    outb(ctx->io + 5, 0);
-    outb(ctx->io + 7, ATA_CMD_IDENTIFY);
-
-    status = inb(ctx->io + 7);
-    if (status == 0) return -1;
-
-    while ((status & ATA_SR_BSY) != 0) {
-        status = inb(ctx->io + 7);
-    }
-
-    if (inb(ctx->io + 4) != 0 || inb(ctx->io + 5) != 0) {
-        return -1;
-    }
-
-    while ((status & ATA_SR_DRQ) == 0) {
-        if (status & ATA_SR_ERR) return -1;
-        status = inb(ctx->io + 7);
+/* Programs the taskfile and picks the command variant for this range. */
+static void issue(const ata_ctx_t* ctx, unsigned int lba, unsigned int count, int is_write) {
+    unsigned char cmd;
+
+    if (ctx->lba48 && lba + count > ATA_LBA28_LIMIT) {
+        ata_setup_lba48(ctx, lba, count);
+        if (ctx->multiple) cmd = is_write ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE_EXT;
+        else cmd = is_write ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_READ_PIO_EXT;
+    } else {
+        ata_setup_lba28(ctx, lba, count);
+        if (ctx->multiple) cmd = is_write ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_READ_MULTIPLE;
+        else cmd = is_write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO;
     }
+    outb(ctx->io + 7, cmd);
+}
 
-    for (i = 0; i < 256; i++) {
-        identify[i] = inw16(ctx->io);
+/* One command; with MULTIPLE mode the device raises DRQ once per block of sectors. */
+static int transfer(const ata_ctx_t* ctx, unsigned int lba, unsigned int count, unsigned char* buf, int is_write) {
+    unsigned int block = ctx->multiple ? ctx->multiple : 1u;
+    unsigned int s = 0;
+
+    /*
+     * Reads raise INTRQ when each block is ready, writes after each block
+     * was taken; the first write block only needs DRQ. Re-arm before moving
+     * data so the next interrupt cannot slip past.
+     */
+    ata_irq_arm(ctx);
+    issue(ctx, lba, count, is_write);
+    while (s < count) {
+        unsigned int n = count - s;
+        if (n > block) n = block;
+
+        if (!is_write && ata_wait_irq(ctx) != 0) return -1;
+        if (ata_poll_ready(ctx) != 0) return -1;
+        ata_irq_arm(ctx);
+        if (is_write) {
+            outsw_rep(ctx->io, buf + s * 512u, n * 256u);
+            if (ata_wait_irq(ctx) != 0) return -1;
+        } else {
+            insw_rep(ctx->io, buf + s * 512u, n * 256u);
+        }
+        s += n;
     }
 
-    *out_sectors = ((unsigned int)identify[61] << 16) | identify[60];
-    return *out_sectors > 0 ? 0 : -1;
+    /* Writes are done once the device has taken the last block off the bus. */
+    if (is_write) return ata_wait_idle(ctx);
+    ata_io_delay(ctx);
+    return 0;
 }
 
-static int ata_pio_read(struct blockdev* dev, unsigned int lba, unsigned int count, void* buf) {
-    ata_ctx_t* ctx;
-    unsigned int i;
-    unsigned int s;
-    unsigned short* out;
+static int ata_pio_rw(struct blockdev* dev, unsigned int lba, unsigned int count, unsigned char* buf, int is_write) {
+    const ata_ctx_t* ctx;
+    int rc = 0;
 
     if (!dev || !buf || count == 0) return -1;
     if (dev->sector_size != 512) return -1;
-    if (lba + count > dev->sector_count) return -1;
-    if (count > 255) return -1;
+    if (lba + count > dev->sector_count || lba + count < lba) return -1;
 
-    ctx = (ata_ctx_t*)dev->ctx;
+    ctx = (const ata_ctx_t*)dev->ctx;
     if (!ctx) return -1;
 
-    outb(ctx->ctrl, 0x00);
-    outb(ctx->io + 6, (unsigned char)((ctx->slave ? ATA_SEL_SLAVE : ATA_SEL_MASTER) | ((lba >> 24) & 0x0Fu)));
-    outb(ctx->io + 2, (unsigned char)count);
-    outb(ctx->io + 3, (unsigned char)(lba & 0xFFu));
-    outb(ctx->io + 4, (unsigned char)((lba >> 8) & 0xFFu));
-    outb(ctx->io + 5, (unsigned char)((lba >> 16) & 0xFFu));
-    outb(ctx->io + 7, ATA_CMD_READ_PIO);
-
-    out = (unsigned short*)buf;
-    for (s = 0; s < count; s++) {
-        if (ata_poll_ready(ctx->io, ctx->ctrl) != 0) return -1;
+    ata_lock(ctx);
+    while (count > 0) {
+        unsigned int chunk = count > ATA_PIO_MAX_SECTORS ? ATA_PIO_MAX_SECTORS : count;
 
-        for (i = 0; i < 256; i++) {
-            out[s * 256u + i] = inw16(ctx->io);
+        if (transfer(ctx, lba, chunk, buf, is_write) != 0) {
+            rc = -1;
+            break;
         }
-        io_delay_400ns(ctx->ctrl);
+        lba += chunk;
+        count -= chunk;
+        buf += chunk * 512u;
     }
+    ata_unlock(ctx);
+    return rc;
+}
 
-    return 0;
+static int ata_pio_read(struct blockdev* dev, unsigned int lba, unsigned int count, void* buf) {
+    return ata_pio_rw(dev, lba, count, (unsigned char*)buf, 0);
 }
 
 static int ata_pio_write(struct blockdev* dev, unsigned int lba, unsigned int count, const void* buf) {
-    ata_ctx_t* ctx;
-    const unsigned short* in;
-    unsigned int i;
-    unsigned int s;
-
-    if (!dev || !buf || count == 0) return -1;
-    if (dev->sector_size != 512) return -1;
-    if (lba + count > dev->sector_count) return -1;
-    if (count > 255) return -1;
-
-    ctx = (ata_ctx_t*)dev->ctx;
-    if (!ctx) return -1;
+    return ata_pio_rw(dev, lba, count, (unsigned char*)buf, 1);
+}
 
-    outb(ctx->ctrl, 0x00);
-    outb(ctx->io + 6, (unsigned char)((ctx->slave ? ATA_SEL_SLAVE : ATA_SEL_MASTER) | ((lba >> 24) & 0x0Fu)));
-    outb(ctx->io + 2, (unsigned char)count);
-    outb(ctx->io + 3, (unsigned char)(lba & 0xFFu));
-    outb(ctx->io + 4, (unsigned char)((lba >> 8) & 0xFFu));
-    outb(ctx->io + 5, (unsigned char)((lba >> 16) & 0xFFu));
-    outb(ctx->io + 7, ATA_CMD_WRITE_PIO);
-
-    in = (const unsigned short*)buf;
-    for (s = 0; s < count; s++) {
-        if (ata_poll_ready(ctx->io, ctx->ctrl) != 0) return -1;
-        for (i = 0; i < 256; i++) {
-            outw(ctx->io, in[s * 256u + i]);
-        }
-        io_delay_400ns(ctx->ctrl);
-    }
+static int ata_pio_flush(struct blockdev* dev) {
+    const ata_ctx_t* ctx;
+    int rc;
 
-    outb(ctx->io + 7, ATA_CMD_CACHE_FLUSH);
-    if (ata_poll_ready(ctx->io, ctx->ctrl) != 0) return -1;
-    return 0;
+    if (!dev || !dev->ctx) return -1;
+    ctx = (const ata_ctx_t*)dev->ctx;
+    ata_lock(ctx);
+    rc = ata_flush(ctx);
+    ata_unlock(ctx);
+    return rc;
 }
 
 static void detect_one(unsigned int index, unsigned short io, unsigned short ctrl, unsigned char slave) {
+    unsigned short identify[256];
     unsigned int sectors;
     blockdev_t dev;
     ata_ctx_t* ctx = &g_ata_ctx[index];
@@ -208,13 +157,26 @@ static void detect_one(unsigned int index, unsigned short io, unsigned short ctr
     ctx->io = io;
     ctx->ctrl = ctrl;
     ctx->slave = slave;
-
-    if (ata_identify(ctx, &sectors) != 0) {
+    ctx->lba48 = 0;
+    ctx->multiple = 0;
+    ctx->chan = 0;
+
+    if (ata_identify(ctx, identify) == 0) {
+        sectors = ata_identify_sectors(ctx, identify);
+    } else {
+        sectors = 0;
+    }
+    if (sectors == 0) {
         console_print("ATA: identify failed on ");
         console_print((io == ATA_PRIMARY_IO) ? "primary " : "secondary ");
         console_print(slave ? "slave\n" : "master\n");
         return;
     }
+    ata_set_multiple(ctx, identify);
+    if (ata_attach(ctx) != 0) {
+        console_print("ATA: no channel slot, skipped\n");
+        return;
+    }
 
     memset(&dev, 0, sizeof(dev));
     memcpy(dev.name, "hd", 2);
@@ -225,7 +187,9 @@ static void detect_one(unsigned int index, unsigned short io, unsigned short ctr
     dev.sector_count = sectors;
     dev.read = ata_pio_read;
     dev.write = ata_pio_write;
+    dev.flush = ata_pio_flush;
     dev.ctx = ctx;
+    dev.disk = ata_disk_id(ctx);
 
     if (block_register(&dev) != 0) {
         console_print("BLOCK: registry full, ATA device skipped\n");
@@ -240,7 +204,13 @@ static void detect_one(unsigned int index, unsigned short io, unsigned short ctr
     print_u32(dev.sector_count);
     console_print(" sectors ");
     print_size_gib(dev.sector_count);
-    console_print(" GiB\n");
+    console_print(" GiB");
+    if (ctx->lba48) console_print(" LBA48");
+    if (ctx->multiple) {
+        console_print(" multiple=");
+        print_u32(ctx->multiple);
+    }
+    console_putc('\n');
 }
 
 void ata_pio_discover(void) {
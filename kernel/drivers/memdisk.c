@@ -0,0 +1,199 @@
+#include "memdisk.h"
+
+#include "../console.h"
+#include "../lib/div64.h"
+#include "../lib/string.h"
+#include "../mem/multiboot2.h"
+#include "../mem/pmm.h"
+#include "../sched/thread.h"
+#include "../tsc.h"
+
+#define MEMDISK_SECTOR 512u
+/* Lets the bio layer run several workers, so injected latency overlaps. */
+#define MEMDISK_QUEUE_DEPTH 4u
+
+typedef struct {
+    uint8_t* base;
+    uint32_t sectors;
+    volatile uint32_t latency_us;
+    int from_module;
+} memdisk_t;
+
+static memdisk_t g_memdisks[MEMDISK_MAX];
+static unsigned int g_memdisk_count;
+
+static void print_u32(unsigned int n) {
+    char buf[11];
+    int i = 0;
+
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+
+    while (i > 0) {
+        i--;
+        console_putc(buf[i]);
+    }
+}
+
+/* Busy device emulation: other threads run while the "device" works. */
+static void inject_latency(const memdisk_t* md, uint64_t start) {
+    uint64_t cycles = div_u64((uint64_t)md->latency_us * tsc_khz(), 1000u, 0);
+
+    if (cycles == 0) return;
+    while (tsc_read() - start < cycles) {
+        if (sched_is_running()) thread_yield();
+        else __asm__ volatile("pause");
+    }
+}
+
+static int memdisk_read(struct blockdev* dev, unsigned int lba, unsigned int count, void* buf) {
+    memdisk_t* md;
+    uint64_t start = tsc_read();
+
+    if (!dev || !buf || count == 0) return -1;
+    if (lba + count > dev->sector_count || lba + count < lba) return -1;
+    md = (memdisk_t*)dev->ctx;
+
+    memcpy(buf, md->base + lba * MEMDISK_SECTOR, count * MEMDISK_SECTOR);
+    inject_latency(md, start);
+    return 0;
+}
+
+static int memdisk_write(struct blockdev* dev, unsigned int lba, unsigned int count, const void* buf) {
+    memdisk_t* md;
+    uint64_t start = tsc_read();
+
+    if (!dev || !buf || count == 0) return -1;
+    if (lba + count > dev->sector_count || lba + count < lba) return -1;
+    md = (memdisk_t*)dev->ctx;
+
+    memcpy(md->base + lba * MEMDISK_SECTOR, buf, count * MEMDISK_SECTOR);
+    inject_latency(md, start);
+    return 0;
+}
+
+static const blockdev_t* register_memdisk(uint8_t* base, uint32_t sectors, int from_module) {
+    memdisk_t* md;
+    blockdev_t dev;
+
+    if (g_memdisk_count >= MEMDISK_MAX || sectors == 0) return 0;
+    md = &g_memdisks[g_memdisk_count];
+    md->base = base;
+    md->sectors = sectors;
+    md->latency_us = 0;
+    md->from_module = from_module;
+
+    memset(&dev, 0, sizeof(dev));
+    memcpy(dev.name, "md", 2);
+    dev.name[2] = (char)('0' + (int)g_memdisk_count);
+    dev.name[3] = 0;
+    dev.type = BLOCKDEV_TYPE_MEMDISK;
+    dev.sector_size = MEMDISK_SECTOR;
+    dev.sector_count = sectors;
+    dev.read = memdisk_read;
+    dev.write = memdisk_write;
+    dev.ctx = md;
+    dev.queue_depth = MEMDISK_QUEUE_DEPTH;
+
+    if (block_register(&dev) != 0) {
+        console_print("BLOCK: registry full, memdisk skipped\n");
+        return 0;
+    }
+    g_memdisk_count++;
+
+    console_print("BLOCK: found ");
+    console_print(dev.name);
+    console_print(from_module ? " MEMDISK module " : " MEMDISK RAM ");
+    print_u32(sectors / 2048u);
+    console_print(" MiB\n");
+    return block_find(dev.name);
+}
+
+static memdisk_t* memdisk_of(const blockdev_t* dev) {
+    unsigned int i;
+
+    if (!dev || dev->type != BLOCKDEV_TYPE_MEMDISK) return 0;
+    for (i = 0; i < g_memdisk_count; i++) {
+        if (dev->ctx == &g_memdisks[i]) return &g_memdisks[i];
+    }
+    return 0;
+}
+
+static int cmdline_has_word(const char* s, const char* word) {
+    size_t len = strlen(word);
+
+    while (*s) {
+        while (*s == ' ') s++;
+        if (strncmp(s, word, len) == 0 && (s[len] == 0 || s[len] == ' ')) return 1;
+        while (*s && *s != ' ') s++;
+    }
+    return 0;
+}
+
+void memdisk_discover(uint32_t mb_magic, uint32_t mb_info_addr) {
+    const struct mb2_info_header* info;
+    const struct mb2_tag* tag;
+    const struct mb2_tag* end_tag;
+
+    if (mb_magic != MULTIBOOT2_BOOTLOADER_MAGIC || mb_info_addr == 0u) return;
+
+    info = (const struct mb2_info_header*)(uintptr_t)mb_info_addr;
+    tag = (const struct mb2_tag*)((uintptr_t)info + 8u);
+    end_tag = (const struct mb2_tag*)((uintptr_t)info + info->total_size - 8u);
+
+    while ((uintptr_t)tag < (uintptr_t)end_tag && tag->type != MULTIBOOT2_TAG_TYPE_END) {
+        if (tag->type == MULTIBOOT2_TAG_TYPE_MODULE) {
+            const struct mb2_tag_module* mod = (const struct mb2_tag_module*)tag;
+
+            /* The module stays reserved in the PMM; trailing partial sectors are ignored. */
+            if (cmdline_has_word(mod->string, "memdisk")) {
+                register_memdisk((uint8_t*)(uintptr_t)mod->mod_start, (mod->mod_end - mod->mod_start) / MEMDISK_SECTOR, 1);
+            }
+        }
+        tag = (const struct mb2_tag*)((uintptr_t)tag + ((tag->size + 7u) & ~7u));
+    }
+}
+
+const blockdev_t* memdisk_create(uint32_t sectors) {
+    uint32_t frames;
+    uint32_t base;
+    const blockdev_t* dev;
+    uint32_t i;
+
+    if (sectors == 0 || g_memdisk_count >= MEMDISK_MAX) return 0;
+    frames = (sectors + (PMM_FRAME_SIZE / MEMDISK_SECTOR) - 1u) / (PMM_FRAME_SIZE / MEMDISK_SECTOR);
+
+    /* Physical memory is identity mapped, so contiguous frames are a flat buffer. */
+    base = pmm_alloc_frames(frames);
+    if (base == 0u) return 0;
+    memset((void*)(uintptr_t)base, 0, frames * PMM_FRAME_SIZE);
+
+    dev = register_memdisk((uint8_t*)(uintptr_t)base, sectors, 0);
+    if (!dev) {
+        for (i = 0; i < frames; i++) pmm_free_frame(base + i * PMM_FRAME_SIZE);
+    }
+    return dev;
+}
+
+int memdisk_set_latency(const blockdev_t* dev, uint32_t latency_us) {
+    memdisk_t* md = memdisk_of(dev);
+
+    if (!md) return -1;
+    md->latency_us = latency_us;
+    return 0;
+}
+
+int memdisk_get_latency(const blockdev_t* dev, uint32_t* latency_us) {
+    memdisk_t* md = memdisk_of(dev);
+
+    if (!md || !latency_us) return -1;
+    *latency_us = md->latency_us;
+    return 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "../block/blockdev.h"
+
+#include <stdint.h>
+
+#define MEMDISK_MAX 4
+
+/*
+ * RAM-backed blockdevs "md0".."md3": multiboot2 modules whose command line
+ * contains the word "memdisk", or PMM frames allocated at runtime. Optional
+ * latency injection makes every request take at least latency_us.
+ */
+void memdisk_discover(uint32_t mb_magic, uint32_t mb_info_addr);
+/* Zero-filled disk of `sectors` 512-byte sectors; returns the registered device or 0. */
+const blockdev_t* memdisk_create(uint32_t sectors);
+int memdisk_set_latency(const blockdev_t* dev, uint32_t latency_us);
+/* -1 if dev is not a memdisk. */
+int memdisk_get_latency(const blockdev_t* dev, uint32_t* latency_us);
@@ -0,0 +1,165 @@
+#include "pci.h"
+
+#include "../console.h"
+#include "../ports.h"
+
+#define PCI_CONFIG_ADDR 0xCF8u
+#define PCI_CONFIG_DATA 0xCFCu
+
+static pci_device_t g_pci_devs[PCI_MAX_DEVICES];
+static uint32_t g_pci_count;
+
+static void print_hex(uint32_t v, int digits) {
+    static const char* hexdig = "0123456789ABCDEF";
+    int shift;
+
+    for (shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+        console_putc(hexdig[(v >> shift) & 0x0Fu]);
+    }
+}
+
+static uint32_t cfg_addr(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off) {
+    return 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)(slot & 0x1Fu) << 11) |
+           ((uint32_t)(func & 0x7u) << 8) | (off & 0xFCu);
+}
+
+uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off) {
+    outl(PCI_CONFIG_ADDR, cfg_addr(bus, slot, func, off));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off, uint32_t v) {
+    outl(PCI_CONFIG_ADDR, cfg_addr(bus, slot, func, off));
+    outl(PCI_CONFIG_DATA, v);
+}
+
+uint8_t pci_read8(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off) {
+    return (uint8_t)(pci_read32(bus, slot, func, off) >> ((off & 3u) * 8u));
+}
+
+uint16_t pci_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off) {
+    return (uint16_t)(pci_read32(bus, slot, func, off) >> ((off & 2u) * 8u));
+}
+
+void pci_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off, uint16_t v) {
+    uint32_t shift = (off & 2u) * 8u;
+    uint32_t cur = pci_read32(bus, slot, func, off);
+
+    cur &= ~(0xFFFFu << shift);
+    cur |= (uint32_t)v << shift;
+    pci_write32(bus, slot, func, off, cur);
+}
+
+static void add_function(uint8_t bus, uint8_t slot, uint8_t func) {
+    uint32_t id = pci_read32(bus, slot, func, 0x00);
+    uint32_t cls = pci_read32(bus, slot, func, 0x08);
+    pci_device_t* d;
+
+    if (g_pci_count >= PCI_MAX_DEVICES) return;
+
+    d = &g_pci_devs[g_pci_count++];
+    d->bus = bus;
+    d->slot = slot;
+    d->func = func;
+    d->vendor_id = (uint16_t)(id & 0xFFFFu);
+    d->device_id = (uint16_t)(id >> 16);
+    d->class_code = (uint8_t)(cls >> 24);
+    d->subclass = (uint8_t)(cls >> 16);
+    d->prog_if = (uint8_t)(cls >> 8);
+    d->irq_line = (uint8_t)(pci_read32(bus, slot, func, PCI_REG_INTERRUPT_LINE) & 0xFFu);
+
+    console_print("PCI: ");
+    print_hex(bus, 2);
+    console_putc(':');
+    print_hex(slot, 2);
+    console_putc('.');
+    print_hex(func, 1);
+    console_putc(' ');
+    print_hex(d->vendor_id, 4);
+    console_putc(':');
+    print_hex(d->device_id, 4);
+    console_print(" class ");
+    print_hex(d->class_code, 2);
+    print_hex(d->subclass, 2);
+    print_hex(d->prog_if, 2);
+    console_putc('\n');
+}
+
+void pci_init(void) {
+    uint32_t bus;
+    uint32_t slot;
+    uint32_t func;
+
+    g_pci_count = 0;
+
+    for (bus = 0; bus < 256u; bus++) {
+        for (slot = 0; slot < 32u; slot++) {
+            uint32_t funcs = 1;
+
+            if ((pci_read32((uint8_t)bus, (uint8_t)slot, 0, 0x00) & 0xFFFFu) == 0xFFFFu) continue;
+            /* Header type bit 7: multi-function device */
+            if (pci_read32((uint8_t)bus, (uint8_t)slot, 0, 0x0C) & 0x00800000u) funcs = 8;
+
+            for (func = 0; func < funcs; func++) {
+                if ((pci_read32((uint8_t)bus, (uint8_t)slot, (uint8_t)func, 0x00) & 0xFFFFu) == 0xFFFFu) continue;
+                add_function((uint8_t)bus, (uint8_t)slot, (uint8_t)func);
+            }
+        }
+    }
+}
+
+uint32_t pci_count(void) {
+    return g_pci_count;
+}
+
+const pci_device_t* pci_get(uint32_t index) {
+    if (index >= g_pci_count) return 0;
+    return &g_pci_devs[index];
+}
+
+const pci_device_t* pci_find_class(uint8_t class_code, uint8_t subclass, uint32_t nth) {
+    uint32_t i;
+
+    for (i = 0; i < g_pci_count; i++) {
+        if (g_pci_devs[i].class_code == class_code && g_pci_devs[i].subclass == subclass) {
+            if (nth == 0) return &g_pci_devs[i];
+            nth--;
+        }
+    }
+    return 0;
+}
+
+/* Raw BAR value; callers mask the I/O (bit 0) or memory type bits themselves. */
+uint32_t pci_bar(const pci_device_t* dev, uint32_t index) {
+    if (!dev || index > 5u) return 0;
+    return pci_read32(dev->bus, dev->slot, dev->func, (uint8_t)(PCI_REG_BAR0 + index * 4u));
+}
+
+void pci_enable(const pci_device_t* dev, uint16_t cmd_bits) {
+    uint16_t cmd;
+
+    if (!dev) return;
+    cmd = pci_read16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND);
+    pci_write16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND, (uint16_t)(cmd | cmd_bits));
+}
+
+uint8_t pci_find_cap(const pci_device_t* dev, uint8_t cap_id, uint8_t from) {
+    uint8_t off;
+    uint32_t guard = 0;
+
+    if (!dev) return 0;
+    if ((pci_read16(dev->bus, dev->slot, dev->func, PCI_REG_STATUS) & PCI_STATUS_CAP_LIST) == 0u) return 0;
+
+    if (from == 0u) {
+        off = pci_read8(dev->bus, dev->slot, dev->func, PCI_REG_CAP_PTR);
+    } else {
+        off = pci_read8(dev->bus, dev->slot, dev->func, (uint8_t)(from + 1u));
+    }
+
+    while (off >= 0x40u && guard++ < 48u) {
+        off &= 0xFCu;
+        if (pci_read8(dev->bus, dev->slot, dev->func, off) == cap_id) return off;
+        off = pci_read8(dev->bus, dev->slot, dev->func, (uint8_t)(off + 1u));
+    }
+    return 0;
+}
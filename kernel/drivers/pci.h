@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PCI_MAX_DEVICES 32
+
+#define PCI_CLASS_STORAGE 0x01u
+#define PCI_SUBCLASS_IDE 0x01u
+#define PCI_SUBCLASS_SATA 0x06u
+
+#define PCI_REG_COMMAND 0x04u
+#define PCI_REG_STATUS 0x06u
+#define PCI_REG_BAR0 0x10u
+#define PCI_REG_CAP_PTR 0x34u
+#define PCI_REG_INTERRUPT_LINE 0x3Cu
+
+#define PCI_STATUS_CAP_LIST 0x0010u
+
+#define PCI_CMD_IO 0x0001u
+#define PCI_CMD_MEMORY 0x0002u
+#define PCI_CMD_BUS_MASTER 0x0004u
+
+typedef struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t irq_line;
+} pci_device_t;
+
+uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off);
+void pci_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off, uint32_t v);
+uint8_t pci_read8(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off);
+uint16_t pci_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off);
+void pci_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t off, uint16_t v);
+
+/* Scans all buses via configuration mechanism #1 and caches the functions found. */
+void pci_init(void);
+uint32_t pci_count(void);
+const pci_device_t* pci_get(uint32_t index);
+const pci_device_t* pci_find_class(uint8_t class_code, uint8_t subclass, uint32_t nth);
+uint32_t pci_bar(const pci_device_t* dev, uint32_t index);
+void pci_enable(const pci_device_t* dev, uint16_t cmd_bits);
+/* Offset of the next capability with this id after 'from' (0 = start of list), 0 if none. */
+uint8_t pci_find_cap(const pci_device_t* dev, uint8_t cap_id, uint8_t from);
@@ -0,0 +1,569 @@
+#include "virtio_blk.h"
+
+#include "pci.h"
+#include "../block/blockdev.h"
+#include "../console.h"
+#include "../isr.h"
+#include "../lib/string.h"
+#include "../mem/paging.h"
+#include "../mem/pmm.h"
+#include "../ports.h"
+#include "../sched/softirq.h"
+#include "../sched/thread.h"
+
+#include <stdint.h>
+
+#define VIRTIO_VENDOR 0x1AF4u
+#define VIRTIO_DEV_BLK_LEGACY 0x1001u
+#define VIRTIO_DEV_BLK_MODERN 0x1042u
+
+#define VBLK_MAX_DEVS 4u
+#define VBLK_QUEUE_MAX 256u
+#define VBLK_MAX_SECTORS 128u
+#define VBLK_MAX_SEGS 18u
+
+/* Legacy I/O BAR layout (no MSI-X) */
+#define VIO_DEVICE_FEATURES 0x00u
+#define VIO_GUEST_FEATURES 0x04u
+#define VIO_QUEUE_PFN 0x08u
+#define VIO_QUEUE_SIZE 0x0Cu
+#define VIO_QUEUE_SELECT 0x0Eu
+#define VIO_QUEUE_NOTIFY 0x10u
+#define VIO_STATUS 0x12u
+#define VIO_ISR 0x13u
+#define VIO_CONFIG 0x14u
+
+/* Modern common configuration layout */
+#define VCC_DFSELECT 0x00u
+#define VCC_DF 0x04u
+#define VCC_GFSELECT 0x08u
+#define VCC_GF 0x0Cu
+#define VCC_STATUS 0x14u
+#define VCC_Q_SELECT 0x16u
+#define VCC_Q_SIZE 0x18u
+#define VCC_Q_ENABLE 0x1Cu
+#define VCC_Q_NOFF 0x1Eu
+#define VCC_Q_DESC 0x20u
+#define VCC_Q_AVAIL 0x28u
+#define VCC_Q_USED 0x30u
+
+#define VIRTIO_PCI_CAP_COMMON 1u
+#define VIRTIO_PCI_CAP_NOTIFY 2u
+#define VIRTIO_PCI_CAP_ISR 3u
+#define VIRTIO_PCI_CAP_DEVICE 4u
+
+#define VIRTIO_STATUS_ACK 0x01u
+#define VIRTIO_STATUS_DRIVER 0x02u
+#define VIRTIO_STATUS_DRIVER_OK 0x04u
+#define VIRTIO_STATUS_FEATURES_OK 0x08u
+
+#define VIRTIO_BLK_F_RO (1u << 5)
+#define VIRTIO_BLK_F_FLUSH (1u << 9)
+#define VIRTIO_F_VERSION_1_HI (1u << 0) /* feature bit 32 */
+
+#define VIRTIO_BLK_T_IN 0u
+#define VIRTIO_BLK_T_OUT 1u
+#define VIRTIO_BLK_T_FLUSH 4u
+
+#define VRING_DESC_F_NEXT 1u
+#define VRING_DESC_F_WRITE 2u
+
+struct vring_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+struct vring_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+};
+
+struct vring_used_elem {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct vring_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct vring_used_elem ring[];
+};
+
+typedef struct {
+    struct {
+        uint32_t type;
+        uint32_t reserved;
+        uint64_t sector;
+    } hdr;
+    volatile uint8_t status;
+    volatile uint8_t done;
+    wait_queue_t wq;
+} vblk_req_t;
+
+typedef struct {
+    uint32_t phys;
+    uint32_t len;
+} vblk_seg_t;
+
+typedef struct {
+    int modern;
+    uint16_t io;
+    volatile uint8_t* common;
+    volatile uint8_t* isr;
+    volatile uint8_t* devcfg;
+    volatile uint16_t* notify;
+
+    uint16_t qsize;
+    struct vring_desc* desc;
+    struct vring_avail* avail;
+    volatile struct vring_used* used;
+    uint16_t free_head;
+    uint16_t num_free;
+    uint16_t last_used;
+    wait_queue_t desc_wq;
+
+    int irq_ok;
+    int read_only;
+    int has_flush;
+    work_t work;
+    vblk_req_t reqs[VBLK_QUEUE_MAX];
+} vblk_t;
+
+static vblk_t g_vblk[VBLK_MAX_DEVS];
+static uint32_t g_vblk_count;
+
+static void print_u32(unsigned int n) {
+    char buf[11];
+    int i = 0;
+
+    if (n == 0) {
+        console_putc('0');
+        return;
+    }
+
+    while (n > 0 && i < (int)sizeof(buf)) {
+        buf[i++] = (char)('0' + (n % 10u));
+        n /= 10u;
+    }
+
+    while (i > 0) {
+        i--;
+        console_putc(buf[i]);
+    }
+}
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+static void mmio_w8(volatile uint8_t* b, uint32_t off, uint8_t v) { *(b + off) = v; }
+static uint8_t mmio_r8(volatile uint8_t* b, uint32_t off) { return *(b + off); }
+static void mmio_w16(volatile uint8_t* b, uint32_t off, uint16_t v) { *(volatile uint16_t*)(b + off) = v; }
+static uint16_t mmio_r16(volatile uint8_t* b, uint32_t off) { return *(volatile uint16_t*)(b + off); }
+static void mmio_w32(volatile uint8_t* b, uint32_t off, uint32_t v) { *(volatile uint32_t*)(b + off) = v; }
+static uint32_t mmio_r32(volatile uint8_t* b, uint32_t off) { return *(volatile uint32_t*)(b + off); }
+
+static uint8_t get_status(vblk_t* d) {
+    return d->modern ? mmio_r8(d->common, VCC_STATUS) : inb((uint16_t)(d->io + VIO_STATUS));
+}
+
+static void set_status(vblk_t* d, uint8_t v) {
+    if (d->modern) mmio_w8(d->common, VCC_STATUS, v);
+    else outb((uint16_t)(d->io + VIO_STATUS), v);
+}
+
+static uint8_t read_isr(vblk_t* d) {
+    return d->modern ? mmio_r8(d->isr, 0) : inb((uint16_t)(d->io + VIO_ISR));
+}
+
+static void notify_queue(vblk_t* d) {
+    if (d->modern) *d->notify = 0;
+    else outw((uint16_t)(d->io + VIO_QUEUE_NOTIFY), 0);
+}
+
+static uint32_t vring_bytes(uint32_t q) {
+    uint32_t first = (16u * q + 6u + 2u * q + 4095u) & ~4095u;
+    return first + ((6u + 8u * q + 4095u) & ~4095u);
+}
+
+/* Legacy layout (desc | avail | pad | used) also satisfies the modern alignment rules. */
+static int setup_ring(vblk_t* d, uint16_t qsize) {
+    uint32_t bytes = vring_bytes(qsize);
+    uint32_t base = pmm_alloc_frames(bytes / PMM_FRAME_SIZE);
+    uint16_t i;
+
+    if (base == 0u) return -1;
+    memset((void*)(uintptr_t)base, 0, bytes);
+
+    d->qsize = qsize;
+    d->desc = (struct vring_desc*)(uintptr_t)base;
+    d->avail = (struct vring_avail*)(uintptr_t)(base + 16u * qsize);
+    d->used = (volatile struct vring_used*)(uintptr_t)(base + ((16u * qsize + 6u + 2u * qsize + 4095u) & ~4095u));
+
+    for (i = 0; i < qsize; i++) {
+        d->desc[i].next = (uint16_t)(i + 1u);
+    }
+    d->free_head = 0;
+    d->num_free = qsize;
+    d->last_used = 0;
+    wait_queue_init(&d->desc_wq);
+    return 0;
+}
+
+/* Runs with IRQs disabled: hand finished chains back to their waiters. */
+static void process_used(vblk_t* d) {
+    while (d->last_used != d->used->idx) {
+        const volatile struct vring_used_elem* e = &d->used->ring[d->last_used % d->qsize];
+        vblk_req_t* req = &d->reqs[e->id];
+
+        req->done = 1;
+        thread_wake_one(&req->wq);
+        d->last_used++;
+    }
+}
+
+static void vblk_softirq(void* arg) {
+    uint32_t flags = irq_save_disable();
+    process_used((vblk_t*)arg);
+    irq_restore(flags);
+}
+
+/* Lines may be shared, so every device's ISR is read (which also deasserts it). */
+static void vblk_irq(void) {
+    uint32_t i;
+
+    for (i = 0; i < g_vblk_count; i++) {
+        if (read_isr(&g_vblk[i]) & 0x01u) {
+            softirq_raise(&g_vblk[i].work, SOFTIRQ_BLOCK);
+        }
+    }
+}
+
+static int build_segs(const void* buf, uint32_t bytes, vblk_seg_t* segs) {
+    uintptr_t va = (uintptr_t)buf;
+    int n = 0;
+
+    while (bytes > 0) {
+        uint32_t phys = translate((uint32_t)va);
+        uint32_t chunk = PMM_FRAME_SIZE - (uint32_t)(va & (PMM_FRAME_SIZE - 1u));
+
+        if (phys == 0u) return -1;
+        if (chunk > bytes) chunk = bytes;
+
+        if (n > 0 && segs[n - 1].phys + segs[n - 1].len == phys) {
+            segs[n - 1].len += chunk;
+        } else {
+            if ((uint32_t)n >= VBLK_MAX_SEGS) return -1;
+            segs[n].phys = phys;
+            segs[n].len = chunk;
+            n++;
+        }
+        va += chunk;
+        bytes -= chunk;
+    }
+    return n;
+}
+
+/* Sleeping needs a completion IRQ and a thread context; boot-time callers poll. */
+static void wait_event(vblk_t* d, wait_queue_t* wq, uint32_t* flags) {
+    if (d->irq_ok && (*flags & 0x200u) && !irq_in_hardirq() && !softirq_in_progress()) {
+        thread_block(wq);
+        return;
+    }
+    irq_restore(*flags);
+    __asm__ volatile("pause");
+    *flags = irq_save_disable();
+    process_used(d);
+}
+
+static int vblk_do(vblk_t* d, uint32_t type, uint32_t sector, const void* buf, uint32_t bytes) {
+    vblk_seg_t segs[VBLK_MAX_SEGS];
+    int nseg = 0;
+    uint16_t needed;
+    uint16_t head;
+    uint16_t idx;
+    vblk_req_t* req;
+    uint32_t flags;
+    int i;
+    int rc;
+
+    if (bytes > 0) {
+        nseg = build_segs(buf, bytes, segs);
+        if (nseg < 0) return -1;
+    }
+    needed = (uint16_t)(nseg + 2);
+
+    flags = irq_save_disable();
+    while (d->num_free < needed) {
+        wait_event(d, &d->desc_wq, &flags);
+    }
+
+    head = d->free_head;
+    idx = head;
+    for (i = 0; i < (int)needed; i++) {
+        idx = d->desc[idx].next;
+    }
+    d->free_head = idx;
+    d->num_free = (uint16_t)(d->num_free - needed);
+
+    req = &d->reqs[head];
+    req->hdr.type = type;
+    req->hdr.reserved = 0;
+    req->hdr.sector = sector;
+    req->status = 0xFF;
+    req->done = 0;
+    wait_queue_init(&req->wq);
+
+    idx = head;
+    d->desc[idx].addr = translate((uint32_t)(uintptr_t)&req->hdr);
+    d->desc[idx].len = sizeof(req->hdr);
+    d->desc[idx].flags = VRING_DESC_F_NEXT;
+    for (i = 0; i < nseg; i++) {
+        idx = d->desc[idx].next;
+        d->desc[idx].addr = segs[i].phys;
+        d->desc[idx].len = segs[i].len;
+        d->desc[idx].flags = (uint16_t)(VRING_DESC_F_NEXT | (type == VIRTIO_BLK_T_IN ? VRING_DESC_F_WRITE : 0u));
+    }
+    idx = d->desc[idx].next;
+    d->desc[idx].addr = translate((uint32_t)(uintptr_t)&req->status);
+    d->desc[idx].len = 1;
+    d->desc[idx].flags = VRING_DESC_F_WRITE;
+
+    d->avail->ring[d->avail->idx % d->qsize] = head;
+    __sync_synchronize();
+    d->avail->idx++;
+    __sync_synchronize();
+    notify_queue(d);
+
+    while (!req->done) {
+        wait_event(d, &req->wq, &flags);
+    }
+    rc = (req->status == 0) ? 0 : -1;
+
+    /* Return the chain to the free list head. */
+    d->desc[idx].next = d->free_head;
+    d->free_head = head;
+    d->num_free = (uint16_t)(d->num_free + needed);
+    thread_wake_all(&d->desc_wq);
+
+    irq_restore(flags);
+    return rc;
+}
+
+static int vblk_read(struct blockdev* dev, unsigned int lba, unsigned int count, void* buf) {
+    if (!dev || !buf || count == 0) return -1;
+    if (lba + count > dev->sector_count || count > VBLK_MAX_SECTORS) return -1;
+    return vblk_do((vblk_t*)dev->ctx, VIRTIO_BLK_T_IN, lba, buf, count * 512u);
+}
+
+static int vblk_write(struct blockdev* dev, unsigned int lba, unsigned int count, const void* buf) {
+    vblk_t* d;
+
+    if (!dev || !buf || count == 0) return -1;
+    if (lba + count > dev->sector_count || count > VBLK_MAX_SECTORS) return -1;
+    d = (vblk_t*)dev->ctx;
+    if (d->read_only) return -1;
+    return vblk_do(d, VIRTIO_BLK_T_OUT, lba, buf, count * 512u);
+}
+
+/* Without VIRTIO_BLK_F_FLUSH the device is write-through. */
+static int vblk_flush(struct blockdev* dev) {
+    vblk_t* d;
+
+    if (!dev || !dev->ctx) return -1;
+    d = (vblk_t*)dev->ctx;
+    return d->has_flush ? vblk_do(d, VIRTIO_BLK_T_FLUSH, 0, 0, 0) : 0;
+}
+
+static volatile uint8_t* map_cap_region(const pci_device_t* pdev, uint8_t cap) {
+    uint8_t bar = pci_read8(pdev->bus, pdev->slot, pdev->func, (uint8_t)(cap + 4u));
+    uint32_t off = pci_read32(pdev->bus, pdev->slot, pdev->func, (uint8_t)(cap + 8u));
+    uint32_t len = pci_read32(pdev->bus, pdev->slot, pdev->func, (uint8_t)(cap + 12u));
+    uint32_t lo;
+    uint32_t base;
+
+    if (bar > 5u) return 0;
+    lo = pci_bar(pdev, bar);
+    if (lo & 1u) return 0;
+    /* 64-bit BAR placed above 4 GiB is unreachable without PAE. */
+    if ((lo & 0x6u) == 0x4u && bar < 5u && pci_bar(pdev, bar + 1u) != 0u) return 0;
+    base = (lo & 0xFFFFFFF0u) + off;
+    if (map_mmio(base, len) != 0) return 0;
+    return (volatile uint8_t*)(uintptr_t)base;
+}
+
+static int init_modern(vblk_t* d, const pci_device_t* pdev, uint32_t* features) {
+    uint8_t cap = 0;
+    uint32_t notify_mult = 0;
+    volatile uint8_t* notify_base = 0;
+    uint16_t qsize;
+    uint16_t noff;
+    uint32_t lo;
+    uint32_t hi;
+
+    while ((cap = pci_find_cap(pdev, 0x09u, cap)) != 0) {
+        uint8_t type = pci_read8(pdev->bus, pdev->slot, pdev->func, (uint8_t)(cap + 3u));
+
+        if (type == VIRTIO_PCI_CAP_COMMON && !d->common) d->common = map_cap_region(pdev, cap);
+        else if (type == VIRTIO_PCI_CAP_ISR && !d->isr) d->isr = map_cap_region(pdev, cap);
+        else if (type == VIRTIO_PCI_CAP_DEVICE && !d->devcfg) d->devcfg = map_cap_region(pdev, cap);
+        else if (type == VIRTIO_PCI_CAP_NOTIFY && !notify_base) {
+            notify_base = map_cap_region(pdev, cap);
+            notify_mult = pci_read32(pdev->bus, pdev->slot, pdev->func, (uint8_t)(cap + 16u));
+        }
+    }
+    if (!d->common || !d->isr || !d->devcfg || !notify_base) return -1;
+    d->modern = 1;
+
+    set_status(d, 0);
+    set_status(d, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    mmio_w32(d->common, VCC_DFSELECT, 0);
+    lo = mmio_r32(d->common, VCC_DF);
+    mmio_w32(d->common, VCC_DFSELECT, 1);
+    hi = mmio_r32(d->common, VCC_DF);
+    if ((hi & VIRTIO_F_VERSION_1_HI) == 0u) return -1;
+
+    *features = lo & (VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH);
+    mmio_w32(d->common, VCC_GFSELECT, 0);
+    mmio_w32(d->common, VCC_GF, *features);
+    mmio_w32(d->common, VCC_GFSELECT, 1);
+    mmio_w32(d->common, VCC_GF, VIRTIO_F_VERSION_1_HI);
+    set_status(d, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK);
+    if ((get_status(d) & VIRTIO_STATUS_FEATURES_OK) == 0u) return -1;
+
+    mmio_w16(d->common, VCC_Q_SELECT, 0);
+    qsize = mmio_r16(d->common, VCC_Q_SIZE);
+    if (qsize == 0u) return -1;
+    if (qsize > VBLK_QUEUE_MAX) {
+        qsize = VBLK_QUEUE_MAX;
+        mmio_w16(d->common, VCC_Q_SIZE, qsize);
+    }
+    if (setup_ring(d, qsize) != 0) return -1;
+
+    mmio_w32(d->common, VCC_Q_DESC, (uint32_t)(uintptr_t)d->desc);
+    mmio_w32(d->common, VCC_Q_DESC + 4u, 0);
+    mmio_w32(d->common, VCC_Q_AVAIL, (uint32_t)(uintptr_t)d->avail);
+    mmio_w32(d->common, VCC_Q_AVAIL + 4u, 0);
+    mmio_w32(d->common, VCC_Q_USED, (uint32_t)(uintptr_t)d->used);
+    mmio_w32(d->common, VCC_Q_USED + 4u, 0);
+    noff = mmio_r16(d->common, VCC_Q_NOFF);
+    d->notify = (volatile uint16_t*)(notify_base + (uint32_t)noff * notify_mult);
+    mmio_w16(d->common, VCC_Q_ENABLE, 1);
+    return 0;
+}
+
+static int init_legacy(vblk_t* d, const pci_device_t* pdev, uint32_t* features) {
+    uint32_t bar0 = pci_bar(pdev, 0);
+    uint16_t qsize;
+
+    if ((bar0 & 1u) == 0u) return -1;
+    d->io = (uint16_t)(bar0 & 0xFFFCu);
+
+    set_status(d, 0);
+    set_status(d, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    *features = inl((uint16_t)(d->io + VIO_DEVICE_FEATURES)) & (VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH);
+    outl((uint16_t)(d->io + VIO_GUEST_FEATURES), *features);
+
+    /* Legacy devices dictate the ring size. */
+    outw((uint16_t)(d->io + VIO_QUEUE_SELECT), 0);
+    qsize = inw((uint16_t)(d->io + VIO_QUEUE_SIZE));
+    if (qsize == 0u || qsize > VBLK_QUEUE_MAX) return -1;
+    if (setup_ring(d, qsize) != 0) return -1;
+
+    outl((uint16_t)(d->io + VIO_QUEUE_PFN), (uint32_t)(uintptr_t)d->desc / PMM_FRAME_SIZE);
+    return 0;
+}
+
+static void probe(const pci_device_t* pdev) {
+    vblk_t* d;
+    uint32_t features = 0;
+    uint32_t cap_lo;
+    uint32_t cap_hi;
+    blockdev_t dev;
+
+    if (g_vblk_count >= VBLK_MAX_DEVS) return;
+    d = &g_vblk[g_vblk_count];
+    memset(d, 0, sizeof(*d));
+
+    pci_enable(pdev, PCI_CMD_IO | PCI_CMD_MEMORY | PCI_CMD_BUS_MASTER);
+    if (init_modern(d, pdev, &features) != 0) {
+        /* Transitional devices also speak the legacy interface. */
+        if (d->modern) set_status(d, 0);
+        d->modern = 0;
+        if (pdev->device_id != VIRTIO_DEV_BLK_LEGACY || init_legacy(d, pdev, &features) != 0) {
+            console_print("virtio-blk: device init failed\n");
+            if (d->io) set_status(d, 0x80u);
+            return;
+        }
+    }
+
+    d->read_only = (features & VIRTIO_BLK_F_RO) != 0u;
+    d->has_flush = (features & VIRTIO_BLK_F_FLUSH) != 0u;
+    work_init(&d->work, vblk_softirq, d);
+
+    if (d->modern) {
+        cap_lo = mmio_r32(d->devcfg, 0);
+        cap_hi = mmio_r32(d->devcfg, 4);
+    } else {
+        cap_lo = inl((uint16_t)(d->io + VIO_CONFIG));
+        cap_hi = inl((uint16_t)(d->io + VIO_CONFIG + 4u));
+    }
+
+    g_vblk_count++;
+    if (pdev->irq_line != 0u && pdev->irq_line < IRQ_COUNT && irq_install_pci_handler(pdev->irq_line, vblk_irq) == 0) {
+        d->irq_ok = 1;
+    }
+    set_status(d, (uint8_t)(get_status(d) | VIRTIO_STATUS_DRIVER_OK));
+
+    memset(&dev, 0, sizeof(dev));
+    memcpy(dev.name, "vd", 2);
+    dev.name[2] = (char)('0' + (int)(g_vblk_count - 1u));
+    dev.name[3] = 0;
+    dev.type = BLOCKDEV_TYPE_VIRTIO;
+    dev.sector_size = 512;
+    dev.sector_count = cap_hi ? 0xFFFFFFFFu : cap_lo;
+    dev.read = vblk_read;
+    dev.write = vblk_write;
+    dev.flush = vblk_flush;
+    dev.ctx = d;
+    dev.queue_depth = d->qsize / (VBLK_MAX_SEGS + 2u);
+    dev.max_sectors = VBLK_MAX_SECTORS;
+
+    if (block_register(&dev) != 0) {
+        console_print("BLOCK: registry full, virtio device skipped\n");
+        return;
+    }
+
+    console_print("BLOCK: found ");
+    console_print(dev.name);
+    console_print(d->modern ? " virtio-blk (modern) " : " virtio-blk (legacy) ");
+    print_u32(dev.sector_count);
+    console_print(" sectors, queue ");
+    print_u32(d->qsize);
+    console_print(d->irq_ok ? ", irq " : ", polled");
+    if (d->irq_ok) print_u32(pdev->irq_line);
+    console_putc('\n');
+}
+
+void virtio_blk_discover(void) {
+    uint32_t i;
+
+    for (i = 0; i < pci_count(); i++) {
+        const pci_device_t* pdev = pci_get(i);
+
+        if (pdev->vendor_id != VIRTIO_VENDOR) continue;
+        if (pdev->device_id != VIRTIO_DEV_BLK_LEGACY && pdev->device_id != VIRTIO_DEV_BLK_MODERN) continue;
+        probe(pdev);
+    }
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+/* virtio-blk over PCI (legacy I/O BAR or modern capabilities); registers vdN blockdevs. */
+void virtio_blk_discover(void);
@@ -28,7 +28,31 @@ EXC 10
 EXC 11
 EXC 12
 EXC 13
-EXC 14
+# 14: page fault, with a real error code. Faults isr_page_fault resolves
+# (vfs_mmap pages) return to the faulting instruction; the rest halts.
+.extern isr_page_fault
+.global isr14_stub
+isr14_stub:
+  pusha
+  pushl 44(%esp)    # eflags of the faulting context
+  pushl 36(%esp)    # err_code
+  mov %cr2, %eax
+  pushl %eax        # faulting address
+  call isr_page_fault
+  add $12, %esp
+  test %eax, %eax
+  jnz 1f
+  popa
+  add $4, %esp      # err_code
+  iret
+1:
+  cli
+  pushl 32(%esp)    # err_code
+  pushl $14
+  call isr_exception_handler
+  add $8, %esp
+  hlt
+  jmp .
 EXC 15
 EXC 16
 EXC 17
@@ -1,4 +1,7 @@
 #include "console.h"
+#include "isr.h"
+#include "fs/vfs.h"
+#include "mem/paging.h"
 #include <stdint.h>
 
 static void print_dec(uint32_t n) {
@@ -18,3 +21,17 @@ void isr_exception_handler(uint32_t int_no, uint32_t err_code) {
     for (;;) { __asm__ volatile("hlt"); }
 }
 
+/*
+ * Not-present faults in the vmap window are vfs_mmap pages that have not
+ * been read yet. Filling one may sleep on disk I/O, so this only happens
+ * when the faulting context had interrupts on and was not an IRQ handler.
+ */
+int isr_page_fault(uint32_t addr, uint32_t err_code, uint32_t eflags) {
+    int rc;
+
+    if ((err_code & 1u) || !(eflags & 0x200u) || irq_in_hardirq() || !vmap_contains(addr)) return -1;
+    __asm__ volatile("sti" : : : "memory");
+    rc = vfs_mmap_fault(addr);
+    __asm__ volatile("cli" : : : "memory");
+    return rc;
+}
@@ -1,11 +1,21 @@
 #include "fat32.h"
 
+#include "../heap.h"
 #include "../lib/string.h"
+#include "../block/bcache.h"
+#include "../block/bio.h"
+#include "../sched/sync.h"
 
+#define FAT32_ATTR_VOLUME_ID 0x08
+#define FAT32_ATTR_DIRECTORY 0x10
 #define FAT32_ATTR_ARCHIVE 0x20
+#define FAT32_ATTR_LFN 0x0F
 #define FAT32_EOC 0x0FFFFFFFu
+#define FAT32_CLEAN_SHUTDOWN 0x08000000u /* in FAT[1]; clear while the volume is in use */
 
 static char g_fat32_last_error[96] = "ok";
+static mutex_t g_fat32_lock;
+static int g_fat32_lock_ready;
 
 static void fat32_set_error(const char* msg) {
     size_t i;
@@ -16,159 +26,2292 @@ static void fat32_set_error(const char* msg) {
     g_fat32_last_error[i] = 0;
 }
 
+/* One lock per driver: FAT scans and directory updates must not interleave. */
+static void fat32_lock(void) {
+    if (!g_fat32_lock_ready) {
+        mutex_init(&g_fat32_lock, "fat32");
+        g_fat32_lock_ready = 1;
+    }
+    mutex_lock(&g_fat32_lock);
+}
+
+static void fat32_unlock(void) {
+    mutex_unlock(&g_fat32_lock);
+}
+
 const char* fat32_last_error(void) {
     return g_fat32_last_error;
 }
 
-void fat32_clear_error(void) {
-    fat32_set_error("ok");
+void fat32_clear_error(void) {
+    fat32_set_error("ok");
+}
+
+int fat32_device_from_blockdev(fat32_device_t* dev, const blockdev_t* bdev) {
+    if (!dev || !bdev || !bdev->read) { fat32_set_error("device or read callback missing"); return -1; }
+    dev->bdev = bdev;
+    dev->sector_size = bdev->sector_size;
+    dev->total_sectors = bdev->sector_count;
+    return 0;
+}
+
+int fat32_io_read(const fat32_device_t* dev, unsigned int sector_lba, unsigned int count, void* out_buf) {
+    if (!dev || !dev->bdev || !dev->bdev->read || !out_buf || count == 0) { fat32_set_error("invalid read call"); return -1; }
+    if (bcache_read(dev->bdev, sector_lba, count, out_buf) != 0) {
+        fat32_set_error("block read failed");
+        return -1;
+    }
+    return 0;
+}
+
+/* Part of one sector, copied from the block cache without a bounce buffer. */
+static int io_read_part(const fat32_device_t* dev, unsigned int lba, unsigned int off, unsigned int len, void* out) {
+    if (bcache_read_bytes(dev->bdev, lba, off, len, out) != 0) {
+        fat32_set_error("block read failed");
+        return -1;
+    }
+    return 0;
+}
+
+int fat32_io_write(const fat32_device_t* dev, unsigned int sector_lba, unsigned int count, const void* in_buf) {
+    if (!dev || !dev->bdev || !dev->bdev->write || !in_buf || count == 0) { fat32_set_error("invalid write call"); return -1; }
+    if (bcache_write(dev->bdev, sector_lba, count, in_buf) != 0) {
+        fat32_set_error("block write failed");
+        return -1;
+    }
+    return 0;
+}
+
+static unsigned short rd16(const unsigned char* p) {
+    return (unsigned short)p[0] | ((unsigned short)p[1] << 8);
+}
+
+static unsigned int rd32(const unsigned char* p) {
+    return (unsigned int)p[0] |
+           ((unsigned int)p[1] << 8) |
+           ((unsigned int)p[2] << 16) |
+           ((unsigned int)p[3] << 24);
+}
+
+static void wr16(unsigned char* p, unsigned short v) {
+    p[0] = (unsigned char)(v & 0xFFu);
+    p[1] = (unsigned char)((v >> 8) & 0xFFu);
+}
+
+static void wr32(unsigned char* p, unsigned int v) {
+    p[0] = (unsigned char)(v & 0xFFu);
+    p[1] = (unsigned char)((v >> 8) & 0xFFu);
+    p[2] = (unsigned char)((v >> 16) & 0xFFu);
+    p[3] = (unsigned char)((v >> 24) & 0xFFu);
+}
+
+static unsigned int cluster_to_lba(const fat32_fs_t* fs, unsigned int cluster) {
+    return fs->data_start_lba + (cluster - 2u) * fs->sectors_per_cluster;
+}
+
+/*
+ * Names are 8-bit strings. Long names are stored as UCS-2 in LFN slots
+ * in front of the short entry; characters outside Latin-1 read back as
+ * '?'. Lookups ignore ASCII case, like FAT itself.
+ */
+#define FAT32_LFN_CHARS 13u
+#define FAT32_LFN_MAX_SLOTS 20u /* 255 characters */
+#define FAT32_LFN_LAST 0x40
+#define FAT32_NT_LOWER_BASE 0x08
+#define FAT32_NT_LOWER_EXT 0x10
+#define FAT32_ALIAS_ATTEMPTS (4u + 9u * 64u)
+
+static const unsigned char g_lfn_char_offsets[FAT32_LFN_CHARS] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+static char fold_char(char c) {
+    return (c >= 'a' && c <= 'z') ? (char)(c - ('a' - 'A')) : c;
+}
+
+static int names_equal(const char* a, const char* b) {
+    while (*a && fold_char(*a) == fold_char(*b)) {
+        a++;
+        b++;
+    }
+    return *a == 0 && *b == 0;
+}
+
+static unsigned int name_hash(unsigned int dir, const char* name) {
+    unsigned int h = 2166136261u ^ dir;
+
+    while (*name) h = (h ^ (unsigned char)fold_char(*name++)) * 16777619u;
+    return h;
+}
+
+static int is_dot_name(const char* name) {
+    return name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0));
+}
+
+static int long_char_valid(unsigned char c) {
+    return c >= 0x20 && c != '"' && c != '*' && c != '/' && c != ':' && c != '<' && c != '>' && c != '?' &&
+           c != '\\' && c != '|';
+}
+
+static int short_char_valid(char c) {
+    const char* extra = "$%'-_@~`!(){}^#&";
+
+    if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) return 1;
+    while (*extra) {
+        if (*extra++ == c) return 1;
+    }
+    return 0;
+}
+
+static char short_case(char c, int lower) {
+    return (lower && c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+/* "README  TXT" -> "README.TXT"; nt_flags are the lowercase bits Windows keeps in byte 12. */
+static void format_name83(const char* name83, unsigned char nt_flags, char* out) {
+    int lower_base = (nt_flags & FAT32_NT_LOWER_BASE) != 0;
+    int lower_ext = (nt_flags & FAT32_NT_LOWER_EXT) != 0;
+    size_t n = 0;
+    size_t i;
+
+    for (i = 0; i < 8 && name83[i] != ' '; i++) out[n++] = short_case(name83[i], lower_base);
+    if (n > 0 && (unsigned char)out[0] == 0x05) out[0] = (char)0xE5;
+    if (name83[8] != ' ') {
+        out[n++] = '.';
+        for (i = 8; i < 11 && name83[i] != ' '; i++) out[n++] = short_case(name83[i], lower_ext);
+    }
+    out[n] = 0;
+}
+
+/*
+ * Checks name and derives its 8.3 form. Returns 0 if the short entry can
+ * hold the name on its own (lowercase parts via the NT flags), 1 if it
+ * needs LFN slots and an alias, -1 if it is not a valid FAT name.
+ */
+static int classify_name(const char* name, char out11[11], unsigned char* nt_flags) {
+    size_t len = strlen(name);
+    size_t dot = len;
+    int lower[2] = { 0, 0 };
+    int upper[2] = { 0, 0 };
+    size_t i;
+
+    if (len == 0 || len > FAT32_NAME_MAX || is_dot_name(name)) return -1;
+    if (name[len - 1] == '.' || name[len - 1] == ' ') return -1;
+    for (i = 0; i < len; i++) {
+        if (!long_char_valid((unsigned char)name[i])) return -1;
+        if (name[i] == '.') dot = i;
+    }
+
+    memset(out11, ' ', 11);
+    *nt_flags = 0;
+    if (dot == 0 || dot > 8 || (dot < len && len - dot - 1 > 3)) return 1;
+    for (i = 0; i < len; i++) {
+        int part = i > dot;
+        char c = name[i];
+
+        if (i == dot) continue;
+        if (c >= 'a' && c <= 'z') lower[part] = 1;
+        if (c >= 'A' && c <= 'Z') upper[part] = 1;
+        c = fold_char(c);
+        if (!short_char_valid(c)) return 1;
+        out11[part ? 8u + (i - dot - 1u) : i] = c;
+    }
+    if ((lower[0] && upper[0]) || (lower[1] && upper[1])) return 1;
+    if (lower[0]) *nt_flags |= FAT32_NT_LOWER_BASE;
+    if (lower[1]) *nt_flags |= FAT32_NT_LOWER_EXT;
+    return 0;
+}
+
+/*
+ * Short alias for a long name: "Quarterly Report.docx" -> "QUARTE~1.DOC".
+ * The first four attempts use a numeric tail like Windows; after that the
+ * base becomes two characters plus four hex digits of a name hash, so a
+ * directory full of similar names does not probe ~1..~N every time.
+ */
+static void make_alias(const char* name, unsigned int attempt, char out11[11]) {
+    const char* ext = 0;
+    const char* p;
+    char base[8];
+    char tail[8];
+    size_t nb = 0;
+    size_t nt = 0;
+    size_t keep;
+    size_t i;
+
+    for (p = name + 1; *p; p++) {
+        if (*p == '.') ext = p;
+    }
+    memset(out11, ' ', 11);
+    for (p = name; *p && p != ext && nb < sizeof(base); p++) {
+        char c = fold_char(*p);
+        if (c == ' ' || c == '.') continue;
+        base[nb++] = short_char_valid(c) ? c : '_';
+    }
+    if (nb == 0) base[nb++] = '_';
+    for (i = 8, p = ext ? ext + 1 : ""; *p && i < 11; p++) {
+        char c = fold_char(*p);
+        if (c == ' ' || c == '.') continue;
+        out11[i++] = short_char_valid(c) ? c : '_';
+    }
+
+    if (attempt <= 4u) {
+        keep = nb < 6u ? nb : 6u;
+        tail[nt++] = '~';
+        tail[nt++] = (char)('0' + attempt);
+    } else {
+        static const char hex[] = "0123456789ABCDEF";
+        unsigned int h = name_hash((attempt - 5u) / 9u, name);
+
+        keep = nb < 2u ? nb : 2u;
+        for (i = 0; i < 4u; i++) base[keep++] = hex[(h >> (12u - 4u * i)) & 0xFu];
+        tail[nt++] = '~';
+        tail[nt++] = (char)('1' + (attempt - 5u) % 9u);
+    }
+    memcpy(out11, base, keep);
+    memcpy(out11 + keep, tail, nt);
+}
+
+static unsigned char lfn_checksum(const unsigned char* name83) {
+    unsigned char sum = 0;
+    unsigned int i;
+
+    for (i = 0; i < 11; i++) sum = (unsigned char)(((sum & 1u) << 7) + (sum >> 1) + name83[i]);
+    return sum;
+}
+
+/* Fills LFN slot ord (1-based, counted from the start of the name). */
+static void lfn_pack(unsigned char slot[32], const char* name, size_t len, unsigned int ord, int last,
+                     unsigned char sum) {
+    size_t first = (ord - 1u) * FAT32_LFN_CHARS;
+    unsigned int i;
+
+    memset(slot, 0, 32);
+    slot[0] = (unsigned char)(ord | (last ? FAT32_LFN_LAST : 0));
+    slot[11] = FAT32_ATTR_LFN;
+    slot[13] = sum;
+    for (i = 0; i < FAT32_LFN_CHARS; i++) {
+        size_t pos = first + i;
+        unsigned short v = 0xFFFFu;
+
+        if (pos < len) v = (unsigned char)name[pos];
+        else if (pos == len) v = 0;
+        wr16(slot + g_lfn_char_offsets[i], v);
+    }
+}
+
+/*
+ * FAT access goes through a small write-back cache of 4 KiB FAT pages
+ * (8 sectors, 1024 entries). Dirty pages are written to every FAT copy
+ * on eviction and on fat32_sync, so one operation touching many entries
+ * costs one write per page instead of one per entry and copy.
+ */
+#define FAT_PAGE_SECTORS 8u
+#define FAT_PAGE_ENTRIES (FAT_PAGE_SECTORS * 128u)
+#define FAT_CACHE_PAGES 16u
+#define FAT_SCAN_SECTORS 64u
+
+typedef struct {
+    unsigned int page;   /* FAT sector index / FAT_PAGE_SECTORS */
+    int valid;
+    int dirty;
+    unsigned int stamp;
+    unsigned int data[FAT_PAGE_ENTRIES];
+} fat_page_t;
+
+struct fat32_fat_cache {
+    fat_page_t pages[FAT_CACHE_PAGES];
+    unsigned int clock;
+    unsigned int hits;
+    unsigned int misses;
+};
+
+static unsigned int fat_page_sectors(const fat32_fs_t* fs, unsigned int page) {
+    unsigned int first = page * FAT_PAGE_SECTORS;
+    unsigned int n = fs->sectors_per_fat - first;
+    return n > FAT_PAGE_SECTORS ? FAT_PAGE_SECTORS : n;
+}
+
+/*
+ * Streaming state of an open file, allocated on first use. Read-ahead
+ * keeps a ring of slots filled with the sectors right after the reader's
+ * position; the window doubles with every prefetch up to one full-size
+ * request and collapses on a seek. Write-behind collects appends and
+ * hands them to the disk in aligned chunks of at least one cluster.
+ */
+#define FAT32_RA_MIN_SECTORS 8u
+#define FAT32_RA_SLOTS 2u
+#define FAT32_WB_BYTES 32768u
+
+typedef struct ra_slot {
+    bio_t bio;
+    unsigned char* data;  /* FAT32_IO_MAX_SECTORS sectors */
+    unsigned int sector;  /* file sector of data[0] */
+    unsigned int lba;     /* disk sector of data[0] */
+    unsigned int count;   /* valid sectors, 0 = empty */
+    int busy;             /* async request in flight */
+} ra_slot_t;
+
+struct fat32_stream {
+    ra_slot_t ra[FAT32_RA_SLOTS];
+    unsigned int window;  /* sectors to keep ahead of the reader, 0 = not streaming */
+    unsigned char* wb_buf;
+    unsigned int wb_cap;
+    unsigned int wb_off;  /* file offset of wb_buf[0] */
+    unsigned int wb_len;
+    struct fat32_stream* next; /* fs->streams */
+};
+
+/*
+ * Every write of the volume passes here: slots holding an overlapping
+ * range are stale now, whichever open handle prefetched them.
+ */
+static void ra_invalidate(fat32_fs_t* fs, unsigned int lba, unsigned int count) {
+    struct fat32_stream* st;
+    unsigned int i;
+
+    for (st = fs->streams; st; st = st->next) {
+        for (i = 0; i < FAT32_RA_SLOTS; i++) {
+            ra_slot_t* s = &st->ra[i];
+
+            if (!s->count || lba >= s->lba + s->count || s->lba >= lba + count) continue;
+            if (s->busy) {
+                s->busy = 0;
+                bio_wait(&s->bio);
+            }
+            s->count = 0;
+        }
+    }
+}
+
+
+/* Writes of a mounted volume are remembered so the next barrier knows there is something to flush. */
+static int fs_write(fat32_fs_t* fs, unsigned int lba, unsigned int count, const void* buf) {
+    fs->unflushed = 1;
+    ra_invalidate(fs, lba, count);
+    return fat32_io_write(fs->dev, lba, count, buf);
+}
+
+/*
+ * Write barrier: everything written so far, including sectors still
+ * dirty in the block cache, is on stable storage when this returns.
+ * Metadata updates are ordered with it so that a crash never leaves a
+ * pointer on disk whose target is not there yet: file data and new
+ * directory clusters, then the FAT, then the directory entry. Freeing
+ * runs the other way round, the entry goes first.
+ */
+static int fat32_barrier(fat32_fs_t* fs) {
+    if (!fs->unflushed) return 0;
+    if (bcache_sync(fs->dev->bdev) != 0 || blockdev_flush(fs->dev->bdev) != 0) {
+        fat32_set_error("write barrier failed");
+        return -1;
+    }
+    fs->unflushed = 0;
+    fs->barriers++;
+    return 0;
+}
+
+static int fat_page_writeback(fat32_fs_t* fs, fat_page_t* pg) {
+    unsigned int lba = fs->fat_start_lba + pg->page * FAT_PAGE_SECTORS;
+    unsigned int n = fat_page_sectors(fs, pg->page);
+    unsigned int f;
+
+    if (!pg->dirty) return 0;
+    for (f = 0; f < fs->fat_count; f++) {
+        if (fs_write(fs, lba + f * fs->sectors_per_fat, n, pg->data) != 0) return -1;
+    }
+    pg->dirty = 0;
+    return 0;
+}
+
+static fat_page_t* fat_page_get(fat32_fs_t* fs, unsigned int page) {
+    struct fat32_fat_cache* fc = fs->fat_cache;
+    fat_page_t* victim;
+    unsigned int i;
+
+    if (!fc || page * FAT_PAGE_SECTORS >= fs->sectors_per_fat) return 0;
+
+    victim = &fc->pages[0];
+    for (i = 0; i < FAT_CACHE_PAGES; i++) {
+        fat_page_t* pg = &fc->pages[i];
+        if (pg->valid && pg->page == page) {
+            pg->stamp = ++fc->clock;
+            fc->hits++;
+            return pg;
+        }
+        if (!pg->valid || (victim->valid && pg->stamp < victim->stamp)) victim = pg;
+    }
+
+    fc->misses++;
+    /* An evicted dirty page may link clusters whose contents are still only in the block cache. */
+    if (victim->valid && victim->dirty && fat32_barrier(fs) != 0) return 0;
+    if (victim->valid && fat_page_writeback(fs, victim) != 0) return 0;
+    victim->valid = 0;
+    if (fat32_io_read(fs->dev, fs->fat_start_lba + page * FAT_PAGE_SECTORS, fat_page_sectors(fs, page), victim->data) != 0) {
+        return 0;
+    }
+    victim->page = page;
+    victim->valid = 1;
+    victim->dirty = 0;
+    victim->stamp = ++fc->clock;
+    return victim;
+}
+
+/*
+ * The clean-shutdown bit in FAT[1] is cleared before the first change
+ * after mount and set again by fat32_unmount, so a volume that was not
+ * unmounted cleanly is recognized on the next mount.
+ */
+static int volume_set_clean(fat32_fs_t* fs, int clean) {
+    fat_page_t* pg = fat_page_get(fs, 0);
+
+    if (!pg) return -1;
+    if (clean) pg->data[1] |= FAT32_CLEAN_SHUTDOWN;
+    else pg->data[1] &= ~FAT32_CLEAN_SHUTDOWN;
+    pg->dirty = 1;
+    if (fat_page_writeback(fs, pg) != 0 || fat32_barrier(fs) != 0) return -1;
+    return 0;
+}
+
+static int volume_mark_dirty(fat32_fs_t* fs) {
+    if (fs->marked_dirty) return 0;
+    if (volume_set_clean(fs, 0) != 0) {
+        fat32_set_error("mark volume dirty failed");
+        return -1;
+    }
+    fs->marked_dirty = 1;
+    return 0;
+}
+
+static int cluster_valid(const fat32_fs_t* fs, unsigned int cluster) {
+    return cluster >= 2u && cluster < fs->total_clusters + 2u;
+}
+
+static int bitmap_test(const fat32_fs_t* fs, unsigned int cluster) {
+    return (fs->used_bitmap[cluster / 32u] >> (cluster % 32u)) & 1u;
+}
+
+/* The free count follows the FAT itself, so it stays right before the bitmap is built. */
+static void bitmap_assign(fat32_fs_t* fs, unsigned int cluster, int was, int used) {
+    unsigned int bit = 1u << (cluster % 32u);
+
+    if (used == was) return;
+    fs->fsinfo_dirty = 1;
+    if (used) {
+        fs->free_count--;
+        if (fs->used_bitmap) fs->used_bitmap[cluster / 32u] |= bit;
+    } else {
+        fs->free_count++;
+        if (fs->used_bitmap) fs->used_bitmap[cluster / 32u] &= ~bit;
+    }
+}
+
+static unsigned int fat_get(fat32_fs_t* fs, unsigned int cluster) {
+    fat_page_t* pg;
+
+    if (!cluster_valid(fs, cluster)) return FAT32_EOC;
+    pg = fat_page_get(fs, cluster / FAT_PAGE_ENTRIES);
+    if (!pg) return FAT32_EOC;
+    return pg->data[cluster % FAT_PAGE_ENTRIES] & 0x0FFFFFFFu;
+}
+
+static int fat_set(fat32_fs_t* fs, unsigned int cluster, unsigned int val) {
+    fat_page_t* pg;
+    unsigned int* e;
+    int was;
+
+    if (!cluster_valid(fs, cluster) || volume_mark_dirty(fs) != 0) return -1;
+    pg = fat_page_get(fs, cluster / FAT_PAGE_ENTRIES);
+    if (!pg) return -1;
+
+    /* The top four bits are reserved and must be preserved. */
+    e = &pg->data[cluster % FAT_PAGE_ENTRIES];
+    was = (*e & 0x0FFFFFFFu) != 0;
+    *e = (*e & 0xF0000000u) | (val & 0x0FFFFFFFu);
+    pg->dirty = 1;
+    bitmap_assign(fs, cluster, was, (val & 0x0FFFFFFFu) != 0);
+    return 0;
+}
+
+static int free_chain(fat32_fs_t* fs, unsigned int cluster) {
+    unsigned int steps = 0;
+
+    while (cluster_valid(fs, cluster) && steps++ < fs->total_clusters) {
+        unsigned int next = fat_get(fs, cluster);
+        if (fat_set(fs, cluster, 0) != 0) return -1;
+        if (cluster < fs->next_free) fs->next_free = cluster;
+        cluster = next;
+    }
+    return 0;
+}
+
+/* Bit helpers for the scratch maps of fat32_check; same layout as used_bitmap. */
+static int bits_test(const unsigned int* map, unsigned int n) {
+    return (map[n / 32u] >> (n % 32u)) & 1u;
+}
+
+static void bits_set(unsigned int* map, unsigned int n) {
+    map[n / 32u] |= 1u << (n % 32u);
+}
+
+/* State of one fat32_check run; scan_fat fills the FAT-wide part. */
+typedef struct {
+    fat32_check_t* out;
+    unsigned int* linked;   /* some FAT entry points here */
+    unsigned int* reached;  /* claimed by a directory entry's chain (or marked bad) */
+    unsigned int* pending;  /* (directory, parent) pairs still to scan */
+    unsigned int pending_count;
+    unsigned int pending_cap;
+    unsigned int dir;
+    unsigned int parent;
+    int saw_dot;
+    int saw_dotdot;
+    int failed;
+} check_ctx_t;
+
+/* Cached FAT page if resident; never loads one. */
+static fat_page_t* fat_page_peek(fat32_fs_t* fs, unsigned int page) {
+    unsigned int i;
+
+    if (!fs->fat_cache) return 0;
+    for (i = 0; i < FAT_CACHE_PAGES; i++) {
+        fat_page_t* pg = &fs->fat_cache->pages[i];
+        if (pg->valid && pg->page == page) return pg;
+    }
+    return 0;
+}
+
+/*
+ * One streaming pass over FAT #0 with large reads that bypass the block
+ * cache; resident FAT pages win over the disk copy since they may be
+ * dirty. Fills used (with clusters 0/1 and the tail padding set) and
+ * returns the free count; chk, if given, collects the check data.
+ */
+static int scan_fat(fat32_fs_t* fs, unsigned int* used, check_ctx_t* chk, unsigned int* free_out) {
+    unsigned int limit = fs->total_clusters + 2u;
+    unsigned int words = (limit + 31u) / 32u;
+    unsigned int* buf;
+    unsigned int sector = 0;
+    unsigned int cluster;
+    unsigned int free_count = 0;
+
+    buf = (unsigned int*)kmalloc(FAT_SCAN_SECTORS * 512u);
+    if (!buf) return -1;
+    memset(used, 0, words * 4u);
+    /* Clusters 0/1 and the padding past the last cluster never get allocated. */
+    used[0] |= 3u;
+    for (cluster = limit; cluster < words * 32u; cluster++) bits_set(used, cluster);
+
+    cluster = 0;
+    while (sector < fs->sectors_per_fat && cluster < limit) {
+        unsigned int n = fs->sectors_per_fat - sector;
+        unsigned int i;
+
+        if (n > FAT_SCAN_SECTORS) n = FAT_SCAN_SECTORS;
+        if (fat32_io_read(fs->dev, fs->fat_start_lba + sector, n, buf) != 0) {
+            kfree(buf);
+            return -1;
+        }
+        for (i = 0; i < n; i += FAT_PAGE_SECTORS) {
+            fat_page_t* pg = fat_page_peek(fs, (sector + i) / FAT_PAGE_SECTORS);
+            if (pg) memcpy(buf + i * 128u, pg->data, fat_page_sectors(fs, pg->page) * 512u);
+        }
+        for (i = 0; i < n * 128u && cluster < limit; i++, cluster++) {
+            unsigned int v = buf[i] & 0x0FFFFFFFu;
+
+            if (cluster < 2u) continue;
+            if (!v) {
+                free_count++;
+                continue;
+            }
+            bits_set(used, cluster);
+            if (!chk) continue;
+            if (v == 0x0FFFFFF7u) {
+                chk->out->bad_clusters++;
+                bits_set(chk->reached, cluster);
+            } else if (v < 0x0FFFFFF8u) {
+                if (cluster_valid(fs, v)) bits_set(chk->linked, v);
+                else chk->out->bad_links++;
+            }
+        }
+        sector += n;
+    }
+
+    kfree(buf);
+    *free_out = free_count;
+    return 0;
+}
+
+static int build_bitmap(fat32_fs_t* fs) {
+    unsigned int words = (fs->total_clusters + 2u + 31u) / 32u;
+    unsigned int* used = (unsigned int*)kmalloc(words * 4u);
+    unsigned int free_count;
+
+    if (!used) return -1;
+    if (scan_fat(fs, used, 0, &free_count) != 0) {
+        kfree(used);
+        return -1;
+    }
+    fs->used_bitmap = used;
+    if (fs->free_count != free_count) fs->fsinfo_dirty = 1;
+    fs->free_count = free_count;
+    return 0;
+}
+
+/*
+ * A mount with a usable FSInfo record does not read the FAT; the bitmap
+ * is built on the first allocation, which also replaces the FSInfo free
+ * count (only a hint) with the exact one.
+ */
+static int bitmap_ready(fat32_fs_t* fs) {
+    if (fs->used_bitmap) return 0;
+    if (build_bitmap(fs) != 0) {
+        fat32_set_error("FAT scan failed");
+        return -1;
+    }
+    return 0;
+}
+
+static int fsinfo_valid(const unsigned char* sec) {
+    return rd32(sec) == 0x41615252u && rd32(sec + 484) == 0x61417272u && rd32(sec + 508) == 0xAA550000u;
+}
+
+/* Reads the FSInfo free count and next-free hint; -1 if there is no valid record. */
+static int read_fsinfo(fat32_fs_t* fs, unsigned int* free_count, unsigned int* hint) {
+    unsigned char sec[512];
+
+    if (fs->fsinfo_sector == 0 || fs->fsinfo_sector >= fs->reserved_sectors) return -1;
+    if (fat32_io_read(fs->dev, fs->fsinfo_sector, 1, sec) != 0 || !fsinfo_valid(sec)) return -1;
+    *free_count = rd32(sec + 488);
+    *hint = rd32(sec + 492);
+    return 0;
+}
+
+/* Word-at-a-time bitmap search from the hint, wrapping once. */
+static int alloc_cluster(fat32_fs_t* fs, unsigned int* out_cluster) {
+    unsigned int limit = fs->total_clusters + 2u;
+    unsigned int words = (limit + 31u) / 32u;
+    unsigned int start = cluster_valid(fs, fs->next_free) ? fs->next_free : 2u;
+    unsigned int w = start / 32u;
+    unsigned int n;
+
+    if (bitmap_ready(fs) != 0 || fs->free_count == 0) return -1;
+
+    for (n = 0; n <= words; n++, w = (w + 1u == words) ? 0u : w + 1u) {
+        unsigned int bits = fs->used_bitmap[w];
+        unsigned int b;
+
+        if (bits == 0xFFFFFFFFu) continue;
+        for (b = 0; b < 32u; b++) {
+            unsigned int c = w * 32u + b;
+            if ((bits >> b) & 1u) continue;
+            if (n == 0 && c < start) continue;
+            if (!cluster_valid(fs, c)) continue;
+
+            if (fat_set(fs, c, FAT32_EOC) != 0) return -1;
+            fs->next_free = c + 1u;
+            *out_cluster = c;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int write_fsinfo(fat32_fs_t* fs) {
+    unsigned char sec[512];
+
+    if (!fs->fsinfo_dirty) return 0;
+    if (fs->fsinfo_sector == 0 || fs->fsinfo_sector >= fs->reserved_sectors) {
+        fs->fsinfo_dirty = 0;
+        return 0;
+    }
+    if (fat32_io_read(fs->dev, fs->fsinfo_sector, 1, sec) != 0) return -1;
+    if (!fsinfo_valid(sec)) {
+        fs->fsinfo_dirty = 0;
+        return 0;
+    }
+    wr32(sec + 488, fs->free_count);
+    wr32(sec + 492, fs->next_free);
+    if (fs_write(fs, fs->fsinfo_sector, 1, sec) != 0) return -1;
+    fs->fsinfo_dirty = 0;
+    return 0;
+}
+
+/* Data written before, then the FAT (every copy) and FSInfo, each behind a barrier. */
+static int fat32_sync_locked(fat32_fs_t* fs) {
+    unsigned int i;
+    int rc = 0;
+
+    if (!fs || !fs->fat_cache) return 0;
+    if (fat32_barrier(fs) != 0) return -1;
+    for (i = 0; i < FAT_CACHE_PAGES; i++) {
+        fat_page_t* pg = &fs->fat_cache->pages[i];
+        if (pg->valid && fat_page_writeback(fs, pg) != 0) rc = -1;
+    }
+    if (write_fsinfo(fs) != 0) rc = -1;
+    if (rc != 0) {
+        fat32_set_error("FAT writeback failed");
+        return -1;
+    }
+    return fat32_barrier(fs);
+}
+
+static void release_mount_state(fat32_fs_t* fs) {
+    kfree(fs->fat_cache);
+    kfree(fs->used_bitmap);
+    kfree(fs->dcache);
+    fs->fat_cache = 0;
+    fs->used_bitmap = 0;
+    fs->dcache = 0;
+}
+
+static int zero_sectors(fat32_device_t* dev, unsigned int lba, unsigned int count) {
+    void* zero = kmalloc(FAT32_IO_MAX_SECTORS * 512u);
+    int rc = 0;
+
+    if (!zero) return -1;
+    memset(zero, 0, FAT32_IO_MAX_SECTORS * 512u);
+    while (count > 0 && rc == 0) {
+        unsigned int n = count > FAT32_IO_MAX_SECTORS ? FAT32_IO_MAX_SECTORS : count;
+        rc = fat32_io_write(dev, lba, n, zero);
+        lba += n;
+        count -= n;
+    }
+    kfree(zero);
+    return rc;
+}
+
+static int zero_cluster(fat32_fs_t* fs, unsigned int cluster) {
+    fs->unflushed = 1;
+    ra_invalidate(fs, cluster_to_lba(fs, cluster), fs->sectors_per_cluster);
+    return zero_sectors(fs->dev, cluster_to_lba(fs, cluster), fs->sectors_per_cluster);
+}
+
+/*
+ * Directories are walked across their whole cluster chain, with long
+ * names assembled from the LFN slots in front of each short entry. Every
+ * entry seen on the way lands in a per-mount cache keyed by (directory
+ * cluster, hash of the case-folded name) that remembers where the entry
+ * starts; long names and short aliases get a key each. Hits are verified
+ * against the (block-cached) directory sectors. A directory that was
+ * scanned to its end without losing cache entries is "complete": a miss
+ * is then a definite "not found", and the position of its first free slot
+ * is remembered so creating files does not rescan it either.
+ */
+#define DCACHE_ENTRIES 8192u
+#define DCACHE_BUCKETS 2048u
+#define DCACHE_DIRS 8u
+#define DCACHE_NONE 0xFFFFu
+
+typedef struct {
+    unsigned int cluster;
+    unsigned int sector; /* within the cluster; sectors_per_cluster = past its end */
+    unsigned int off;
+} dir_pos_t;
+
+/* One directory entry: its LFN run (if any) and the short entry. */
+typedef struct {
+    dir_pos_t start;     /* first slot, the short entry itself without LFN */
+    unsigned int slots;
+    unsigned int lba;    /* sector and offset of the short entry */
+    unsigned int off;
+    unsigned char ent[32];
+    int has_lfn;
+    char name[FAT32_NAME_MAX + 1]; /* long name, or the short one as "NAME.EXT" */
+    char short_name[13];
+} dir_entry_t;
+
+typedef struct {
+    unsigned int dir_cluster;
+    unsigned int hash;
+    unsigned int cluster;  /* first slot of the entry */
+    unsigned short sector;
+    unsigned short off;
+    unsigned short next;
+    unsigned char used;
+} dcache_ent_t;
+
+typedef struct {
+    unsigned int dir_cluster; /* 0 = unused */
+    dir_pos_t free_pos;       /* no free slot before this position */
+} dcache_dir_t;
+
+struct fat32_dcache {
+    dcache_ent_t ents[DCACHE_ENTRIES];
+    unsigned short buckets[DCACHE_BUCKETS];
+    unsigned int victim;
+    dcache_dir_t complete[DCACHE_DIRS];
+    unsigned int complete_next;
+    unsigned int scan_dir;
+    int scan_lost;
+    unsigned int hits;
+    unsigned int misses;
+};
+
+static int dir_pos_equal(const dir_pos_t* a, const dir_pos_t* b) {
+    return a->cluster == b->cluster && a->sector == b->sector && a->off == b->off;
+}
+
+static void dcache_reset(struct fat32_dcache* dc) {
+    unsigned int i;
+
+    memset(dc, 0, sizeof(*dc));
+    for (i = 0; i < DCACHE_BUCKETS; i++) dc->buckets[i] = DCACHE_NONE;
+}
+
+static dcache_dir_t* dcache_complete(struct fat32_dcache* dc, unsigned int dir) {
+    unsigned int i;
+
+    for (i = 0; i < DCACHE_DIRS; i++) {
+        if (dc->complete[i].dir_cluster == dir) return &dc->complete[i];
+    }
+    return 0;
+}
+
+static void dcache_uncomplete(struct fat32_dcache* dc, unsigned int dir) {
+    dcache_dir_t* cd = dcache_complete(dc, dir);
+    if (cd) cd->dir_cluster = 0;
+}
+
+static void dcache_mark_complete(struct fat32_dcache* dc, unsigned int dir, const dir_pos_t* free_pos) {
+    dcache_dir_t* cd = dcache_complete(dc, dir);
+
+    if (!cd) {
+        cd = &dc->complete[dc->complete_next];
+        dc->complete_next = (dc->complete_next + 1u) % DCACHE_DIRS;
+    }
+    cd->dir_cluster = dir;
+    cd->free_pos = *free_pos;
+}
+
+static int dcache_ent_at(const dcache_ent_t* e, const dir_pos_t* pos) {
+    return e->cluster == pos->cluster && e->sector == pos->sector && e->off == pos->off;
+}
+
+static void dcache_unlink(struct fat32_dcache* dc, unsigned int idx) {
+    dcache_ent_t* e = &dc->ents[idx];
+    unsigned short* link = &dc->buckets[e->hash % DCACHE_BUCKETS];
+
+    while (*link != DCACHE_NONE) {
+        if (*link == idx) {
+            *link = e->next;
+            break;
+        }
+        link = &dc->ents[*link].next;
+    }
+    e->used = 0;
+}
+
+static void dcache_insert(struct fat32_dcache* dc, unsigned int dir, unsigned int hash, const dir_pos_t* start) {
+    unsigned int b = hash % DCACHE_BUCKETS;
+    unsigned int idx;
+    dcache_ent_t* e;
+
+    for (idx = dc->buckets[b]; idx != DCACHE_NONE; idx = dc->ents[idx].next) {
+        e = &dc->ents[idx];
+        if (e->dir_cluster == dir && e->hash == hash && dcache_ent_at(e, start)) return;
+    }
+
+    /* FIFO replacement; losing an entry makes its directory incomplete. */
+    idx = dc->victim;
+    dc->victim = (dc->victim + 1u) % DCACHE_ENTRIES;
+    e = &dc->ents[idx];
+    if (e->used) {
+        if (e->dir_cluster == dc->scan_dir) dc->scan_lost = 1;
+        dcache_uncomplete(dc, e->dir_cluster);
+        dcache_unlink(dc, idx);
+    }
+
+    e->dir_cluster = dir;
+    e->hash = hash;
+    e->cluster = start->cluster;
+    e->sector = (unsigned short)start->sector;
+    e->off = (unsigned short)start->off;
+    e->used = 1;
+    e->next = dc->buckets[b];
+    dc->buckets[b] = (unsigned short)idx;
+}
+
+static void dcache_remove(struct fat32_dcache* dc, unsigned int dir, unsigned int hash, const dir_pos_t* start) {
+    unsigned int idx = dc->buckets[hash % DCACHE_BUCKETS];
+
+    while (idx != DCACHE_NONE) {
+        dcache_ent_t* e = &dc->ents[idx];
+        unsigned int next = e->next;
+
+        if (e->dir_cluster == dir && e->hash == hash && dcache_ent_at(e, start)) dcache_unlink(dc, idx);
+        idx = next;
+    }
+}
+
+/* Keys an entry under its long name and, if that differs, its short alias. */
+static void dcache_add_entry(struct fat32_dcache* dc, unsigned int dir, const dir_entry_t* e) {
+    dcache_insert(dc, dir, name_hash(dir, e->name), &e->start);
+    if (e->has_lfn && !names_equal(e->name, e->short_name)) dcache_insert(dc, dir, name_hash(dir, e->short_name), &e->start);
+}
+
+/*
+ * The freed slots may lie before free_pos. Within one cluster the order is
+ * known; across clusters it would need the chain, so the scan restarts at
+ * the directory's first slot instead.
+ */
+static void dcache_drop_entry(struct fat32_dcache* dc, unsigned int dir, const dir_entry_t* e) {
+    dcache_dir_t* cd = dcache_complete(dc, dir);
+
+    dcache_remove(dc, dir, name_hash(dir, e->name), &e->start);
+    dcache_remove(dc, dir, name_hash(dir, e->short_name), &e->start);
+    if (!cd) return;
+    if (e->start.cluster != cd->free_pos.cluster) {
+        cd->free_pos.cluster = dir;
+        cd->free_pos.sector = 0;
+        cd->free_pos.off = 0;
+    } else if (e->start.sector * 512u + e->start.off < cd->free_pos.sector * 512u + cd->free_pos.off) {
+        cd->free_pos = e->start;
+    }
+}
+
+static void dcache_purge_dir(struct fat32_dcache* dc, unsigned int dir) {
+    unsigned int i;
+
+    for (i = 0; i < DCACHE_ENTRIES; i++) {
+        if (dc->ents[i].used && dc->ents[i].dir_cluster == dir) dcache_unlink(dc, i);
+    }
+    dcache_uncomplete(dc, dir);
+}
+
+static unsigned int dir_pos_lba(const fat32_fs_t* fs, const dir_pos_t* pos) {
+    return cluster_to_lba(fs, pos->cluster) + pos->sector;
+}
+
+static int dirent_is_visible(const unsigned char* ent) {
+    return ent[0] != 0x00 && ent[0] != 0xE5 && (ent[11] & FAT32_ATTR_LFN) != FAT32_ATTR_LFN &&
+           !(ent[11] & FAT32_ATTR_VOLUME_ID);
+}
+
+static unsigned int dirent_cluster(const unsigned char* ent) {
+    return ((unsigned int)rd16(ent + 20) << 16) | rd16(ent + 26);
+}
+
+/* ".." of a first-level directory stores cluster 0 for the root. */
+static unsigned int dirent_dir_cluster(const fat32_fs_t* fs, const unsigned char* ent) {
+    unsigned int c = dirent_cluster(ent);
+    return c ? c : fs->root_cluster;
+}
+
+typedef int (*dir_visit_fn)(fat32_fs_t* fs, const dir_pos_t* pos, const unsigned char* ent, void* user);
+
+/*
+ * Visits every slot from *pos on, following the cluster chain. Returns 1
+ * with *pos on the slot where visit returned nonzero, 0 at the end of the
+ * chain (*pos just past the last cluster) and -1 on I/O errors.
+ */
+static int dir_walk(fat32_fs_t* fs, dir_pos_t* pos, dir_visit_fn visit, void* user) {
+    unsigned char sec[512];
+    unsigned int clusters = 0;
+
+    for (;;) {
+        if (pos->sector >= fs->sectors_per_cluster) {
+            unsigned int next = fat_get(fs, pos->cluster);
+            if (!cluster_valid(fs, next) || ++clusters > fs->total_clusters) return 0;
+            pos->cluster = next;
+            pos->sector = 0;
+            pos->off = 0;
+        }
+        if (fat32_io_read(fs->dev, dir_pos_lba(fs, pos), 1, sec) != 0) {
+            fat32_set_error("read directory failed");
+            return -1;
+        }
+        for (; pos->off < 512u; pos->off += 32u) {
+            if (visit(fs, pos, sec + pos->off, user)) return 1;
+        }
+        pos->sector++;
+        pos->off = 0;
+    }
+}
+
+typedef int (*entry_visit_fn)(fat32_fs_t* fs, const dir_entry_t* e, void* user);
+
+typedef struct {
+    entry_visit_fn fn;
+    void* user;
+    int stopped;
+    int have_free;
+    dir_pos_t free_pos;
+    unsigned int lfn_ord;   /* ord of the last LFN slot seen, 0 = no run */
+    unsigned int lfn_slots;
+    unsigned char lfn_sum;
+    dir_entry_t e;
+} entry_walk_t;
+
+/*
+ * LFN slots come in descending order, the one flagged LAST first. A run
+ * only names the short entry right behind it if it is unbroken down to
+ * ord 1 and its checksum matches; anything else is an orphan and ignored.
+ */
+static void lfn_feed(entry_walk_t* w, const dir_pos_t* pos, const unsigned char* ent) {
+    unsigned int ord = ent[0] & 0x1Fu;
+    size_t first;
+    unsigned int i;
+
+    if (ent[0] & FAT32_LFN_LAST) {
+        if (ord == 0 || ord > FAT32_LFN_MAX_SLOTS) {
+            w->lfn_ord = 0;
+            return;
+        }
+        first = ord * FAT32_LFN_CHARS;
+        w->e.start = *pos;
+        w->e.name[first < FAT32_NAME_MAX ? first : FAT32_NAME_MAX] = 0;
+        w->lfn_sum = ent[13];
+        w->lfn_slots = ord;
+    } else if (w->lfn_ord < 2u || ord != w->lfn_ord - 1u || ent[13] != w->lfn_sum) {
+        w->lfn_ord = 0;
+        return;
+    }
+    w->lfn_ord = ord;
+
+    first = (ord - 1u) * FAT32_LFN_CHARS;
+    for (i = 0; i < FAT32_LFN_CHARS && first + i < FAT32_NAME_MAX; i++) {
+        unsigned short c = rd16(ent + g_lfn_char_offsets[i]);
+
+        if (c == 0) {
+            w->e.name[first + i] = 0;
+            break;
+        }
+        w->e.name[first + i] = c > 0xFFu ? '?' : (char)c;
+    }
+}
+
+static int visit_entries(fat32_fs_t* fs, const dir_pos_t* pos, const unsigned char* ent, void* user) {
+    entry_walk_t* w = (entry_walk_t*)user;
+    dir_entry_t* e = &w->e;
+
+    if (ent[0] == 0x00 || ent[0] == 0xE5) {
+        if (!w->have_free) {
+            w->free_pos = *pos;
+            w->have_free = 1;
+        }
+        w->lfn_ord = 0;
+        return ent[0] == 0x00;
+    }
+    if ((ent[11] & FAT32_ATTR_LFN) == FAT32_ATTR_LFN) {
+        lfn_feed(w, pos, ent);
+        return 0;
+    }
+    if (ent[11] & FAT32_ATTR_VOLUME_ID) {
+        w->lfn_ord = 0;
+        return 0;
+    }
+
+    format_name83((const char*)ent, ent[12], e->short_name);
+    e->has_lfn = w->lfn_ord == 1u && lfn_checksum(ent) == w->lfn_sum && e->name[0] != 0;
+    w->lfn_ord = 0;
+    if (e->has_lfn) {
+        e->slots = w->lfn_slots + 1u;
+    } else {
+        e->start = *pos;
+        e->slots = 1;
+        memcpy(e->name, e->short_name, sizeof(e->short_name));
+    }
+    e->lba = dir_pos_lba(fs, pos);
+    e->off = pos->off;
+    memcpy(e->ent, ent, 32);
+
+    if (w->fn(fs, e, w->user)) {
+        w->stopped = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Visits every entry (visible short entry with its long name) from *pos
+ * on. Returns 1 with *pos on the short entry where fn returned nonzero,
+ * 0 at the end of the directory and -1 on I/O errors. free_pos, if given,
+ * receives the first free slot seen or the end of the chain.
+ */
+static int dir_walk_entries(fat32_fs_t* fs, dir_pos_t* pos, entry_visit_fn fn, void* user, dir_pos_t* free_pos) {
+    entry_walk_t w;
+    int rc;
+
+    w.fn = fn;
+    w.user = user;
+    w.stopped = 0;
+    w.have_free = 0;
+    w.lfn_ord = 0;
+    rc = dir_walk(fs, pos, visit_entries, &w);
+    if (rc < 0) return -1;
+    if (free_pos) *free_pos = w.have_free ? w.free_pos : *pos;
+    return w.stopped;
+}
+
+static int entry_matches(const dir_entry_t* e, const char* name) {
+    return names_equal(e->name, name) || names_equal(e->short_name, name);
+}
+
+typedef struct {
+    dir_pos_t start;
+    dir_entry_t* out;
+    int found;
+} dir_probe_t;
+
+static int visit_probe(fat32_fs_t* fs, const dir_entry_t* e, void* user) {
+    dir_probe_t* p = (dir_probe_t*)user;
+
+    (void)fs;
+    if (dir_pos_equal(&e->start, &p->start)) {
+        *p->out = *e;
+        p->found = 1;
+    }
+    return 1;
+}
+
+/* Reads the entry whose first slot is at start: 0 if there is one, 1 if not, -1 on errors. */
+static int dir_read_at(fat32_fs_t* fs, const dir_pos_t* start, dir_entry_t* out) {
+    dir_probe_t probe;
+    dir_pos_t pos = *start;
+
+    probe.start = *start;
+    probe.out = out;
+    probe.found = 0;
+    if (dir_walk_entries(fs, &pos, visit_probe, &probe, 0) < 0) return -1;
+    return probe.found ? 0 : 1;
+}
+
+typedef struct {
+    unsigned int dir;
+    const char* name;
+    dir_entry_t* out;
+    int found;
+} dir_scan_t;
+
+static int visit_scan(fat32_fs_t* fs, const dir_entry_t* e, void* user) {
+    dir_scan_t* s = (dir_scan_t*)user;
+
+    dcache_add_entry(fs->dcache, s->dir, e);
+    if (!s->found && entry_matches(e, s->name)) {
+        *s->out = *e;
+        s->found = 1;
+    }
+    return 0;
+}
+
+/*
+ * Returns 0 and the entry if name (long or short, any case) exists in
+ * dir, 1 if it does not, -1 on errors. Cache candidates whose slots no
+ * longer hold an entry under that key are dropped; a different name that
+ * merely shares the hash is kept.
+ */
+static int dir_lookup(fat32_fs_t* fs, unsigned int dir, const char* name, dir_entry_t* out) {
+    struct fat32_dcache* dc = fs->dcache;
+    unsigned int hash = name_hash(dir, name);
+    unsigned int idx = dc->buckets[hash % DCACHE_BUCKETS];
+    dir_scan_t scan;
+    dir_pos_t pos;
+    dir_pos_t free_pos;
+    int rc;
+
+    while (idx != DCACHE_NONE) {
+        dcache_ent_t* e = &dc->ents[idx];
+        unsigned int next = e->next;
+
+        if (e->dir_cluster == dir && e->hash == hash) {
+            pos.cluster = e->cluster;
+            pos.sector = e->sector;
+            pos.off = e->off;
+            rc = dir_read_at(fs, &pos, out);
+            if (rc < 0) return -1;
+            if (rc == 0 && entry_matches(out, name)) {
+                dc->hits++;
+                return 0;
+            }
+            if (rc > 0 || (name_hash(dir, out->name) != hash && name_hash(dir, out->short_name) != hash)) {
+                dcache_unlink(dc, idx);
+                dcache_uncomplete(dc, dir);
+            }
+        }
+        idx = next;
+    }
+    if (dcache_complete(dc, dir)) {
+        dc->hits++;
+        return 1;
+    }
+
+    /* Full scan; it also fills the cache for the rest of the directory. */
+    dc->misses++;
+    scan.dir = dir;
+    scan.name = name;
+    scan.out = out;
+    scan.found = 0;
+    pos.cluster = dir;
+    pos.sector = 0;
+    pos.off = 0;
+    dc->scan_dir = dir;
+    dc->scan_lost = 0;
+    rc = dir_walk_entries(fs, &pos, visit_scan, &scan, &free_pos);
+    dc->scan_dir = 0;
+    if (rc < 0) return -1;
+    if (!dc->scan_lost) dcache_mark_complete(dc, dir, &free_pos);
+    return scan.found ? 0 : 1;
+}
+
+typedef struct {
+    unsigned int need;
+    unsigned int len;
+    dir_pos_t start;
+} free_run_t;
+
+static int visit_free_run(fat32_fs_t* fs, const dir_pos_t* pos, const unsigned char* ent, void* user) {
+    free_run_t* run = (free_run_t*)user;
+
+    (void)fs;
+    if (ent[0] != 0x00 && ent[0] != 0xE5) {
+        run->len = 0;
+        return 0;
+    }
+    if (run->len == 0) run->start = *pos;
+    return ++run->len == run->need;
+}
+
+/* Writes count slots from *pos on (ents 0: mark them deleted); leaves *pos on the last one. */
+static int dir_put_slots(fat32_fs_t* fs, dir_pos_t* pos, const unsigned char* ents, unsigned int count) {
+    unsigned char sec[512];
+    unsigned int i = 0;
+
+    if (volume_mark_dirty(fs) != 0) return -1;
+    for (;;) {
+        unsigned int lba;
+
+        if (pos->sector >= fs->sectors_per_cluster) {
+            unsigned int next = fat_get(fs, pos->cluster);
+            if (!cluster_valid(fs, next)) { fat32_set_error("directory chain broken"); return -1; }
+            pos->cluster = next;
+            pos->sector = 0;
+        }
+        lba = dir_pos_lba(fs, pos);
+        if (fat32_io_read(fs->dev, lba, 1, sec) != 0) { fat32_set_error("read directory failed"); return -1; }
+        for (;;) {
+            if (ents) memcpy(sec + pos->off, ents + i * 32u, 32);
+            else sec[pos->off] = 0xE5;
+            if (++i == count || pos->off + 32u >= 512u) break;
+            pos->off += 32u;
+        }
+        if (fs_write(fs, lba, 1, sec) != 0) { fat32_set_error("write directory entry failed"); return -1; }
+        if (i == count) return 0;
+        pos->sector++;
+        pos->off = 0;
+    }
+}
+
+/*
+ * Stores count consecutive slots (LFN run, then the short entry) in dir,
+ * growing the directory by zeroed clusters until they fit. Fills the
+ * location fields of out.
+ */
+static int dir_add(fat32_fs_t* fs, unsigned int dir, const unsigned char* ents, unsigned int count, dir_entry_t* out) {
+    dcache_dir_t* cd = dcache_complete(fs->dcache, dir);
+    free_run_t run;
+    dir_pos_t pos;
+    int from_first_free;
+    int rc;
+
+    if (cd) {
+        pos = cd->free_pos;
+    } else {
+        pos.cluster = dir;
+        pos.sector = 0;
+        pos.off = 0;
+    }
+    from_first_free = cd != 0;
+
+    run.need = count;
+    run.len = 0;
+    rc = dir_walk(fs, &pos, visit_free_run, &run);
+    if (rc < 0) return -1;
+    while (rc == 0 && run.len < count) {
+        unsigned int c;
+
+        if (alloc_cluster(fs, &c) != 0) { fat32_set_error("no free cluster for directory"); return -1; }
+        /* Zeroed before it is linked: a FAT page written back early must not chain in stale entries. */
+        if (zero_cluster(fs, c) != 0) {
+            fat32_set_error("clear directory cluster failed");
+            return -1;
+        }
+        if (fat_set(fs, pos.cluster, c) != 0) { fat32_set_error("link directory cluster failed"); return -1; }
+        if (run.len == 0) {
+            run.start.cluster = c;
+            run.start.sector = 0;
+            run.start.off = 0;
+        }
+        run.len += fs->sectors_per_cluster * 16u;
+        pos.cluster = c;
+    }
+    if (cd && !dir_pos_equal(&run.start, &cd->free_pos) && cd->free_pos.sector < fs->sectors_per_cluster) {
+        from_first_free = 0;
+    }
+
+    /* New clusters must be zeroed on disk before the FAT links them in. */
+    if (rc == 0 && fat32_sync_locked(fs) != 0) return -1;
+    pos = run.start;
+    if (dir_put_slots(fs, &pos, ents, count) != 0) return -1;
+    out->start = run.start;
+    out->slots = count;
+    out->lba = dir_pos_lba(fs, &pos);
+    out->off = pos.off;
+    memcpy(out->ent, ents + (count - 1u) * 32u, 32);
+    if (from_first_free) {
+        cd->free_pos = pos;
+        cd->free_pos.off += 32u;
+    }
+    return 0;
+}
+
+static int visit_nonempty(fat32_fs_t* fs, const dir_pos_t* pos, const unsigned char* ent, void* user) {
+    (void)fs;
+    (void)pos;
+    if (ent[0] == 0x00) return 1;
+    if (!dirent_is_visible(ent) || ent[0] == '.') return 0;
+    *(int*)user = 1;
+    return 1;
+}
+
+static int dir_is_empty(fat32_fs_t* fs, unsigned int dir) {
+    dir_pos_t pos;
+    int found = 0;
+
+    pos.cluster = dir;
+    pos.sector = 0;
+    pos.off = 0;
+    if (dir_walk(fs, &pos, visit_nonempty, &found) < 0) return -1;
+    return !found;
+}
+
+/* Copies the next path component (without slashes) and advances *path. */
+static int next_component(const char** path, char* out, size_t cap) {
+    const char* p = *path;
+    size_t n = 0;
+
+    while (*p == '/') p++;
+    if (!*p) return 0;
+    while (*p && *p != '/') {
+        if (n + 1 >= cap) return -1;
+        out[n++] = *p++;
+    }
+    out[n] = 0;
+    *path = p;
+    return 1;
+}
+
+/*
+ * Resolves every component but the last. Leaves the cluster of the parent
+ * directory in *out_dir and the last component in leaf (FAT32_NAME_MAX + 1
+ * bytes).
+ */
+static int resolve_parent(fat32_fs_t* fs, const char* path, unsigned int* out_dir, char* leaf) {
+    unsigned int dir = fs->root_cluster;
+    char next[FAT32_NAME_MAX + 1];
+    dir_entry_t e;
+    int rc;
+
+    if (!path) { fat32_set_error("invalid path"); return -1; }
+    rc = next_component(&path, leaf, FAT32_NAME_MAX + 1);
+    if (rc <= 0) { fat32_set_error(rc < 0 ? "path component too long" : "empty path"); return -1; }
+
+    for (;;) {
+        rc = next_component(&path, next, sizeof(next));
+        if (rc < 0) { fat32_set_error("path component too long"); return -1; }
+        if (rc == 0) break;
+
+        if (strcmp(leaf, ".") == 0) {
+            /* "." stays in dir */
+        } else if (dir == fs->root_cluster && strcmp(leaf, "..") == 0) {
+            /* ".." of the root is the root */
+        } else {
+            rc = dir_lookup(fs, dir, leaf, &e);
+            if (rc < 0) return -1;
+            if (rc > 0) { fat32_set_error("directory not found"); return -1; }
+            if (!(e.ent[11] & FAT32_ATTR_DIRECTORY)) { fat32_set_error("not a directory"); return -1; }
+            dir = dirent_dir_cluster(fs, e.ent);
+        }
+        memcpy(leaf, next, sizeof(next));
+    }
+
+    *out_dir = dir;
+    return 0;
+}
+
+/* Resolves a path that must name a directory; "" and "/" are the root. */
+static int resolve_dir(fat32_fs_t* fs, const char* path, unsigned int* out_dir) {
+    unsigned int parent;
+    char leaf[FAT32_NAME_MAX + 1];
+    dir_entry_t e;
+    const char* p = path;
+    int rc;
+
+    if (!path || next_component(&p, leaf, sizeof(leaf)) == 0) {
+        *out_dir = fs->root_cluster;
+        return 0;
+    }
+    if (resolve_parent(fs, path, &parent, leaf) != 0) return -1;
+    if (strcmp(leaf, ".") == 0 || (parent == fs->root_cluster && strcmp(leaf, "..") == 0)) {
+        *out_dir = parent;
+        return 0;
+    }
+    rc = dir_lookup(fs, parent, leaf, &e);
+    if (rc < 0) return -1;
+    if (rc > 0) { fat32_set_error("directory not found"); return -1; }
+    if (!(e.ent[11] & FAT32_ATTR_DIRECTORY)) { fat32_set_error("not a directory"); return -1; }
+    *out_dir = dirent_dir_cluster(fs, e.ent);
+    return 0;
+}
+
+static void make_dirent(unsigned char ent[32], const char name83[11], unsigned char attr, unsigned int cluster) {
+    memset(ent, 0, 32);
+    memcpy(ent, name83, 11);
+    ent[11] = attr;
+    wr16(ent + 20, (unsigned short)((cluster >> 16) & 0xFFFFu));
+    wr16(ent + 26, (unsigned short)(cluster & 0xFFFFu));
+}
+
+/*
+ * Open files keep an extent map of their cluster chain: runs of physically
+ * contiguous clusters, filled lazily from the FAT as the file is accessed.
+ * Data I/O goes straight to the device in requests spanning whole runs;
+ * only unaligned head and tail bytes take the one-sector bounce path.
+ */
+static void map_reset(fat32_file_t* f) {
+    f->extent_count = 0;
+    f->mapped = 0;
+    f->chain_len = 0;
+    f->cursor_idx = 0;
+    f->cursor_cluster = 0;
+}
+
+/* Appends disk cluster c as file cluster f->mapped. */
+static int map_push(fat32_file_t* f, unsigned int c) {
+    fat32_extent_t* e = f->extent_count ? &f->extents[f->extent_count - 1] : 0;
+
+    if (e && e->disk_cluster + e->count == c) {
+        e->count++;
+        f->mapped++;
+        return 0;
+    }
+    if (f->extent_count == FAT32_FILE_EXTENTS) return -1;
+    e = &f->extents[f->extent_count++];
+    e->file_cluster = f->mapped;
+    e->disk_cluster = c;
+    e->count = 1;
+    f->mapped++;
+    return 0;
+}
+
+static int map_lookup(const fat32_file_t* f, unsigned int idx, unsigned int* cluster, unsigned int* run) {
+    unsigned int lo = 0;
+    unsigned int hi = f->extent_count;
+
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2u;
+        const fat32_extent_t* e = &f->extents[mid];
+
+        if (idx < e->file_cluster) {
+            hi = mid;
+        } else if (idx >= e->file_cluster + e->count) {
+            lo = mid + 1u;
+        } else {
+            *cluster = e->disk_cluster + (idx - e->file_cluster);
+            *run = e->count - (idx - e->file_cluster);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Resolves file cluster idx to a disk cluster and the number of contiguous
+ * clusters starting there. Walks the FAT only past the mapped prefix; once
+ * the extent table is full a cursor keeps sequential access O(1) per step.
+ */
+static int file_map(fat32_file_t* f, unsigned int idx, unsigned int* cluster, unsigned int* run) {
+    fat32_fs_t* fs = f->fs;
+    unsigned int limit = FAT32_IO_MAX_SECTORS / fs->sectors_per_cluster + 1u;
+    const fat32_extent_t* e;
+    unsigned int pos;
+    unsigned int cur;
+
+    if (f->chain_len && idx >= f->chain_len) return -1;
+    if (map_lookup(f, idx, cluster, run) == 0 && (idx + *run < f->mapped || *run >= limit || f->chain_len == f->mapped)) {
+        return 0;
+    }
+    if (!cluster_valid(fs, f->first_cluster)) return -1;
+    if (f->mapped == 0) map_push(f, f->first_cluster);
+
+    e = &f->extents[f->extent_count - 1];
+    pos = f->mapped - 1u;
+    cur = e->disk_cluster + e->count - 1u;
+    if (f->cursor_cluster && f->cursor_idx > pos && f->cursor_idx <= idx) {
+        pos = f->cursor_idx;
+        cur = f->cursor_cluster;
+    }
+
+    for (;;) {
+        unsigned int next;
+
+        /* Past idx, keep going only to grow the last extent for a larger request. */
+        if (pos >= idx && (pos + 1u != f->mapped || pos - idx + 1u >= limit)) break;
+        next = fat_get(fs, cur);
+        /* A chain longer than the volume must loop; treat it as ending here. */
+        if (!cluster_valid(fs, next) || pos + 1u >= fs->total_clusters) {
+            f->chain_len = pos + 1u;
+            break;
+        }
+        if (pos >= idx && next != cur + 1u) break;
+        cur = next;
+        pos++;
+        if (pos == f->mapped && map_push(f, cur) == 0) continue;
+        f->cursor_idx = pos;
+        f->cursor_cluster = cur;
+    }
+
+    if (map_lookup(f, idx, cluster, run) == 0) return 0;
+    if (pos != idx) return -1;
+
+    *cluster = cur;
+    *run = 1;
+    while (*run < limit && fat_get(fs, cur) == cur + 1u) {
+        cur++;
+        (*run)++;
+    }
+    return 0;
+}
+
+static int file_chain_length(fat32_file_t* f, unsigned int* out_len) {
+    unsigned int c;
+    unsigned int run;
+
+    if (!cluster_valid(f->fs, f->first_cluster)) {
+        *out_len = 0;
+        return 0;
+    }
+    while (!f->chain_len) {
+        unsigned int idx = f->cursor_cluster && f->cursor_idx >= f->mapped ? f->cursor_idx : f->mapped;
+        if (file_map(f, idx + FAT32_IO_MAX_SECTORS, &c, &run) != 0 && !f->chain_len) {
+            fat32_set_error("broken cluster chain");
+            return -1;
+        }
+    }
+    *out_len = f->chain_len;
+    return 0;
+}
+
+/* Extends the chain to need clusters, preferring the cluster right after the tail. */
+static int file_grow(fat32_file_t* f, unsigned int need) {
+    fat32_fs_t* fs = f->fs;
+    unsigned int have;
+    unsigned int last = 0;
+    unsigned int run;
+
+    if (file_chain_length(f, &have) != 0) return -1;
+    if (have > 0 && file_map(f, have - 1u, &last, &run) != 0) { fat32_set_error("broken cluster chain"); return -1; }
+
+    while (have < need) {
+        unsigned int c;
+
+        if (last && cluster_valid(fs, last + 1u)) fs->next_free = last + 1u;
+        if (alloc_cluster(fs, &c) != 0) { fat32_set_error("no free cluster available"); return -1; }
+        if (last) {
+            if (fat_set(fs, last, c) != 0) { fat32_set_error("link cluster failed"); return -1; }
+        } else {
+            f->first_cluster = c;
+            f->dirty = 1;
+        }
+        if (have == f->mapped && map_push(f, c) == 0) {
+            /* mapped prefix grows with the chain */
+        } else {
+            f->cursor_idx = have;
+            f->cursor_cluster = c;
+        }
+        last = c;
+        have++;
+        f->chain_len = have;
+    }
+    return 0;
+}
+
+static struct fat32_stream* stream_get(fat32_file_t* f) {
+    if (!f->stream) {
+        f->stream = (struct fat32_stream*)kmalloc(sizeof(*f->stream));
+        if (f->stream) {
+            memset(f->stream, 0, sizeof(*f->stream));
+            f->stream->next = f->fs->streams;
+            f->fs->streams = f->stream;
+        }
+    }
+    return f->stream;
+}
+
+static unsigned int file_sectors(const fat32_file_t* f) {
+    return f->size / 512u + (f->size % 512u ? 1u : 0u);
+}
+
+/*
+ * The async read went around the buffer cache, so sectors cached there
+ * (possibly dirty) replace what came from the disk. A failed prefetch
+ * just leaves the slot empty; the reader falls back to a direct read.
+ */
+static void ra_wait(fat32_file_t* f, ra_slot_t* s) {
+    if (!s->busy) return;
+    s->busy = 0;
+    if (bio_wait(&s->bio) != 0) {
+        s->count = 0;
+        return;
+    }
+    bcache_overlay(f->fs->dev->bdev, s->bio.lba, s->count, s->data);
+}
+
+static void ra_drop(fat32_file_t* f) {
+    unsigned int i;
+
+    if (!f->stream) return;
+    for (i = 0; i < FAT32_RA_SLOTS; i++) {
+        ra_wait(f, &f->stream->ra[i]);
+        f->stream->ra[i].count = 0;
+    }
+    f->stream->window = 0;
+}
+
+/* Fills s with up to window sectors from file sector first, one contiguous run. */
+static void ra_start(fat32_file_t* f, ra_slot_t* s, unsigned int first) {
+    fat32_fs_t* fs = f->fs;
+    unsigned int spc = fs->sectors_per_cluster;
+    unsigned int cluster;
+    unsigned int run;
+    unsigned int lba;
+    unsigned int count;
+
+    if (!s->data) {
+        s->data = (unsigned char*)kmalloc(FAT32_IO_MAX_SECTORS * 512u);
+        if (!s->data) return;
+    }
+    if (file_map(f, first / spc, &cluster, &run) != 0) return;
+    lba = cluster_to_lba(fs, cluster) + first % spc;
+    count = run * spc - first % spc;
+    if (count > f->stream->window) count = f->stream->window;
+    if (count > file_sectors(f) - first) count = file_sectors(f) - first;
+
+    s->sector = first;
+    s->lba = lba;
+    s->count = count;
+    fs->ra_requests++;
+    /*
+     * Dirty cached sectors go to the disk first: written back and evicted
+     * while the bio is in flight, they could no longer be overlaid.
+     */
+    if (block_can_queue() && bcache_writeback(fs->dev->bdev, lba, count) == 0) {
+        bio_init(&s->bio, fs->dev->bdev, BIO_READ, lba, count, s->data);
+        if (blockdev_submit(&s->bio) == 0) {
+            s->busy = 1;
+            return;
+        }
+    }
+    /* No scheduler yet: still worth it, one large read instead of many small ones. */
+    if (bcache_read(fs->dev->bdev, lba, count, s->data) != 0) s->count = 0;
+}
+
+/* Slot holding the byte at offset, waited for; sets *avail to the bytes from there on. */
+static ra_slot_t* ra_find(fat32_file_t* f, unsigned int offset, size_t* avail) {
+    unsigned int sector = offset / 512u;
+    unsigned int i;
+
+    if (!f->stream) return 0;
+    for (i = 0; i < FAT32_RA_SLOTS; i++) {
+        ra_slot_t* s = &f->stream->ra[i];
+
+        if (!s->count || sector < s->sector || sector - s->sector >= s->count) continue;
+        ra_wait(f, s);
+        if (!s->count) return 0;
+        *avail = (size_t)(s->sector + s->count - sector) * 512u - offset % 512u;
+        if (*avail > f->size - offset) *avail = f->size - offset;
+        return s;
+    }
+    return 0;
+}
+
+/* Serves the read at offset from a slot; returns the bytes copied, 0 on a miss. */
+static size_t ra_copy(fat32_file_t* f, unsigned int offset, unsigned char* out, size_t n) {
+    size_t avail;
+    ra_slot_t* s = ra_find(f, offset, &avail);
+
+    if (!s) return 0;
+    if (avail > n) avail = n;
+    memcpy(out, s->data + (offset - s->sector * 512u), avail);
+    f->fs->ra_hits++;
+    return avail;
+}
+
+/* Shortens a direct read of count sectors so it stops where a slot begins. */
+static unsigned int ra_gap(const fat32_file_t* f, unsigned int sector, unsigned int count) {
+    unsigned int i;
+
+    if (!f->stream) return count;
+    for (i = 0; i < FAT32_RA_SLOTS; i++) {
+        const ra_slot_t* s = &f->stream->ra[i];
+        if (s->count && s->sector > sector && s->sector - sector < count) count = s->sector - sector;
+    }
+    return count;
+}
+
+/* Starts the next prefetch once less than a window is buffered past offset. */
+static void ra_advance(fat32_file_t* f, unsigned int offset) {
+    struct fat32_stream* st = f->stream;
+    unsigned int cur = offset / 512u;
+    unsigned int hi = cur;
+    ra_slot_t* idle = 0;
+    unsigned int i;
+    int grown = 1;
+
+    while (grown) {
+        grown = 0;
+        for (i = 0; i < FAT32_RA_SLOTS; i++) {
+            ra_slot_t* s = &st->ra[i];
+            if (s->count && s->sector <= hi && s->sector + s->count > hi) {
+                hi = s->sector + s->count;
+                grown = 1;
+            }
+        }
+    }
+    for (i = 0; i < FAT32_RA_SLOTS && !idle; i++) {
+        ra_slot_t* s = &st->ra[i];
+        if (!s->count || s->sector + s->count <= cur || s->sector > hi) {
+            ra_wait(f, s);
+            idle = s;
+        }
+    }
+    if (!idle || hi >= file_sectors(f) || hi - cur >= st->window) return;
+
+    ra_start(f, idle, hi);
+    if (st->window < FAT32_IO_MAX_SECTORS) st->window *= 2u;
+}
+
+static void stream_release(fat32_file_t* f) {
+    struct fat32_stream** link;
+    unsigned int i;
+
+    if (!f->stream) return;
+    ra_drop(f);
+    for (i = 0; i < FAT32_RA_SLOTS; i++) {
+        if (f->stream->ra[i].data) kfree(f->stream->ra[i].data);
+    }
+    if (f->stream->wb_buf) kfree(f->stream->wb_buf);
+    for (link = &f->fs->streams; *link; link = &(*link)->next) {
+        if (*link == f->stream) {
+            *link = f->stream->next;
+            break;
+        }
+    }
+    kfree(f->stream);
+    f->stream = 0;
+}
+
+static int file_write_core(fat32_file_t* f, unsigned int offset, const void* buf, size_t n) {
+    fat32_fs_t* fs = f->fs;
+    unsigned int cbytes = fs->sectors_per_cluster * 512u;
+    const unsigned char* in = (const unsigned char*)buf;
+    unsigned char sec[512];
+    unsigned int end;
+    size_t done = 0;
+
+    if (offset > f->size) { fat32_set_error("write past end of file"); return -1; }
+    if (n == 0) return 0;
+    if (n > 0xFFFFFFFFu - offset) { fat32_set_error("file too large"); return -1; }
+    if (volume_mark_dirty(fs) != 0) return -1;
+    end = offset + (unsigned int)n;
+    if (file_grow(f, (end + cbytes - 1u) / cbytes) != 0) return -1;
+
+    while (done < n) {
+        unsigned int cluster;
+        unsigned int run;
+        unsigned int in_cluster = offset % cbytes;
+        unsigned int avail;
+        unsigned int lba;
+        unsigned int b = offset % 512u;
+
+        if (file_map(f, offset / cbytes, &cluster, &run) != 0) { fat32_set_error("broken cluster chain"); return -1; }
+        lba = cluster_to_lba(fs, cluster) + in_cluster / 512u;
+        avail = run * fs->sectors_per_cluster - in_cluster / 512u;
+
+        if (b == 0 && n - done >= 512u) {
+            unsigned int count = (unsigned int)((n - done) / 512u);
+            if (count > avail) count = avail;
+            if (count > FAT32_IO_MAX_SECTORS) count = FAT32_IO_MAX_SECTORS;
+            if (fs_write(fs, lba, count, in + done) != 0) { fat32_set_error("write file data failed"); return -1; }
+            done += count * 512u;
+            offset += count * 512u;
+        } else {
+            size_t part = 512u - b;
+            if (part > n - done) part = n - done;
+            /* Only sectors holding existing data need a read-modify-write. */
+            if (offset - b < f->size) {
+                if (fat32_io_read(fs->dev, lba, 1, sec) != 0) { fat32_set_error("read file data failed"); return -1; }
+            } else {
+                memset(sec, 0, sizeof(sec));
+            }
+            memcpy(sec + b, in + done, part);
+            if (fs_write(fs, lba, 1, sec) != 0) { fat32_set_error("write file data failed"); return -1; }
+            done += part;
+            offset += (unsigned int)part;
+        }
+    }
+
+    if (end > f->size) {
+        f->size = end;
+        f->dirty = 1;
+    }
+    return (int)done;
+}
+
+/* Writes the buffered appends; f->size already counts them. */
+static int wb_flush(fat32_file_t* f) {
+    struct fat32_stream* st = f->stream;
+    unsigned int len;
+
+    if (!st || !st->wb_len) return 0;
+    len = st->wb_len;
+    st->wb_len = 0;
+    f->size = st->wb_off;
+    f->fs->wb_flushes++;
+    return file_write_core(f, st->wb_off, st->wb_buf, len) == (int)len ? 0 : -1;
 }
 
-int fat32_device_from_blockdev(fat32_device_t* dev, const blockdev_t* bdev) {
-    if (!dev || !bdev || !bdev->read) { fat32_set_error("device or read callback missing"); return -1; }
-    dev->bdev = bdev;
-    dev->sector_size = bdev->sector_size;
-    dev->total_sectors = bdev->sector_count;
+/* Writes size and first cluster back into the directory entry. */
+static int file_store_dirent(fat32_file_t* f) {
+    unsigned char sec[512];
+
+    if (volume_mark_dirty(f->fs) != 0) return -1;
+    if (fat32_io_read(f->fs->dev, f->dir_lba, 1, sec) != 0) { fat32_set_error("read directory entry failed"); return -1; }
+    wr16(sec + f->dir_off + 20, (unsigned short)((f->first_cluster >> 16) & 0xFFFFu));
+    wr16(sec + f->dir_off + 26, (unsigned short)(f->first_cluster & 0xFFFFu));
+    wr32(sec + f->dir_off + 28, f->size);
+    if (fs_write(f->fs, f->dir_lba, 1, sec) != 0) { fat32_set_error("write directory entry failed"); return -1; }
+    f->dirty = 0;
     return 0;
 }
 
-int fat32_io_read(const fat32_device_t* dev, unsigned int sector_lba, unsigned int count, void* out_buf) {
-    if (!dev || !dev->bdev || !dev->bdev->read || !out_buf || count == 0) { fat32_set_error("invalid read call"); return -1; }
-    if (dev->bdev->read((blockdev_t*)dev->bdev, sector_lba, count, out_buf) != 0) {
-        fat32_set_error("block read failed");
-        return -1;
-    }
+static int file_truncate_locked(fat32_file_t* f) {
+    unsigned int first = f->first_cluster;
+
+    ra_drop(f);
+    if (f->stream) f->stream->wb_len = 0;
+    f->first_cluster = 0;
+    f->size = 0;
+    f->dirty = 1;
+    map_reset(f);
+    if (!first) return 0;
+
+    /* The entry lets go of the chain on disk before the chain is freed. */
+    if (file_store_dirent(f) != 0 || fat32_barrier(f->fs) != 0) return -1;
+    if (free_chain(f->fs, first) != 0) { fat32_set_error("free cluster chain failed"); return -1; }
     return 0;
 }
 
-int fat32_io_write(const fat32_device_t* dev, unsigned int sector_lba, unsigned int count, const void* in_buf) {
-    if (!dev || !dev->bdev || !dev->bdev->write || !in_buf || count == 0) { fat32_set_error("invalid write call"); return -1; }
-    if (dev->bdev->write((blockdev_t*)dev->bdev, sector_lba, count, in_buf) != 0) {
-        fat32_set_error("block write failed");
-        return -1;
+static int file_read_locked(fat32_file_t* f, unsigned int offset, void* buf, size_t n) {
+    fat32_fs_t* fs = f->fs;
+    unsigned int cbytes = fs->sectors_per_cluster * 512u;
+    unsigned char* out = (unsigned char*)buf;
+    size_t done = 0;
+
+    if (offset >= f->size) return 0;
+    if (n > f->size - offset) n = f->size - offset;
+    if (wb_flush(f) != 0) return -1;
+
+    if (offset != f->seq_next) {
+        ra_drop(f);
+    } else if (offset + n < f->size && stream_get(f) && !f->stream->window) {
+        f->stream->window = FAT32_RA_MIN_SECTORS;
     }
-    return 0;
+
+    while (done < n) {
+        size_t got = ra_copy(f, offset, out + done, n - done);
+        unsigned int cluster;
+        unsigned int run;
+        unsigned int in_cluster = offset % cbytes;
+        unsigned int avail;
+        unsigned int lba;
+        unsigned int b = offset % 512u;
+
+        if (got) {
+            done += got;
+            offset += (unsigned int)got;
+            continue;
+        }
+        if (file_map(f, offset / cbytes, &cluster, &run) != 0) { fat32_set_error("cluster chain shorter than file"); return -1; }
+        lba = cluster_to_lba(fs, cluster) + in_cluster / 512u;
+        avail = run * fs->sectors_per_cluster - in_cluster / 512u;
+
+        if (b == 0 && n - done >= 512u) {
+            /* Only runs above the bcache bypass size reach the caller's buffer without a copy. */
+            unsigned int count = (unsigned int)((n - done) / 512u);
+            if (count > avail) count = avail;
+            if (count > FAT32_IO_MAX_SECTORS) count = FAT32_IO_MAX_SECTORS;
+            count = ra_gap(f, offset / 512u, count);
+            if (fat32_io_read(fs->dev, lba, count, out + done) != 0) { fat32_set_error("read file data failed"); return -1; }
+            done += count * 512u;
+            offset += count * 512u;
+        } else {
+            size_t part = 512u - b;
+            if (part > n - done) part = n - done;
+            if (io_read_part(fs->dev, lba, b, (unsigned int)part, out + done) != 0) { fat32_set_error("read file data failed"); return -1; }
+            done += part;
+            offset += (unsigned int)part;
+        }
+    }
+
+    f->seq_next = offset;
+    if (f->stream && f->stream->window) ra_advance(f, offset);
+    return (int)done;
 }
 
-static unsigned short rd16(const unsigned char* p) {
-    return (unsigned short)p[0] | ((unsigned short)p[1] << 8);
+/* Slot to refill after a miss at offset: one that is empty or already consumed. */
+static ra_slot_t* ra_victim(fat32_file_t* f, unsigned int offset) {
+    unsigned int cur = offset / 512u;
+    unsigned int i;
+
+    for (i = 0; i < FAT32_RA_SLOTS; i++) {
+        ra_slot_t* s = &f->stream->ra[i];
+        if (!s->count || s->sector + s->count <= cur) break;
+    }
+    if (i == FAT32_RA_SLOTS) i = 0;
+    ra_wait(f, &f->stream->ra[i]);
+    return &f->stream->ra[i];
 }
 
-static unsigned int rd32(const unsigned char* p) {
-    return (unsigned int)p[0] |
-           ((unsigned int)p[1] << 8) |
-           ((unsigned int)p[2] << 16) |
-           ((unsigned int)p[3] << 24);
+/*
+ * Hands out the read-ahead buffers themselves instead of copying: the
+ * device fills a slot, the callback reads it once. The next slot is
+ * already in flight while the callback runs.
+ */
+static int file_read_pages_locked(fat32_file_t* f, unsigned int offset, size_t n, fat32_page_cb_t cb, void* user) {
+    size_t done = 0;
+
+    if (offset >= f->size) return 0;
+    if (n > f->size - offset) n = f->size - offset;
+    if (wb_flush(f) != 0) return -1;
+    if (!stream_get(f)) { fat32_set_error("out of memory for read buffers"); return -1; }
+    if (offset != f->seq_next) ra_drop(f);
+    if (f->stream->window < FAT32_RA_MIN_SECTORS) f->stream->window = FAT32_RA_MIN_SECTORS;
+
+    while (done < n) {
+        size_t avail;
+        ra_slot_t* s = ra_find(f, offset, &avail);
+        int stop;
+
+        if (s) {
+            f->fs->ra_hits++;
+        } else {
+            ra_start(f, ra_victim(f, offset), offset / 512u);
+            s = ra_find(f, offset, &avail);
+            if (!s) { fat32_set_error("read file data failed"); return -1; }
+        }
+        if (avail > n - done) avail = n - done;
+
+        /* Before the callback, so the device works while the data is consumed. */
+        ra_advance(f, offset);
+        stop = cb(s->data + (offset - s->sector * 512u), avail, user);
+        done += avail;
+        offset += (unsigned int)avail;
+        f->seq_next = offset;
+        if (stop) break;
+    }
+    return (int)done;
 }
 
-static void wr16(unsigned char* p, unsigned short v) {
-    p[0] = (unsigned char)(v & 0xFFu);
-    p[1] = (unsigned char)((v >> 8) & 0xFFu);
+/*
+ * Appends go through the write-behind buffer; everything else flushes it
+ * and writes in place. Large appends skip the copy once the buffer is
+ * drained and the offset is chunk-aligned.
+ */
+static int file_write_locked(fat32_file_t* f, unsigned int offset, const void* buf, size_t n) {
+    unsigned int cbytes = f->fs->sectors_per_cluster * 512u;
+    const unsigned char* in = (const unsigned char*)buf;
+    struct fat32_stream* st;
+    size_t done = 0;
+
+    if (offset > f->size) { fat32_set_error("write past end of file"); return -1; }
+    if (n == 0) return 0;
+    if (n > 0xFFFFFFFFu - offset) { fat32_set_error("file too large"); return -1; }
+    ra_drop(f);
+
+    st = f->stream;
+    if (offset != f->size || (n >= FAT32_WB_BYTES && !(st && st->wb_len))) {
+        if (wb_flush(f) != 0) return -1;
+        return file_write_core(f, offset, buf, n);
+    }
+    st = stream_get(f);
+    if (st && !st->wb_buf) {
+        st->wb_cap = cbytes > FAT32_WB_BYTES ? cbytes : FAT32_WB_BYTES;
+        st->wb_buf = (unsigned char*)kmalloc(st->wb_cap);
+    }
+    if (!st || !st->wb_buf) return file_write_core(f, offset, buf, n);
+
+    while (done < n) {
+        unsigned int room;
+        size_t part;
+
+        if (!st->wb_len) {
+            st->wb_off = f->size;
+            if (st->wb_off % st->wb_cap == 0 && n - done >= st->wb_cap) {
+                part = (n - done) - (n - done) % st->wb_cap;
+                if (file_write_core(f, st->wb_off, in + done, part) < 0) return -1;
+                done += part;
+                continue;
+            }
+        }
+        room = st->wb_cap - (st->wb_off + st->wb_len) % st->wb_cap;
+        part = n - done;
+        if (part > room) part = room;
+        memcpy(st->wb_buf + st->wb_len, in + done, part);
+        st->wb_len += (unsigned int)part;
+        done += part;
+        f->size = st->wb_off + st->wb_len;
+        if ((st->wb_off + st->wb_len) % st->wb_cap == 0 && wb_flush(f) != 0) return -1;
+    }
+    f->fs->wb_appends++;
+    return (int)done;
 }
 
-static void wr32(unsigned char* p, unsigned int v) {
-    p[0] = (unsigned char)(v & 0xFFu);
-    p[1] = (unsigned char)((v >> 8) & 0xFFu);
-    p[2] = (unsigned char)((v >> 16) & 0xFFu);
-    p[3] = (unsigned char)((v >> 24) & 0xFFu);
+/* Buffered appends, FAT and FSInfo first, then the directory entry, each step behind a barrier. */
+static int file_commit_locked(fat32_file_t* f) {
+    if (wb_flush(f) != 0 || fat32_sync_locked(f->fs) != 0) return -1;
+    if (!f->dirty) return 0;
+    if (file_store_dirent(f) != 0) return -1;
+    return fat32_barrier(f->fs);
 }
 
-static unsigned int cluster_to_lba(const fat32_fs_t* fs, unsigned int cluster) {
-    return fs->data_start_lba + (cluster - 2u) * fs->sectors_per_cluster;
+static void file_init(fat32_file_t* f, fat32_fs_t* fs, const unsigned char ent[32], unsigned int lba, unsigned int off) {
+    f->fs = fs;
+    f->dir_lba = lba;
+    f->dir_off = off;
+    f->first_cluster = dirent_cluster(ent);
+    f->size = rd32(ent + 28);
+    f->dirty = 0;
+    f->seq_next = 0;
+    f->stream = 0;
+    map_reset(f);
 }
 
-static int make_name83(const char* name, char out11[11]) {
-    size_t i;
-    size_t pos = 0;
-    size_t ext_pos = 8;
+static int file_open_locked(fat32_fs_t* fs, const char* path, fat32_file_t* f) {
+    char leaf[FAT32_NAME_MAX + 1];
+    dir_entry_t e;
+    unsigned int dir;
+    int rc;
 
-    for (i = 0; i < 11; i++) out11[i] = ' ';
-    if (!name || !name[0]) return -1;
+    if (!fs || !f) { fat32_set_error("invalid open arguments"); return -1; }
+    if (resolve_parent(fs, path, &dir, leaf) != 0) return -1;
+    rc = dir_lookup(fs, dir, leaf, &e);
+    if (rc < 0) return -1;
+    if (rc > 0) { fat32_set_error("file not found"); return -1; }
+    if (e.ent[11] & FAT32_ATTR_DIRECTORY) { fat32_set_error("is a directory"); return -1; }
 
-    for (i = 0; name[i]; i++) {
-        char c = name[i];
-        if (c == '.') {
-            if (pos == 0 || pos > 8 || ext_pos != 8) return -1;
-            pos = ext_pos;
-            continue;
-        }
+    file_init(f, fs, e.ent, e.lba, e.off);
+    return 0;
+}
 
-        if (c >= 'a' && c <= 'z') c = (char)(c - ('a' - 'A'));
-        if (!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) {
-            return -1;
-        }
+/* Picks an 8.3 alias for name that no entry of dir uses, neither as short nor as long name. */
+static int pick_alias(fat32_fs_t* fs, unsigned int dir, const char* name, char out11[11]) {
+    char alias[13];
+    dir_entry_t e;
+    unsigned int attempt;
+    int rc;
+
+    for (attempt = 1; attempt <= FAT32_ALIAS_ATTEMPTS; attempt++) {
+        make_alias(name, attempt, out11);
+        format_name83(out11, 0, alias);
+        rc = dir_lookup(fs, dir, alias, &e);
+        if (rc < 0) return -1;
+        if (rc > 0) return 0;
+    }
+    fat32_set_error("no free short name");
+    return -1;
+}
 
-        if (pos < 8) {
-            out11[pos++] = c;
-        } else if (pos >= 8 && pos < 11) {
-            out11[pos++] = c;
-        } else {
+/*
+ * Adds a new file or directory entry to dir; the name must not exist yet.
+ * Names that do not fit 8.3 get LFN slots and a generated alias.
+ */
+static int create_at_locked(fat32_fs_t* fs, unsigned int dir, const char* name, int is_dir, dir_entry_t* out) {
+    unsigned char slots[(FAT32_LFN_MAX_SLOTS + 1u) * 32u];
+    unsigned char sec[512];
+    unsigned char nt_flags;
+    unsigned int count = 1;
+    unsigned int c = 0;
+    char name83[11];
+    char dot83[11];
+    int rc;
+
+    rc = classify_name(name, name83, &nt_flags);
+    if (rc < 0) { fat32_set_error("invalid filename"); return -1; }
+    if (rc > 0) {
+        size_t len = strlen(name);
+        unsigned int n = (unsigned int)((len + FAT32_LFN_CHARS - 1u) / FAT32_LFN_CHARS);
+        unsigned char sum;
+        unsigned int i;
+
+        if (pick_alias(fs, dir, name, name83) != 0) return -1;
+        sum = lfn_checksum((const unsigned char*)name83);
+        for (i = 0; i < n; i++) lfn_pack(slots + i * 32u, name, len, n - i, i == 0, sum);
+        count = n + 1u;
+    }
+
+    if (is_dir) {
+        if (alloc_cluster(fs, &c) != 0) { fat32_set_error("no free cluster available"); return -1; }
+        if (zero_cluster(fs, c) != 0) {
+            fat32_set_error("clear directory cluster failed");
             return -1;
         }
+        memset(sec, 0, sizeof(sec));
+        memset(dot83, ' ', sizeof(dot83));
+        dot83[0] = '.';
+        make_dirent(sec, dot83, FAT32_ATTR_DIRECTORY, c);
+        dot83[1] = '.';
+        make_dirent(sec + 32, dot83, FAT32_ATTR_DIRECTORY, dir == fs->root_cluster ? 0 : dir);
+        if (fs_write(fs, cluster_to_lba(fs, c), 1, sec) != 0) { fat32_set_error("write directory failed"); return -1; }
+        /* The new directory and its FAT entry are on disk before the entry naming it. */
+        if (fat32_sync_locked(fs) != 0) return -1;
     }
 
+    make_dirent(slots + (count - 1u) * 32u, name83, is_dir ? FAT32_ATTR_DIRECTORY : FAT32_ATTR_ARCHIVE, c);
+    if (count == 1u) slots[12] = nt_flags;
+    if (dir_add(fs, dir, slots, count, out) != 0) return -1;
+
+    out->has_lfn = count > 1u;
+    format_name83(name83, count == 1u ? nt_flags : 0, out->short_name);
+    memcpy(out->name, name, strlen(name) + 1u);
+    dcache_add_entry(fs->dcache, dir, out);
     return 0;
 }
 
-static unsigned int fat_get(fat32_fs_t* fs, unsigned int cluster) {
-    unsigned char sec[512];
-    unsigned int off = cluster * 4u;
-    unsigned int lba = fs->fat_start_lba + (off / 512u);
-    unsigned int in_sec = off % 512u;
+static int file_create_locked(fat32_fs_t* fs, const char* path, fat32_file_t* f) {
+    char leaf[FAT32_NAME_MAX + 1];
+    dir_entry_t e;
+    unsigned int dir;
+    int rc;
+
+    if (!fs || !f) { fat32_set_error("invalid create arguments"); return -1; }
+    if (resolve_parent(fs, path, &dir, leaf) != 0) return -1;
+    if (is_dot_name(leaf)) { fat32_set_error("invalid filename"); return -1; }
+    rc = dir_lookup(fs, dir, leaf, &e);
+    if (rc < 0) return -1;
+    if (rc == 0) {
+        if (e.ent[11] & FAT32_ATTR_DIRECTORY) { fat32_set_error("is a directory"); return -1; }
+        file_init(f, fs, e.ent, e.lba, e.off);
+        return file_truncate_locked(f);
+    }
 
-    if (fat32_io_read(fs->dev, lba, 1, sec) != 0) return FAT32_EOC;
-    return rd32(sec + in_sec) & 0x0FFFFFFFu;
+    if (create_at_locked(fs, dir, leaf, 0, &e) != 0) return -1;
+    file_init(f, fs, e.ent, e.lba, e.off);
+    return 0;
 }
 
-static int fat_set(fat32_fs_t* fs, unsigned int cluster, unsigned int val) {
-    unsigned char sec[512];
-    unsigned int off = cluster * 4u;
-    unsigned int lba = fs->fat_start_lba + (off / 512u);
-    unsigned int in_sec = off % 512u;
+static int mkdir_locked(fat32_fs_t* fs, const char* path) {
+    char leaf[FAT32_NAME_MAX + 1];
+    dir_entry_t e;
+    unsigned int dir;
+    int rc;
+
+    if (!fs) { fat32_set_error("invalid mkdir arguments"); return -1; }
+    if (resolve_parent(fs, path, &dir, leaf) != 0) return -1;
+    if (is_dot_name(leaf)) { fat32_set_error("already exists"); return -1; }
+    rc = dir_lookup(fs, dir, leaf, &e);
+    if (rc < 0) return -1;
+    if (rc == 0) { fat32_set_error("already exists"); return -1; }
+    if (create_at_locked(fs, dir, leaf, 1, &e) != 0) return -1;
+    return fat32_sync_locked(fs);
+}
 
-    unsigned int f;
+static void fill_entry(const fat32_fs_t* fs, const dir_entry_t* e, fat32_entry_t* out) {
+    out->is_dir = (e->ent[11] & FAT32_ATTR_DIRECTORY) != 0;
+    out->cluster = out->is_dir ? dirent_dir_cluster(fs, e->ent) : dirent_cluster(e->ent);
+    out->size = rd32(e->ent + 28);
+    out->dir_lba = e->lba;
+    out->dir_off = e->off;
+}
 
-    if (fat32_io_read(fs->dev, lba, 1, sec) != 0) return -1;
-    wr32(sec + in_sec, val);
-    for (f = 0; f < fs->fat_count; f++) {
-        unsigned int fat_lba = lba + f * fs->sectors_per_fat;
-        if (fat32_io_write(fs->dev, fat_lba, 1, sec) != 0) return -1;
+static int lookup_at_locked(fat32_fs_t* fs, unsigned int dir, const char* name, fat32_entry_t* out) {
+    dir_entry_t e;
+    int rc;
+
+    if (strcmp(name, ".") == 0 || (dir == fs->root_cluster && strcmp(name, "..") == 0)) {
+        /* "." and the root's ".." have no entry of their own */
+        memset(out, 0, sizeof(*out));
+        out->is_dir = 1;
+        out->cluster = dir;
+        return 0;
+    }
+    rc = dir_lookup(fs, dir, name, &e);
+    if (rc != 0) {
+        if (rc > 0) fat32_set_error("file not found");
+        return rc;
     }
+    fill_entry(fs, &e, out);
     return 0;
 }
 
-static int alloc_cluster(fat32_fs_t* fs, unsigned int* out_cluster) {
-    unsigned int c;
-    for (c = 2; c < fs->total_clusters + 2u; c++) {
-        if (fat_get(fs, c) == 0) {
-            if (fat_set(fs, c, FAT32_EOC) != 0) return -1;
-            *out_cluster = c;
-            return 0;
-        }
-    }
-    return -1;
+static int create_named_locked(fat32_fs_t* fs, unsigned int dir, const char* name, int is_dir, fat32_entry_t* out) {
+    dir_entry_t e;
+    int rc;
+
+    if (is_dot_name(name)) { fat32_set_error("invalid filename"); return -1; }
+    rc = dir_lookup(fs, dir, name, &e);
+    if (rc < 0) return -1;
+    if (rc == 0) { fat32_set_error("already exists"); return -1; }
+    if (create_at_locked(fs, dir, name, is_dir, &e) != 0) return -1;
+    if (fat32_sync_locked(fs) != 0) return -1;
+    fill_entry(fs, &e, out);
+    return 0;
 }
 
-static int find_root_entry(fat32_fs_t* fs, const char name83[11], unsigned int* out_lba, unsigned int* out_off) {
-    unsigned char sec[512];
-    unsigned int lba = cluster_to_lba(fs, fs->root_cluster);
-    unsigned int i;
+static void fill_dirent(const dir_entry_t* e, fat32_dirent_t* out) {
+    memcpy(out->name83, e->ent, 11);
+    out->name83[11] = 0;
+    memcpy(out->name, e->name, sizeof(out->name));
+    out->size = rd32(e->ent + 28);
+    out->is_dir = (e->ent[11] & FAT32_ATTR_DIRECTORY) != 0;
+}
 
-    if (fat32_io_read(fs->dev, lba, 1, sec) != 0) return -1;
-    for (i = 0; i < 512; i += 32) {
-        if (sec[i] == 0x00) break;
-        if (sec[i] == 0xE5) continue;
-        if ((sec[i + 11] & 0x0Fu) == 0x0Fu) continue;
-        if (strncmp((const char*)(sec + i), name83, 11) == 0) {
-            if (out_lba) *out_lba = lba;
-            if (out_off) *out_off = i;
-            return 0;
-        }
+typedef struct {
+    fat32_dirent_t* out;
+    int found;
+} readdir_ctx_t;
+
+static int visit_readdir(fat32_fs_t* fs, const dir_entry_t* e, void* user) {
+    readdir_ctx_t* ctx = (readdir_ctx_t*)user;
+
+    (void)fs;
+    if (e->ent[0] == '.') return 0;
+    fill_dirent(e, ctx->out);
+    ctx->found = 1;
+    return 1;
+}
+
+static int readdir_locked(fat32_fs_t* fs, fat32_dir_cursor_t* cur, fat32_dirent_t* out) {
+    readdir_ctx_t ctx;
+    dir_pos_t pos;
+    int rc;
+
+    if (cur->done) return 1;
+    pos.cluster = cur->cluster;
+    pos.sector = cur->sector;
+    pos.off = cur->off;
+    ctx.out = out;
+    ctx.found = 0;
+    rc = dir_walk_entries(fs, &pos, visit_readdir, &ctx, 0);
+    if (rc < 0) return -1;
+    if (!ctx.found) {
+        cur->done = 1;
+        return 1;
     }
-    return -1;
+    cur->cluster = pos.cluster;
+    cur->sector = pos.sector;
+    cur->off = pos.off + 32u;
+    return 0;
 }
 
-int fat32_format(fat32_device_t* dev) {
+static int fat32_format_locked(fat32_device_t* dev) {
     fat32_clear_error();
     unsigned char sec[512];
     unsigned int reserved = 32;
@@ -273,6 +2416,9 @@ int fat32_format(fat32_device_t* dev) {
     if (fat32_io_read(dev, 1, 1, sec) != 0) { fat32_set_error("read fsinfo for backup failed"); return -1; }
     if (fat32_io_write(dev, 7, 1, sec) != 0) { fat32_set_error("write backup fsinfo failed"); return -1; }
 
+    /* Stale entries from an earlier layout would show up as allocated chains. */
+    if (zero_sectors(dev, fat_start, fat_count * sectors_per_fat) != 0) { fat32_set_error("clear FAT failed"); return -1; }
+
     memset(sec, 0, sizeof(sec));
     wr32(sec + 0, 0x0FFFFFF8u);
     wr32(sec + 4, FAT32_EOC);
@@ -282,14 +2428,18 @@ int fat32_format(fat32_device_t* dev) {
 
     memset(sec, 0, sizeof(sec));
     if (fat32_io_write(dev, data_start, 1, sec) != 0) { fat32_set_error("write root directory cluster failed"); return -1; }
+    if (bcache_sync(dev->bdev) != 0 || blockdev_flush(dev->bdev) != 0) { fat32_set_error("flush after format failed"); return -1; }
     fat32_set_error("ok");
     return 0;
 }
 
-int fat32_mount(fat32_fs_t* fs, fat32_device_t* dev) {
+static int fat32_mount_locked(fat32_fs_t* fs, fat32_device_t* dev) {
     fat32_clear_error();
     unsigned char sec[512];
     unsigned int total_sectors;
+    unsigned int fsinfo_free;
+    unsigned int fsinfo_hint;
+    fat_page_t* pg;
 
     if (!fs || !dev) { fat32_set_error("mount arguments invalid"); return -1; }
     if (dev->sector_size != 512) { fat32_set_error("unsupported sector size"); return -1; }
@@ -298,6 +2448,7 @@ int fat32_mount(fat32_fs_t* fs, fat32_device_t* dev) {
     if (sec[510] != 0x55 || sec[511] != 0xAA) { fat32_set_error("boot signature missing"); return -1; }
     if (rd16(sec + 11) != 512) { fat32_set_error("invalid bytes/sector in BPB"); return -1; }
     if (rd16(sec + 17) != 0) { fat32_set_error("not a FAT32 BPB"); return -1; }
+    if (rd16(sec + 42) != 0) { fat32_set_error("unsupported FAT32 version"); return -1; }
 
     fs->dev = dev;
     fs->sectors_per_cluster = sec[13];
@@ -305,151 +2456,589 @@ int fat32_mount(fat32_fs_t* fs, fat32_device_t* dev) {
     fs->fat_count = sec[16];
     fs->sectors_per_fat = rd32(sec + 36);
     fs->root_cluster = rd32(sec + 44);
-    fs->fat_start_lba = fs->reserved_sectors;
-    fs->data_start_lba = fs->reserved_sectors + fs->fat_count * fs->sectors_per_fat;
-
     total_sectors = rd32(sec + 32);
     if (!total_sectors) total_sectors = rd16(sec + 19);
+
+    /* Everything below is used for arithmetic and I/O without further checks. */
+    if (fs->sectors_per_cluster == 0 || (fs->sectors_per_cluster & (fs->sectors_per_cluster - 1u)) != 0 ||
+        fs->reserved_sectors == 0 || fs->fat_count == 0 || fs->fat_count > 2u || fs->sectors_per_fat == 0) {
+        fat32_set_error("invalid BPB geometry");
+        return -1;
+    }
+    if (total_sectors > dev->total_sectors) { fat32_set_error("volume larger than device"); return -1; }
+    if (fs->sectors_per_fat > total_sectors / fs->fat_count) { fat32_set_error("invalid layout: FAT too large"); return -1; }
+    fs->fat_start_lba = fs->reserved_sectors;
+    fs->data_start_lba = fs->reserved_sectors + fs->fat_count * fs->sectors_per_fat;
     if (total_sectors <= fs->data_start_lba) { fat32_set_error("invalid layout: no data area"); return -1; }
 
     fs->total_clusters = (total_sectors - fs->data_start_lba) / fs->sectors_per_cluster;
     if (fs->total_clusters == 0) { fat32_set_error("invalid cluster count"); return -1; }
+    /* Clusters without a FAT entry cannot be used. */
+    if (fs->total_clusters + 2u > fs->sectors_per_fat * 128u) fs->total_clusters = fs->sectors_per_fat * 128u - 2u;
+    if (!cluster_valid(fs, fs->root_cluster)) { fat32_set_error("invalid root cluster"); return -1; }
+    fs->fsinfo_sector = rd16(sec + 48);
+
+    fs->fsinfo_dirty = 0;
+    fs->used_bitmap = 0;
+    fs->dcache = 0;
+    fs->streams = 0;
+    fs->ra_requests = 0;
+    fs->ra_hits = 0;
+    fs->wb_appends = 0;
+    fs->wb_flushes = 0;
+    fs->was_dirty = 0;
+    fs->marked_dirty = 0;
+    fs->unflushed = 0;
+    fs->barriers = 0;
+    fs->fat_cache = (struct fat32_fat_cache*)kmalloc(sizeof(struct fat32_fat_cache));
+    if (!fs->fat_cache) { fat32_set_error("out of memory for FAT cache"); return -1; }
+    memset(fs->fat_cache, 0, sizeof(struct fat32_fat_cache));
+    fs->dcache = (struct fat32_dcache*)kmalloc(sizeof(struct fat32_dcache));
+    if (!fs->dcache) {
+        release_mount_state(fs);
+        fat32_set_error("out of memory for dentry cache");
+        return -1;
+    }
+    dcache_reset(fs->dcache);
+
+    /* FAT[1] carries the clean-shutdown bit; without it nothing on the volume is trusted. */
+    pg = fat_page_get(fs, 0);
+    if (!pg) {
+        release_mount_state(fs);
+        fat32_set_error("cannot read FAT");
+        return -1;
+    }
+    if (!(pg->data[1] & FAT32_CLEAN_SHUTDOWN)) {
+        fs->was_dirty = 1;
+        fs->marked_dirty = 1;
+    }
+
+    /* A valid FSInfo record makes mounting O(1); without one the FAT is scanned now. */
+    fs->next_free = 2u;
+    fs->free_count = 0;
+    if (!fs->was_dirty && read_fsinfo(fs, &fsinfo_free, &fsinfo_hint) == 0) {
+        if (cluster_valid(fs, fsinfo_hint)) fs->next_free = fsinfo_hint;
+        if (fsinfo_free <= fs->total_clusters) fs->free_count = fsinfo_free;
+        else fsinfo_free = 0xFFFFFFFFu;
+    } else {
+        fsinfo_free = 0xFFFFFFFFu;
+    }
+    if (fsinfo_free == 0xFFFFFFFFu && build_bitmap(fs) != 0) {
+        release_mount_state(fs);
+        fat32_set_error("FAT scan failed");
+        return -1;
+    }
     fat32_set_error("ok");
     return 0;
 }
 
-int fat32_list_root(fat32_fs_t* fs, fat32_dirent_t* out, size_t max_out, size_t* out_count) {
-    unsigned char sec[512];
-    unsigned int lba;
-    unsigned int i;
-    size_t found = 0;
-
-    if (!fs || !out || max_out == 0) { fat32_set_error("invalid ls arguments"); return -1; }
+typedef struct {
+    fat32_list_cb_t cb;
+    void* user;
+    int stopped;
+} list_ctx_t;
+
+static int visit_list(fat32_fs_t* fs, const dir_entry_t* e, void* user) {
+    list_ctx_t* ctx = (list_ctx_t*)user;
+    fat32_dirent_t de;
+
+    (void)fs;
+    if (e->ent[0] == '.') return 0;
+    fill_dirent(e, &de);
+    if (ctx->cb(&de, ctx->user) != 0) {
+        ctx->stopped = 1;
+        return 1;
+    }
+    return 0;
+}
 
-    lba = cluster_to_lba(fs, fs->root_cluster);
-    if (fat32_io_read(fs->dev, lba, 1, sec) != 0) { fat32_set_error("read root directory failed"); return -1; }
+static int fat32_list_dir_locked(fat32_fs_t* fs, const char* path, fat32_list_cb_t cb, void* user) {
+    list_ctx_t ctx;
+    dir_pos_t pos;
+
+    if (!fs || !cb) { fat32_set_error("invalid ls arguments"); return -1; }
+    if (resolve_dir(fs, path, &pos.cluster) != 0) return -1;
+    pos.sector = 0;
+    pos.off = 0;
+    ctx.cb = cb;
+    ctx.user = user;
+    ctx.stopped = 0;
+    if (dir_walk_entries(fs, &pos, visit_list, &ctx, 0) < 0) return -1;
+    return 0;
+}
 
-    for (i = 0; i < 512 && found < max_out; i += 32) {
-        if (sec[i] == 0x00) break;
-        if (sec[i] == 0xE5) continue;
-        if ((sec[i + 11] & 0x0Fu) == 0x0Fu) continue;
+static int fat32_write_file_locked(fat32_fs_t* fs, const char* path, const char* data, size_t len) {
+    fat32_file_t f;
+    int rc;
 
-        memcpy(out[found].name83, sec + i, 11);
-        out[found].name83[11] = 0;
-        out[found].size = rd32(sec + i + 28);
-        found++;
+    if (!fs || !data) { fat32_set_error("invalid write arguments"); return -1; }
+    if (file_create_locked(fs, path, &f) != 0) return -1;
+    if (file_write_locked(&f, 0, data, len) < 0) {
+        file_commit_locked(&f);
+        stream_release(&f);
+        return -1;
     }
+    rc = file_commit_locked(&f);
+    stream_release(&f);
+    if (rc != 0) return -1;
+    fat32_set_error("ok");
+    return 0;
+}
 
-    if (out_count) *out_count = found;
+static int fat32_read_file_locked(fat32_fs_t* fs, const char* path, char* out, size_t out_cap, size_t* out_len) {
+    fat32_file_t f;
+    int n;
+
+    if (!fs || !out || out_cap == 0) { fat32_set_error("invalid read arguments"); return -1; }
+    if (file_open_locked(fs, path, &f) != 0) return -1;
+    if ((size_t)f.size + 1u > out_cap) { fat32_set_error("output buffer too small"); return -1; }
+
+    n = file_read_locked(&f, 0, out, f.size);
+    stream_release(&f);
+    if (n < 0) return -1;
+    out[n] = 0;
+    if (out_len) *out_len = (size_t)n;
+    fat32_set_error("ok");
     return 0;
 }
 
-int fat32_write_file(fat32_fs_t* fs, const char* name, const char* data, size_t len) {
-    unsigned char sec[512];
-    unsigned int lba;
-    unsigned int off;
+static int fat32_delete_file_locked(fat32_fs_t* fs, const char* path) {
+    char leaf[FAT32_NAME_MAX + 1];
+    dir_entry_t e;
+    dir_pos_t pos;
+    unsigned int dir;
     unsigned int cluster;
-    unsigned int data_lba;
-    unsigned short hi;
-    unsigned short lo;
-    char name83[11];
+    int rc;
 
-    if (!fs || !data) { fat32_set_error("invalid write arguments"); return -1; }
-    if (len > 512u * fs->sectors_per_cluster) { fat32_set_error("file too large for current implementation"); return -1; }
-    if (make_name83(name, name83) != 0) { fat32_set_error("invalid 8.3 filename"); return -1; }
+    if (!fs) { fat32_set_error("invalid delete arguments"); return -1; }
+    if (resolve_parent(fs, path, &dir, leaf) != 0) return -1;
+    if (is_dot_name(leaf)) { fat32_set_error("invalid filename"); return -1; }
+    rc = dir_lookup(fs, dir, leaf, &e);
+    if (rc < 0) return -1;
+    if (rc > 0) { fat32_set_error("file not found"); return -1; }
+
+    cluster = dirent_cluster(e.ent);
+    if (e.ent[11] & FAT32_ATTR_DIRECTORY) {
+        rc = dir_is_empty(fs, cluster);
+        if (rc < 0) return -1;
+        if (!rc) { fat32_set_error("directory not empty"); return -1; }
+        dcache_purge_dir(fs->dcache, cluster);
+    }
 
-    lba = cluster_to_lba(fs, fs->root_cluster);
-    if (fat32_io_read(fs->dev, lba, 1, sec) != 0) { fat32_set_error("read root entry sector failed"); return -1; }
+    /* The LFN slots go together with the short entry; it is gone on disk before the chain is freed. */
+    pos = e.start;
+    if (dir_put_slots(fs, &pos, 0, e.slots) != 0) { fat32_set_error("write delete marker failed"); return -1; }
+    dcache_drop_entry(fs->dcache, dir, &e);
+    if (fat32_barrier(fs) != 0) return -1;
+    if (free_chain(fs, cluster) != 0) { fat32_set_error("free cluster failed"); return -1; }
+    if (fat32_sync_locked(fs) != 0) return -1;
+    fat32_set_error("ok");
+    return 0;
+}
 
-    if (find_root_entry(fs, name83, &lba, &off) == 0) {
-        hi = rd16(sec + off + 20);
-        lo = rd16(sec + off + 26);
-        cluster = ((unsigned int)hi << 16) | lo;
-        if (cluster >= 2) {
-            if (fat_set(fs, cluster, 0) != 0) { fat32_set_error("free old cluster failed"); return -1; }
+/*
+ * fsck-style check: FAT #0 is streamed once (scan_fat) for the allocation
+ * state and the set of clusters something links to. Then the directory
+ * tree is walked from the root, following each chain through the FAT
+ * cache and marking what it reaches. A cluster reached twice is a cross
+ * link (or loop); allocated clusters never reached are lost, and those
+ * nothing links to start a lost chain.
+ */
+static unsigned int check_chain(fat32_fs_t* fs, check_ctx_t* ctx, unsigned int c) {
+    unsigned int len = 0;
+
+    while (cluster_valid(fs, c)) {
+        if (!bitmap_test(fs, c)) {
+            ctx->out->bad_links++;
+            break;
         }
-    } else {
-        for (off = 0; off < 512; off += 32) {
-            if (sec[off] == 0x00 || sec[off] == 0xE5) break;
+        if (bits_test(ctx->reached, c)) {
+            ctx->out->cross_links++;
+            break;
         }
-        if (off >= 512) { fat32_set_error("root directory is full"); return -1; }
+        bits_set(ctx->reached, c);
+        len++;
+        c = fat_get(fs, c);
     }
+    return len;
+}
 
-    if (alloc_cluster(fs, &cluster) != 0) { fat32_set_error("no free cluster available"); return -1; }
-
-    memset(sec + off, 0, 32);
-    memcpy(sec + off, name83, 11);
-    sec[off + 11] = FAT32_ATTR_ARCHIVE;
-    wr16(sec + off + 20, (unsigned short)((cluster >> 16) & 0xFFFFu));
-    wr16(sec + off + 26, (unsigned short)(cluster & 0xFFFFu));
-    wr32(sec + off + 28, (unsigned int)len);
-    if (fat32_io_write(fs->dev, lba, 1, sec) != 0) { fat32_set_error("write directory entry failed"); return -1; }
+static int check_push(check_ctx_t* ctx, unsigned int dir, unsigned int parent) {
+    if (ctx->pending_count == ctx->pending_cap) {
+        unsigned int cap = ctx->pending_cap ? ctx->pending_cap * 2u : 64u;
+        unsigned int* p = (unsigned int*)kmalloc(cap * 2u * sizeof(unsigned int));
 
-    memset(sec, 0, sizeof(sec));
-    memcpy(sec, data, len);
-    data_lba = cluster_to_lba(fs, cluster);
-    if (fat32_io_write(fs->dev, data_lba, 1, sec) != 0) { fat32_set_error("write file data failed"); return -1; }
-    fat32_set_error("ok");
+        if (!p) return -1;
+        if (ctx->pending) {
+            memcpy(p, ctx->pending, ctx->pending_count * 2u * sizeof(unsigned int));
+            kfree(ctx->pending);
+        }
+        ctx->pending = p;
+        ctx->pending_cap = cap;
+    }
+    ctx->pending[ctx->pending_count * 2u] = dir;
+    ctx->pending[ctx->pending_count * 2u + 1u] = parent;
+    ctx->pending_count++;
     return 0;
 }
 
-int fat32_read_file(fat32_fs_t* fs, const char* name, char* out, size_t out_cap, size_t* out_len) {
-    unsigned char sec[512];
-    unsigned int lba;
-    unsigned int off;
-    unsigned int cluster;
-    unsigned int data_lba;
+static int visit_check(fat32_fs_t* fs, const dir_entry_t* e, void* user) {
+    check_ctx_t* ctx = (check_ctx_t*)user;
+    unsigned int cbytes = fs->sectors_per_cluster * 512u;
+    unsigned int c = dirent_cluster(e->ent);
+    unsigned int size = rd32(e->ent + 28);
     unsigned int len;
-    unsigned short hi;
-    unsigned short lo;
-    char name83[11];
 
-    if (!fs || !out || out_cap == 0) { fat32_set_error("invalid read arguments"); return -1; }
-    if (make_name83(name, name83) != 0) { fat32_set_error("invalid 8.3 filename"); return -1; }
+    if (e->ent[0] == '.') {
+        if (ctx->dir == fs->root_cluster || !(e->ent[11] & FAT32_ATTR_DIRECTORY)) {
+            ctx->out->dir_errors++;
+        } else if (!strcmp(e->name, ".")) {
+            ctx->saw_dot = 1;
+            if (c != ctx->dir) ctx->out->dir_errors++;
+        } else if (!strcmp(e->name, "..")) {
+            ctx->saw_dotdot = 1;
+            if (dirent_dir_cluster(fs, e->ent) != ctx->parent) ctx->out->dir_errors++;
+        } else {
+            ctx->out->dir_errors++;
+        }
+        return 0;
+    }
+
+    if (e->ent[11] & FAT32_ATTR_DIRECTORY) {
+        ctx->out->dirs++;
+        if (!cluster_valid(fs, c)) {
+            ctx->out->dir_errors++;
+            return 0;
+        }
+        /* A directory reached twice is not scanned again, so loops in the tree end here. */
+        if (check_chain(fs, ctx, c) == 0) return 0;
+        if (check_push(ctx, c, ctx->dir) != 0) {
+            ctx->failed = 1;
+            return 1;
+        }
+        return 0;
+    }
 
-    if (find_root_entry(fs, name83, &lba, &off) != 0) { fat32_set_error("file not found"); return -1; }
-    if (fat32_io_read(fs->dev, lba, 1, sec) != 0) { fat32_set_error("read directory entry failed"); return -1; }
+    ctx->out->files++;
+    if (c == 0) {
+        if (size != 0) ctx->out->size_mismatches++;
+        return 0;
+    }
+    len = check_chain(fs, ctx, c);
+    if (len != size / cbytes + (size % cbytes ? 1u : 0u)) ctx->out->size_mismatches++;
+    return 0;
+}
 
-    len = rd32(sec + off + 28);
-    hi = rd16(sec + off + 20);
-    lo = rd16(sec + off + 26);
-    cluster = ((unsigned int)hi << 16) | lo;
-    if (cluster < 2) { fat32_set_error("invalid file cluster"); return -1; }
+/* Takes over *used as the resident bitmap once the FAT scan succeeded. */
+static int check_run(fat32_fs_t* fs, check_ctx_t* ctx, unsigned int** used) {
+    fat32_check_t* out = ctx->out;
+    unsigned int limit = fs->total_clusters + 2u;
+    unsigned int fsinfo_free;
+    unsigned int hint;
+    unsigned int c;
 
-    if (len + 1 > out_cap) { fat32_set_error("output buffer too small"); return -1; }
-    data_lba = cluster_to_lba(fs, cluster);
-    if (fat32_io_read(fs->dev, data_lba, 1, sec) != 0) { fat32_set_error("read file data failed"); return -1; }
+    if (scan_fat(fs, *used, ctx, &out->free_clusters) != 0) {
+        fat32_set_error("FAT scan failed");
+        return -1;
+    }
+    /* The scan is exact: it replaces the resident bitmap and free count. */
+    kfree(fs->used_bitmap);
+    fs->used_bitmap = *used;
+    *used = 0;
+    if (fs->free_count != out->free_clusters) fs->fsinfo_dirty = 1;
+    fs->free_count = out->free_clusters;
+    out->used_clusters = fs->total_clusters - out->free_clusters;
+
+    check_chain(fs, ctx, fs->root_cluster);
+    if (check_push(ctx, fs->root_cluster, 0) != 0) ctx->failed = 1;
+    while (ctx->pending_count > 0 && !ctx->failed) {
+        dir_pos_t pos;
+
+        ctx->pending_count--;
+        ctx->dir = ctx->pending[ctx->pending_count * 2u];
+        ctx->parent = ctx->pending[ctx->pending_count * 2u + 1u];
+        ctx->saw_dot = 0;
+        ctx->saw_dotdot = 0;
+        pos.cluster = ctx->dir;
+        pos.sector = 0;
+        pos.off = 0;
+        if (dir_walk_entries(fs, &pos, visit_check, ctx, 0) < 0) return -1;
+        if (ctx->dir != fs->root_cluster && (!ctx->saw_dot || !ctx->saw_dotdot)) out->dir_errors++;
+    }
+    if (ctx->failed) {
+        fat32_set_error("out of memory for check");
+        return -1;
+    }
 
-    memcpy(out, sec, len);
-    out[len] = 0;
-    if (out_len) *out_len = len;
-    fat32_set_error("ok");
-    return 0;
+    for (c = 2u; c < limit; c++) {
+        if (!bitmap_test(fs, c) || bits_test(ctx->reached, c)) continue;
+        out->lost_clusters++;
+        if (!bits_test(ctx->linked, c)) out->lost_chains++;
+    }
+
+    if (read_fsinfo(fs, &fsinfo_free, &hint) == 0 && fsinfo_free != fs->free_count && fs->dev->bdev->write) {
+        fs->fsinfo_dirty = 1;
+        out->fsinfo_fixed = 1;
+    }
+    return fat32_sync_locked(fs);
 }
 
-int fat32_delete_file(fat32_fs_t* fs, const char* name) {
-    unsigned char sec[512];
-    unsigned int lba;
-    unsigned int off;
-    unsigned int cluster;
-    unsigned short hi;
-    unsigned short lo;
-    char name83[11];
+static int fat32_check_locked(fat32_fs_t* fs, fat32_check_t* out) {
+    unsigned int words = (fs->total_clusters + 2u + 31u) / 32u;
+    unsigned int* used;
+    check_ctx_t ctx;
+    int rc = -1;
+
+    memset(out, 0, sizeof(*out));
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.out = out;
+    used = (unsigned int*)kmalloc(words * 4u);
+    ctx.linked = (unsigned int*)kmalloc(words * 4u);
+    ctx.reached = (unsigned int*)kmalloc(words * 4u);
+    if (!used || !ctx.linked || !ctx.reached) {
+        fat32_set_error("out of memory for check bitmaps");
+    } else {
+        memset(ctx.linked, 0, words * 4u);
+        memset(ctx.reached, 0, words * 4u);
+        rc = check_run(fs, &ctx, &used);
+        if (rc == 0) fat32_set_error("ok");
+        if (rc == 0 && !out->bad_links && !out->cross_links && !out->lost_chains && !out->size_mismatches &&
+            !out->dir_errors && fs->dev->bdev->write)
+            fs->was_dirty = 0;
+    }
+    kfree(used);
+    kfree(ctx.linked);
+    kfree(ctx.reached);
+    kfree(ctx.pending);
+    return rc;
+}
 
-    if (!fs) { fat32_set_error("invalid delete arguments"); return -1; }
-    if (make_name83(name, name83) != 0) { fat32_set_error("invalid 8.3 filename"); return -1; }
-    if (find_root_entry(fs, name83, &lba, &off) != 0) { fat32_set_error("file not found"); return -1; }
-    if (fat32_io_read(fs->dev, lba, 1, sec) != 0) { fat32_set_error("read directory entry failed"); return -1; }
+int fat32_format(fat32_device_t* dev) {
+    int rc;
+    fat32_lock();
+    rc = fat32_format_locked(dev);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_mount(fat32_fs_t* fs, fat32_device_t* dev) {
+    int rc;
+    fat32_lock();
+    rc = fat32_mount_locked(fs, dev);
+    fat32_unlock();
+    return rc;
+}
 
-    hi = rd16(sec + off + 20);
-    lo = rd16(sec + off + 26);
-    cluster = ((unsigned int)hi << 16) | lo;
-    if (cluster >= 2) {
-        if (fat_set(fs, cluster, 0) != 0) { fat32_set_error("free cluster failed"); return -1; }
+int fat32_sync(fat32_fs_t* fs) {
+    int rc;
+    fat32_lock();
+    rc = fat32_sync_locked(fs);
+    fat32_unlock();
+    return rc;
+}
+
+void fat32_unmount(fat32_fs_t* fs) {
+    if (!fs) return;
+    fat32_lock();
+    /* A volume that was dirty at mount stays dirty until fat32_check found no errors. */
+    if (fat32_sync_locked(fs) == 0 && fs->marked_dirty && !fs->was_dirty && fs->fat_cache) volume_set_clean(fs, 1);
+    release_mount_state(fs);
+    fat32_unlock();
+}
+
+void fat32_get_cache_stats(const fat32_fs_t* fs, fat32_cache_stats_t* out) {
+    memset(out, 0, sizeof(*out));
+    if (!fs) return;
+    if (fs->fat_cache) {
+        out->fat_hits = fs->fat_cache->hits;
+        out->fat_misses = fs->fat_cache->misses;
     }
+    if (fs->dcache) {
+        out->dentry_hits = fs->dcache->hits;
+        out->dentry_misses = fs->dcache->misses;
+    }
+    out->ra_requests = fs->ra_requests;
+    out->ra_hits = fs->ra_hits;
+    out->wb_appends = fs->wb_appends;
+    out->wb_flushes = fs->wb_flushes;
+    out->barriers = fs->barriers;
+}
 
-    sec[off] = 0xE5;
-    if (fat32_io_write(fs->dev, lba, 1, sec) != 0) { fat32_set_error("write delete marker failed"); return -1; }
-    fat32_set_error("ok");
-    return 0;
+int fat32_check(fat32_fs_t* fs, fat32_check_t* out) {
+    int rc;
+    if (!fs || !out) return -1;
+    fat32_lock();
+    rc = fat32_check_locked(fs, out);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_list_dir(fat32_fs_t* fs, const char* path, fat32_list_cb_t cb, void* user) {
+    int rc;
+    fat32_lock();
+    rc = fat32_list_dir_locked(fs, path, cb, user);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_lookup(fat32_fs_t* fs, unsigned int dir_cluster, const char* name, fat32_entry_t* out) {
+    int rc;
+    if (!fs || !name || !out) return -1;
+    fat32_lock();
+    rc = lookup_at_locked(fs, dir_cluster, name, out);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_create_at(fat32_fs_t* fs, unsigned int dir_cluster, const char* name, int is_dir, fat32_entry_t* out) {
+    int rc;
+    if (!fs || !name || !out) return -1;
+    fat32_lock();
+    rc = create_named_locked(fs, dir_cluster, name, is_dir, out);
+    fat32_unlock();
+    return rc;
+}
+
+void fat32_dir_rewind(unsigned int dir_cluster, fat32_dir_cursor_t* cur) {
+    cur->cluster = dir_cluster;
+    cur->sector = 0;
+    cur->off = 0;
+    cur->done = 0;
+}
+
+int fat32_readdir(fat32_fs_t* fs, fat32_dir_cursor_t* cur, fat32_dirent_t* out) {
+    int rc;
+    if (!fs || !cur || !out) return -1;
+    fat32_lock();
+    rc = readdir_locked(fs, cur, out);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_mkdir(fat32_fs_t* fs, const char* path) {
+    int rc;
+    fat32_lock();
+    rc = mkdir_locked(fs, path);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_write_file(fat32_fs_t* fs, const char* path, const char* data, size_t len) {
+    int rc;
+    fat32_lock();
+    rc = fat32_write_file_locked(fs, path, data, len);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_read_file(fat32_fs_t* fs, const char* path, char* out, size_t out_cap, size_t* out_len) {
+    int rc;
+    fat32_lock();
+    rc = fat32_read_file_locked(fs, path, out, out_cap, out_len);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_delete_file(fat32_fs_t* fs, const char* path) {
+    int rc;
+    fat32_lock();
+    rc = fat32_delete_file_locked(fs, path);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_open(fat32_fs_t* fs, const char* path, fat32_file_t* file) {
+    int rc;
+    fat32_lock();
+    rc = file_open_locked(fs, path, file);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_create(fat32_fs_t* fs, const char* path, fat32_file_t* file) {
+    int rc;
+    fat32_lock();
+    rc = file_create_locked(fs, path, file);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_file_read(fat32_file_t* file, unsigned int offset, void* buf, size_t n) {
+    int rc;
+    if (!file || !file->fs || (!buf && n)) return -1;
+    fat32_lock();
+    rc = file_read_locked(file, offset, buf, n);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_file_read_pages(fat32_file_t* file, unsigned int offset, size_t n, fat32_page_cb_t cb, void* user) {
+    int rc;
+    if (!file || !file->fs || !cb) return -1;
+    fat32_lock();
+    rc = file_read_pages_locked(file, offset, n, cb, user);
+    fat32_unlock();
+    return rc;
+}
+
+int fat32_file_write(fat32_file_t* file, unsigned int offset, const void* buf, size_t n) {
+    int rc;
+    if (!file || !file->fs || (!buf && n)) return -1;
+    fat32_lock();
+    rc = file_write_locked(file, offset, buf, n);
+    fat32_unlock();
+    return rc;
+}
+
+void fat32_open_entry(fat32_fs_t* fs, const fat32_entry_t* ent, fat32_file_t* file) {
+    file->fs = fs;
+    file->dir_lba = ent->dir_lba;
+    file->dir_off = ent->dir_off;
+    file->first_cluster = ent->cluster;
+    file->size = ent->size;
+    file->dirty = 0;
+    file->seq_next = 0;
+    file->stream = 0;
+    map_reset(file);
+}
+
+int fat32_file_sync(fat32_file_t* file) {
+    int rc;
+    if (!file || !file->fs) return -1;
+    fat32_lock();
+    rc = file_commit_locked(file);
+    fat32_unlock();
+    return rc;
+}
+
+void fat32_file_release(fat32_file_t* file) {
+    if (!file || !file->fs) return;
+    fat32_lock();
+    stream_release(file);
+    fat32_unlock();
+}
+
+int fat32_close(fat32_file_t* file) {
+    int rc;
+    if (!file || !file->fs) return -1;
+    fat32_lock();
+    rc = file_commit_locked(file);
+    stream_release(file);
+    fat32_unlock();
+    file->fs = 0;
+    return rc;
+}
+
+int fat32_file_extents(fat32_file_t* file, fat32_extent_t* out, size_t max_out, size_t* out_count) {
+    unsigned int len;
+    size_t i;
+    int rc = 0;
+
+    if (!file || !file->fs || !out) return -1;
+    fat32_lock();
+    if (wb_flush(file) != 0 || file_chain_length(file, &len) != 0) rc = -1;
+    for (i = 0; rc == 0 && i < file->extent_count && i < max_out; i++) out[i] = file->extents[i];
+    if (out_count) *out_count = i;
+    fat32_unlock();
+    return rc;
 }
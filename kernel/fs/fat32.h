@@ -5,7 +5,10 @@
 
 enum {
     FAT32_NAME83_LEN = 11,
+    FAT32_NAME_MAX = 255, /* long file names, without the terminator */
     FAT32_MAX_ROOT_ENTRIES = 128,
+    FAT32_FILE_EXTENTS = 32,
+    FAT32_IO_MAX_SECTORS = 128, /* read-ahead/write-behind buffer size, the block layer splits further */
 };
 
 typedef struct {
@@ -14,6 +17,10 @@ typedef struct {
     unsigned int total_sectors;
 } fat32_device_t;
 
+struct fat32_fat_cache;
+struct fat32_dcache;
+struct fat32_stream;
+
 typedef struct {
     fat32_device_t* dev;
     unsigned int sectors_per_cluster;
@@ -24,23 +31,178 @@ typedef struct {
     unsigned int fat_start_lba;
     unsigned int data_start_lba;
     unsigned int total_clusters;
+
+    /* Resident allocation state, valid between fat32_mount and fat32_unmount. */
+    unsigned int fsinfo_sector;
+    unsigned int free_count;
+    unsigned int next_free;     /* allocation starts here (FSInfo hint) */
+    int fsinfo_dirty;
+    unsigned int* used_bitmap;  /* bit per cluster number, set = allocated */
+    struct fat32_fat_cache* fat_cache;
+    struct fat32_dcache* dcache; /* (directory, name) -> entry location */
+
+    /* Crash consistency: FAT[1] clean-shutdown bit and write barriers. */
+    int was_dirty;              /* mounted without the clean bit; cleared by an error-free fat32_check */
+    int marked_dirty;           /* clean bit cleared on disk */
+    int unflushed;              /* writes since the last barrier */
+    unsigned int barriers;
+
+    struct fat32_stream* streams; /* read-ahead state of open files, see ra_invalidate */
+
+    /* Streaming I/O counters, see fat32_cache_stats_t. */
+    unsigned int ra_requests;
+    unsigned int ra_hits;
+    unsigned int wb_appends;
+    unsigned int wb_flushes;
 } fat32_fs_t;
 
+/* Run of physically contiguous clusters within a file. */
 typedef struct {
-    char name83[FAT32_NAME83_LEN + 1];
+    unsigned int file_cluster;
+    unsigned int disk_cluster;
+    unsigned int count;
+} fat32_extent_t;
+
+/* Open file with a lazily filled extent map of its cluster chain. */
+typedef struct {
+    fat32_fs_t* fs;
+    unsigned int dir_lba;        /* sector and offset of the directory entry */
+    unsigned int dir_off;
+    unsigned int first_cluster;
     unsigned int size;
+    int dirty;                   /* size or first cluster not yet in the dirent */
+    unsigned int extent_count;
+    unsigned int mapped;         /* file clusters covered by extents[] */
+    unsigned int chain_len;      /* 0 until the end of the chain was seen */
+    unsigned int cursor_idx;     /* walk position once extents[] is full */
+    unsigned int cursor_cluster;
+    unsigned int seq_next;       /* offset where a sequential read continues */
+    struct fat32_stream* stream; /* read-ahead and write-behind buffers, 0 until needed */
+    fat32_extent_t extents[FAT32_FILE_EXTENTS];
+} fat32_file_t;
+
+typedef struct {
+    char name83[FAT32_NAME83_LEN + 1];  /* short entry as stored, e.g. "QUARTE~1DOC" */
+    char name[FAT32_NAME_MAX + 1];      /* long name, or the short one as "NAME.EXT" */
+    unsigned int size;
+    int is_dir;
 } fat32_dirent_t;
 
+/* A directory entry as returned by fat32_lookup. */
+typedef struct {
+    int is_dir;
+    unsigned int cluster;   /* first cluster; for directories never 0 */
+    unsigned int size;
+    unsigned int dir_lba;   /* location of the entry, 0 for "." of the root */
+    unsigned int dir_off;
+} fat32_entry_t;
+
+/* Resumable position inside a directory for fat32_readdir. */
+typedef struct {
+    unsigned int cluster;
+    unsigned int sector;
+    unsigned int off;
+    int done;
+} fat32_dir_cursor_t;
+
+/* Return nonzero to stop the listing. */
+typedef int (*fat32_list_cb_t)(const fat32_dirent_t* ent, void* user);
+/* data is only valid during the call; return nonzero to stop reading. */
+typedef int (*fat32_page_cb_t)(const void* data, size_t len, void* user);
+
+typedef struct {
+    unsigned int fat_hits;
+    unsigned int fat_misses;
+    unsigned int dentry_hits;
+    unsigned int dentry_misses;
+    unsigned int ra_requests; /* prefetches issued */
+    unsigned int ra_hits;     /* reads served from prefetched data */
+    unsigned int wb_appends;  /* appends absorbed by write-behind buffers */
+    unsigned int wb_flushes;  /* coalesced writes issued */
+    unsigned int barriers;    /* cache syncs plus device flushes for ordered metadata updates */
+} fat32_cache_stats_t;
+
+/* Result of fat32_check. Everything from bad_links on is 0 on a clean volume. */
+typedef struct {
+    unsigned int files;
+    unsigned int dirs;
+    unsigned int used_clusters;
+    unsigned int free_clusters;
+    unsigned int bad_clusters;    /* marked bad in the FAT; not an error */
+    unsigned int bad_links;       /* chain entries pointing outside the volume or at a free cluster */
+    unsigned int cross_links;     /* clusters claimed twice: shared chains or loops */
+    unsigned int lost_chains;     /* allocated chains no directory entry refers to */
+    unsigned int lost_clusters;
+    unsigned int size_mismatches; /* file size does not match the chain length */
+    unsigned int dir_errors;      /* bad start cluster, missing or wrong "." / ".." */
+    int fsinfo_fixed;             /* FSInfo free count was wrong and has been rewritten */
+} fat32_check_t;
+
 int fat32_format(fat32_device_t* dev);
+/*
+ * Validates the BPB; with a valid FSInfo record the FAT is not read until
+ * the first allocation. A volume that was not unmounted cleanly mounts
+ * with was_dirty set; FSInfo is not trusted then and the FAT is scanned.
+ */
 int fat32_mount(fat32_fs_t* fs, fat32_device_t* dev);
+/* Writes back dirty FAT sectors (every FAT copy) and FSInfo, ordered after earlier data writes. */
+int fat32_sync(fat32_fs_t* fs);
+/* Syncs, marks the volume clean, then releases the FAT cache and bitmap. */
+void fat32_unmount(fat32_fs_t* fs);
+void fat32_get_cache_stats(const fat32_fs_t* fs, fat32_cache_stats_t* out);
+/*
+ * Read-only consistency check of a mounted volume (only FSInfo gets fixed).
+ * Returns 0 when the check ran, whatever it found, and -1 on I/O errors or
+ * when out of memory. Files with unsynced changes show up as mismatches.
+ */
+int fat32_check(fat32_fs_t* fs, fat32_check_t* out);
 int fat32_device_from_blockdev(fat32_device_t* dev, const blockdev_t* bdev);
 int fat32_io_read(const fat32_device_t* dev, unsigned int sector_lba, unsigned int count, void* out_buf);
 int fat32_io_write(const fat32_device_t* dev, unsigned int sector_lba, unsigned int count, const void* in_buf);
 
-int fat32_list_root(fat32_fs_t* fs, fat32_dirent_t* out, size_t max_out, size_t* out_count);
-int fat32_write_file(fat32_fs_t* fs, const char* name, const char* data, size_t len);
-int fat32_read_file(fat32_fs_t* fs, const char* name, char* out, size_t out_cap, size_t* out_len);
-int fat32_delete_file(fat32_fs_t* fs, const char* name);
+/*
+ * Paths are '/'-separated names relative to the root, e.g. "Logs/boot log.txt".
+ * Names are matched case-insensitively against long names and 8.3 aliases;
+ * new names that do not fit 8.3 get VFAT long name entries.
+ */
+int fat32_list_dir(fat32_fs_t* fs, const char* path, fat32_list_cb_t cb, void* user);
+int fat32_mkdir(fat32_fs_t* fs, const char* path);
+int fat32_write_file(fat32_fs_t* fs, const char* path, const char* data, size_t len);
+int fat32_read_file(fat32_fs_t* fs, const char* path, char* out, size_t out_cap, size_t* out_len);
+/* Removes a file, or a directory if it is empty. */
+int fat32_delete_file(fat32_fs_t* fs, const char* path);
+
+/* Single-component operations relative to a directory cluster (root: fs->root_cluster). */
+/* Returns 0 if found, 1 if not, -1 on errors. */
+int fat32_lookup(fat32_fs_t* fs, unsigned int dir_cluster, const char* name, fat32_entry_t* out);
+/* Fails if name already exists. */
+int fat32_create_at(fat32_fs_t* fs, unsigned int dir_cluster, const char* name, int is_dir, fat32_entry_t* out);
+void fat32_dir_rewind(unsigned int dir_cluster, fat32_dir_cursor_t* cur);
+/* Returns 0 with the next entry ("." and ".." skipped), 1 at the end, -1 on errors. */
+int fat32_readdir(fat32_fs_t* fs, fat32_dir_cursor_t* cur, fat32_dirent_t* out);
+void fat32_open_entry(fat32_fs_t* fs, const fat32_entry_t* ent, fat32_file_t* file);
+
+/* read/write return the byte count or -1. */
+int fat32_open(fat32_fs_t* fs, const char* path, fat32_file_t* file);
+/* Creates the entry, or truncates an existing file to zero length. */
+int fat32_create(fat32_fs_t* fs, const char* path, fat32_file_t* file);
+int fat32_file_read(fat32_file_t* file, unsigned int offset, void* buf, size_t n);
+/*
+ * Passes the file data from offset on to cb in pieces that point into the
+ * read-ahead buffers, no copy in between. Returns the bytes handed out or
+ * -1. cb runs with the filesystem lock held and must not call into FAT32.
+ */
+int fat32_file_read_pages(fat32_file_t* file, unsigned int offset, size_t n, fat32_page_cb_t cb, void* user);
+/* offset may be at most the current size; the chain grows as needed. */
+int fat32_file_write(fat32_file_t* file, unsigned int offset, const void* buf, size_t n);
+/* Writes buffered appends, updates the directory entry and writes back the FAT. */
+int fat32_file_sync(fat32_file_t* file);
+/* Drops read-ahead and write-behind buffers (call fat32_file_sync first); they come back on demand. */
+void fat32_file_release(fat32_file_t* file);
+/* fat32_file_sync and fat32_file_release, then detaches the file from the volume. */
+int fat32_close(fat32_file_t* file);
+/* Maps the whole chain and copies out the extent table. */
+int fat32_file_extents(fat32_file_t* file, fat32_extent_t* out, size_t max_out, size_t* out_count);
 
 const char* fat32_last_error(void);
 void fat32_clear_error(void);
@@ -0,0 +1,327 @@
+#include "fat32_vfs.h"
+
+#include "vfs.h"
+#include "../heap.h"
+#include "../lib/string.h"
+#include "../sched/sync.h"
+
+#define FAT32_VFS_NODES 64u
+
+/*
+ * VFS nodes are plain pointers the VFS never gives back, so each mount
+ * owns a fixed table of them. Files are identified by the location of
+ * their directory entry, directories by their first cluster. Nodes held
+ * by an open descriptor are pinned; the rest are recycled LRU.
+ */
+typedef struct fat32_vnode {
+    int used;
+    int refs;
+    int is_dir;
+    unsigned int cluster;
+    unsigned int stamp;
+    fat32_file_t file;
+    fat32_dir_cursor_t cursor;
+    size_t cursor_index;
+    char name[FAT32_NAME_MAX + 1];
+} fat32_vnode_t;
+
+typedef struct fat32_mount {
+    int used;
+    const blockdev_t* bdev;
+    char mountpoint[VFS_MAX_PATH];
+    fat32_device_t dev;
+    fat32_fs_t fs;
+    fat32_vnode_t root;
+    fat32_vnode_t* nodes;
+    unsigned int clock;
+} fat32_mount_t;
+
+static fat32_mount_t g_mounts[FAT32_VFS_MAX_MOUNTS];
+static mutex_t g_vnode_lock;
+static int g_vnode_lock_ready;
+
+static void vnode_lock(void) {
+    if (!g_vnode_lock_ready) {
+        mutex_init(&g_vnode_lock, "fat32vfs");
+        g_vnode_lock_ready = 1;
+    }
+    mutex_lock(&g_vnode_lock);
+}
+
+static void vnode_unlock(void) {
+    mutex_unlock(&g_vnode_lock);
+}
+
+static int same_node(const fat32_vnode_t* vn, const fat32_entry_t* ent) {
+    if (vn->is_dir != ent->is_dir) return 0;
+    if (vn->is_dir) return vn->cluster == ent->cluster;
+    return vn->file.dir_lba == ent->dir_lba && vn->file.dir_off == ent->dir_off;
+}
+
+static void node_fill(fat32_mount_t* m, fat32_vnode_t* vn, const fat32_entry_t* ent) {
+    vn->is_dir = ent->is_dir;
+    vn->cluster = ent->cluster;
+    vn->cursor_index = 0;
+    fat32_dir_rewind(ent->cluster, &vn->cursor);
+    if (!ent->is_dir) fat32_open_entry(&m->fs, ent, &vn->file);
+}
+
+static fat32_vnode_t* node_get(fat32_mount_t* m, const fat32_entry_t* ent) {
+    fat32_vnode_t* victim = 0;
+    unsigned int i;
+
+    if (ent->is_dir && ent->cluster == m->fs.root_cluster) return &m->root;
+
+    vnode_lock();
+    for (i = 0; i < FAT32_VFS_NODES; i++) {
+        fat32_vnode_t* vn = &m->nodes[i];
+
+        if (vn->used && same_node(vn, ent)) {
+            /* Unpinned nodes pick up changes made through the path API. */
+            if (vn->refs == 0) node_fill(m, vn, ent);
+            vn->stamp = ++m->clock;
+            vnode_unlock();
+            return vn;
+        }
+        if (vn->refs == 0 && (!victim || !vn->used || (victim->used && vn->stamp < victim->stamp))) victim = vn;
+    }
+    if (victim) {
+        memset(victim, 0, sizeof(*victim));
+        victim->used = 1;
+        victim->stamp = ++m->clock;
+        node_fill(m, victim, ent);
+    }
+    vnode_unlock();
+    return victim;
+}
+
+static void* fat_get_root(void* ctx) {
+    return &((fat32_mount_t*)ctx)->root;
+}
+
+static int fat_lookup(void* ctx, void* dir, const char* name, void** out_node, int* out_is_dir) {
+    fat32_mount_t* m = (fat32_mount_t*)ctx;
+    fat32_vnode_t* d = (fat32_vnode_t*)dir;
+    fat32_entry_t ent;
+    fat32_vnode_t* vn;
+
+    if (!d || !d->is_dir || !name || !out_node || !out_is_dir) return -1;
+    if (fat32_lookup(&m->fs, d->cluster, name, &ent) != 0) return -1;
+    vn = node_get(m, &ent);
+    if (!vn) return -1;
+    *out_node = vn;
+    *out_is_dir = vn->is_dir;
+    return 0;
+}
+
+static int fat_create(void* ctx, void* dir, const char* name, int is_dir, void** out_node) {
+    fat32_mount_t* m = (fat32_mount_t*)ctx;
+    fat32_vnode_t* d = (fat32_vnode_t*)dir;
+    fat32_entry_t ent;
+    fat32_vnode_t* vn;
+    int rc;
+
+    if (!d || !d->is_dir || !name) return -1;
+    rc = fat32_lookup(&m->fs, d->cluster, name, &ent);
+    if (rc < 0) return -1;
+    if (rc == 0 && ent.is_dir != (is_dir != 0)) return -1;
+    if (rc > 0 && fat32_create_at(&m->fs, d->cluster, name, is_dir, &ent) != 0) return -1;
+
+    if (!out_node) return 0;
+    vn = node_get(m, &ent);
+    if (!vn) return -1;
+    *out_node = vn;
+    return 0;
+}
+
+static int fat_read(void* ctx, void* node, size_t offset, void* buf, size_t n) {
+    fat32_vnode_t* vn = (fat32_vnode_t*)node;
+
+    (void)ctx;
+    if (!vn || vn->is_dir) return -1;
+    return fat32_file_read(&vn->file, (unsigned int)offset, buf, n);
+}
+
+static int fat_read_pages(void* ctx, void* node, size_t offset, size_t n, vfs_page_cb_t cb, void* user) {
+    fat32_vnode_t* vn = (fat32_vnode_t*)node;
+
+    (void)ctx;
+    if (!vn || vn->is_dir) return -1;
+    return fat32_file_read_pages(&vn->file, (unsigned int)offset, n, cb, user);
+}
+
+static int fat_write(void* ctx, void* node, size_t offset, const void* buf, size_t n) {
+    fat32_vnode_t* vn = (fat32_vnode_t*)node;
+
+    (void)ctx;
+    if (!vn || vn->is_dir) return -1;
+    return fat32_file_write(&vn->file, (unsigned int)offset, buf, n);
+}
+
+/* Sequential index walks continue from the cached cursor instead of rescanning. */
+static int fat_readdir(void* ctx, void* dir, size_t index, const char** out_name, int* out_is_dir, size_t* out_size) {
+    fat32_mount_t* m = (fat32_mount_t*)ctx;
+    fat32_vnode_t* d = (fat32_vnode_t*)dir;
+    fat32_dirent_t ent;
+
+    if (!d || !d->is_dir || !out_name || !out_is_dir || !out_size) return -1;
+    if (index != d->cursor_index || index == 0) {
+        fat32_dir_rewind(d->cluster, &d->cursor);
+        d->cursor_index = 0;
+    }
+    while (d->cursor_index <= index) {
+        if (fat32_readdir(&m->fs, &d->cursor, &ent) != 0) return -1;
+        d->cursor_index++;
+    }
+
+    memcpy(d->name, ent.name, sizeof(d->name));
+    *out_name = d->name;
+    *out_is_dir = ent.is_dir;
+    *out_size = ent.size;
+    return 0;
+}
+
+static size_t fat_size(void* ctx, void* node) {
+    fat32_vnode_t* vn = (fat32_vnode_t*)node;
+
+    (void)ctx;
+    if (!vn || vn->is_dir) return 0;
+    return vn->file.size;
+}
+
+static int fat_open(void* ctx, void* node) {
+    fat32_vnode_t* vn = (fat32_vnode_t*)node;
+
+    (void)ctx;
+    vnode_lock();
+    vn->refs++;
+    vnode_unlock();
+    return 0;
+}
+
+/*
+ * The directory entry and FAT are brought up to date when a descriptor
+ * closes; the last close also frees the read-ahead and write-behind
+ * buffers, before node_get may refill the unpinned node.
+ */
+static void fat_close(void* ctx, void* node) {
+    fat32_vnode_t* vn = (fat32_vnode_t*)node;
+
+    (void)ctx;
+    if (!vn->is_dir) fat32_file_sync(&vn->file);
+    vnode_lock();
+    if (vn->refs > 0) vn->refs--;
+    if (vn->refs == 0 && !vn->is_dir) fat32_file_release(&vn->file);
+    vnode_unlock();
+}
+
+static const vfs_fs_ops_t g_fat32_ops = {
+    fat_get_root,
+    fat_lookup,
+    fat_create,
+    fat_read,
+    fat_write,
+    fat_readdir,
+    fat_size,
+    fat_open,
+    fat_close,
+    fat_read_pages,
+    0,
+};
+
+static fat32_mount_t* find_mount(const blockdev_t* bdev) {
+    size_t i;
+
+    for (i = 0; i < FAT32_VFS_MAX_MOUNTS; i++) {
+        if (g_mounts[i].used && g_mounts[i].bdev == bdev) return &g_mounts[i];
+    }
+    return 0;
+}
+
+/* hd0 and dma0 reach one drive; two mounts of it would each cache their own FAT. */
+static int disk_mounted(const blockdev_t* bdev) {
+    size_t i;
+
+    for (i = 0; i < FAT32_VFS_MAX_MOUNTS; i++) {
+        if (g_mounts[i].used && block_disk(g_mounts[i].bdev) == block_disk(bdev)) return 1;
+    }
+    return 0;
+}
+
+int fat32_vfs_mount(const blockdev_t* bdev, const char* mountpoint) {
+    fat32_mount_t* m = 0;
+    fat32_entry_t root;
+    size_t i;
+    size_t n;
+
+    if (!bdev || disk_mounted(bdev)) return -1;
+    for (i = 0; i < FAT32_VFS_MAX_MOUNTS && !m; i++) {
+        if (!g_mounts[i].used) m = &g_mounts[i];
+    }
+    if (!m) return -1;
+
+    memset(m, 0, sizeof(*m));
+    if (mountpoint) {
+        n = strlen(mountpoint);
+        if (n == 0 || n >= sizeof(m->mountpoint)) return -1;
+        memcpy(m->mountpoint, mountpoint, n + 1u);
+    } else {
+        n = strlen(bdev->name);
+        memcpy(m->mountpoint, "/mnt/", 5);
+        memcpy(m->mountpoint + 5, bdev->name, n + 1u);
+    }
+
+    m->nodes = (fat32_vnode_t*)kmalloc(FAT32_VFS_NODES * sizeof(fat32_vnode_t));
+    if (!m->nodes) return -1;
+    memset(m->nodes, 0, FAT32_VFS_NODES * sizeof(fat32_vnode_t));
+    if (fat32_device_from_blockdev(&m->dev, bdev) != 0 || fat32_mount(&m->fs, &m->dev) != 0) {
+        kfree(m->nodes);
+        return -1;
+    }
+
+    memset(&root, 0, sizeof(root));
+    root.is_dir = 1;
+    root.cluster = m->fs.root_cluster;
+    m->root.used = 1;
+    node_fill(m, &m->root, &root);
+    m->bdev = bdev;
+    m->used = 1;
+
+    /* Directories in the root ramfs make the mountpoint show up in ls. */
+    if (!mountpoint) vfs_mkdir("/mnt");
+    vfs_mkdir(m->mountpoint);
+    if (vfs_mount(m->mountpoint, &g_fat32_ops, m) != 0) {
+        fat32_unmount(&m->fs);
+        kfree(m->nodes);
+        m->used = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int fat32_vfs_unmount(const blockdev_t* bdev) {
+    fat32_mount_t* m = find_mount(bdev);
+    unsigned int i;
+
+    if (!m) return -1;
+    for (i = 0; i < FAT32_VFS_NODES; i++) {
+        if (m->nodes[i].used && m->nodes[i].refs > 0) return -1;
+    }
+    if (vfs_unmount(m->mountpoint) != 0) return -1;
+
+    fat32_unmount(&m->fs);
+    kfree(m->nodes);
+    m->nodes = 0;
+    m->used = 0;
+    return 0;
+}
+
+fat32_fs_t* fat32_vfs_fs(const blockdev_t* bdev) {
+    fat32_mount_t* m = find_mount(bdev);
+    return m ? &m->fs : 0;
+}
+
+const char* fat32_vfs_mountpoint(const blockdev_t* bdev) {
+    fat32_mount_t* m = find_mount(bdev);
+    return m ? m->mountpoint : 0;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "fat32.h"
+
+#define FAT32_VFS_MAX_MOUNTS 4
+
+/*
+ * Keeps a FAT32 volume mounted in the VFS with its BPB, FAT cache, free
+ * bitmap and dentry cache resident. mountpoint 0 means "/mnt/<device>".
+ */
+int fat32_vfs_mount(const blockdev_t* bdev, const char* mountpoint);
+/* Fails while files of the volume are open. */
+int fat32_vfs_unmount(const blockdev_t* bdev);
+/* Resident volume of bdev, or 0 if it is not mounted. */
+fat32_fs_t* fat32_vfs_fs(const blockdev_t* bdev);
+const char* fat32_vfs_mountpoint(const blockdev_t* bdev);
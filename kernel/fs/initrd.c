@@ -122,6 +122,31 @@ static int initrd_read(void* ctx, void* node, size_t offset, void* buf, size_t n
     return (int)can;
 }
 
+/* The module stays mapped for the whole uptime; cb reads it in place. */
+static int initrd_read_pages(void* ctx, void* node, size_t offset, size_t n, vfs_page_cb_t cb, void* user) {
+    initrd_file_t* file = (initrd_file_t*)node;
+    size_t can;
+    (void)ctx;
+
+    if (!file || !cb) return -1;
+    if (offset >= file->size) return 0;
+
+    can = file->size - offset;
+    if (can > n) can = n;
+    cb(file->data + offset, can, user);
+    return (int)can;
+}
+
+/* Modules sit in identity-mapped RAM, so vfs_mmap can map them without a copy. */
+static int initrd_phys_addr(void* ctx, void* node, size_t offset, uint32_t* out_phys) {
+    initrd_file_t* file = (initrd_file_t*)node;
+    (void)ctx;
+
+    if (!file || !out_phys || offset >= file->size) return -1;
+    *out_phys = (uint32_t)(uintptr_t)(file->data + offset);
+    return 0;
+}
+
 static int initrd_write(void* ctx, void* node, size_t offset, const void* buf, size_t n) {
     (void)ctx;
     (void)node;
@@ -167,6 +192,10 @@ static const vfs_fs_ops_t g_initrd_ops = {
     initrd_write,
     initrd_readdir,
     initrd_size,
+    0,
+    0,
+    initrd_read_pages,
+    initrd_phys_addr,
 };
 
 void initrd_mount_from_multiboot(uint32_t mb_magic, uint32_t mb_info_addr) {
@@ -111,6 +111,18 @@ static int fs_read(void* ctx, void* node, size_t offset, void* buf, size_t n) {
     return (int)can;
 }
 
+static int fs_read_pages(void* ctx, void* node, size_t offset, size_t n, vfs_page_cb_t cb, void* user) {
+    ramfs_node_t* f = (ramfs_node_t*)node;
+    size_t can;
+    (void)ctx;
+    if (!f || f->is_dir || !cb) return -1;
+    if (offset >= f->size) return 0;
+    can = f->size - offset;
+    if (can > n) can = n;
+    cb(f->data + offset, can, user);
+    return (int)can;
+}
+
 static int fs_write(void* ctx, void* node, size_t offset, const void* buf, size_t n) {
     ramfs_node_t* f = (ramfs_node_t*)node;
     size_t can;
@@ -164,6 +176,10 @@ static const vfs_fs_ops_t g_ops = {
     fs_write,
     fs_readdir,
     fs_size,
+    0,
+    0,
+    fs_read_pages,
+    0,
 };
 
 const vfs_fs_ops_t* ramfs_ops(void) {
@@ -1,9 +1,12 @@
 #include "vfs.h"
 
 #include "../lib/string.h"
+#include "../mem/paging.h"
+#include "../mem/pmm.h"
 
 #define VFS_MAX_MOUNTS 4
 #define VFS_MAX_FD 32
+#define VFS_MAX_MAPS 16
 
 typedef struct {
     int used;
@@ -21,8 +24,26 @@ typedef struct {
     size_t pos;
 } vfs_fd_t;
 
+/* Mapped file range; page i covers file offset offset + i * PMM_FRAME_SIZE. */
+typedef struct {
+    int used;
+    int direct;        /* pages are the filesystem's own memory, mapped up front */
+    const vfs_fs_ops_t* ops;
+    void* ctx;
+    void* node;
+    size_t offset;     /* page-aligned for lazy maps, as passed for direct ones */
+    size_t bytes;      /* valid file bytes from offset */
+    uint32_t base;
+    uint32_t pages;
+    uint32_t lead;     /* vfs_mmap returned base + lead */
+    uint32_t gen;      /* distinguishes reuses of the slot, see vfs_mmap_fault */
+} vfs_map_t;
+
 static vfs_mount_t g_mounts[VFS_MAX_MOUNTS];
 static vfs_fd_t g_fds[VFS_MAX_FD];
+static vfs_map_t g_maps[VFS_MAX_MAPS];
+static unsigned int g_map_faults;
+static uint32_t g_map_gen;
 static char g_cwd[VFS_MAX_PATH];
 
 static size_t s_len(const char* s, size_t max) {
@@ -71,8 +92,7 @@ static int normalize_path(const char* in, char* out) {
             seg[j++] = temp[i++];
         }
         seg[j] = 0;
-
-        while (temp[i] && temp[i] != '/') i++;
+        if (temp[i] && temp[i] != '/') return -1; /* a cut-off name would resolve to another file */
 
         if (strcmp(seg, ".") == 0) {
             continue;
@@ -106,6 +126,7 @@ static int normalize_path(const char* in, char* out) {
 static int starts_with(const char* a, const char* b) {
     size_t n = strlen(b);
     if (strncmp(a, b, n) != 0) return 0;
+    if (n > 0 && b[n - 1] == '/') return 1; /* the root mount covers every path */
     return a[n] == 0 || a[n] == '/';
 }
 
@@ -240,6 +261,33 @@ int vfs_mount(const char* mountpoint, const vfs_fs_ops_t* ops, void* ctx) {
     return -1;
 }
 
+int vfs_unmount(const char* mountpoint) {
+    size_t i;
+    char norm[VFS_MAX_PATH];
+
+    if (normalize_path(mountpoint, norm) < 0) return -1;
+
+    for (i = 0; i < VFS_MAX_MOUNTS; i++) {
+        vfs_mount_t* m = &g_mounts[i];
+        size_t j;
+
+        if (!m->used || strcmp(m->mountpoint, norm) != 0) continue;
+        for (j = 0; j < VFS_MAX_FD; j++) {
+            if (g_fds[j].used && g_fds[j].ops == m->ops && g_fds[j].ctx == m->ctx) return -1;
+        }
+        for (j = 0; j < VFS_MAX_MAPS; j++) {
+            if (g_maps[j].used && g_maps[j].ops == m->ops && g_maps[j].ctx == m->ctx) return -1;
+        }
+        if (starts_with(g_cwd, norm)) {
+            g_cwd[0] = '/';
+            g_cwd[1] = 0;
+        }
+        memset(m, 0, sizeof(*m));
+        return 0;
+    }
+    return -1;
+}
+
 int vfs_open(const char* path, int flags) {
     size_t i;
     const vfs_mount_t* m;
@@ -254,6 +302,7 @@ int vfs_open(const char* path, int flags) {
 
     for (i = 0; i < VFS_MAX_FD; i++) {
         if (!g_fds[i].used) {
+            if (m->ops->open && m->ops->open(m->ctx, node) < 0) return -1;
             g_fds[i].used = 1;
             g_fds[i].flags = flags;
             g_fds[i].ops = m->ops;
@@ -275,6 +324,37 @@ int vfs_read(int fd, void* buf, size_t n) {
     return rc;
 }
 
+/* Filesystems without read_pages go through a bounce buffer. */
+static int read_pages_copy(vfs_fd_t* f, size_t n, vfs_page_cb_t cb, void* user) {
+    char buf[512];
+    size_t done = 0;
+
+    while (done < n) {
+        size_t want = n - done < sizeof(buf) ? n - done : sizeof(buf);
+        int rc = f->ops->read(f->ctx, f->node, f->pos + done, buf, want);
+
+        if (rc < 0) return done ? (int)done : -1;
+        if (rc == 0) break;
+        done += (size_t)rc;
+        if (cb(buf, (size_t)rc, user) != 0) break;
+    }
+    return (int)done;
+}
+
+int vfs_read_pages(int fd, size_t n, vfs_page_cb_t cb, void* user) {
+    vfs_fd_t* f;
+    int rc;
+
+    if (fd < 0 || fd >= VFS_MAX_FD || !g_fds[fd].used || !cb) return -1;
+    f = &g_fds[fd];
+    if ((f->flags & VFS_O_WRONLY) == VFS_O_WRONLY) return -1;
+    if (f->ops->read_pages) rc = f->ops->read_pages(f->ctx, f->node, f->pos, n, cb, user);
+    else if (f->ops->read) rc = read_pages_copy(f, n, cb, user);
+    else return -1;
+    if (rc > 0) f->pos += (size_t)rc;
+    return rc;
+}
+
 int vfs_write(int fd, const void* buf, size_t n) {
     int rc;
     if (fd < 0 || fd >= VFS_MAX_FD || !g_fds[fd].used || !g_fds[fd].ops->write) return -1;
@@ -284,8 +364,145 @@ int vfs_write(int fd, const void* buf, size_t n) {
     return rc;
 }
 
+/* Maps the filesystem's memory page by page; without PAGE_WRITE the window stays read-only. */
+static int map_direct(vfs_map_t* m, uint32_t phys) {
+    uint32_t i;
+
+    for (i = 0; i < m->pages; i++) {
+        if (map_page(m->base + i * PMM_FRAME_SIZE, (phys & 0xFFFFF000u) + i * PMM_FRAME_SIZE, 0) != 0) return -1;
+    }
+    return 0;
+}
+
+void* vfs_mmap(int fd, size_t offset, size_t len) {
+    vfs_fd_t* f;
+    vfs_map_t* m = 0;
+    uint32_t phys;
+    size_t size;
+    size_t i;
+
+    if (fd < 0 || fd >= VFS_MAX_FD || !g_fds[fd].used || !g_fds[fd].ops->size) return 0;
+    f = &g_fds[fd];
+    if ((f->flags & VFS_O_WRONLY) == VFS_O_WRONLY) return 0;
+    size = f->ops->size(f->ctx, f->node);
+    if (offset >= size) return 0;
+    if (len == 0 || len > size - offset) len = size - offset;
+    if (len > 0x7FFFFFFFu) return 0;
+    for (i = 0; i < VFS_MAX_MAPS && !m; i++) {
+        if (!g_maps[i].used) m = &g_maps[i];
+    }
+    if (!m) return 0;
+
+    memset(m, 0, sizeof(*m));
+    if (f->ops->phys_addr && f->ops->phys_addr(f->ctx, f->node, offset, &phys) == 0) {
+        m->direct = 1;
+        m->lead = phys & 0xFFFu;
+        m->offset = offset;
+    } else if (f->ops->read) {
+        m->lead = (uint32_t)(offset & 0xFFFu);
+        m->offset = offset - m->lead;
+    } else {
+        return 0;
+    }
+    m->bytes = m->lead + len;
+    m->pages = (uint32_t)((m->bytes + PMM_FRAME_SIZE - 1u) / PMM_FRAME_SIZE);
+    m->base = vmap_alloc(m->pages);
+    if (!m->base) return 0;
+    if ((m->direct && map_direct(m, phys) != 0) || (f->ops->open && f->ops->open(f->ctx, f->node) < 0)) {
+        vmap_free(m->base, m->pages);
+        return 0;
+    }
+    m->used = 1;
+    m->gen = ++g_map_gen;
+    m->ops = f->ops;
+    m->ctx = f->ctx;
+    m->node = f->node;
+    return (void*)(uintptr_t)(m->base + m->lead);
+}
+
+int vfs_munmap(void* addr) {
+    size_t i;
+
+    for (i = 0; i < VFS_MAX_MAPS; i++) {
+        vfs_map_t* m = &g_maps[i];
+        uint32_t p;
+
+        if (!m->used || m->base + m->lead != (uint32_t)(uintptr_t)addr) continue;
+        /* Frames of lazily filled pages were allocated by vfs_mmap_fault. */
+        for (p = 0; p < m->pages && !m->direct; p++) {
+            uint32_t phys = translate(m->base + p * PMM_FRAME_SIZE);
+            if (phys) pmm_free_frame(phys & 0xFFFFF000u);
+        }
+        vmap_free(m->base, m->pages);
+        if (m->ops->close) m->ops->close(m->ctx, m->node);
+        memset(m, 0, sizeof(*m));
+        return 0;
+    }
+    return -1;
+}
+
+/* The frame is identity mapped like all RAM, so it can be filled before it appears in the window. */
+static int fill_page(const vfs_map_t* m, uint32_t page, uint8_t* buf) {
+    size_t start = (size_t)page * PMM_FRAME_SIZE;
+    size_t want = m->bytes - start < PMM_FRAME_SIZE ? m->bytes - start : PMM_FRAME_SIZE;
+    size_t done = 0;
+
+    memset(buf, 0, PMM_FRAME_SIZE);
+    while (done < want) {
+        int rc = m->ops->read(m->ctx, m->node, m->offset + start + done, buf + done, want - done);
+        if (rc < 0) return -1;
+        if (rc == 0) break;
+        done += (size_t)rc;
+    }
+    return 0;
+}
+
+int vfs_mmap_fault(uint32_t addr) {
+    uint32_t va = addr & 0xFFFFF000u;
+    uint32_t frame;
+    size_t i;
+
+    for (i = 0; i < VFS_MAX_MAPS; i++) {
+        vfs_map_t* m = &g_maps[i];
+        vfs_map_t snap;
+
+        if (!m->used || va < m->base || va - m->base >= m->pages * PMM_FRAME_SIZE) continue;
+        if (m->direct) return -1;
+        if (translate(va)) return 0;
+        frame = pmm_alloc_frame();
+        if (!frame) return -1;
+        /* The read sleeps; a concurrent vfs_munmap must not pull the map out from under it. */
+        snap = *m;
+        if (fill_page(&snap, (va - snap.base) / PMM_FRAME_SIZE, (uint8_t*)(uintptr_t)frame) != 0) {
+            pmm_free_frame(frame);
+            return -1;
+        }
+        /*
+         * Meanwhile the range may have been unmapped, or the slot reused for
+         * another file; retrying the access sorts that out. Another thread
+         * may also have faulted the same page in.
+         */
+        if (!m->used || m->gen != snap.gen || translate(va)) {
+            pmm_free_frame(frame);
+            return 0;
+        }
+        if (map_page(va, frame, 0) != 0) {
+            pmm_free_frame(frame);
+            return -1;
+        }
+        g_map_faults++;
+        return 0;
+    }
+    return -1;
+}
+
+unsigned int vfs_mmap_faults(void) {
+    return g_map_faults;
+}
+
 int vfs_close(int fd) {
     if (fd < 0 || fd >= VFS_MAX_FD || !g_fds[fd].used) return -1;
+    if (g_fds[fd].ops->close) g_fds[fd].ops->close(g_fds[fd].ctx, g_fds[fd].node);
     memset(&g_fds[fd], 0, sizeof(g_fds[fd]));
     return 0;
 }
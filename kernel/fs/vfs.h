@@ -3,13 +3,16 @@
 #include "../lib/types.h"
 
 #define VFS_MAX_PATH 128
-#define VFS_MAX_NAME 24
+#define VFS_MAX_NAME 64
 
 #define VFS_O_RDONLY 0x01
 #define VFS_O_WRONLY 0x02
 #define VFS_O_RDWR 0x03
 #define VFS_O_CREATE 0x10
 
+/* data is only valid during the call; return nonzero to stop reading. */
+typedef int (*vfs_page_cb_t)(const void* data, size_t len, void* user);
+
 typedef struct vfs_fs_ops {
     void* (*get_root)(void* ctx);
     int (*lookup)(void* ctx, void* dir, const char* name, void** out_node, int* out_is_dir);
@@ -18,6 +21,13 @@ typedef struct vfs_fs_ops {
     int (*write)(void* ctx, void* node, size_t offset, const void* buf, size_t n);
     int (*readdir)(void* ctx, void* dir, size_t index, const char** out_name, int* out_is_dir, size_t* out_size);
     size_t (*size)(void* ctx, void* node);
+    /* Optional: a descriptor starts or stops using node. */
+    int (*open)(void* ctx, void* node);
+    void (*close)(void* ctx, void* node);
+    /* Optional: passes up to n bytes from offset to cb straight from the filesystem's own buffers. */
+    int (*read_pages)(void* ctx, void* node, size_t offset, size_t n, vfs_page_cb_t cb, void* user);
+    /* Optional: physical address of the byte at offset when the file lies contiguously in RAM. */
+    int (*phys_addr)(void* ctx, void* node, size_t offset, uint32_t* out_phys);
 } vfs_fs_ops_t;
 
 typedef struct vfs_dirent {
@@ -35,10 +45,33 @@ typedef int (*vfs_listdir_cb_t)(const vfs_dirent_t* ent, void* user);
 
 void vfs_init(void);
 int vfs_mount(const char* mountpoint, const vfs_fs_ops_t* ops, void* ctx);
+/* Fails while descriptors or mappings on the mount are open. */
+int vfs_unmount(const char* mountpoint);
 
 int vfs_open(const char* path, int flags);
 int vfs_read(int fd, void* buf, size_t n);
+/*
+ * Zero-copy counterpart of vfs_read: cb sees the data in place (page
+ * cache, initrd image, read-ahead buffer) and must not keep the pointer
+ * or call into the filesystem. Returns the bytes handed out, 0 at EOF.
+ */
+int vfs_read_pages(int fd, size_t n, vfs_page_cb_t cb, void* user);
 int vfs_write(int fd, const void* buf, size_t n);
+/*
+ * Maps len bytes (0 = up to the end) from offset of the file read-only
+ * into the kernel's vmap window and returns their address, 0 on errors.
+ * Files in RAM (initrd) are mapped in place; all others are filled page
+ * by page on first access by reading through the filesystem, i.e. the
+ * block cache. The mapping outlives fd and pins the file until
+ * vfs_munmap. Lazily filled pages must only be touched from thread
+ * context with interrupts enabled and no filesystem lock held.
+ */
+void* vfs_mmap(int fd, size_t offset, size_t len);
+int vfs_munmap(void* addr);
+/* Page fault in the vmap window; returns 0 when the page is mapped now. */
+int vfs_mmap_fault(uint32_t addr);
+/* Pages filled by vfs_mmap_fault since boot. */
+unsigned int vfs_mmap_faults(void);
 int vfs_close(int fd);
 
 int vfs_mkdir(const char* path);
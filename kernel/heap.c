@@ -3,6 +3,7 @@
 #include "mem/paging.h"
 #include "mem/pmm.h"
 #include "lib/string.h"
+#include "irqstat.h"
 #include "panic.h"
 
 #include <stdint.h>
@@ -40,8 +41,9 @@ static void irq_restore(uint32_t flags) {
     __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
 }
 
-static uint32_t heap_lock(void) {
+static uint32_t heap_lock(void* caller) {
     uint32_t flags = irq_save_disable();
+    irqsoff_begin(flags, caller);
     while (__sync_lock_test_and_set(&g_lock, 1u) != 0u) {
     }
     return flags;
@@ -49,6 +51,7 @@ static uint32_t heap_lock(void) {
 
 static void heap_unlock(uint32_t flags) {
     __sync_lock_release(&g_lock);
+    irqsoff_end(flags);
     irq_restore(flags);
 }
 
@@ -178,7 +181,7 @@ void* kmalloc(size_t size) {
 
     wanted = (size + (HEAP_ALIGN - 1u)) & ~(HEAP_ALIGN - 1u);
 
-    flags = heap_lock();
+    flags = heap_lock(__builtin_return_address(0));
 
 retry:
     cur = g_head;
@@ -208,7 +211,7 @@ void kfree(void* ptr) {
         return;
     }
 
-    flags = heap_lock();
+    flags = heap_lock(__builtin_return_address(0));
 
     block = (heap_block_t*)((uintptr_t)ptr - block_overhead());
     block->free = 1;
@@ -270,7 +273,7 @@ void heap_get_stats(heap_stats_t* out) {
         return;
     }
 
-    flags = heap_lock();
+    flags = heap_lock(__builtin_return_address(0));
     stats.heap_start = g_heap_start;
     stats.heap_end = g_heap_end;
     stats.total_bytes = g_heap_end - g_heap_start;
@@ -0,0 +1,98 @@
+#include "input.h"
+
+#include "../lib/ring.h"
+#include "../sched/sync.h"
+#include "../serial.h"
+
+#define INPUT_KEY_RING_SIZE 128u
+
+static uint8_t g_key_storage[RING_STORAGE_SIZE(sizeof(key_event_t), INPUT_KEY_RING_SIZE)];
+static ring_t g_key_ring;
+static semaphore_t g_input_ready;
+
+/* Serial line discipline state for ANSI arrow keys (ESC [ A..D). */
+static uint8_t g_esc_state;
+
+void input_init(void) {
+    ring_init(&g_key_ring, g_key_storage, sizeof(key_event_t), INPUT_KEY_RING_SIZE);
+    sem_init(&g_input_ready, "input", 0);
+    g_esc_state = 0;
+}
+
+void input_report_key(key_event_t ev) {
+    if (ring_push(&g_key_ring, &ev) == 0) {
+        sem_post(&g_input_ready);
+    }
+}
+
+void input_notify(void) {
+    sem_post(&g_input_ready);
+}
+
+static int serial_to_key(uint8_t b, key_event_t* ev) {
+    ev->code = KEY_NONE;
+    ev->ch = 0;
+    ev->modifiers = 0;
+
+    if (g_esc_state == 1) {
+        g_esc_state = (b == '[') ? 2 : 0;
+        return 0;
+    }
+    if (g_esc_state == 2) {
+        g_esc_state = 0;
+        if (b == 'A') ev->code = KEY_UP;
+        else if (b == 'B') ev->code = KEY_DOWN;
+        else if (b == 'C') ev->code = KEY_RIGHT;
+        else if (b == 'D') ev->code = KEY_LEFT;
+        else if (b == 'H') ev->code = KEY_HOME;
+        else if (b == 'F') ev->code = KEY_END;
+        return ev->code != KEY_NONE;
+    }
+
+    if (b == 0x1B) {
+        g_esc_state = 1;
+        return 0;
+    }
+    if (b == '\r' || b == '\n') {
+        ev->code = KEY_ENTER;
+        return 1;
+    }
+    if (b == 0x7F || b == 0x08) {
+        ev->code = KEY_BACKSPACE;
+        return 1;
+    }
+    if (b == '\t') {
+        ev->code = KEY_TAB;
+        return 1;
+    }
+    if (b >= 32 && b <= 126) {
+        ev->code = KEY_CHAR;
+        ev->ch = (char)b;
+        return 1;
+    }
+    return 0;
+}
+
+int input_poll_event(key_event_t* out) {
+    uint8_t b;
+
+    if (ring_pop(&g_key_ring, out)) {
+        return 1;
+    }
+    while (serial_read_byte(&b)) {
+        if (serial_to_key(b, out)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void input_wait_event(key_event_t* out) {
+    while (!input_poll_event(out)) {
+        sem_wait(&g_input_ready);
+    }
+}
+
+uint32_t input_dropped_events(void) {
+    return ring_dropped(&g_key_ring) + serial_rx_dropped();
+}
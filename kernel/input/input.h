@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+#include "keyboard.h"
+
+/*
+ * IRQ-to-thread input path: keyboard/serial IRQ handlers only enqueue into
+ * lock-free rings and wake the shell thread, which decodes and dispatches.
+ */
+void input_init(void);
+void input_report_key(key_event_t ev);
+void input_notify(void);
+
+int input_poll_event(key_event_t* out);
+void input_wait_event(key_event_t* out);
+
+uint32_t input_dropped_events(void);
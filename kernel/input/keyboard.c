@@ -1,11 +1,17 @@
 #include "keyboard.h"
 
-#include "../pic.h"
+#include "../lib/ring.h"
 #include "../ports.h"
-#include "../shell/shell.h"
+#include "../sched/softirq.h"
+#include "input.h"
+
+#define KBD_SCANCODE_RING_SIZE 64u
 
 static uint8_t g_mods = 0;
 static uint8_t g_e0 = 0;
+static uint8_t g_sc_storage[RING_STORAGE_SIZE(1u, KBD_SCANCODE_RING_SIZE)];
+static ring_t g_sc_ring;
+static work_t g_kbd_work;
 
 static const char keymap[128] = {
     0,  27, '1','2','3','4','5','6','7','8','9','0','-','=', 0,
@@ -22,7 +28,7 @@ static const char keymap_shift[128] = {
 };
 
 static void emit_key(key_event_t ev) {
-    shell_handle_key(ev);
+    input_report_key(ev);
 }
 
 static char map_ascii(uint8_t sc) {
@@ -78,17 +84,9 @@ static void on_key_press(uint8_t sc) {
     }
 }
 
-void keyboard_init(void) {
-    g_mods = 0;
-    g_e0 = 0;
-}
-
-void keyboard_isr(void) {
-    uint8_t sc = inb(0x60);
-
+static void process_scancode(uint8_t sc) {
     if (sc == 0xE0) {
         g_e0 = 1;
-        pic_send_eoi(1);
         return;
     }
 
@@ -103,8 +101,30 @@ void keyboard_isr(void) {
         else if (sc == 0x38) g_mods |= KEYMOD_ALT;
         else on_key_press(sc);
     }
+}
+
+/* Bottom half (SOFTIRQ_INPUT): decode queued scancodes into key events. */
+static void keyboard_softirq(void* arg) {
+    uint8_t sc;
+    (void)arg;
+
+    while (ring_pop(&g_sc_ring, &sc)) {
+        process_scancode(sc);
+    }
+}
+
+void keyboard_init(void) {
+    g_mods = 0;
+    g_e0 = 0;
+    ring_init(&g_sc_ring, g_sc_storage, 1u, KBD_SCANCODE_RING_SIZE);
+    work_init(&g_kbd_work, keyboard_softirq, 0);
+}
+
+void keyboard_isr(void) {
+    uint8_t sc = inb(0x60);
 
-    pic_send_eoi(1);
+    ring_push(&g_sc_ring, &sc);
+    softirq_raise(&g_kbd_work, SOFTIRQ_INPUT);
 }
 
 void irq1_handler_c(void) {
@@ -0,0 +1,104 @@
+#include "irqstat.h"
+
+#include "lib/string.h"
+#include "tsc.h"
+
+#define EFLAGS_IF 0x200u
+
+static irq_vector_stats_t g_vec[IRQSTAT_VECTORS];
+static irqsoff_entry_t g_top[IRQSOFF_TOP];
+static uint64_t g_off_start;
+static uint32_t g_off_caller;
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+/* Runs from irq_dispatch with IRQs disabled. */
+void irqstat_record(uint32_t irq, uint32_t cycles) {
+    irq_vector_stats_t* v;
+
+    if (irq >= IRQSTAT_VECTORS) return;
+    v = &g_vec[irq];
+    if (v->count == 0 || cycles < v->min_cycles) v->min_cycles = cycles;
+    if (cycles > v->max_cycles) v->max_cycles = cycles;
+    v->total_cycles += cycles;
+    v->count++;
+}
+
+void irqstat_get(uint32_t irq, irq_vector_stats_t* out) {
+    uint32_t flags;
+
+    if (!out || irq >= IRQSTAT_VECTORS) return;
+    flags = irq_save_disable();
+    *out = g_vec[irq];
+    irq_restore(flags);
+}
+
+void irqstat_reset(void) {
+    uint32_t flags = irq_save_disable();
+    memset(g_vec, 0, sizeof(g_vec));
+    memset(g_top, 0, sizeof(g_top));
+    irq_restore(flags);
+}
+
+void irqsoff_begin(uint32_t saved_flags, void* caller) {
+    if ((saved_flags & EFLAGS_IF) == 0) return;
+    g_off_start = tsc_read();
+    g_off_caller = (uint32_t)(uintptr_t)caller;
+}
+
+void irqsoff_end(uint32_t saved_flags) {
+    uint32_t cycles;
+    int slot;
+    int i;
+
+    if ((saved_flags & EFLAGS_IF) == 0) return;
+    cycles = (uint32_t)(tsc_read() - g_off_start);
+
+    /* Same call site keeps only its worst case; otherwise replace the shortest entry. */
+    slot = 0;
+    for (i = 0; i < IRQSOFF_TOP; i++) {
+        if (g_top[i].caller == g_off_caller && g_top[i].cycles != 0) {
+            if (cycles > g_top[i].cycles) g_top[i].cycles = cycles;
+            return;
+        }
+        if (g_top[i].cycles < g_top[slot].cycles) slot = i;
+    }
+    if (cycles > g_top[slot].cycles) {
+        g_top[slot].cycles = cycles;
+        g_top[slot].caller = g_off_caller;
+    }
+}
+
+int irqsoff_get_top(irqsoff_entry_t* out, int max) {
+    uint32_t flags;
+    int n = 0;
+    int i;
+    int j;
+
+    if (!out || max <= 0) return 0;
+
+    flags = irq_save_disable();
+    for (i = 0; i < IRQSOFF_TOP && n < max; i++) {
+        if (g_top[i].cycles != 0) out[n++] = g_top[i];
+    }
+    irq_restore(flags);
+
+    for (i = 1; i < n; i++) {
+        irqsoff_entry_t e = out[i];
+        j = i - 1;
+        while (j >= 0 && out[j].cycles < e.cycles) {
+            out[j + 1] = out[j];
+            j--;
+        }
+        out[j + 1] = e;
+    }
+    return n;
+}
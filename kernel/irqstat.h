@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#define IRQSTAT_VECTORS 16
+#define IRQSOFF_TOP 8
+
+typedef struct irq_vector_stats {
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+} irq_vector_stats_t;
+
+typedef struct irqsoff_entry {
+    uint32_t cycles;
+    uint32_t caller;
+} irqsoff_entry_t;
+
+void irqstat_record(uint32_t irq, uint32_t cycles);
+void irqstat_get(uint32_t irq, irq_vector_stats_t* out);
+void irqstat_reset(void);
+
+/*
+ * IRQs-off tracer: callers pass the flags returned by their cli helper.
+ * Only outermost sections (IF was set before) are timed; the longest
+ * IRQSOFF_TOP sections are kept with the call site address.
+ */
+void irqsoff_begin(uint32_t saved_flags, void* caller);
+void irqsoff_end(uint32_t saved_flags);
+int irqsoff_get_top(irqsoff_entry_t* out, int max);
@@ -1,8 +1,13 @@
 #include "isr.h"
+#include "apic.h"
+#include "console.h"
 #include "idt.h"
+#include "irqstat.h"
 #include "pic.h"
 #include "ports.h"
 #include "pit.h"
+#include "tsc.h"
+#include "sched/softirq.h"
 #include <stdint.h>
 
 /* Exception gates (0..31) */
@@ -39,6 +44,32 @@ extern void isr29_stub(void);
 extern void isr30_stub(void);
 extern void isr31_stub(void);
 
+/* IRQ gates (0x20..0x2F), generated in isr_stubs.s */
+extern void irq0_stub(void);
+extern void irq1_stub(void);
+extern void irq2_stub(void);
+extern void irq3_stub(void);
+extern void irq4_stub(void);
+extern void irq5_stub(void);
+extern void irq6_stub(void);
+extern void irq7_stub(void);
+extern void irq8_stub(void);
+extern void irq9_stub(void);
+extern void irq10_stub(void);
+extern void irq11_stub(void);
+extern void irq12_stub(void);
+extern void irq13_stub(void);
+extern void irq14_stub(void);
+extern void irq15_stub(void);
+
+extern void apic_spurious_stub(void);
+
+static irq_handler_t g_irq_handlers[IRQ_COUNT];
+static uint8_t g_irq_pci[IRQ_COUNT];
+static volatile uint32_t g_irq_depth;
+static int g_use_apic;
+static int g_irq_ready;
+
 static void set_exc_gates(void) {
     void* stubs[32] = {
         isr0_stub,isr1_stub,isr2_stub,isr3_stub,isr4_stub,isr5_stub,isr6_stub,isr7_stub,
@@ -53,8 +84,89 @@ static void set_exc_gates(void) {
     }
 }
 
+static void set_irq_gates(void) {
+    void* stubs[IRQ_COUNT] = {
+        irq0_stub,irq1_stub,irq2_stub,irq3_stub,irq4_stub,irq5_stub,irq6_stub,irq7_stub,
+        irq8_stub,irq9_stub,irq10_stub,irq11_stub,irq12_stub,irq13_stub,irq14_stub,irq15_stub
+    };
+    int i;
+
+    for (i = 0; i < IRQ_COUNT; i++) {
+        idt_set_gate((uint8_t)(IRQ_VECTOR_BASE + i), (uint32_t)stubs[i], 0x10, 0x8E);
+    }
+}
+
+static void pic_unmask(uint8_t irq) {
+    uint16_t port = (irq < 8) ? 0x21 : 0xA1;
+    uint8_t mask = inb(port);
+
+    mask &= (uint8_t)~(1u << (irq & 7u));
+    outb(port, mask);
+    if (irq >= 8) {
+        /* Cascade line on the master. */
+        outb(0x21, (uint8_t)(inb(0x21) & ~(1u << 2)));
+    }
+}
+
+static int irq_enable_line(uint8_t irq) {
+    if (g_use_apic) {
+        return apic_route_irq(irq, (uint8_t)(IRQ_VECTOR_BASE + irq), g_irq_pci[irq]);
+    }
+    pic_unmask(irq);
+    return 0;
+}
+
+/* Drivers probed before isr_install get their line enabled once the controller is up. */
+int irq_install_handler(uint8_t irq, irq_handler_t handler) {
+    if (irq >= IRQ_COUNT || !handler) return -1;
+    g_irq_handlers[irq] = handler;
+    if (!g_irq_ready) return 0;
+    return irq_enable_line(irq);
+}
+
+/* Same for a PCI INTx line, which the IOAPIC then routes level-triggered, active-low. */
+int irq_install_pci_handler(uint8_t irq, irq_handler_t handler) {
+    if (irq >= IRQ_COUNT || !handler) return -1;
+    g_irq_pci[irq] = 1;
+    return irq_install_handler(irq, handler);
+}
+
+const char* irq_controller_name(void) {
+    return g_use_apic ? "ioapic" : "8259";
+}
+
+static void irq_eoi(uint32_t irq) {
+    if (g_use_apic) {
+        /* Unrouted lines can only be 8259 spurious IRQs; the LAPIC never saw them. */
+        if (g_irq_handlers[irq] || apic_vector_in_service((uint8_t)(IRQ_VECTOR_BASE + irq))) {
+            apic_eoi();
+        }
+        return;
+    }
+    pic_send_eoi((uint8_t)irq);
+}
+
+int irq_in_hardirq(void) {
+    return g_irq_depth != 0;
+}
+
+/* entry_tsc is sampled by the stub right after pusha, before any C code runs. */
+void irq_dispatch(uint32_t irq, uint64_t entry_tsc) {
+    g_irq_depth++;
+    if (irq < IRQ_COUNT && g_irq_handlers[irq]) {
+        g_irq_handlers[irq]();
+    }
+    irq_eoi(irq);
+    irqstat_record(irq, (uint32_t)(tsc_read() - entry_tsc));
+    g_irq_depth--;
+
+    if (g_irq_depth == 0) {
+        softirq_irq_exit();
+    }
+}
+
 void isr_install(void) {
-    uint8_t mask;
+    int i;
 
     set_exc_gates();
 
@@ -63,13 +175,24 @@ void isr_install(void) {
     outb(0x21, 0xFF);
     outb(0xA1, 0xFF);
 
-    idt_set_gate(0x20, (uint32_t)irq0_stub, 0x10, 0x8E);
-    idt_set_gate(0x21, (uint32_t)irq1_stub, 0x10, 0x8E);
+    set_irq_gates();
+
+    /* Prefer LAPIC/IOAPIC when the MADT describes them; the 8259 stays masked then. */
+    if (apic_init() == 0) {
+        idt_set_gate(APIC_SPURIOUS_VECTOR, (uint32_t)apic_spurious_stub, 0x10, 0x8E);
+        g_use_apic = 1;
+    }
+    console_print("IRQ controller: ");
+    console_print(irq_controller_name());
+    console_putc('\n');
 
-    mask = inb(0x21);
-    mask &= ~(1 << 0);
-    mask &= ~(1 << 1);
-    outb(0x21, mask);
+    g_irq_ready = 1;
+    for (i = 0; i < IRQ_COUNT; i++) {
+        if (g_irq_handlers[i]) irq_enable_line((uint8_t)i);
+    }
 
     pit_init(100);
+    irq_install_handler(0, irq0_handler_c);
+    irq_install_handler(1, irq1_handler_c);
+    irq_install_handler(4, irq4_handler_c);
 }
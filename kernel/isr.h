@@ -1,10 +1,18 @@
 #pragma once
 #include <stdint.h>
 
-void isr_install(void);
+#define IRQ_COUNT 16
+#define IRQ_VECTOR_BASE 0x20
+
+typedef void (*irq_handler_t)(void);
 
-extern void irq0_stub(void);
-extern void irq1_stub(void);
+void isr_install(void);
+int irq_install_handler(uint8_t irq, irq_handler_t handler);
+int irq_install_pci_handler(uint8_t irq, irq_handler_t handler);
+void irq_dispatch(uint32_t irq, uint64_t entry_tsc);
+int irq_in_hardirq(void);
+const char* irq_controller_name(void);
 
 void irq0_handler_c(void);
 void irq1_handler_c(void);
+void irq4_handler_c(void);
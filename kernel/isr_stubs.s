@@ -1,16 +1,38 @@
-.global irq0_stub
-.global irq1_stub
-.extern irq0_handler_c
-.extern irq1_handler_c
+.extern irq_dispatch
 
-irq0_stub:
+# Hardware IRQ 0..15 on vectors 0x20..0x2F; irq_dispatch(irq, entry_tsc) handles EOI, cost accounting + softirqs.
+.macro IRQ n
+  .global irq\n\()_stub
+irq\n\()_stub:
     pusha
-    call irq0_handler_c
+    rdtsc
+    pushl %edx
+    pushl %eax
+    pushl $\n
+    call irq_dispatch
+    add $12, %esp
     popa
     iret
+.endm
 
-irq1_stub:
-    pusha
-    call irq1_handler_c
-    popa
+IRQ 0
+IRQ 1
+IRQ 2
+IRQ 3
+IRQ 4
+IRQ 5
+IRQ 6
+IRQ 7
+IRQ 8
+IRQ 9
+IRQ 10
+IRQ 11
+IRQ 12
+IRQ 13
+IRQ 14
+IRQ 15
+
+# LAPIC spurious vector: no handler, no EOI.
+.global apic_spurious_stub
+apic_spurious_stub:
     iret
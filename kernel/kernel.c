@@ -1,18 +1,30 @@
+#include "acpi.h"
 #include "console.h"
 #include "shell/shell.h"
 #include "heap.h"
 #include "idt.h"
 #include "isr.h"
 #include "keyboard.h"
+#include "input/input.h"
 #include "mem/paging.h"
 #include "mem/pmm.h"
 #include "panic.h"
+#include "tsc.h"
 #include "fs/ramfs.h"
 #include "fs/vfs.h"
 #include "fs/initrd.h"
 #include "sched/thread.h"
+#include "sched/timer.h"
+#include "sched/workqueue.h"
+#include "block/bcache.h"
 #include "block/blockdev.h"
+#include "drivers/ahci.h"
+#include "drivers/ata.h"
+#include "drivers/ata_dma.h"
 #include "drivers/ata_pio.h"
+#include "drivers/memdisk.h"
+#include "drivers/pci.h"
+#include "drivers/virtio_blk.h"
 
 #include <stdint.h>
 
@@ -67,6 +79,9 @@ void kmain(uint32_t mb_magic, uint32_t mb_info_addr) {
     console_print("Init: Paging...\n");
     paging_init(pmm_get_max_phys_addr());
 
+    console_print("Init: ACPI...\n");
+    acpi_init(mb_magic, mb_info_addr);
+
     console_print("Init: Heap...\n");
     heap_init();
 
@@ -81,13 +96,24 @@ void kmain(uint32_t mb_magic, uint32_t mb_info_addr) {
 
     console_print("Init: Block devices...\n");
     block_init();
+    pci_init();
+    ata_init();
     ata_pio_discover();
+    ata_dma_discover();
+    ahci_discover();
+    virtio_blk_discover();
+    memdisk_discover(mb_magic, mb_info_addr);
 
-    console_print("Init: IDT + PIC + Keyboard + Scheduler...\n");
+    console_print("Init: IDT + IRQ controller + Keyboard + Scheduler...\n");
     idt_init();
-    isr_install();
+    tsc_calibrate();
+    input_init();
+    timer_init();
     keyboard_init();
+    isr_install();
     sched_init();
+    workqueue_init();
+    bcache_init();
 
     __asm__ volatile("sti");
 
@@ -96,8 +122,11 @@ void kmain(uint32_t mb_magic, uint32_t mb_info_addr) {
     }
     console_print("OK. Tippe 'help' und druecke Enter.\n");
     shell_init();
+    if (thread_create("shell", shell_thread_main, 0) < 0) {
+        panic("kmain: cannot start shell thread");
+    }
 
     for (;;) {
-        __asm__ volatile("hlt");
+        sched_idle();
     }
 }
@@ -0,0 +1,22 @@
+#include "div64.h"
+
+uint64_t div_u64(uint64_t n, uint32_t d, uint32_t* rem) {
+    uint32_t high = (uint32_t)(n >> 32);
+    uint32_t low = (uint32_t)n;
+    uint32_t q_high;
+    uint32_t q_low;
+    uint32_t r;
+
+    if (d == 0) {
+        if (rem) *rem = 0;
+        return 0;
+    }
+
+    q_high = high / d;
+    r = high % d;
+    /* r < d, so r:low / d fits in 32 bits and divl cannot fault. */
+    __asm__("divl %4" : "=a"(q_low), "=d"(r) : "a"(low), "d"(r), "rm"(d));
+
+    if (rem) *rem = r;
+    return ((uint64_t)q_high << 32) | q_low;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+/* 64/32 division without libgcc (__udivdi3 is not linked into the kernel). */
+uint64_t div_u64(uint64_t n, uint32_t d, uint32_t* rem);
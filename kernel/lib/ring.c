@@ -0,0 +1,71 @@
+#include "ring.h"
+
+#include "string.h"
+
+/* Uniprocessor x86: stores are not reordered with other stores, so keeping
+ * the compiler from reordering is enough to publish a slot. */
+#define ring_barrier() __asm__ volatile("" : : : "memory")
+
+static volatile uint32_t* slot_seq(const ring_t* r, uint32_t pos) {
+    return (volatile uint32_t*)(r->slots + (pos & r->mask) * r->stride);
+}
+
+static uint8_t* slot_data(const ring_t* r, uint32_t pos) {
+    return r->slots + (pos & r->mask) * r->stride + 4u;
+}
+
+int ring_init(ring_t* r, void* storage, uint32_t elem_size, uint32_t capacity) {
+    uint32_t i;
+
+    if (!r || !storage || elem_size == 0 || capacity < 2) return -1;
+    if ((capacity & (capacity - 1u)) != 0) return -1;
+
+    r->slots = (uint8_t*)storage;
+    r->elem_size = elem_size;
+    r->stride = RING_SLOT_STRIDE(elem_size);
+    r->mask = capacity - 1u;
+    r->enqueue_pos = 0;
+    r->dequeue_pos = 0;
+    r->dropped = 0;
+
+    for (i = 0; i < capacity; i++) {
+        *slot_seq(r, i) = i;
+    }
+    return 0;
+}
+
+static void publish(ring_t* r, uint32_t pos, const void* elem) {
+    memcpy(slot_data(r, pos), elem, r->elem_size);
+    ring_barrier();
+    *slot_seq(r, pos) = pos + 1u;
+}
+
+int ring_push(ring_t* r, const void* elem) {
+    uint32_t pos = r->enqueue_pos;
+
+    if ((int32_t)(*slot_seq(r, pos) - pos) != 0) {
+        r->dropped++;
+        return -1;
+    }
+    r->enqueue_pos = pos + 1u;
+    publish(r, pos, elem);
+    return 0;
+}
+
+int ring_pop(ring_t* r, void* out) {
+    uint32_t pos = r->dequeue_pos;
+
+    if ((int32_t)(*slot_seq(r, pos) - (pos + 1u)) < 0) {
+        return 0;
+    }
+
+    memcpy(out, slot_data(r, pos), r->elem_size);
+    ring_barrier();
+    *slot_seq(r, pos) = pos + r->mask + 1u;
+    r->dequeue_pos = pos + 1u;
+    return 1;
+}
+
+uint32_t ring_dropped(const ring_t* r) {
+    return r->dropped;
+}
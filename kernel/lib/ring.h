@@ -0,0 +1,28 @@
+#pragma once
+
+#include "types.h"
+
+/*
+ * Bounded lock-free ring of fixed-size elements (per-slot sequence numbers).
+ * ring_push: single producer (an IRQ handler), ring_pop: single consumer.
+ * Never blocks, so it is safe from interrupt context; a full ring drops the
+ * element and counts it.
+ */
+
+#define RING_SLOT_STRIDE(elem_size) ((((elem_size) + 3u) & ~3u) + 4u)
+#define RING_STORAGE_SIZE(elem_size, capacity) (RING_SLOT_STRIDE(elem_size) * (capacity))
+
+typedef struct ring {
+    uint8_t* slots;
+    uint32_t elem_size;
+    uint32_t stride;
+    uint32_t mask;
+    volatile uint32_t enqueue_pos;
+    volatile uint32_t dequeue_pos;
+    volatile uint32_t dropped;
+} ring_t;
+
+int ring_init(ring_t* r, void* storage, uint32_t elem_size, uint32_t capacity);
+int ring_push(ring_t* r, const void* elem);
+int ring_pop(ring_t* r, void* out);
+uint32_t ring_dropped(const ring_t* r);
@@ -60,3 +60,14 @@ void* memset(void* dst, int value, size_t n) {
     for (i = 0; i < n; i++) d[i] = (unsigned char)value;
     return dst;
 }
+
+int memcmp(const void* a, const void* b, size_t n) {
+    size_t i;
+    const unsigned char* pa = (const unsigned char*)a;
+    const unsigned char* pb = (const unsigned char*)b;
+
+    for (i = 0; i < n; i++) {
+        if (pa[i] != pb[i]) return (int)pa[i] - (int)pb[i];
+    }
+    return 0;
+}
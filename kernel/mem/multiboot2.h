@@ -9,6 +9,8 @@
 #define MULTIBOOT2_TAG_TYPE_BASIC_MEMINFO 4u
 #define MULTIBOOT2_TAG_TYPE_MMAP 6u
 #define MULTIBOOT2_TAG_TYPE_FRAMEBUFFER 8u
+#define MULTIBOOT2_TAG_TYPE_ACPI_OLD 14u
+#define MULTIBOOT2_TAG_TYPE_ACPI_NEW 15u
 
 #define MULTIBOOT2_MMAP_TYPE_AVAILABLE 1u
 
@@ -63,3 +65,9 @@ struct mb2_tag_framebuffer_common {
     uint8_t framebuffer_type;
     uint16_t reserved;
 };
+
+struct mb2_tag_acpi {
+    uint32_t type;
+    uint32_t size;
+    uint8_t rsdp[0];
+};
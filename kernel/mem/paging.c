@@ -9,11 +9,15 @@
 #include <stdint.h>
 
 #define MAX_BOOTSTRAP_TABLES 256u
+#define VMAP_PAGES 8192u /* 32 MiB */
+#define VMAP_TABLES (VMAP_PAGES / 1024u)
 
 static uint32_t g_page_directory[1024] __attribute__((aligned(4096)));
 static uint32_t g_table_pool[MAX_BOOTSTRAP_TABLES][1024] __attribute__((aligned(4096)));
 static uint32_t g_tables_used;
 static int g_paging_enabled;
+static uint32_t g_vmap_base;
+static uint32_t g_vmap_used[VMAP_PAGES / 32u];
 
 static void print_u32(uint32_t n) {
     char buf[11];
@@ -165,6 +169,111 @@ uint32_t translate(uint32_t virt) {
     return (table[pt_index] & 0xFFFFF000u) | (virt & 0xFFFu);
 }
 
+int map_identity(uint32_t phys, uint32_t bytes, uint32_t flags) {
+    uint32_t start = phys & 0xFFFFF000u;
+    uint32_t end;
+    uint32_t addr;
+
+    if (bytes == 0u) {
+        return 0;
+    }
+
+    end = (phys + bytes + 0xFFFu) & 0xFFFFF000u;
+    if (end != 0u && end < start) {
+        return -1;
+    }
+
+    addr = start;
+    do {
+        uint32_t cur = translate(addr);
+        if (cur != 0u && cur != addr) {
+            return -1;
+        }
+        if (map_page(addr, addr, flags) != 0) {
+            return -1;
+        }
+        addr += PMM_FRAME_SIZE;
+    } while (addr != end);
+
+    return 0;
+}
+
+int map_mmio(uint32_t phys, uint32_t bytes) {
+    return map_identity(phys, bytes, PAGE_WRITE | PAGE_PCD | PAGE_PWT);
+}
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+/*
+ * The window starts at the next 4 MiB boundary past the identity map plus
+ * a 4 MiB guard. Its page tables are created here, so mapping into it
+ * later never needs a table from the pool.
+ */
+static void vmap_init(uint32_t phys_limit) {
+    uint32_t base = ((phys_limit + 0x3FFFFFu) & 0xFFC00000u) + 0x400000u;
+    uint32_t i;
+
+    g_vmap_base = 0;
+    if (base < phys_limit || base > 0xF0000000u - VMAP_PAGES * PMM_FRAME_SIZE) return;
+    if (g_tables_used + VMAP_TABLES > MAX_BOOTSTRAP_TABLES) return;
+    for (i = 0; i < VMAP_TABLES; i++) {
+        if (g_page_directory[((base >> 22) + i) & 0x3FFu] & PAGE_PRESENT) return;
+    }
+    for (i = 0; i < VMAP_TABLES; i++) get_table(base + i * 0x400000u, 1);
+    g_vmap_base = base;
+}
+
+int vmap_contains(uint32_t virt) {
+    return g_vmap_base && virt >= g_vmap_base && virt - g_vmap_base < VMAP_PAGES * PMM_FRAME_SIZE;
+}
+
+uint32_t vmap_alloc(uint32_t pages) {
+    uint32_t flags;
+    uint32_t start = 0;
+    uint32_t run = 0;
+    uint32_t i;
+
+    if (!g_vmap_base || pages == 0u || pages > VMAP_PAGES) return 0;
+    flags = irq_save_disable();
+    for (i = 0; i < VMAP_PAGES && run < pages; i++) {
+        if (g_vmap_used[i / 32u] & (1u << (i % 32u))) {
+            run = 0;
+            continue;
+        }
+        if (run++ == 0u) start = i;
+    }
+    if (run < pages) {
+        irq_restore(flags);
+        return 0;
+    }
+    for (i = start; i < start + pages; i++) g_vmap_used[i / 32u] |= 1u << (i % 32u);
+    irq_restore(flags);
+    return g_vmap_base + start * PMM_FRAME_SIZE;
+}
+
+void vmap_free(uint32_t virt, uint32_t pages) {
+    uint32_t flags;
+    uint32_t first;
+    uint32_t i;
+
+    if (!vmap_contains(virt) || (virt & 0xFFFu) || pages > VMAP_PAGES - (virt - g_vmap_base) / PMM_FRAME_SIZE) return;
+    first = (virt - g_vmap_base) / PMM_FRAME_SIZE;
+    flags = irq_save_disable();
+    for (i = first; i < first + pages; i++) {
+        unmap_page(g_vmap_base + i * PMM_FRAME_SIZE);
+        g_vmap_used[i / 32u] &= ~(1u << (i % 32u));
+    }
+    irq_restore(flags);
+}
+
 void paging_init(uint32_t phys_limit) {
     uint32_t cr0;
     uint64_t fb_addr = 0;
@@ -206,10 +315,13 @@ void paging_init(uint32_t phys_limit) {
         serial_print("paging: no active framebuffer backend\n");
     }
 
+    vmap_init(phys_limit);
+
     __asm__ volatile("mov %0, %%cr3" : : "r"((uint32_t)(uintptr_t)g_page_directory) : "memory");
 
     __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000u;
+    /* PG, and WP so that read-only pages (the vfs_mmap window) bind the kernel too. */
+    cr0 |= 0x80000000u | 0x00010000u;
     __asm__ volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
 
     g_paging_enabled = 1;
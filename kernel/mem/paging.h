@@ -5,8 +5,25 @@
 #define PAGE_PRESENT 0x001u
 #define PAGE_WRITE   0x002u
 #define PAGE_USER    0x004u
+#define PAGE_PWT     0x008u
+#define PAGE_PCD     0x010u
 
 void paging_init(uint32_t phys_limit);
 int map_page(uint32_t virt, uint32_t phys, uint32_t flags);
 void unmap_page(uint32_t virt);
 uint32_t translate(uint32_t virt);
+
+/* Identity map a physical range after boot (ACPI tables, MMIO); refuses to
+ * replace a page that already maps somewhere else. */
+int map_identity(uint32_t phys, uint32_t bytes, uint32_t flags);
+int map_mmio(uint32_t phys, uint32_t bytes);
+
+/*
+ * Kernel virtual window above the identity-mapped RAM for mappings made
+ * after boot (vfs_mmap). vmap_alloc returns 0 when the window is full or
+ * could not be set up; vmap_free unmaps every page of the range, frames
+ * behind it belong to the caller.
+ */
+uint32_t vmap_alloc(uint32_t pages);
+void vmap_free(uint32_t virt, uint32_t pages);
+int vmap_contains(uint32_t virt);
@@ -2,6 +2,7 @@
 
 #include "multiboot2.h"
 #include "../console.h"
+#include "../irqstat.h"
 #include "../panic.h"
 #include "../lib/string.h"
 
@@ -31,8 +32,9 @@ static void irq_restore(uint32_t flags) {
     __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
 }
 
-static uint32_t pmm_lock(void) {
+static uint32_t pmm_lock(void* caller) {
     uint32_t flags = irq_save_disable();
+    irqsoff_begin(flags, caller);
     while (__sync_lock_test_and_set(&g_lock, 1u) != 0u) {
     }
     return flags;
@@ -40,6 +42,7 @@ static uint32_t pmm_lock(void) {
 
 static void pmm_unlock(uint32_t flags) {
     __sync_lock_release(&g_lock);
+    irqsoff_end(flags);
     irq_restore(flags);
 }
 
@@ -251,7 +254,7 @@ uint32_t pmm_alloc_frame(void) {
         return 0;
     }
 
-    flags = pmm_lock();
+    flags = pmm_lock(__builtin_return_address(0));
 
     for (i = 0; i < PMM_BITMAP_WORDS; i++) {
         if (g_bitmap[i] != 0xFFFFFFFFu) {
@@ -275,6 +278,44 @@ uint32_t pmm_alloc_frame(void) {
     return 0;
 }
 
+/* First-fit run of free frames for devices that need physically contiguous memory. */
+uint32_t pmm_alloc_frames(uint32_t count) {
+    uint32_t frame;
+    uint32_t run = 0;
+    uint32_t flags;
+
+    if (!g_ready || count == 0u) {
+        return 0;
+    }
+    if (count == 1u) {
+        return pmm_alloc_frame();
+    }
+
+    flags = pmm_lock(__builtin_return_address(0));
+
+    for (frame = 0; frame < g_stats.total_frames; frame++) {
+        if (is_set(frame)) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) {
+            uint32_t first = frame + 1u - count;
+            uint32_t i;
+
+            for (i = first; i <= frame; i++) {
+                set_frame(i);
+            }
+            g_stats.free_frames -= count;
+            g_stats.used_frames += count;
+            pmm_unlock(flags);
+            return first * PMM_FRAME_SIZE;
+        }
+    }
+
+    pmm_unlock(flags);
+    return 0;
+}
+
 void pmm_free_frame(uint32_t phys_addr) {
     uint32_t frame;
     uint32_t flags;
@@ -283,7 +324,7 @@ void pmm_free_frame(uint32_t phys_addr) {
         return;
     }
 
-    flags = pmm_lock();
+    flags = pmm_lock(__builtin_return_address(0));
 
     frame = phys_addr / PMM_FRAME_SIZE;
     if (frame >= g_stats.total_frames) {
@@ -305,7 +346,7 @@ void pmm_get_stats(pmm_stats_t* out) {
     if (!out) {
         return;
     }
-    flags = pmm_lock();
+    flags = pmm_lock(__builtin_return_address(0));
     *out = g_stats;
     pmm_unlock(flags);
 }
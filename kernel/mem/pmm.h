@@ -13,6 +13,7 @@ typedef struct pmm_stats {
 
 int pmm_init(uint32_t mb_magic, uint32_t mb_info_addr);
 uint32_t pmm_alloc_frame(void);
+uint32_t pmm_alloc_frames(uint32_t count);
 void pmm_free_frame(uint32_t phys_addr);
 void pmm_get_stats(pmm_stats_t* out);
 void pmm_dump_stats(void);
@@ -1,8 +1,8 @@
 #include "pit.h"
 
-#include "pic.h"
 #include "ports.h"
 #include "sched/thread.h"
+#include "sched/timer.h"
 
 static volatile uint32_t g_ticks = 0;
 static volatile uint32_t g_hz = 100;
@@ -27,9 +27,9 @@ void pit_init(uint32_t hz) {
 
 void pit_irq_handler(void) {
     g_ticks++;
-    pic_send_eoi(0);
+    timer_tick(g_ticks);
     if (sched_is_preempt_enabled()) {
-        thread_yield();
+        sched_request_resched();
     }
 }
 
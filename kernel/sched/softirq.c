@@ -0,0 +1,128 @@
+#include "softirq.h"
+
+#include "thread.h"
+#include "../lib/string.h"
+
+/* Passes over all lists per IRQ exit; the rest waits for the next interrupt. */
+#define SOFTIRQ_MAX_PASSES 4
+
+typedef struct {
+    work_t* head;
+    work_t* tail;
+} work_list_t;
+
+static work_list_t g_lists[SOFTIRQ_PRIO_COUNT];
+static volatile uint32_t g_pending_mask;
+static volatile int g_in_softirq;
+static softirq_stats_t g_stats;
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+void work_init(work_t* w, work_fn_t fn, void* arg) {
+    w->fn = fn;
+    w->arg = arg;
+    w->next = 0;
+    w->pending = 0;
+}
+
+int softirq_raise(work_t* w, softirq_prio_t prio) {
+    uint32_t flags;
+    work_list_t* l;
+
+    if (!w || !w->fn || prio >= SOFTIRQ_PRIO_COUNT) return -1;
+
+    flags = irq_save_disable();
+    if (w->pending) {
+        irq_restore(flags);
+        return 0;
+    }
+    w->pending = 1;
+    w->next = 0;
+    l = &g_lists[prio];
+    if (l->tail) {
+        l->tail->next = w;
+    } else {
+        l->head = w;
+    }
+    l->tail = w;
+    g_pending_mask |= 1u << prio;
+    g_stats.raised[prio]++;
+    irq_restore(flags);
+    return 1;
+}
+
+static work_t* pop_highest(softirq_prio_t* out_prio) {
+    uint32_t p;
+
+    for (p = 0; p < SOFTIRQ_PRIO_COUNT; p++) {
+        work_list_t* l = &g_lists[p];
+        work_t* w = l->head;
+        if (!w) continue;
+
+        l->head = w->next;
+        if (!l->head) {
+            l->tail = 0;
+            g_pending_mask &= ~(1u << p);
+        }
+        w->next = 0;
+        w->pending = 0;
+        *out_prio = (softirq_prio_t)p;
+        return w;
+    }
+    return 0;
+}
+
+/* Called by irq_dispatch with IRQs disabled after the EOI. */
+void softirq_irq_exit(void) {
+    int passes = 0;
+
+    if (g_in_softirq) {
+        return;
+    }
+
+    g_in_softirq = 1;
+    while (g_pending_mask && passes < SOFTIRQ_MAX_PASSES) {
+        uint32_t batch = 0;
+        softirq_prio_t prio;
+        work_t* w;
+
+        /* Highest priority first; re-check after each item because nested IRQs may raise more. */
+        while (batch < 32u && (w = pop_highest(&prio)) != 0) {
+            __asm__ volatile("sti" : : : "memory");
+            w->fn(w->arg);
+            __asm__ volatile("cli" : : : "memory");
+            g_stats.executed[prio]++;
+            batch++;
+        }
+        passes++;
+    }
+    if (g_pending_mask) {
+        g_stats.deferred_passes++;
+    }
+    g_in_softirq = 0;
+
+    if (sched_take_resched()) {
+        thread_yield();
+    }
+}
+
+int softirq_in_progress(void) {
+    return g_in_softirq;
+}
+
+void softirq_get_stats(softirq_stats_t* out) {
+    uint32_t flags;
+
+    if (!out) return;
+    flags = irq_save_disable();
+    memcpy(out, &g_stats, sizeof(*out));
+    irq_restore(flags);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Bottom halves: IRQ handlers queue work items that run at IRQ exit with IRQs enabled. */
+typedef enum {
+    SOFTIRQ_HI = 0,
+    SOFTIRQ_TIMER = 1,
+    SOFTIRQ_INPUT = 2,
+    SOFTIRQ_BLOCK = 3,
+    SOFTIRQ_LOW = 4,
+    SOFTIRQ_PRIO_COUNT = 5,
+} softirq_prio_t;
+
+typedef void (*work_fn_t)(void* arg);
+
+typedef struct work {
+    work_fn_t fn;
+    void* arg;
+    struct work* next;
+    volatile int pending;
+} work_t;
+
+typedef struct softirq_stats {
+    uint32_t raised[SOFTIRQ_PRIO_COUNT];
+    uint32_t executed[SOFTIRQ_PRIO_COUNT];
+    uint32_t deferred_passes;
+} softirq_stats_t;
+
+void work_init(work_t* w, work_fn_t fn, void* arg);
+
+int softirq_raise(work_t* w, softirq_prio_t prio);
+void softirq_irq_exit(void);
+int softirq_in_progress(void);
+void softirq_get_stats(softirq_stats_t* out);
@@ -0,0 +1,267 @@
+#include "sync.h"
+
+#include "../pit.h"
+
+static lock_stats_t* g_stats_head;
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+static void stats_register(lock_stats_t* st, const char* name, lock_kind_t kind) {
+    uint32_t flags;
+    lock_stats_t* cur;
+
+    st->name = name ? name : "anon";
+    st->kind = kind;
+    st->acquisitions = 0;
+    st->contentions = 0;
+    st->wait_ticks = 0;
+    st->max_wait_ticks = 0;
+    st->next = 0;
+
+    flags = irq_save_disable();
+    for (cur = g_stats_head; cur; cur = cur->next) {
+        if (cur == st) {
+            irq_restore(flags);
+            return;
+        }
+    }
+    st->next = g_stats_head;
+    g_stats_head = st;
+    irq_restore(flags);
+}
+
+static void stats_waited(lock_stats_t* st, uint32_t start_tick) {
+    uint32_t waited = pit_get_ticks() - start_tick;
+
+    st->wait_ticks += waited;
+    if (waited > st->max_wait_ticks) {
+        st->max_wait_ticks = waited;
+    }
+}
+
+void mutex_init(mutex_t* m, const char* name) {
+    m->owner = 0;
+    wait_queue_init(&m->waiters);
+    stats_register(&m->stats, name, LOCK_KIND_MUTEX);
+}
+
+void mutex_lock(mutex_t* m) {
+    struct thread* self = thread_current();
+    uint32_t flags = irq_save_disable();
+    uint32_t start;
+
+    m->stats.acquisitions++;
+    if (!m->owner) {
+        m->owner = self;
+        irq_restore(flags);
+        return;
+    }
+
+    m->stats.contentions++;
+    start = pit_get_ticks();
+    while (m->owner != self) {
+        thread_block(&m->waiters);
+    }
+    stats_waited(&m->stats, start);
+    irq_restore(flags);
+}
+
+int mutex_trylock(mutex_t* m) {
+    uint32_t flags = irq_save_disable();
+
+    if (m->owner) {
+        irq_restore(flags);
+        return 0;
+    }
+    m->owner = thread_current();
+    m->stats.acquisitions++;
+    irq_restore(flags);
+    return 1;
+}
+
+void mutex_unlock(mutex_t* m) {
+    uint32_t flags = irq_save_disable();
+
+    m->owner = thread_wake_one(&m->waiters);
+    irq_restore(flags);
+}
+
+int mutex_is_held(const mutex_t* m) {
+    return m->owner == thread_current();
+}
+
+void sem_init(semaphore_t* s, const char* name, int initial) {
+    s->count = initial;
+    wait_queue_init(&s->waiters);
+    stats_register(&s->stats, name, LOCK_KIND_SEMAPHORE);
+}
+
+void sem_wait(semaphore_t* s) {
+    uint32_t flags = irq_save_disable();
+    uint32_t start;
+
+    s->stats.acquisitions++;
+    if (s->count > 0) {
+        s->count--;
+        irq_restore(flags);
+        return;
+    }
+
+    /* sem_post hands the unit straight to the woken waiter. */
+    s->stats.contentions++;
+    start = pit_get_ticks();
+    thread_block(&s->waiters);
+    stats_waited(&s->stats, start);
+    irq_restore(flags);
+}
+
+int sem_trywait(semaphore_t* s) {
+    uint32_t flags = irq_save_disable();
+
+    if (s->count <= 0) {
+        irq_restore(flags);
+        return 0;
+    }
+    s->count--;
+    s->stats.acquisitions++;
+    irq_restore(flags);
+    return 1;
+}
+
+void sem_post(semaphore_t* s) {
+    uint32_t flags = irq_save_disable();
+
+    if (!thread_wake_one(&s->waiters)) {
+        s->count++;
+    }
+    irq_restore(flags);
+}
+
+void cond_init(condvar_t* c) {
+    wait_queue_init(&c->waiters);
+}
+
+void cond_wait(condvar_t* c, mutex_t* m) {
+    uint32_t flags = irq_save_disable();
+
+    mutex_unlock(m);
+    thread_block(&c->waiters);
+    irq_restore(flags);
+
+    mutex_lock(m);
+}
+
+void cond_signal(condvar_t* c) {
+    uint32_t flags = irq_save_disable();
+    thread_wake_one(&c->waiters);
+    irq_restore(flags);
+}
+
+void cond_broadcast(condvar_t* c) {
+    uint32_t flags = irq_save_disable();
+    thread_wake_all(&c->waiters);
+    irq_restore(flags);
+}
+
+void rwlock_init(rwlock_t* rw, const char* name) {
+    rw->readers = 0;
+    rw->writer = 0;
+    rw->writers_waiting = 0;
+    wait_queue_init(&rw->read_waiters);
+    wait_queue_init(&rw->write_waiters);
+    stats_register(&rw->stats, name, LOCK_KIND_RWLOCK);
+}
+
+void rwlock_read_lock(rwlock_t* rw) {
+    uint32_t flags = irq_save_disable();
+    uint32_t start;
+
+    rw->stats.acquisitions++;
+    if (!rw->writer && rw->writers_waiting == 0) {
+        rw->readers++;
+        irq_restore(flags);
+        return;
+    }
+
+    /* The releasing side counts us into rw->readers before waking us. */
+    rw->stats.contentions++;
+    start = pit_get_ticks();
+    thread_block(&rw->read_waiters);
+    stats_waited(&rw->stats, start);
+    irq_restore(flags);
+}
+
+static void rwlock_grant_writer(rwlock_t* rw) {
+    struct thread* t = thread_wake_one(&rw->write_waiters);
+
+    if (t) {
+        rw->writers_waiting--;
+        rw->writer = t;
+    }
+}
+
+void rwlock_read_unlock(rwlock_t* rw) {
+    uint32_t flags = irq_save_disable();
+
+    if (rw->readers > 0) {
+        rw->readers--;
+    }
+    if (rw->readers == 0 && !rw->writer) {
+        rwlock_grant_writer(rw);
+    }
+    irq_restore(flags);
+}
+
+void rwlock_write_lock(rwlock_t* rw) {
+    struct thread* self = thread_current();
+    uint32_t flags = irq_save_disable();
+    uint32_t start;
+
+    rw->stats.acquisitions++;
+    if (!rw->writer && rw->readers == 0) {
+        rw->writer = self;
+        irq_restore(flags);
+        return;
+    }
+
+    rw->stats.contentions++;
+    rw->writers_waiting++;
+    start = pit_get_ticks();
+    while (rw->writer != self) {
+        thread_block(&rw->write_waiters);
+    }
+    stats_waited(&rw->stats, start);
+    irq_restore(flags);
+}
+
+void rwlock_write_unlock(rwlock_t* rw) {
+    uint32_t flags = irq_save_disable();
+
+    rw->writer = 0;
+    while (thread_wake_one(&rw->read_waiters)) {
+        rw->readers++;
+    }
+    if (rw->readers == 0) {
+        rwlock_grant_writer(rw);
+    }
+    irq_restore(flags);
+}
+
+const lock_stats_t* sync_stats_head(void) {
+    return g_stats_head;
+}
+
+const char* sync_kind_name(lock_kind_t kind) {
+    if (kind == LOCK_KIND_MUTEX) return "mutex";
+    if (kind == LOCK_KIND_SEMAPHORE) return "sem";
+    if (kind == LOCK_KIND_RWLOCK) return "rwlock";
+    return "?";
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include "thread.h"
+
+typedef enum {
+    LOCK_KIND_MUTEX = 0,
+    LOCK_KIND_SEMAPHORE = 1,
+    LOCK_KIND_RWLOCK = 2,
+} lock_kind_t;
+
+typedef struct lock_stats {
+    const char* name;
+    lock_kind_t kind;
+    uint32_t acquisitions;
+    uint32_t contentions;
+    uint32_t wait_ticks;
+    uint32_t max_wait_ticks;
+    struct lock_stats* next;
+} lock_stats_t;
+
+/* Sleeping mutex. Unlock hands ownership directly to the oldest waiter. */
+typedef struct mutex {
+    struct thread* owner;
+    wait_queue_t waiters;
+    lock_stats_t stats;
+} mutex_t;
+
+typedef struct semaphore {
+    int count;
+    wait_queue_t waiters;
+    lock_stats_t stats;
+} semaphore_t;
+
+typedef struct condvar {
+    wait_queue_t waiters;
+} condvar_t;
+
+/* Phase-fair reader/writer lock: new readers queue behind a waiting writer,
+ * a releasing writer admits the whole batch of queued readers first. */
+typedef struct rwlock {
+    int readers;
+    struct thread* writer;
+    int writers_waiting;
+    wait_queue_t read_waiters;
+    wait_queue_t write_waiters;
+    lock_stats_t stats;
+} rwlock_t;
+
+void mutex_init(mutex_t* m, const char* name);
+void mutex_lock(mutex_t* m);
+int mutex_trylock(mutex_t* m);
+void mutex_unlock(mutex_t* m);
+int mutex_is_held(const mutex_t* m);
+
+void sem_init(semaphore_t* s, const char* name, int initial);
+void sem_wait(semaphore_t* s);
+int sem_trywait(semaphore_t* s);
+void sem_post(semaphore_t* s);
+
+void cond_init(condvar_t* c);
+void cond_wait(condvar_t* c, mutex_t* m);
+void cond_signal(condvar_t* c);
+void cond_broadcast(condvar_t* c);
+
+void rwlock_init(rwlock_t* rw, const char* name);
+void rwlock_read_lock(rwlock_t* rw);
+void rwlock_read_unlock(rwlock_t* rw);
+void rwlock_write_lock(rwlock_t* rw);
+void rwlock_write_unlock(rwlock_t* rw);
+
+const lock_stats_t* sync_stats_head(void);
+const char* sync_kind_name(lock_kind_t kind);
@@ -5,7 +5,7 @@
 #include "../panic.h"
 
 #define THREAD_MAX 32
-#define THREAD_STACK_SIZE 4096
+#define THREAD_STACK_SIZE 16384
 
 extern void thread_switch(uint32_t** old_esp, uint32_t* new_esp);
 
@@ -13,6 +13,17 @@ static struct thread g_threads[THREAD_MAX];
 static int g_thread_count;
 static int g_current_tid;
 static int g_preempt_enabled;
+static volatile int g_need_resched;
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
 
 static void print_u32(uint32_t n) {
     char buf[11];
@@ -46,6 +57,7 @@ static void print_hex(uint32_t n) {
 static const char* state_name(enum thread_state state) {
     if (state == THREAD_RUNNING) return "RUNNING";
     if (state == THREAD_RUNNABLE) return "RUNNABLE";
+    if (state == THREAD_BLOCKED) return "BLOCKED";
     return "ZOMBIE";
 }
 
@@ -67,11 +79,45 @@ static int find_next_runnable(int from_tid, int allow_current) {
     return -1;
 }
 
+static void switch_to(int next_tid) {
+    struct thread* prev = &g_threads[g_current_tid];
+    struct thread* next = &g_threads[next_tid];
+
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_RUNNABLE;
+    }
+    next->state = THREAD_RUNNING;
+    g_current_tid = next_tid;
+
+    thread_switch(&prev->esp, next->esp);
+}
+
+/* Leave the current thread after it was marked BLOCKED. Idles with hlt while
+ * nothing is runnable; an IRQ may wake the current thread itself meanwhile. */
+static void schedule_blocked(void) {
+    int self = g_current_tid;
+    int next_tid;
+
+    for (;;) {
+        next_tid = find_next_runnable(self, 0);
+        if (next_tid >= 0) break;
+        if (g_threads[self].state == THREAD_RUNNABLE) {
+            g_threads[self].state = THREAD_RUNNING;
+            return;
+        }
+        __asm__ volatile("sti; hlt; cli" : : : "memory");
+    }
+
+    switch_to(next_tid);
+}
+
 static void thread_bootstrap(void) {
     struct thread* t = &g_threads[g_current_tid];
     void (*entry)(void*) = t->entry;
     void* arg = t->arg;
 
+    /* First switch into a thread may happen with IRQs masked (IRQ0, thread_block). */
+    __asm__ volatile("sti");
     entry(arg);
     thread_exit();
 }
@@ -89,19 +135,46 @@ void sched_init(void) {
     g_threads[0].tid = 0;
     g_threads[0].entry = 0;
     g_threads[0].arg = 0;
+    g_threads[0].wait_next = 0;
 }
 
 int thread_create(const char* name, void (*entry)(void*), void* arg) {
-    struct thread* t;
+    struct thread* t = 0;
     uint32_t* sp;
+    uint32_t flags;
+    int tid;
+    int reuse = 0;
 
     if (!entry) return -1;
-    if (g_thread_count >= THREAD_MAX) return -1;
 
-    t = &g_threads[g_thread_count];
+    flags = irq_save_disable();
+    for (tid = 1; tid < g_thread_count; tid++) {
+        if (g_threads[tid].state == THREAD_ZOMBIE) {
+            t = &g_threads[tid];
+            reuse = 1;
+            break;
+        }
+    }
+    if (!t) {
+        if (g_thread_count >= THREAD_MAX) {
+            irq_restore(flags);
+            return -1;
+        }
+        tid = g_thread_count;
+        t = &g_threads[tid];
+    }
+
+    if (reuse && t->stack_base) {
+        kfree(t->stack_base);
+        t->stack_base = 0;
+    }
+
     t->stack_size = THREAD_STACK_SIZE;
     t->stack_base = (uint32_t*)kmalloc(t->stack_size);
-    if (!t->stack_base) return -1;
+    if (!t->stack_base) {
+        irq_restore(flags);
+        return -1;
+    }
 
     sp = (uint32_t*)((uint8_t*)t->stack_base + t->stack_size);
 
@@ -112,57 +185,116 @@ int thread_create(const char* name, void (*entry)(void*), void* arg) {
     *--sp = 0;
 
     t->esp = sp;
-    t->state = THREAD_RUNNABLE;
     t->name = name ? name : "thread";
-    t->tid = g_thread_count;
+    t->tid = tid;
     t->entry = entry;
     t->arg = arg;
+    t->wait_next = 0;
+    t->state = THREAD_RUNNABLE;
 
-    g_thread_count++;
+    if (!reuse) {
+        g_thread_count++;
+    }
+    irq_restore(flags);
     return t->tid;
 }
 
 void thread_yield(void) {
-    int prev_tid = g_current_tid;
-    int next_tid = find_next_runnable(prev_tid, 0);
-    struct thread* prev;
-    struct thread* next;
+    uint32_t flags = irq_save_disable();
+    int next_tid = find_next_runnable(g_current_tid, 0);
 
-    if (next_tid < 0) {
-        return;
+    if (next_tid >= 0) {
+        switch_to(next_tid);
     }
+    irq_restore(flags);
+}
 
-    prev = &g_threads[prev_tid];
-    next = &g_threads[next_tid];
+/* Body of the main thread's idle loop: run others, or halt until the next IRQ. */
+void sched_idle(void) {
+    uint32_t flags = irq_save_disable();
+    int next_tid = find_next_runnable(g_current_tid, 0);
 
-    if (prev->state == THREAD_RUNNING) {
-        prev->state = THREAD_RUNNABLE;
+    if (next_tid >= 0) {
+        switch_to(next_tid);
+        irq_restore(flags);
+        return;
     }
-    next->state = THREAD_RUNNING;
-    g_current_tid = next_tid;
-
-    thread_switch(&prev->esp, next->esp);
+    __asm__ volatile("sti; hlt" : : : "memory");
 }
 
 void thread_exit(void) {
     int next_tid;
-    int dead_tid = g_current_tid;
+    int dead_tid;
 
+    __asm__ volatile("cli");
+    dead_tid = g_current_tid;
     g_threads[dead_tid].state = THREAD_ZOMBIE;
 
     next_tid = find_next_runnable(dead_tid, 0);
-    if (next_tid < 0) {
-        panic("thread_exit: no runnable thread left");
+    while (next_tid < 0) {
+        /* Wait for an IRQ to wake a blocked thread; nothing returns here. */
+        __asm__ volatile("sti; hlt; cli" : : : "memory");
+        next_tid = find_next_runnable(dead_tid, 0);
     }
 
-    g_threads[next_tid].state = THREAD_RUNNING;
-    g_current_tid = next_tid;
-
-    thread_switch(&g_threads[dead_tid].esp, g_threads[next_tid].esp);
+    switch_to(next_tid);
 
     panic("thread_exit: switch returned unexpectedly");
 }
 
+struct thread* thread_current(void) {
+    return &g_threads[g_current_tid];
+}
+
+void wait_queue_init(wait_queue_t* wq) {
+    wq->head = 0;
+    wq->tail = 0;
+}
+
+int wait_queue_empty(const wait_queue_t* wq) {
+    return wq->head == 0;
+}
+
+void thread_block(wait_queue_t* wq) {
+    struct thread* self = &g_threads[g_current_tid];
+
+    self->state = THREAD_BLOCKED;
+    self->wait_next = 0;
+    if (wq->tail) {
+        wq->tail->wait_next = self;
+    } else {
+        wq->head = self;
+    }
+    wq->tail = self;
+
+    schedule_blocked();
+}
+
+struct thread* thread_wake_one(wait_queue_t* wq) {
+    struct thread* t = wq->head;
+
+    if (!t) return 0;
+
+    wq->head = t->wait_next;
+    if (!wq->head) {
+        wq->tail = 0;
+    }
+    t->wait_next = 0;
+    if (t->state == THREAD_BLOCKED) {
+        t->state = THREAD_RUNNABLE;
+    }
+    return t;
+}
+
+int thread_wake_all(wait_queue_t* wq) {
+    int woken = 0;
+
+    while (thread_wake_one(wq)) {
+        woken++;
+    }
+    return woken;
+}
+
 void sched_dump(void) {
     int i;
 
@@ -195,6 +327,21 @@ int sched_set_preempt(int enabled) {
     return g_preempt_enabled;
 }
 
+/* True once sched_init has adopted the boot context as thread 0. */
+int sched_is_running(void) {
+    return g_thread_count > 0;
+}
+
 int sched_is_preempt_enabled(void) {
     return g_preempt_enabled;
 }
+
+void sched_request_resched(void) {
+    g_need_resched = 1;
+}
+
+int sched_take_resched(void) {
+    int v = g_need_resched;
+    g_need_resched = 0;
+    return v;
+}
@@ -7,6 +7,7 @@ enum thread_state {
     THREAD_RUNNABLE = 0,
     THREAD_RUNNING = 1,
     THREAD_ZOMBIE = 2,
+    THREAD_BLOCKED = 3,
 };
 
 struct thread {
@@ -19,13 +20,34 @@ struct thread {
 
     void (*entry)(void*);
     void* arg;
+
+    struct thread* wait_next;
 };
 
+/* FIFO of blocked threads. All wait_queue_* / thread_block calls expect IRQs disabled. */
+typedef struct wait_queue {
+    struct thread* head;
+    struct thread* tail;
+} wait_queue_t;
+
 void sched_init(void);
 int thread_create(const char* name, void (*entry)(void*), void* arg);
 void thread_yield(void);
 void thread_exit(void);
+void sched_idle(void);
 void sched_dump(void);
+struct thread* thread_current(void);
+
+void wait_queue_init(wait_queue_t* wq);
+int wait_queue_empty(const wait_queue_t* wq);
+void thread_block(wait_queue_t* wq);
+struct thread* thread_wake_one(wait_queue_t* wq);
+int thread_wake_all(wait_queue_t* wq);
 
 int sched_set_preempt(int enabled);
 int sched_is_preempt_enabled(void);
+int sched_is_running(void);
+
+/* Preemption point is the outermost IRQ exit, after softirqs ran. */
+void sched_request_resched(void);
+int sched_take_resched(void);
@@ -0,0 +1,127 @@
+#include "timer.h"
+
+#include "softirq.h"
+#include "thread.h"
+#include "../pit.h"
+
+static ktimer_t* g_timers;
+static work_t g_timer_work;
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+static int expired(uint32_t expires, uint32_t now) {
+    return (int32_t)(now - expires) >= 0;
+}
+
+static void timer_softirq(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        uint32_t flags = irq_save_disable();
+        ktimer_t* t = g_timers;
+
+        if (!t || !expired(t->expires, pit_get_ticks())) {
+            irq_restore(flags);
+            return;
+        }
+        g_timers = t->next;
+        t->next = 0;
+        t->active = 0;
+        irq_restore(flags);
+
+        t->fn(t->arg);
+    }
+}
+
+void timer_init(void) {
+    g_timers = 0;
+    work_init(&g_timer_work, timer_softirq, 0);
+}
+
+/* Hard-IRQ side: only checks the list head and defers the callbacks. */
+void timer_tick(uint32_t now) {
+    if (g_timers && expired(g_timers->expires, now)) {
+        softirq_raise(&g_timer_work, SOFTIRQ_TIMER);
+    }
+}
+
+void timer_add(ktimer_t* t, uint32_t delay_ticks, void (*fn)(void*), void* arg) {
+    uint32_t flags;
+    ktimer_t** link;
+
+    if (!t || !fn) return;
+
+    flags = irq_save_disable();
+    if (t->active) {
+        irq_restore(flags);
+        timer_cancel(t);
+        flags = irq_save_disable();
+    }
+
+    t->expires = pit_get_ticks() + (delay_ticks ? delay_ticks : 1u);
+    t->fn = fn;
+    t->arg = arg;
+    t->active = 1;
+
+    link = &g_timers;
+    while (*link && (int32_t)((*link)->expires - t->expires) <= 0) {
+        link = &(*link)->next;
+    }
+    t->next = *link;
+    *link = t;
+    irq_restore(flags);
+}
+
+int timer_cancel(ktimer_t* t) {
+    uint32_t flags = irq_save_disable();
+    ktimer_t** link = &g_timers;
+
+    while (*link) {
+        if (*link == t) {
+            *link = t->next;
+            t->next = 0;
+            t->active = 0;
+            irq_restore(flags);
+            return 1;
+        }
+        link = &(*link)->next;
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+static void sleep_wake(void* arg) {
+    uint32_t flags = irq_save_disable();
+    thread_wake_all((wait_queue_t*)arg);
+    irq_restore(flags);
+}
+
+void thread_sleep_ticks(uint32_t ticks) {
+    wait_queue_t wq;
+    ktimer_t t;
+    uint32_t flags;
+
+    t.active = 0;
+    t.next = 0;
+    wait_queue_init(&wq);
+
+    flags = irq_save_disable();
+    timer_add(&t, ticks, sleep_wake, &wq);
+    while (t.active) {
+        thread_block(&wq);
+    }
+    irq_restore(flags);
+}
+
+void thread_sleep_ms(uint32_t ms) {
+    uint32_t hz = pit_get_hz();
+    thread_sleep_ticks((ms * hz + 999u) / 1000u);
+}
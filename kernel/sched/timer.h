@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/* One-shot kernel timers in PIT ticks; callbacks run from SOFTIRQ_TIMER. */
+typedef struct ktimer {
+    uint32_t expires;
+    void (*fn)(void* arg);
+    void* arg;
+    struct ktimer* next;
+    int active;
+} ktimer_t;
+
+void timer_init(void);
+void timer_tick(uint32_t now);
+void timer_add(ktimer_t* t, uint32_t delay_ticks, void (*fn)(void*), void* arg);
+int timer_cancel(ktimer_t* t);
+
+void thread_sleep_ticks(uint32_t ticks);
+void thread_sleep_ms(uint32_t ms);
@@ -0,0 +1,103 @@
+#include "workqueue.h"
+
+#include "thread.h"
+#include "../panic.h"
+
+static workqueue_t g_system_wq;
+
+static uint32_t irq_save_disable(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void irq_restore(uint32_t flags) {
+    __asm__ volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+static work_t* pop_work(workqueue_t* wq) {
+    uint32_t flags = irq_save_disable();
+    work_t* w = wq->head;
+
+    if (w) {
+        wq->head = w->next;
+        if (!wq->head) {
+            wq->tail = 0;
+        }
+        w->next = 0;
+        w->pending = 0;
+    }
+    irq_restore(flags);
+    return w;
+}
+
+static void worker_main(void* arg) {
+    workqueue_t* wq = (workqueue_t*)arg;
+
+    for (;;) {
+        work_t* w;
+
+        sem_wait(&wq->items);
+        w = pop_work(wq);
+        if (w) {
+            w->fn(w->arg);
+            wq->executed++;
+        }
+    }
+}
+
+int workqueue_create(workqueue_t* wq, const char* name, int threads) {
+    int i;
+
+    if (!wq || threads <= 0 || threads > WORKQUEUE_MAX_THREADS) return -1;
+
+    wq->name = name ? name : "wq";
+    wq->head = 0;
+    wq->tail = 0;
+    wq->threads = 0;
+    wq->queued = 0;
+    wq->executed = 0;
+    sem_init(&wq->items, wq->name, 0);
+
+    for (i = 0; i < threads; i++) {
+        if (thread_create(wq->name, worker_main, wq) < 0) break;
+        wq->threads++;
+    }
+    return wq->threads > 0 ? 0 : -1;
+}
+
+/* IRQ-safe: may be called from hard-IRQ or softirq context. */
+int queue_work(workqueue_t* wq, work_t* w) {
+    uint32_t flags;
+
+    if (!wq || !w || !w->fn) return -1;
+
+    flags = irq_save_disable();
+    if (w->pending) {
+        irq_restore(flags);
+        return 0;
+    }
+    w->pending = 1;
+    w->next = 0;
+    if (wq->tail) {
+        wq->tail->next = w;
+    } else {
+        wq->head = w;
+    }
+    wq->tail = w;
+    wq->queued++;
+    irq_restore(flags);
+
+    sem_post(&wq->items);
+    return 1;
+}
+
+void workqueue_init(void) {
+    if (workqueue_create(&g_system_wq, "kworker", 1) != 0) {
+        panic("workqueue_init: cannot start kworker");
+    }
+}
+
+workqueue_t* system_workqueue(void) {
+    return &g_system_wq;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "softirq.h"
+#include "sync.h"
+
+#define WORKQUEUE_MAX_THREADS 4
+
+/* Work items executed by dedicated kernel threads (may block, unlike softirqs). */
+typedef struct workqueue {
+    const char* name;
+    work_t* head;
+    work_t* tail;
+    semaphore_t items;
+    int threads;
+    uint32_t queued;
+    uint32_t executed;
+} workqueue_t;
+
+void workqueue_init(void);
+int workqueue_create(workqueue_t* wq, const char* name, int threads);
+int queue_work(workqueue_t* wq, work_t* w);
+workqueue_t* system_workqueue(void);
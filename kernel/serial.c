@@ -1,10 +1,18 @@
 #include "serial.h"
 
+#include "input/input.h"
+#include "lib/ring.h"
 #include "ports.h"
 
 #define COM1_PORT 0x3F8
+#define SERIAL_RX_RING_SIZE 256u
+
+static uint8_t g_rx_storage[RING_STORAGE_SIZE(1u, SERIAL_RX_RING_SIZE)];
+static ring_t g_rx_ring;
 
 void serial_init(void) {
+    ring_init(&g_rx_ring, g_rx_storage, 1u, SERIAL_RX_RING_SIZE);
+
     outb(COM1_PORT + 1, 0x00);
     outb(COM1_PORT + 3, 0x80);
     outb(COM1_PORT + 0, 0x03);
@@ -12,6 +20,8 @@ void serial_init(void) {
     outb(COM1_PORT + 3, 0x03);
     outb(COM1_PORT + 2, 0xC7);
     outb(COM1_PORT + 4, 0x0B);
+    /* RX data available interrupt; only delivered once IRQ4 is unmasked. */
+    outb(COM1_PORT + 1, 0x01);
 }
 
 static int serial_tx_ready(void) {
@@ -31,3 +41,24 @@ void serial_print(const char* s) {
         serial_putc(*s++);
     }
 }
+
+int serial_read_byte(uint8_t* out) {
+    return ring_pop(&g_rx_ring, out);
+}
+
+uint32_t serial_rx_dropped(void) {
+    return ring_dropped(&g_rx_ring);
+}
+
+void irq4_handler_c(void) {
+    int got = 0;
+
+    while (inb(COM1_PORT + 5) & 0x01) {
+        uint8_t b = inb(COM1_PORT);
+        ring_push(&g_rx_ring, &b);
+        got = 1;
+    }
+    if (got) {
+        input_notify();
+    }
+}
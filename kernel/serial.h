@@ -1,5 +1,11 @@
 #pragma once
 
+#include <stdint.h>
+
 void serial_init(void);
 void serial_putc(char c);
 void serial_print(const char* s);
+
+int serial_read_byte(uint8_t* out);
+uint32_t serial_rx_dropped(void);
+void irq4_handler_c(void);
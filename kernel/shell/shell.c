@@ -1,6 +1,7 @@
 #include "shell.h"
 
 #include "../console.h"
+#include "../input/input.h"
 #include "../lib/string.h"
 #include "../terminal/terminal.h"
 #include "commands.h"
@@ -218,3 +219,13 @@ void shell_handle_key(key_event_t ev) {
 
     redraw_input();
 }
+
+void shell_thread_main(void* arg) {
+    key_event_t ev;
+    (void)arg;
+
+    for (;;) {
+        input_wait_event(&ev);
+        shell_handle_key(ev);
+    }
+}
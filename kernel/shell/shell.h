@@ -4,3 +4,4 @@
 
 void shell_init(void);
 void shell_handle_key(key_event_t ev);
+void shell_thread_main(void* arg);
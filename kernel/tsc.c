@@ -0,0 +1,43 @@
+#include "tsc.h"
+
+#include "lib/div64.h"
+#include "ports.h"
+
+#define PIT_HZ 1193182u
+#define TSC_CAL_MS 10u
+
+static uint32_t g_tsc_khz;
+
+/* Measure the TSC against a PIT channel 2 one-shot; no interrupts needed. */
+void tsc_calibrate(void) {
+    uint32_t latch = (PIT_HZ * TSC_CAL_MS) / 1000u;
+    uint32_t spins = 0;
+    uint64_t t0;
+    uint64_t t1;
+
+    outb(0x61, (uint8_t)((inb(0x61) & ~0x02u) | 0x01u));
+    outb(0x43, 0xB0);
+    outb(0x42, (uint8_t)(latch & 0xFFu));
+    outb(0x42, (uint8_t)((latch >> 8) & 0xFFu));
+
+    t0 = tsc_read();
+    while ((inb(0x61) & 0x20u) == 0 && spins < 50000000u) {
+        spins++;
+    }
+    t1 = tsc_read();
+
+    g_tsc_khz = (uint32_t)div_u64(t1 - t0, TSC_CAL_MS, 0);
+    if (g_tsc_khz == 0) {
+        g_tsc_khz = 1000000u;
+    }
+}
+
+uint32_t tsc_khz(void) {
+    return g_tsc_khz;
+}
+
+uint32_t tsc_cycles_to_us(uint64_t cycles) {
+    uint32_t mhz = g_tsc_khz / 1000u;
+    if (mhz == 0) mhz = 1;
+    return (uint32_t)div_u64(cycles, mhz, 0);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+static inline uint64_t tsc_read(void) {
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void tsc_calibrate(void);
+uint32_t tsc_khz(void);
+uint32_t tsc_cycles_to_us(uint64_t cycles);
@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+# Startet RōninOS headless mit einer Scratch-Disk und fuehrt `diskbench` ueber
+# die serielle Konsole aus. Die Ausgabe landet zusaetzlich in build/diskbench.log.
+#
+#   DISK_IF=ide|dma|ahci|virtio   Anbindung der Scratch-Disk (Default: ide)
+#   DISK_SIZE=256M                Groesse des Images (wird bei Bedarf neu angelegt)
+#   BENCH_ARGS="all 4096 1 2000"  Argumente nach dem Geraetenamen
+#   BOOT_WAIT=8 BENCH_WAIT=30     Sekunden bis zum Befehl bzw. bis zum Abbruch
+set -euo pipefail
+
+ISO="build/roninos.iso"
+IMG="build/diskbench.img"
+LOG="build/diskbench.log"
+DISK_IF="${DISK_IF:-ide}"
+DISK_SIZE="${DISK_SIZE:-256M}"
+BENCH_ARGS="${BENCH_ARGS:-all 4096 1 2000}"
+BOOT_WAIT="${BOOT_WAIT:-8}"
+BENCH_WAIT="${BENCH_WAIT:-30}"
+
+need_cmd() {
+    if ! command -v "$1" >/dev/null 2>&1; then
+        echo "ERROR: benötigtes Tool fehlt: $1" >&2
+        exit 1
+    fi
+}
+
+need_cmd qemu-system-i386
+need_cmd timeout
+need_cmd truncate
+
+if [[ ! -f "$ISO" ]]; then
+    echo "ERROR: $ISO fehlt. Bitte zuerst 'make $ISO' ausführen." >&2
+    exit 1
+fi
+
+# Die Scratch-Disk wird ueberschrieben, nie eine echte Platte verwenden.
+rm -f "$IMG"
+truncate -s "$DISK_SIZE" "$IMG"
+
+case "$DISK_IF" in
+    ide)
+        DEV="hd0"
+        DISK_ARGS=( -drive "file=$IMG,format=raw,if=ide,index=0,media=disk" )
+        ;;
+    dma)
+        DEV="dma0"
+        DISK_ARGS=( -drive "file=$IMG,format=raw,if=ide,index=0,media=disk" )
+        ;;
+    ahci)
+        DEV="sd0"
+        DISK_ARGS=( -device ahci,id=ahci -drive "file=$IMG,format=raw,if=none,id=d0" -device ide-hd,drive=d0,bus=ahci.0 )
+        ;;
+    virtio)
+        DEV="vd0"
+        DISK_ARGS=( -drive "file=$IMG,format=raw,if=virtio" )
+        ;;
+    *)
+        echo "ERROR: unbekanntes DISK_IF '$DISK_IF' (ide|dma|ahci|virtio)" >&2
+        exit 1
+        ;;
+esac
+
+echo "diskbench $DEV $BENCH_ARGS ($DISK_IF, $DISK_SIZE)" | tee "$LOG"
+
+{
+    sleep "$BOOT_WAIT"
+    printf 'diskbench %s %s\r' "$DEV" "$BENCH_ARGS"
+    sleep "$BENCH_WAIT"
+} | timeout "$((BOOT_WAIT + BENCH_WAIT + 5))" qemu-system-i386 \
+        -cdrom "$ISO" -m 256M -display none -monitor none -serial stdio -no-reboot \
+        "${DISK_ARGS[@]}" | tee -a "$LOG" || true
+
+grep -E "^(seq|rand)(read|write) " "$LOG" >/dev/null || {
+    echo "ERROR: keine Benchmark-Ergebnisse, siehe $LOG" >&2
+    exit 1
+}